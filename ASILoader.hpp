@@ -0,0 +1,256 @@
+#pragma once
+
+// ASI plugin loader with dependency-aware, parallel initialization - for loaders (e.g. a dinput8.dll proxy) built with ModUtils
+// Usage:
+//	ASILoader::Loader loader;
+//	loader.LoadDirectory( L"scripts" );
+//	loader.InitializeAll();
+//
+// Plugins are initialized in two phases, both optional:
+// - PrepareASI() - the read-only part, mostly pattern scanning. Runs on TaskPool, concurrently with other plugins.
+// - InitializeASI() - the part that patches. Runs on the calling thread, one plugin at a time.
+// A plugin starts preparing only once all of its dependencies have been initialized, as it may be scanning code they patch.
+// This relies on InitializeASI having patched by the time it returns - HookInit plugins exporting PrepareASI do,
+// while plugins deferring their patches (e.g. to a hooked WinAPI function) can't be ordered against.
+// Everything else prepares in parallel, so startup costs the longest chain of plugins rather than the sum of all of them.
+// Plugins exporting only InitializeASI behave exactly as with a serial loader.
+//
+// Metadata exported by plugins (see HookInit.hpp for exporting it):
+// const char* GetASIDependencies() - names of plugins to initialize first, separated with ';' (e.g. "SilentPatchSA;WidescreenFix")
+// Names are matched case-insensitively against file names, extensions are optional. Missing dependencies are ignored.
+// Beyond dependencies, plugins are initialized in file name order.
+//
+// NOTE: A plugin scanning code another plugin patches must list it as a dependency - otherwise it may be scanning
+// while the other one is writing.
+
+#include <algorithm>
+#include <cwctype>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+#include "TaskPool.hpp"
+
+namespace ASILoader
+{
+	struct Plugin
+	{
+		std::wstring path;
+		// Lowercase file name without the extension
+		std::wstring name;
+		HMODULE module;
+
+		void (__cdecl *prepare)();
+		void (__cdecl *initialize)();
+		// Indices into Loader::Plugins()
+		std::vector<size_t> dependencies;
+	};
+
+	namespace details
+	{
+		inline std::wstring NormalizeName( std::wstring_view name )
+		{
+			const size_t slash = name.find_last_of( L"\\/" );
+			if ( slash != std::wstring_view::npos ) name.remove_prefix( slash + 1 );
+
+			std::wstring result( name );
+			std::transform( result.begin(), result.end(), result.begin(), []( wchar_t ch ) { return static_cast<wchar_t>(towlower( ch )); } );
+
+			for ( std::wstring_view extension : { L".asi", L".dll" } )
+			{
+				if ( result.size() > extension.size() && result.compare( result.size() - extension.size(), extension.size(), extension ) == 0 )
+				{
+					result.resize( result.size() - extension.size() );
+					break;
+				}
+			}
+			return result;
+		}
+	}
+
+	class Loader
+	{
+	public:
+		// Loads every *.asi in the directory, in file name order. Returns the number of plugins loaded
+		size_t LoadDirectory( const std::wstring& directory )
+		{
+			std::vector<std::wstring> files;
+
+			WIN32_FIND_DATAW findData;
+			const HANDLE find = FindFirstFileW( (directory + L"\\*.asi").c_str(), &findData );
+			if ( find != INVALID_HANDLE_VALUE )
+			{
+				do
+				{
+					if ( (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 )
+					{
+						files.push_back( directory + L"\\" + findData.cFileName );
+					}
+				}
+				while ( FindNextFileW( find, &findData ) );
+				FindClose( find );
+			}
+
+			std::sort( files.begin(), files.end(), []( const std::wstring& left, const std::wstring& right ) {
+				return details::NormalizeName( left ) < details::NormalizeName( right );
+			} );
+
+			size_t numLoaded = 0;
+			for ( const std::wstring& file : files )
+			{
+				numLoaded += LoadPlugin( file ) ? 1 : 0;
+			}
+			return numLoaded;
+		}
+
+		// DllMains run under the loader lock, so loading itself is serial
+		bool LoadPlugin( const std::wstring& path )
+		{
+			const HMODULE module = LoadLibraryW( path.c_str() );
+			if ( module == nullptr )
+			{
+				return false;
+			}
+
+			Plugin plugin;
+			plugin.path = path;
+			plugin.name = details::NormalizeName( path );
+			plugin.module = module;
+			plugin.prepare = reinterpret_cast<void(__cdecl*)()>(GetProcAddress( module, "PrepareASI" ));
+			plugin.initialize = reinterpret_cast<void(__cdecl*)()>(GetProcAddress( module, "InitializeASI" ));
+			m_plugins.push_back( std::move(plugin) );
+			return true;
+		}
+
+		// Prepares and initializes all loaded plugins, see the top of the file
+		void InitializeAll( TaskPool::Pool& pool = TaskPool::Pool::Get() )
+		{
+			ResolveDependencies();
+			const std::vector<size_t> order = InitializationOrder();
+
+			// A group per plugin, so the patch phase can wait for exactly the one it needs
+			std::vector<std::unique_ptr<TaskPool::TaskGroup>> groups( m_plugins.size() );
+			std::vector<bool> initialized( m_plugins.size() );
+			auto prepareReady = [&] {
+				for ( size_t i = 0; i < m_plugins.size(); i++ )
+				{
+					const Plugin& plugin = m_plugins[i];
+					if ( groups[i] != nullptr || plugin.prepare == nullptr ) continue;
+					if ( std::all_of( plugin.dependencies.begin(), plugin.dependencies.end(), [&]( size_t dependency ) { return initialized[dependency]; } ) )
+					{
+						groups[i] = std::make_unique<TaskPool::TaskGroup>( pool );
+						groups[i]->Run( plugin.prepare );
+					}
+				}
+			};
+
+			prepareReady();
+			for ( size_t index : order )
+			{
+				const Plugin& plugin = m_plugins[index];
+				if ( plugin.prepare != nullptr )
+				{
+					// Dependencies come first in the order, so the preparation has been started already
+					if ( groups[index] == nullptr )
+					{
+						groups[index] = std::make_unique<TaskPool::TaskGroup>( pool );
+						groups[index]->Run( plugin.prepare );
+					}
+					groups[index]->Wait();
+				}
+
+				if ( plugin.initialize != nullptr )
+				{
+					plugin.initialize();
+				}
+				initialized[index] = true;
+				prepareReady();
+			}
+		}
+
+		const std::vector<Plugin>& Plugins() const
+		{
+			return m_plugins;
+		}
+
+	private:
+		void ResolveDependencies()
+		{
+			using GetDependenciesFunc = const char* (__cdecl*)();
+
+			for ( Plugin& plugin : m_plugins )
+			{
+				plugin.dependencies.clear();
+
+				const GetDependenciesFunc getDependencies = reinterpret_cast<GetDependenciesFunc>(GetProcAddress( plugin.module, "GetASIDependencies" ));
+				const char* list = getDependencies != nullptr ? getDependencies() : nullptr;
+				if ( list == nullptr )
+				{
+					continue;
+				}
+
+				std::string_view remaining( list );
+				while ( !remaining.empty() )
+				{
+					const size_t separator = remaining.find( ';' );
+					std::string_view entry = remaining.substr( 0, separator );
+					remaining.remove_prefix( separator != std::string_view::npos ? separator + 1 : remaining.size() );
+
+					while ( !entry.empty() && entry.front() == ' ' ) entry.remove_prefix( 1 );
+					while ( !entry.empty() && entry.back() == ' ' ) entry.remove_suffix( 1 );
+					if ( entry.empty() ) continue;
+
+					const std::wstring name = details::NormalizeName( std::wstring( entry.begin(), entry.end() ) );
+					for ( size_t i = 0; i < m_plugins.size(); i++ )
+					{
+						if ( m_plugins[i].name == name && &m_plugins[i] != &plugin )
+						{
+							plugin.dependencies.push_back( i );
+						}
+					}
+				}
+			}
+		}
+
+		// Dependencies first, load order otherwise. Cycles are broken at the first plugin (in load order) that's part of one
+		std::vector<size_t> InitializationOrder() const
+		{
+			std::vector<size_t> order;
+			std::vector<bool> done( m_plugins.size() );
+			while ( order.size() < m_plugins.size() )
+			{
+				bool progress = false;
+				for ( size_t i = 0; i < m_plugins.size(); i++ )
+				{
+					if ( done[i] ) continue;
+
+					const std::vector<size_t>& dependencies = m_plugins[i].dependencies;
+					if ( std::all_of( dependencies.begin(), dependencies.end(), [&]( size_t dependency ) { return done[dependency]; } ) )
+					{
+						order.push_back( i );
+						done[i] = true;
+						progress = true;
+						// Restart, so plugins that were waiting on this one keep their place in load order
+						break;
+					}
+				}
+
+				if ( !progress )
+				{
+					const size_t first = std::find( done.begin(), done.end(), false ) - done.begin();
+					order.push_back( first );
+					done[first] = true;
+				}
+			}
+			return order;
+		}
+
+		std::vector<Plugin> m_plugins;
+	};
+}
@@ -0,0 +1,426 @@
+#pragma once
+
+// Code cave allocator - hands out unused padding inside the executable sections of a module as space for code stubs,
+// so hooks can reach far away handlers without allocating anything near the module. Works in 32-bit processes too.
+// Usage:
+//	CodeCaves::Allocator caves( GetModuleHandle(nullptr) );
+//	Memory::VP::InjectHook( address, caves.Jump( address, &Hook ), Memory::VP::HookType::Call );
+//	std::byte* stub = caves.RawSpace( address, 32, 16 ); // nullptr if no cave within rel32 range has space left
+//	Memory::VP::Patch( stub, { ... } ); // the space keeps the protection of the module's code, so write it like any other patch
+//
+// Caves are int3 runs between functions and the slack between the end of an executable section and the end of its last page.
+// Zero and nop runs are indexed too, but only handed out when asked for in Options - nops may still be executed
+// (loop alignment inside functions), and zeroes may be data read by the code.
+// Space is claimed in 16 byte blocks, by atomically replacing the first bytes of the block in the module itself -
+// so Allocators in different modules never hand out the same space, even if they indexed the module at the same time.
+// Don't leave the first 4 bytes of a stub untouched, or in the padding pattern - it would look unclaimed again.
+// The pages are made writable only for the duration of a claim or a stub write, and then get their old protection back.
+// NOTE: Like with Memory::VP, this isn't coordinated with other modules - patching the same pages from another thread
+// while an Allocator claims space may leave either of them without write access.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CODECAVES_USE_SSE2 1
+#endif
+
+namespace CodeCaves
+{
+	enum class Kind
+	{
+		Int3,
+		Zero,
+		Nop,
+		SectionSlack,
+	};
+
+	struct Cave
+	{
+		uintptr_t begin;
+		uintptr_t end;
+		Kind kind;
+		uint8_t fill;
+	};
+
+	namespace details
+	{
+		static constexpr uintptr_t BLOCK_SIZE = 16;
+		// The longest immediate a run can start inside of (mov r64, imm64)
+		static constexpr uintptr_t IMMEDIATE_GUARD = 8;
+		static constexpr uint8_t FILLS[] = { 0xCC, 0x00, 0x90 };
+		static constexpr Kind FILL_KINDS[] = { Kind::Int3, Kind::Zero, Kind::Nop };
+		static constexpr uint8_t CLAIM_MARKER = 0xF4; // hlt
+
+		inline uintptr_t AlignUp( uintptr_t value, uintptr_t align )
+		{
+			return (value + align - 1) & ~(align - 1);
+		}
+
+		inline uintptr_t AlignDown( uintptr_t value, uintptr_t align )
+		{
+			return value & ~(align - 1);
+		}
+
+		inline bool IsInRange( uintptr_t from, uintptr_t to )
+		{
+			const int64_t diff = static_cast<int64_t>(to) - static_cast<int64_t>(from);
+			return diff >= INT32_MIN && diff <= INT32_MAX;
+		}
+
+		// Bit N set if the whole block is FILLS[N]
+		inline uint32_t FullBlockFills( const uint8_t* block )
+		{
+			uint32_t result = 0;
+#if CODECAVES_USE_SSE2
+			const __m128i data = _mm_load_si128( reinterpret_cast<const __m128i*>(block) );
+			for ( size_t i = 0; i < std::size(FILLS); i++ )
+			{
+				if ( _mm_movemask_epi8( _mm_cmpeq_epi8( data, _mm_set1_epi8( static_cast<char>(FILLS[i]) ) ) ) == 0xFFFF )
+				{
+					result |= 1u << i;
+				}
+			}
+#else
+			uint64_t data[2];
+			memcpy( data, block, sizeof(data) );
+			for ( size_t i = 0; i < std::size(FILLS); i++ )
+			{
+				const uint64_t pattern = FILLS[i] * UINT64_C(0x0101010101010101);
+				if ( data[0] == pattern && data[1] == pattern )
+				{
+					result |= 1u << i;
+				}
+			}
+#endif
+			return result;
+		}
+
+		inline void AddCave( std::vector<Cave>& caves, uintptr_t begin, uintptr_t end, Kind kind, uint8_t fill )
+		{
+			begin = AlignUp( begin, BLOCK_SIZE );
+			end = AlignDown( end, BLOCK_SIZE );
+			if ( begin < end )
+			{
+				caves.push_back( { begin, end, kind, fill } );
+			}
+		}
+
+		inline void AddRun( std::vector<Cave>& caves, uintptr_t begin, uintptr_t end, size_t fillIndex, uintptr_t sectionEnd )
+		{
+			const uint8_t fill = FILLS[fillIndex];
+			if ( fill == 0 && end > sectionEnd )
+			{
+				// Past the end of section data, nothing could ever be there
+				AddCave( caves, std::max( begin, sectionEnd ), end, Kind::SectionSlack, fill );
+				end = sectionEnd;
+			}
+
+			// The run may start with the tail of an instruction, give it room
+			if ( begin < end )
+			{
+				AddCave( caves, begin + IMMEDIATE_GUARD, end, FILL_KINDS[fillIndex], fill );
+			}
+		}
+
+		inline void ScanRange( std::vector<Cave>& caves, const uint8_t* begin, const uint8_t* end, const uint8_t* sectionEnd )
+		{
+			const uint8_t* block = reinterpret_cast<const uint8_t*>(AlignUp( reinterpret_cast<uintptr_t>(begin), BLOCK_SIZE ));
+			for ( ; block + BLOCK_SIZE <= end; block += BLOCK_SIZE )
+			{
+				const uint32_t fills = FullBlockFills( block );
+				if ( fills == 0 )
+				{
+					continue;
+				}
+
+				size_t fillIndex = 0;
+				while ( (fills & (1u << fillIndex)) == 0 ) fillIndex++;
+				const uint8_t fill = FILLS[fillIndex];
+
+				// Extend both ways - whole blocks first, then the odd bytes
+				const uint8_t* runBegin = block;
+				while ( runBegin > begin && runBegin[-1] == fill ) runBegin--;
+
+				const uint8_t* runEnd = block + BLOCK_SIZE;
+				while ( runEnd + BLOCK_SIZE <= end && (FullBlockFills( runEnd ) & (1u << fillIndex)) != 0 ) runEnd += BLOCK_SIZE;
+				while ( runEnd < end && *runEnd == fill ) runEnd++;
+
+				AddRun( caves, reinterpret_cast<uintptr_t>(runBegin), reinterpret_cast<uintptr_t>(runEnd), fillIndex, reinterpret_cast<uintptr_t>(sectionEnd) );
+				block = reinterpret_cast<const uint8_t*>(AlignDown( reinterpret_cast<uintptr_t>(runEnd), BLOCK_SIZE ));
+			}
+		}
+
+		class ScopedWritable
+		{
+		public:
+			ScopedWritable( uintptr_t begin, uintptr_t end )
+				: m_address( reinterpret_cast<void*>(begin) ), m_size( end - begin )
+			{
+				m_valid = VirtualProtect( m_address, m_size, PAGE_EXECUTE_READWRITE, &m_oldProtect ) != FALSE;
+			}
+
+			~ScopedWritable()
+			{
+				if ( m_valid )
+				{
+					DWORD dummy;
+					VirtualProtect( m_address, m_size, m_oldProtect, &dummy );
+				}
+			}
+
+			ScopedWritable( const ScopedWritable& ) = delete;
+			ScopedWritable& operator=( const ScopedWritable& ) = delete;
+
+			bool Valid() const { return m_valid; }
+
+		private:
+			void* m_address;
+			size_t m_size;
+			DWORD m_oldProtect = 0;
+			bool m_valid;
+		};
+
+		inline LONG BlockPattern( uint8_t fill )
+		{
+			LONG pattern;
+			memset( &pattern, fill, sizeof(pattern) );
+			return pattern;
+		}
+
+		// The block must be writable
+		inline bool ClaimBlock( uintptr_t block, uint8_t fill )
+		{
+			const LONG expected = BlockPattern( fill );
+			LONG desired = expected;
+			memcpy( &desired, &CLAIM_MARKER, sizeof(CLAIM_MARKER) );
+			return InterlockedCompareExchange( reinterpret_cast<volatile LONG*>(block), desired, expected ) == expected;
+		}
+
+		inline void ReleaseBlock( uintptr_t block, uint8_t fill )
+		{
+			InterlockedExchange( reinterpret_cast<volatile LONG*>(block), BlockPattern( fill ) );
+		}
+	}
+
+	// Indexes the padding runs of all executable sections of the module, in one pass over their pages
+	inline std::vector<Cave> FindCaves( HMODULE module )
+	{
+		std::vector<Cave> caves;
+
+		const uintptr_t base = reinterpret_cast<uintptr_t>(module);
+		const PIMAGE_DOS_HEADER dosHeader = reinterpret_cast<PIMAGE_DOS_HEADER>(module);
+		const PIMAGE_NT_HEADERS ntHeader = reinterpret_cast<PIMAGE_NT_HEADERS>(base + dosHeader->e_lfanew);
+		const uintptr_t sectionAlignment = std::max<uintptr_t>( ntHeader->OptionalHeader.SectionAlignment, 1 );
+
+		PIMAGE_SECTION_HEADER section = IMAGE_FIRST_SECTION(ntHeader);
+		for ( WORD i = 0; i < ntHeader->FileHeader.NumberOfSections; i++, section++ )
+		{
+			if ( (section->Characteristics & IMAGE_SCN_MEM_EXECUTE) == 0 || section->Misc.VirtualSize == 0 )
+			{
+				continue;
+			}
+
+			// Scan up to the end of the section's last page to include the slack
+			const uintptr_t begin = base + section->VirtualAddress;
+			const uintptr_t dataEnd = begin + section->Misc.VirtualSize;
+			const uintptr_t end = std::min<uintptr_t>( details::AlignUp( dataEnd, sectionAlignment ), base + ntHeader->OptionalHeader.SizeOfImage );
+			details::ScanRange( caves, reinterpret_cast<const uint8_t*>(begin), reinterpret_cast<const uint8_t*>(end), reinterpret_cast<const uint8_t*>(dataEnd) );
+		}
+		return caves;
+	}
+
+	class Allocator
+	{
+	public:
+		struct Options
+		{
+			bool useZeroRuns = false;
+			bool useNopRuns = false;
+		};
+
+		explicit Allocator( HMODULE module )
+			: Allocator( module, Options() )
+		{
+		}
+
+		Allocator( HMODULE module, Options options )
+			: m_options( options )
+		{
+			AddModule( module );
+		}
+
+		void AddModule( HMODULE module )
+		{
+			std::vector<Cave> caves = FindCaves( module );
+
+			std::lock_guard<std::mutex> lock( m_mutex );
+			for ( const Cave& cave : caves )
+			{
+				if ( IsUsable( cave.kind ) )
+				{
+					m_caves.push_back( { cave, cave.begin, cave.begin } );
+				}
+			}
+		}
+
+		// Space for code within rel32 range of addr (and all of its bytes), or nullptr
+		template<typename T>
+		std::byte* RawSpace( T addr, size_t size, size_t align = 1 )
+		{
+			return static_cast<std::byte*>(GetNewSpace( uintptr_t(addr), size, align ));
+		}
+
+		// Jump stub to func within rel32 range of addr, or nullptr
+		template<typename T, typename Func>
+		LPVOID Jump( T addr, Func func )
+		{
+			uintptr_t destination;
+			memcpy( &destination, std::addressof(func), sizeof(destination) );
+#ifdef _WIN64
+			uint8_t stub[14] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 };
+			memcpy( stub + 6, &destination, sizeof(destination) );
+#else
+			uint8_t stub[5] = { 0xE9 };
+#endif
+
+			uint8_t* space = static_cast<uint8_t*>(GetNewSpace( uintptr_t(addr), sizeof(stub), 1 ));
+			if ( space == nullptr )
+			{
+				return nullptr;
+			}
+
+#ifndef _WIN64
+			const intptr_t distance = static_cast<intptr_t>(destination) - reinterpret_cast<intptr_t>(space + sizeof(stub));
+			memcpy( stub + 1, &distance, sizeof(int32_t) );
+#endif
+
+			{
+				details::ScopedWritable writable( reinterpret_cast<uintptr_t>(space), reinterpret_cast<uintptr_t>(space + sizeof(stub)) );
+				memcpy( space, stub, sizeof(stub) );
+			}
+			FlushInstructionCache( GetCurrentProcess(), space, sizeof(stub) );
+			return space;
+		}
+
+		// Bytes left in all caves, claimed by others or not
+		size_t SpaceLeft() const
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+
+			size_t space = 0;
+			for ( const Slot& slot : m_caves )
+			{
+				space += slot.cave.end - slot.used;
+			}
+			return space;
+		}
+
+	private:
+		struct Slot
+		{
+			Cave cave;
+			uintptr_t used;
+			// Blocks up to here belong to this Allocator
+			uintptr_t claimed;
+		};
+
+		bool IsUsable( Kind kind ) const
+		{
+			switch ( kind )
+			{
+			case Kind::Zero:
+				return m_options.useZeroRuns;
+			case Kind::Nop:
+				return m_options.useNopRuns;
+			default:
+				return true;
+			}
+		}
+
+		void* GetNewSpace( uintptr_t addr, size_t size, size_t align )
+		{
+			if ( size == 0 || align == 0 || (align & (align - 1)) != 0 )
+			{
+				return nullptr;
+			}
+
+			std::lock_guard<std::mutex> lock( m_mutex );
+			for ( Slot& slot : m_caves )
+			{
+				while ( true )
+				{
+					const uintptr_t begin = details::AlignUp( slot.used, align );
+					const uintptr_t end = begin + size;
+					if ( end > slot.cave.end || end < begin || !details::IsInRange( addr, begin ) || !details::IsInRange( addr, end ) )
+					{
+						break;
+					}
+
+					uintptr_t failedBlock;
+					bool unwritable;
+					if ( Claim( slot, end, failedBlock, unwritable ) )
+					{
+						slot.used = end;
+						return reinterpret_cast<void*>(begin);
+					}
+
+					if ( unwritable )
+					{
+						slot.used = slot.cave.end;
+						break;
+					}
+
+					// Someone else took a block in the middle, carry on past it
+					slot.used = slot.claimed = failedBlock + details::BLOCK_SIZE;
+				}
+			}
+			return nullptr;
+		}
+
+		static bool Claim( Slot& slot, uintptr_t end, uintptr_t& failedBlock, bool& unwritable )
+		{
+			const uintptr_t claimEnd = details::AlignUp( end, details::BLOCK_SIZE );
+			unwritable = false;
+			if ( slot.claimed >= claimEnd )
+			{
+				return true;
+			}
+
+			details::ScopedWritable writable( slot.claimed, claimEnd );
+			if ( !writable.Valid() )
+			{
+				unwritable = true;
+				return false;
+			}
+
+			for ( uintptr_t block = slot.claimed; block < claimEnd; block += details::BLOCK_SIZE )
+			{
+				if ( !details::ClaimBlock( block, slot.cave.fill ) )
+				{
+					for ( uintptr_t release = slot.claimed; release < block; release += details::BLOCK_SIZE )
+					{
+						details::ReleaseBlock( release, slot.cave.fill );
+					}
+					failedBlock = block;
+					return false;
+				}
+			}
+			slot.claimed = std::max( slot.claimed, claimEnd );
+			return true;
+		}
+
+		const Options m_options;
+		mutable std::mutex m_mutex;
+		std::vector<Slot> m_caves;
+	};
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+// Code modification tracker - detects when code is changed after it's been indexed (e.g. patched by another mod),
+// so caches built over it can drop only what the changes affected.
+// Usage:
+//	static CodeTracker::Tracker tracker( GetModuleHandle(nullptr) ); // Once the patterns are resolved
+//	...
+//	tracker.Refresh( hook::invalidate_code ); // Before trusting cached results again, e.g. once other mods have loaded
+//
+// Every page gets a hash when tracking starts, Refresh re-hashes and reports runs of changed pages.
+// Where the OS can tell, pages known to be unmodified aren't even hashed, so a refresh usually only hashes the few that were patched:
+// - Windows - image pages stay shared with the file until something writes to them,
+//   so any page that's still shared (QueryWorkingSetEx) can't have changed.
+// - Linux - pages not written to since the soft-dirty bits were cleared (/proc/self/pagemap) can't have changed.
+//   The first Tracker clears them for the whole process, once - don't use it alongside anything else relying on them.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CODETRACKER_USE_SSE2 1
+#endif
+
+namespace CodeTracker
+{
+	namespace details
+	{
+		static constexpr uintptr_t PAGE_SIZE = 0x1000;
+		static constexpr size_t NUM_LANES = 8;
+
+		// Multiply-accumulate over 8 lanes of 64-bit words, 64 bytes per step (the xxh3 accumulator, without its secret)
+		// Every word is also added in as is, so changing any single word always changes the hash
+		alignas(16) static constexpr uint64_t LANE_KEYS[NUM_LANES] = {
+			0xBE4BA423396CFEB8, 0x1CAD21F72C81017C, 0xDB979083E96DD4DE, 0x1F67B3B7A4A44072,
+			0x78E5C0CC4EE679CB, 0x2172FFCC7DD05A82, 0x8E2443F7744608B8, 0x4C263A81E69035E0,
+		};
+
+		inline uint64_t HashPage( const uint8_t* page )
+		{
+			alignas(16) uint64_t acc[NUM_LANES] = {};
+#if CODETRACKER_USE_SSE2
+			__m128i vacc[NUM_LANES / 2];
+			for ( size_t i = 0; i < NUM_LANES / 2; i++ )
+			{
+				vacc[i] = _mm_setzero_si128();
+			}
+			for ( uintptr_t offset = 0; offset < PAGE_SIZE; offset += NUM_LANES * sizeof(uint64_t) )
+			{
+				for ( size_t i = 0; i < NUM_LANES / 2; i++ )
+				{
+					const __m128i data = _mm_loadu_si128( reinterpret_cast<const __m128i*>(page + offset) + i );
+					const __m128i key = _mm_xor_si128( data, _mm_load_si128( reinterpret_cast<const __m128i*>(LANE_KEYS) + i ) );
+					const __m128i product = _mm_mul_epu32( key, _mm_shuffle_epi32( key, _MM_SHUFFLE(0, 3, 0, 1) ) );
+					vacc[i] = _mm_add_epi64( vacc[i], _mm_add_epi64( product, _mm_shuffle_epi32( data, _MM_SHUFFLE(1, 0, 3, 2) ) ) );
+				}
+			}
+			for ( size_t i = 0; i < NUM_LANES / 2; i++ )
+			{
+				_mm_store_si128( reinterpret_cast<__m128i*>(acc) + i, vacc[i] );
+			}
+#else
+			for ( uintptr_t offset = 0; offset < PAGE_SIZE; offset += NUM_LANES * sizeof(uint64_t) )
+			{
+				uint64_t data[NUM_LANES];
+				memcpy( data, page + offset, sizeof(data) );
+				for ( size_t i = 0; i < NUM_LANES; i++ )
+				{
+					const uint64_t key = data[i] ^ LANE_KEYS[i];
+					acc[i] += (key & 0xFFFFFFFF) * (key >> 32) + data[i ^ 1];
+				}
+			}
+#endif
+			uint64_t hash = 0;
+			for ( size_t i = 0; i < NUM_LANES; i++ )
+			{
+				hash = (hash ^ acc[i]) * 0x9FB21C651E98DF25;
+				hash ^= hash >> 29;
+			}
+			return hash;
+		}
+
+#ifdef _WIN32
+		// PSAPI_WORKING_SET_EX_INFORMATION
+		struct WorkingSetExInformation
+		{
+			void* VirtualAddress;
+			ULONG_PTR VirtualAttributes;
+		};
+		static constexpr ULONG_PTR WORKING_SET_VALID = 1;
+		static constexpr ULONG_PTR WORKING_SET_SHARED = 1 << 15;
+
+		typedef BOOL (WINAPI * QueryWorkingSetExFunc)(HANDLE hProcess, PVOID pv, DWORD cb);
+
+		inline QueryWorkingSetExFunc GetQueryWorkingSetEx()
+		{
+			static const QueryWorkingSetExFunc func = [] {
+				QueryWorkingSetExFunc result = nullptr;
+				HMODULE hLib = GetModuleHandle( TEXT("kernel32") );
+				if ( hLib != nullptr )
+				{
+					result = reinterpret_cast<QueryWorkingSetExFunc>(GetProcAddress( hLib, "K32QueryWorkingSetEx" ));
+				}
+				if ( result == nullptr )
+				{
+					// Try psapi, deliberately never freed
+					hLib = LoadLibrary( TEXT("psapi") );
+					if ( hLib != nullptr )
+					{
+						result = reinterpret_cast<QueryWorkingSetExFunc>(GetProcAddress( hLib, "QueryWorkingSetEx" ));
+					}
+				}
+				return result;
+			}();
+			return func;
+		}
+
+		inline void StartTracking()
+		{
+		}
+
+		// Pages that may have changed, or nothing if the OS can't tell
+		inline std::vector<bool> PossiblyChangedPages( const std::vector<uintptr_t>& pages )
+		{
+			const QueryWorkingSetExFunc queryWorkingSetEx = GetQueryWorkingSetEx();
+			if ( queryWorkingSetEx == nullptr || pages.empty() )
+			{
+				return {};
+			}
+
+			std::vector<WorkingSetExInformation> workingSet( pages.size() );
+			for ( size_t i = 0; i < pages.size(); i++ )
+			{
+				workingSet[i].VirtualAddress = reinterpret_cast<void*>(pages[i]);
+			}
+			if ( queryWorkingSetEx( GetCurrentProcess(), workingSet.data(), static_cast<DWORD>(workingSet.size() * sizeof(workingSet[0])) ) == FALSE )
+			{
+				return {};
+			}
+
+			std::vector<bool> result( pages.size() );
+			const ULONG_PTR sharedPage = WORKING_SET_VALID | WORKING_SET_SHARED;
+			for ( size_t i = 0; i < pages.size(); i++ )
+			{
+				result[i] = (workingSet[i].VirtualAttributes & sharedPage) != sharedPage;
+			}
+			return result;
+		}
+#elif defined(__linux__)
+		static constexpr uint64_t PAGEMAP_SOFT_DIRTY = UINT64_C(1) << 55;
+
+		// Whether the soft-dirty bits were cleared, so they show writes since then
+		inline bool& SoftDirtyCleared()
+		{
+			static bool cleared = false;
+			return cleared;
+		}
+
+		inline bool ReadPagemap( int fd, uintptr_t firstEntry, uint64_t* entries, size_t numEntries )
+		{
+			const size_t bytes = numEntries * sizeof(uint64_t);
+			return pread( fd, entries, bytes, static_cast<off_t>(firstEntry * sizeof(uint64_t)) ) == static_cast<ssize_t>(bytes);
+		}
+
+		// Must happen before the first pages are hashed - writes from then on mark pages soft-dirty
+		inline void StartTracking()
+		{
+			static std::once_flag once;
+			std::call_once( once, [] {
+				const int fd = open( "/proc/self/clear_refs", O_WRONLY | O_CLOEXEC );
+				if ( fd == -1 )
+				{
+					return;
+				}
+				const bool cleared = write( fd, "4", 1 ) == 1;
+				close( fd );
+
+				// Kernels built without soft-dirty support accept the write, but never set the bits - so see if a write shows up
+				const int pagemap = open( "/proc/self/pagemap", O_RDONLY | O_CLOEXEC );
+				if ( cleared && pagemap != -1 )
+				{
+					static volatile uint64_t probe[PAGE_SIZE / sizeof(uint64_t)];
+					probe[0] = probe[0] + 1;
+
+					uint64_t entry = 0;
+					SoftDirtyCleared() = ReadPagemap( pagemap, reinterpret_cast<uintptr_t>(&probe[0]) / static_cast<uintptr_t>(sysconf( _SC_PAGESIZE )), &entry, 1 )
+						&& (entry & PAGEMAP_SOFT_DIRTY) != 0;
+				}
+				if ( pagemap != -1 )
+				{
+					close( pagemap );
+				}
+			} );
+		}
+
+		inline std::vector<bool> PossiblyChangedPages( const std::vector<uintptr_t>& pages )
+		{
+			if ( !SoftDirtyCleared() || pages.empty() )
+			{
+				return {};
+			}
+
+			const int fd = open( "/proc/self/pagemap", O_RDONLY | O_CLOEXEC );
+			if ( fd == -1 )
+			{
+				return {};
+			}
+
+			// One entry per system page, which may be bigger than ours
+			// Tracked pages are mostly contiguous, so read the entries in runs
+			const uintptr_t systemPageSize = static_cast<uintptr_t>(sysconf( _SC_PAGESIZE ));
+			std::vector<bool> result( pages.size() );
+			std::vector<uint64_t> entries;
+			bool ok = true;
+			for ( size_t i = 0; i < pages.size() && ok; )
+			{
+				size_t runEnd = i + 1;
+				while ( runEnd < pages.size() && pages[runEnd] == pages[runEnd - 1] + PAGE_SIZE ) runEnd++;
+
+				const uintptr_t firstEntry = pages[i] / systemPageSize;
+				entries.resize( pages[runEnd - 1] / systemPageSize - firstEntry + 1 );
+				ok = ReadPagemap( fd, firstEntry, entries.data(), entries.size() );
+				for ( size_t j = i; j < runEnd && ok; j++ )
+				{
+					result[j] = (entries[pages[j] / systemPageSize - firstEntry] & PAGEMAP_SOFT_DIRTY) != 0;
+				}
+				i = runEnd;
+			}
+			close( fd );
+			return ok ? result : std::vector<bool>();
+		}
+#else
+		inline void StartTracking()
+		{
+		}
+
+		inline std::vector<bool> PossiblyChangedPages( const std::vector<uintptr_t>& )
+		{
+			return {};
+		}
+#endif
+	}
+
+	class Tracker
+	{
+	public:
+#ifdef _WIN32
+		// Executable sections of the module
+		explicit Tracker( HMODULE module )
+		{
+			details::StartTracking();
+
+			const uintptr_t base = reinterpret_cast<uintptr_t>(module);
+			const PIMAGE_DOS_HEADER dosHeader = reinterpret_cast<PIMAGE_DOS_HEADER>(module);
+			const PIMAGE_NT_HEADERS ntHeader = reinterpret_cast<PIMAGE_NT_HEADERS>(base + dosHeader->e_lfanew);
+
+			PIMAGE_SECTION_HEADER section = IMAGE_FIRST_SECTION(ntHeader);
+			for ( WORD i = 0; i < ntHeader->FileHeader.NumberOfSections; i++, section++ )
+			{
+				if ( (section->Characteristics & IMAGE_SCN_MEM_EXECUTE) != 0 && section->Misc.VirtualSize != 0 )
+				{
+					AddRange( base + section->VirtualAddress, base + section->VirtualAddress + section->Misc.VirtualSize );
+				}
+			}
+		}
+#endif
+
+		// Any readable range, widened to whole pages
+		Tracker( uintptr_t begin, uintptr_t end )
+		{
+			details::StartTracking();
+			AddRange( begin, end );
+		}
+
+		// Re-hashes the pages that may have changed since the last refresh (or since tracking started),
+		// then calls onChange( begin, end ) for every run of changed pages. Returns the number of changed pages
+		template<typename Func>
+		size_t Refresh( Func&& onChange )
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+
+			std::vector<uintptr_t> addresses( m_pages.size() );
+			for ( size_t i = 0; i < m_pages.size(); i++ )
+			{
+				addresses[i] = m_pages[i].address;
+			}
+			const std::vector<bool> possiblyChanged = details::PossiblyChangedPages( addresses );
+
+			size_t numChanged = 0;
+			uintptr_t runBegin = 0, runEnd = 0;
+			for ( size_t i = 0; i < m_pages.size(); i++ )
+			{
+				Page& page = m_pages[i];
+
+				if ( !possiblyChanged.empty() && !possiblyChanged[i] )
+				{
+					continue;
+				}
+
+				const uint64_t hash = details::HashPage( reinterpret_cast<const uint8_t*>(page.address) );
+				if ( hash == page.hash )
+				{
+					continue;
+				}
+				page.hash = hash;
+				numChanged++;
+
+				if ( page.address != runEnd )
+				{
+					if ( runBegin != runEnd )
+					{
+						onChange( runBegin, runEnd );
+					}
+					runBegin = page.address;
+				}
+				runEnd = page.address + details::PAGE_SIZE;
+			}
+			if ( runBegin != runEnd )
+			{
+				onChange( runBegin, runEnd );
+			}
+			return numChanged;
+		}
+
+		size_t NumPages() const
+		{
+			return m_pages.size();
+		}
+
+	private:
+		struct Page
+		{
+			uintptr_t address;
+			uint64_t hash;
+		};
+
+		void AddRange( uintptr_t begin, uintptr_t end )
+		{
+			begin &= ~(details::PAGE_SIZE - 1);
+			end = (end + details::PAGE_SIZE - 1) & ~(details::PAGE_SIZE - 1);
+			for ( uintptr_t address = begin; address < end; address += details::PAGE_SIZE )
+			{
+				m_pages.push_back( { address, details::HashPage( reinterpret_cast<const uint8_t*>(address) ) } );
+			}
+		}
+
+		std::mutex m_mutex;
+		// In address order
+		std::vector<Page> m_pages;
+	};
+}
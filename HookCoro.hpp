@@ -0,0 +1,407 @@
+#pragma once
+
+// C++20 coroutines for staged initialization
+// Lets init code that depends on late-loading modules, scans or the game loop read sequentially:
+//
+// hook::init_task InitRenderer()
+// {
+//     HMODULE d3d9 = static_cast<HMODULE>(co_await hook::module_loaded(L"d3d9"));
+//     auto present = co_await hook::scan(hook::make_module_pattern(d3d9, "8B FF 55 8B EC ..."));
+//     co_await hook::next_frame();
+//     ...
+// }
+//
+// Suspended coroutines are resumed on whichever thread fires the event they wait on:
+// - module_loaded - the thread loading the module, from the loader's DLL notification (under the loader lock,
+//   before the module's own initialization). Where there are no notifications (e.g. Linux), call hook::check_modules()
+// - scan/run_on_pool - a TaskPool worker, once the work is done
+// - next_frame - the thread calling hook::signal_frame(), normally from a Present/swap hook
+// - any hook::event_source - the thread calling fire()
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "LoaderModules.hpp"
+#include "Patterns.h"
+#include "TaskPool.hpp"
+
+namespace hook
+{
+	// Fire-and-forget coroutine - starts running immediately and frees itself when it finishes
+	struct init_task
+	{
+		struct promise_type
+		{
+			init_task get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	// Event that coroutines can wait for - every fire() resumes everything that was waiting for it
+	class event_source
+	{
+	public:
+		struct awaiter
+		{
+			event_source& source;
+
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> handle)
+			{
+				std::lock_guard<std::mutex> lock(source.m_mutex);
+				source.m_waiters.push_back(handle);
+			}
+			void await_resume() const noexcept {}
+		};
+
+		awaiter operator co_await() noexcept
+		{
+			return awaiter{ *this };
+		}
+
+		// Resumes the waiters on the calling thread
+		// Coroutines waiting again from within are resumed by the next fire()
+		void fire()
+		{
+			std::vector<std::coroutine_handle<>> waiters;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				waiters.swap(m_waiters);
+			}
+
+			for (auto handle : waiters)
+			{
+				handle.resume();
+			}
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::vector<std::coroutine_handle<>> m_waiters;
+	};
+
+	namespace details
+	{
+		using module_name = std::basic_string<LoaderModules::char_type>;
+
+		inline bool module_name_equals(LoaderModules::string_view a, LoaderModules::string_view b)
+		{
+#ifdef _WIN32
+			return a.size() == b.size() && _wcsnicmp(a.data(), b.data(), a.size()) == 0;
+#else
+			return a == b;
+#endif
+		}
+
+		// Accepts names with or without the extension (on Linux, also without the .so version suffix)
+		inline bool module_name_matches(LoaderModules::string_view wanted, LoaderModules::string_view name)
+		{
+			if (module_name_equals(wanted, name) || module_name_equals(wanted, LoaderModules::StemOf(name)))
+			{
+				return true;
+			}
+#ifndef _WIN32
+			const size_t so = name.find(".so");
+			return so != LoaderModules::string_view::npos && module_name_equals(wanted, name.substr(0, so));
+#else
+			return false;
+#endif
+		}
+
+		inline void* find_module(LoaderModules::string_view wanted)
+		{
+			void* base = nullptr;
+			LoaderModules::ForEach([&](const LoaderModules::Module& module) {
+				if (module_name_matches(wanted, module.name))
+				{
+					base = module.base;
+					return false;
+				}
+				return true;
+			});
+			return base;
+		}
+
+		struct module_waiter
+		{
+			module_name name;
+			std::coroutine_handle<> handle;
+			void* base = nullptr;
+		};
+
+		class module_watch
+		{
+		public:
+			static module_watch& get()
+			{
+				static module_watch watch;
+				return watch;
+			}
+
+			// Returns false if the module showed up in the meantime, waiter->base is set then
+			bool add(module_waiter* waiter)
+			{
+				// The loader calls us with its lock held, so the module list can't be walked under our mutex -
+				// instead, retry if anything got loaded between the walk and the registration
+				while (true)
+				{
+					const uint32_t generation = m_generation.load();
+					waiter->base = find_module(waiter->name);
+					if (waiter->base != nullptr)
+					{
+						return false;
+					}
+
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if (m_generation.load() == generation)
+					{
+						m_waiters.push_back(waiter);
+						return true;
+					}
+				}
+			}
+
+			void on_loaded(LoaderModules::string_view name, void* base)
+			{
+				std::vector<module_waiter*> ready;
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_generation++;
+					auto it = std::remove_if(m_waiters.begin(), m_waiters.end(), [&](module_waiter* waiter) {
+						if (module_name_matches(waiter->name, name))
+						{
+							waiter->base = base;
+							ready.push_back(waiter);
+							return true;
+						}
+						return false;
+					});
+					m_waiters.erase(it, m_waiters.end());
+				}
+				resume(ready);
+			}
+
+			void check()
+			{
+				std::vector<module_waiter*> waiters, ready;
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_generation++;
+					waiters.swap(m_waiters);
+				}
+
+				// Still missing ones go back to the list
+				for (module_waiter* waiter : waiters)
+				{
+					if (!add(waiter))
+					{
+						ready.push_back(waiter);
+					}
+				}
+				resume(ready);
+			}
+
+		private:
+			static void resume(const std::vector<module_waiter*>& waiters)
+			{
+				for (module_waiter* waiter : waiters)
+				{
+					waiter->handle.resume();
+				}
+			}
+
+#ifdef _WIN32
+			struct LDR_DLL_NOTIFICATION_DATA_T
+			{
+				ULONG Flags;
+				const LoaderModules::details::UNICODE_STRING_T* FullDllName;
+				const LoaderModules::details::UNICODE_STRING_T* BaseDllName;
+				PVOID DllBase;
+				ULONG SizeOfImage;
+			};
+
+			using notification_func = VOID (CALLBACK*)(ULONG reason, const LDR_DLL_NOTIFICATION_DATA_T* data, PVOID context);
+			static constexpr ULONG LDR_DLL_NOTIFICATION_REASON_LOADED = 1;
+
+			static VOID CALLBACK notification(ULONG reason, const LDR_DLL_NOTIFICATION_DATA_T* data, PVOID context)
+			{
+				if (reason == LDR_DLL_NOTIFICATION_REASON_LOADED && data->BaseDllName != nullptr)
+				{
+					static_cast<module_watch*>(context)->on_loaded(LoaderModules::details::ToStringView(*data->BaseDllName), data->DllBase);
+				}
+			}
+
+			module_watch()
+			{
+				const HMODULE ntdll = GetModuleHandleW(L"ntdll");
+				if (ntdll != nullptr)
+				{
+					using register_func = LONG (NTAPI*)(ULONG flags, notification_func callback, PVOID context, PVOID* cookie);
+					auto pRegister = reinterpret_cast<register_func>(GetProcAddress(ntdll, "LdrRegisterDllNotification"));
+					if (pRegister != nullptr && pRegister(0, notification, this, &m_cookie) < 0)
+					{
+						m_cookie = nullptr;
+					}
+				}
+			}
+
+			~module_watch()
+			{
+				if (m_cookie != nullptr)
+				{
+					using unregister_func = LONG (NTAPI*)(PVOID cookie);
+					auto pUnregister = reinterpret_cast<unregister_func>(GetProcAddress(GetModuleHandleW(L"ntdll"), "LdrUnregisterDllNotification"));
+					if (pUnregister != nullptr)
+					{
+						pUnregister(m_cookie);
+					}
+				}
+			}
+
+			PVOID m_cookie = nullptr;
+#else
+			module_watch() = default;
+#endif
+
+			std::mutex m_mutex;
+			std::vector<module_waiter*> m_waiters;
+			std::atomic<uint32_t> m_generation { 0 };
+		};
+
+		class module_awaiter
+		{
+		public:
+			explicit module_awaiter(LoaderModules::string_view name)
+			{
+				m_waiter.name.assign(name.begin(), name.end());
+			}
+
+			bool await_ready()
+			{
+				m_waiter.base = find_module(m_waiter.name);
+				return m_waiter.base != nullptr;
+			}
+
+			bool await_suspend(std::coroutine_handle<> handle)
+			{
+				m_waiter.handle = handle;
+				return module_watch::get().add(&m_waiter);
+			}
+
+			void* await_resume() const noexcept
+			{
+				return m_waiter.base;
+			}
+
+		private:
+			module_waiter m_waiter;
+		};
+
+		template<typename Func>
+		class pool_awaiter
+		{
+		public:
+			using result_type = std::invoke_result_t<Func&>;
+
+			pool_awaiter(Func func, TaskPool::Pool& pool)
+				: m_func(std::move(func)), m_pool(pool)
+			{
+			}
+
+			bool await_ready() const noexcept { return false; }
+
+			void await_suspend(std::coroutine_handle<> handle)
+			{
+				m_pool.Submit([this, handle] {
+					if constexpr (std::is_void_v<result_type>)
+					{
+						m_func();
+					}
+					else
+					{
+						m_result.emplace(m_func());
+					}
+					handle.resume();
+				});
+			}
+
+			result_type await_resume()
+			{
+				if constexpr (!std::is_void_v<result_type>)
+				{
+					return std::move(*m_result);
+				}
+			}
+
+		private:
+			using storage_type = std::conditional_t<std::is_void_v<result_type>, bool, result_type>;
+
+			Func m_func;
+			TaskPool::Pool& m_pool;
+			std::optional<storage_type> m_result;
+		};
+	}
+
+	// Resumes once a module with the given name (extension optional) is loaded, returning its base
+	inline details::module_awaiter module_loaded(LoaderModules::string_view name)
+	{
+		return details::module_awaiter(name);
+	}
+
+	// Rechecks modules waited on with module_loaded, for when the loader can't notify us
+	inline void check_modules()
+	{
+		details::module_watch::get().check();
+	}
+
+	// Runs func on the pool and resumes there with its result
+	template<typename Func>
+	inline auto run_on_pool(Func func, TaskPool::Pool& pool = TaskPool::Pool::Get())
+	{
+		return details::pool_awaiter<Func>(std::move(func), pool);
+	}
+
+	// Scans on the pool, resuming with the pattern and its matches ready
+	template<typename err_policy>
+	inline auto scan(basic_pattern<err_policy> pattern, TaskPool::Pool& pool = TaskPool::Pool::Get())
+	{
+		return run_on_pool([pattern = std::move(pattern)]() mutable {
+			pattern.size();
+			return std::move(pattern);
+		}, pool);
+	}
+
+	inline auto scan(std::string_view pattern_string, TaskPool::Pool& pool = TaskPool::Pool::Get())
+	{
+		return scan(pattern(pattern_string), pool);
+	}
+
+	inline event_source& frame_event()
+	{
+		static event_source event;
+		return event;
+	}
+
+	// Resumes on the next signal_frame()
+	inline event_source::awaiter next_frame()
+	{
+		return frame_event().operator co_await();
+	}
+
+	// Call once per frame (e.g. from a Present hook) to resume everything waiting in next_frame()
+	inline void signal_frame()
+	{
+		frame_event().fire();
+	}
+}
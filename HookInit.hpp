@@ -9,10 +9,21 @@
 
 // When integrated properly, the following function shall be exposed:
 // void OnInitializeHook() - called once from the hooked WinAPI function
+// void OnPrepareHook() - only if HOOKINIT_PREPARE is defined, called once before OnInitializeHook
 
 // The following exports are added to the binary:
 // void InitializeASI()
 // uint32_t GetBuildNumber() - returns revision/build number as defined in VersionInfo.lua (if defined)
+// void PrepareASI() - only if HOOKINIT_PREPARE is defined, calls OnPrepareHook
+// const char* GetASIDependencies() - only if HOOKINIT_DEPENDENCIES is defined, returns it (e.g. "SilentPatchSA;WidescreenFix")
+
+// Loaders aware of PrepareASI (see ASILoader.hpp) call it on a worker thread, in parallel with other plugins,
+// so OnPrepareHook must not patch anything - it's meant for pattern scanning and such, with OnInitializeHook applying the results.
+// It runs as soon as the loader calls it, not from the hooked function, so only use it if the executable isn't packed.
+// Once PrepareASI has been called, InitializeASI calls OnInitializeHook right away instead of hooking the WinAPI function,
+// so the loader knows the plugin has patched by the time InitializeASI returns.
+// Other loaders never call PrepareASI, in which case OnPrepareHook runs right before OnInitializeHook.
+// HOOKINIT_DEPENDENCIES lists plugins which must have been initialized before this one prepares, e.g. ones patching code it scans.
 
 // Hooks will be initialized by first attempting to patch IAT of the main module
 // If this fails, selected WinAPI export will be hooked directly
@@ -20,18 +31,35 @@
 #include "MemoryMgr.h"
 #include "Trampoline.h"
 
+#include <atomic>
 #include <mutex>
 
 #define STRINGIZE(s) STRINGIZE2(s)
 #define STRINGIZE2(s) #s
 
 extern void OnInitializeHook();
+#ifdef HOOKINIT_PREPARE
+extern void OnPrepareHook();
+#endif
 
 namespace HookInit
 {
+#ifdef HOOKINIT_PREPARE
+static std::once_flag prepareFlag;
+// Set once a loader has called PrepareASI
+static std::atomic<bool> preparedByLoader { false };
+static void ProcPrepare()
+{
+	std::call_once(prepareFlag, OnPrepareHook);
+}
+#endif
+
 static std::once_flag hookFlag;
 static void ProcHook()
 {
+#ifdef HOOKINIT_PREPARE
+	ProcPrepare();
+#endif
 	std::call_once(hookFlag, OnInitializeHook);
 }
 
@@ -168,8 +196,30 @@ extern "C"
 	__declspec(dllexport) void __cdecl InitializeASI()
 	{
 		if ( _InterlockedCompareExchange(&InitCount, 1, 0) != 0 ) return;
+#if defined(HOOKINIT_PREPARE)
+		if ( HookInit::preparedByLoader.load() )
+		{
+			HookInit::ProcHook();
+			return;
+		}
+#endif
 		HookInit::InstallHooks();
 	}
+
+#if defined(HOOKINIT_PREPARE)
+	__declspec(dllexport) void __cdecl PrepareASI()
+	{
+		HookInit::ProcPrepare();
+		HookInit::preparedByLoader.store(true);
+	}
+#endif
+#endif
+
+#if defined(HOOKINIT_DEPENDENCIES)
+	__declspec(dllexport) const char* __cdecl GetASIDependencies()
+	{
+		return HOOKINIT_DEPENDENCIES;
+	}
 #endif
 
 #if !defined(SKIP_BUILDNUMBER) && defined(rsc_RevisionID) && defined(rsc_BuildID)
@@ -0,0 +1,649 @@
+#pragma once
+
+// Binary logging for hooks on hot paths (per-frame, per-entity...)
+// Every thread writes fixed-size binary records - format, timestamp and raw arguments - into its own lock-free ring buffer.
+// Nothing is formatted on the logging thread: a background drainer picks the records up every few milliseconds,
+// formats them with the printf-style format and writes them to the file, in timestamp order.
+// When a ring buffer is full, records are dropped (and counted) rather than waiting for the drainer.
+//
+// HotLog::Start( "hooks.log" );
+// HOTLOG( "Entity %p spawned with model %u at %.2f", entity, modelID, posX );
+// ...
+// HotLog::Stop();
+//
+// Arguments may be integers, enums, floating point values and pointers. Strings are not copied, so const char*
+// arguments must outlive the drainer - pass only string literals and other static strings!
+// Logging before Start or after Stop does nothing.
+// On Windows the drainer thread keeps the module loaded until Stop, so call it before the module is meant to unload.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <intrin.h>
+#include "TaskPool.hpp"
+#else
+#include <thread>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#endif
+
+#define HOTLOG(format, ...) ::HotLog::Log( [] { return format; }, ##__VA_ARGS__ )
+
+namespace HotLog
+{
+	struct Options
+	{
+		// Per thread, rounded up to a power of two. A record takes 24 bytes plus 8 per argument, so 1MB holds about
+		// 20000 records of a few arguments - a thread logging more than that every drainIntervalMs (e.g. a tight loop) drops the rest
+		size_t bufferSize = 1024 * 1024;
+		unsigned int drainIntervalMs = 50;
+	};
+
+	namespace details
+	{
+		using PrintFunc = int (*)( char* buffer, size_t size, const char* format, const uint64_t* args );
+
+		// Identifies the call site - one per HOTLOG
+		struct Format
+		{
+			const char* format;
+			PrintFunc print;
+		};
+
+		struct RecordHeader
+		{
+			// nullptr for the padding before the ring buffer wraps around
+			const Format* format;
+			uint64_t timestamp;
+			uint32_t size;
+			uint32_t numArgs;
+		};
+
+		inline uint64_t Timestamp()
+		{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+			return __rdtsc();
+#else
+			return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+		}
+
+		inline uint32_t CurrentThreadId()
+		{
+#ifdef _WIN32
+			return GetCurrentThreadId();
+#else
+			return static_cast<uint32_t>(syscall( SYS_gettid ));
+#endif
+		}
+
+		template<typename T>
+		inline uint64_t Pack( T value )
+		{
+			static_assert( std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>, "HotLog only takes integers, enums, floating point values and pointers" );
+			if constexpr ( std::is_floating_point_v<T> )
+			{
+				const double d = value;
+				uint64_t result;
+				memcpy( &result, &d, sizeof(result) );
+				return result;
+			}
+			else if constexpr ( std::is_pointer_v<T> )
+			{
+				return reinterpret_cast<uintptr_t>(value);
+			}
+			else if constexpr ( std::is_enum_v<T> )
+			{
+				return static_cast<uint64_t>(static_cast<std::underlying_type_t<T>>(value));
+			}
+			else
+			{
+				return static_cast<uint64_t>(value);
+			}
+		}
+
+		// Gives back the original type, so the format specifiers work exactly like with printf
+		template<typename T>
+		inline auto Unpack( uint64_t value )
+		{
+			if constexpr ( std::is_floating_point_v<T> )
+			{
+				double d;
+				memcpy( &d, &value, sizeof(d) );
+				return d;
+			}
+			else if constexpr ( std::is_pointer_v<T> )
+			{
+				return reinterpret_cast<T>(static_cast<uintptr_t>(value));
+			}
+			else
+			{
+				return static_cast<T>(value);
+			}
+		}
+
+		template<typename... Args, size_t... I>
+		inline int PrintImpl( char* buffer, size_t size, const char* format, const uint64_t* args, std::index_sequence<I...> )
+		{
+			if constexpr ( sizeof...(Args) == 0 )
+			{
+				return snprintf( buffer, size, "%s", format );
+			}
+			else
+			{
+				return snprintf( buffer, size, format, Unpack<Args>( args[I] )... );
+			}
+		}
+
+		template<typename... Args>
+		inline int Print( char* buffer, size_t size, const char* format, const uint64_t* args )
+		{
+			return PrintImpl<Args...>( buffer, size, format, args, std::index_sequence_for<Args...>() );
+		}
+
+		// Single producer (the owning thread), single consumer (the drainer)
+		class ThreadBuffer
+		{
+		public:
+			explicit ThreadBuffer( size_t capacity )
+				: m_data( new uint64_t[capacity / sizeof(uint64_t)] ), m_capacity( capacity ), m_threadId( CurrentThreadId() )
+			{
+			}
+
+			template<size_t NumArgs>
+			void Write( const Format* format, uint64_t timestamp, const uint64_t* args )
+			{
+				constexpr uint64_t size = sizeof(RecordHeader) + NumArgs * sizeof(uint64_t);
+
+				uint64_t head = m_head.load( std::memory_order_relaxed );
+				const uint64_t contiguous = m_capacity - (head & (m_capacity - 1));
+				const uint64_t needed = contiguous < size ? contiguous + size : size;
+				if ( head + needed - m_cachedTail > m_capacity )
+				{
+					m_cachedTail = m_tail.load( std::memory_order_acquire );
+					if ( head + needed - m_cachedTail > m_capacity )
+					{
+						m_dropped.store( m_dropped.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+						return;
+					}
+				}
+
+				if ( contiguous < size )
+				{
+					// Records never wrap - a gap too small for a header is skipped by the reader implicitly
+					if ( contiguous >= sizeof(RecordHeader) )
+					{
+						const RecordHeader padding = { nullptr, 0, static_cast<uint32_t>(contiguous), 0 };
+						memcpy( At( head ), &padding, sizeof(padding) );
+					}
+					head += contiguous;
+				}
+
+				uint8_t* record = At( head );
+				const RecordHeader header = { format, timestamp, static_cast<uint32_t>(size), static_cast<uint32_t>(NumArgs) };
+				memcpy( record, &header, sizeof(header) );
+				if constexpr ( NumArgs != 0 )
+				{
+					memcpy( record + sizeof(header), args, NumArgs * sizeof(uint64_t) );
+				}
+				m_head.store( head + size, std::memory_order_release );
+			}
+
+			// Calls func( header, args ) for every complete record - drainer only
+			template<typename Func>
+			void Read( Func&& func )
+			{
+				uint64_t tail = m_tail.load( std::memory_order_relaxed );
+				const uint64_t head = m_head.load( std::memory_order_acquire );
+				while ( tail != head )
+				{
+					const uint64_t contiguous = m_capacity - (tail & (m_capacity - 1));
+					if ( contiguous < sizeof(RecordHeader) )
+					{
+						tail += contiguous;
+						continue;
+					}
+
+					RecordHeader header;
+					memcpy( &header, At( tail ), sizeof(header) );
+					if ( header.format != nullptr )
+					{
+						func( header, reinterpret_cast<const uint64_t*>(At( tail ) + sizeof(header)) );
+					}
+					tail += header.size;
+				}
+				m_tail.store( tail, std::memory_order_release );
+			}
+
+			uint32_t ThreadId() const { return m_threadId; }
+			uint64_t Dropped() const { return m_dropped.load( std::memory_order_relaxed ); }
+
+			bool Abandoned() const { return m_abandoned.load( std::memory_order_acquire ); }
+			void Abandon() { m_abandoned.store( true, std::memory_order_release ); }
+
+		private:
+			uint8_t* At( uint64_t position ) const
+			{
+				return reinterpret_cast<uint8_t*>(m_data.get()) + (position & (m_capacity - 1));
+			}
+
+			const std::unique_ptr<uint64_t[]> m_data;
+			const uint64_t m_capacity;
+			const uint32_t m_threadId;
+
+			// Kept on separate cache lines, so the producer and the drainer don't fight over them
+			alignas(64) std::atomic<uint64_t> m_head { 0 };
+			uint64_t m_cachedTail = 0;
+			std::atomic<uint64_t> m_dropped { 0 };
+			alignas(64) std::atomic<uint64_t> m_tail { 0 };
+			std::atomic<bool> m_abandoned { false };
+		};
+
+		inline ThreadBuffer*& CurrentBufferSlot()
+		{
+			static thread_local ThreadBuffer* buffer = nullptr;
+			return buffer;
+		}
+
+		class Logger
+		{
+		public:
+			static Logger& Get()
+			{
+				static Logger logger;
+				return logger;
+			}
+
+			~Logger()
+			{
+#ifdef _WIN32
+				// The drainer may have been killed holding a lock, there is nothing left to wait for
+				if ( TaskPool::details::ProcessTerminating() ) return;
+#endif
+				Stop();
+			}
+
+			bool Running() const
+			{
+				return m_running.load( std::memory_order_relaxed );
+			}
+
+			bool Start( const char* path, const Options& options )
+			{
+				std::lock_guard<std::mutex> startLock( m_startMutex );
+				if ( m_thread.joinable() )
+				{
+					return false;
+				}
+
+				m_file = fopen( path, "w" );
+				if ( m_file == nullptr )
+				{
+					return false;
+				}
+
+				m_bufferSize = 256;
+				while ( m_bufferSize < options.bufferSize )
+				{
+					m_bufferSize *= 2;
+				}
+				m_drainInterval = std::chrono::milliseconds( options.drainIntervalMs );
+
+				m_startTimestamp = Timestamp();
+				m_startTime = std::chrono::steady_clock::now();
+				m_stop = false;
+				m_thread = Thread( this );
+				m_running.store( true, std::memory_order_release );
+				return true;
+			}
+
+			void Stop()
+			{
+				std::lock_guard<std::mutex> startLock( m_startMutex );
+				if ( !m_thread.joinable() )
+				{
+					return;
+				}
+
+				// Records written after this point are lost
+				m_running.store( false, std::memory_order_release );
+				{
+					std::lock_guard<std::mutex> lock( m_mutex );
+					m_stop = true;
+				}
+				m_wake.notify_all();
+				m_thread.Join();
+
+				fclose( m_file );
+				m_file = nullptr;
+			}
+
+			// Waits until everything logged so far is in the file
+			void Flush()
+			{
+				std::unique_lock<std::mutex> lock( m_mutex );
+				if ( m_stop || !m_thread.joinable() )
+				{
+					return;
+				}
+
+				const uint64_t target = ++m_flushRequested;
+				m_wake.notify_all();
+				m_flushed.wait( lock, [&] { return m_flushDone >= target || m_stop; } );
+			}
+
+			uint64_t Dropped()
+			{
+				std::lock_guard<std::mutex> lock( m_buffersMutex );
+				uint64_t result = m_droppedByExited;
+				for ( const auto& buffer : m_buffers )
+				{
+					result += buffer->Dropped();
+				}
+				return result;
+			}
+
+			ThreadBuffer* RegisterThread()
+			{
+				// Frees the buffer up for the drainer once the thread is gone
+				struct Owner
+				{
+					ThreadBuffer* buffer = nullptr;
+					~Owner()
+					{
+						if ( buffer != nullptr )
+						{
+							CurrentBufferSlot() = nullptr;
+							buffer->Abandon();
+						}
+					}
+				};
+				static thread_local Owner owner;
+
+				auto buffer = std::make_unique<ThreadBuffer>( m_bufferSize );
+				owner.buffer = buffer.get();
+				CurrentBufferSlot() = buffer.get();
+
+				std::lock_guard<std::mutex> lock( m_buffersMutex );
+				m_buffers.push_back( std::move(buffer) );
+				return owner.buffer;
+			}
+
+		private:
+			Logger() = default;
+
+			// Drainer thread - see TaskPool::Pool::Join for why Windows doesn't just join the thread
+			class Thread
+			{
+			public:
+				Thread() = default;
+
+				explicit Thread( Logger* logger )
+				{
+#ifdef _WIN32
+					m_exited = CreateEventW( nullptr, TRUE, FALSE, nullptr );
+					if ( m_exited != nullptr )
+					{
+						Params* params = new Params { logger, m_exited, TaskPool::details::ReferenceThisModule() };
+						m_thread = CreateThread( nullptr, 0, ThreadProc, params, 0, nullptr );
+						if ( m_thread == nullptr )
+						{
+							if ( params->module != nullptr ) FreeLibrary( params->module );
+							delete params;
+						}
+					}
+#else
+					m_thread = std::thread( [logger] { logger->DrainLoop(); } );
+#endif
+				}
+
+				Thread& operator=( Thread&& other ) noexcept
+				{
+#ifdef _WIN32
+					std::swap( m_thread, other.m_thread );
+					std::swap( m_exited, other.m_exited );
+#else
+					m_thread = std::move(other.m_thread);
+#endif
+					return *this;
+				}
+
+				bool joinable() const
+				{
+#ifdef _WIN32
+					return m_thread != nullptr;
+#else
+					return m_thread.joinable();
+#endif
+				}
+
+				void Join()
+				{
+#ifdef _WIN32
+					if ( m_thread != nullptr )
+					{
+						const HANDLE handles[] = { m_exited, m_thread };
+						WaitForMultipleObjects( 2, handles, FALSE, INFINITE );
+						CloseHandle( m_thread );
+						m_thread = nullptr;
+					}
+					if ( m_exited != nullptr )
+					{
+						CloseHandle( m_exited );
+						m_exited = nullptr;
+					}
+#else
+					m_thread.join();
+#endif
+				}
+
+			private:
+#ifdef _WIN32
+				struct Params
+				{
+					Logger* logger;
+					HANDLE exited;
+					HMODULE module;
+				};
+
+				static DWORD WINAPI ThreadProc( LPVOID lpParameter )
+				{
+					const Params params = *static_cast<Params*>(lpParameter);
+					delete static_cast<Params*>(lpParameter);
+
+					params.logger->DrainLoop();
+					SetEvent( params.exited );
+					return TaskPool::details::ExitThreadInModule( params.module );
+				}
+
+				HANDLE m_thread = nullptr;
+				HANDLE m_exited = nullptr;
+#else
+				std::thread m_thread;
+#endif
+			};
+
+			void DrainLoop()
+			{
+				std::unique_lock<std::mutex> lock( m_mutex );
+				while ( true )
+				{
+					const uint64_t flushRequested = m_flushRequested;
+					const bool stop = m_stop;
+					lock.unlock();
+
+					Drain();
+
+					lock.lock();
+					m_flushDone = flushRequested;
+					m_flushed.notify_all();
+					if ( stop )
+					{
+						break;
+					}
+					m_wake.wait_for( lock, m_drainInterval, [&] { return m_stop || m_flushRequested != flushRequested; } );
+				}
+			}
+
+			void Drain()
+			{
+				struct Line
+				{
+					uint64_t timestamp;
+					uint32_t threadId;
+					std::string text;
+				};
+				std::vector<Line> lines;
+
+				char text[1024];
+				std::vector<std::unique_ptr<ThreadBuffer>> exited;
+				{
+					std::lock_guard<std::mutex> lock( m_buffersMutex );
+					for ( auto it = m_buffers.begin(); it != m_buffers.end(); )
+					{
+						ThreadBuffer& buffer = **it;
+
+						// Checked first, so nothing the thread wrote before leaving is missed
+						const bool abandoned = buffer.Abandoned();
+						buffer.Read( [&]( const RecordHeader& header, const uint64_t* args ) {
+							const int length = header.format->print( text, sizeof(text), header.format->format, args );
+							lines.push_back( { header.timestamp, buffer.ThreadId(), std::string( text, std::min<size_t>( std::max( length, 0 ), sizeof(text) - 1 ) ) } );
+						} );
+
+						const uint64_t dropped = buffer.Dropped();
+						if ( dropped != m_droppedReported[&buffer] )
+						{
+							fprintf( m_file, "[thread %u] %llu records dropped so far - buffer too small or drained too rarely\n", buffer.ThreadId(), static_cast<unsigned long long>(dropped) );
+							m_droppedReported[&buffer] = dropped;
+						}
+
+						if ( abandoned )
+						{
+							m_droppedByExited += dropped;
+							m_droppedReported.erase( &buffer );
+							exited.push_back( std::move(*it) );
+							it = m_buffers.erase( it );
+						}
+						else
+						{
+							++it;
+						}
+					}
+				}
+
+				std::stable_sort( lines.begin(), lines.end(), []( const Line& a, const Line& b ) {
+					return static_cast<int64_t>(a.timestamp - b.timestamp) < 0;
+				} );
+
+				const double ticksPerSecond = TicksPerSecond();
+				for ( const Line& line : lines )
+				{
+					const double seconds = static_cast<int64_t>(line.timestamp - m_startTimestamp) / ticksPerSecond;
+					fprintf( m_file, "[%12.6f] [%u] %s\n", std::max( seconds, 0.0 ), line.threadId, line.text.c_str() );
+				}
+				fflush( m_file );
+			}
+
+			double TicksPerSecond() const
+			{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+				// TSC frequency, measured against the steady clock over the whole run so far
+				const uint64_t ticks = Timestamp() - m_startTimestamp;
+				const double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - m_startTime ).count();
+				return ticks != 0 && elapsed > 0.0 ? ticks / elapsed : 1e9;
+#else
+				return static_cast<double>(std::chrono::steady_clock::period::den) / std::chrono::steady_clock::period::num;
+#endif
+			}
+
+			std::atomic<bool> m_running { false };
+			std::mutex m_startMutex;
+			Thread m_thread;
+			FILE* m_file = nullptr;
+			size_t m_bufferSize = 0;
+			std::chrono::milliseconds m_drainInterval { 50 };
+			uint64_t m_startTimestamp = 0;
+			std::chrono::steady_clock::time_point m_startTime;
+
+			std::mutex m_mutex;
+			std::condition_variable m_wake;
+			std::condition_variable m_flushed;
+			bool m_stop = false;
+			uint64_t m_flushRequested = 0;
+			uint64_t m_flushDone = 0;
+
+			std::mutex m_buffersMutex;
+			std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+			std::map<const ThreadBuffer*, uint64_t> m_droppedReported;
+			uint64_t m_droppedByExited = 0;
+		};
+	}
+
+	// Starts logging to the file at path, truncating it
+	inline bool Start( const char* path, const Options& options = Options() )
+	{
+		return details::Logger::Get().Start( path, options );
+	}
+
+	// Drains everything that was logged, and closes the file
+	inline void Stop()
+	{
+		details::Logger::Get().Stop();
+	}
+
+	// Waits until everything logged so far is in the file
+	inline void Flush()
+	{
+		details::Logger::Get().Flush();
+	}
+
+	// Records dropped because a ring buffer was full
+	inline uint64_t Dropped()
+	{
+		return details::Logger::Get().Dropped();
+	}
+
+	// Use through HOTLOG - site is a lambda returning the format, one per call site
+	template<typename Site, typename... Args>
+	inline void Log( Site site, Args... args )
+	{
+		details::Logger& logger = details::Logger::Get();
+		if ( !logger.Running() )
+		{
+			return;
+		}
+
+		static const details::Format format = { site(), &details::Print<std::decay_t<Args>...> };
+
+		details::ThreadBuffer* buffer = details::CurrentBufferSlot();
+		if ( buffer == nullptr )
+		{
+			buffer = logger.RegisterThread();
+		}
+
+		// One extra, as arrays can't be empty
+		const uint64_t packed[sizeof...(Args) + 1] = { details::Pack( args )... };
+		buffer->Write<sizeof...(Args)>( &format, details::Timestamp(), packed );
+	}
+}
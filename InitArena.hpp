@@ -0,0 +1,164 @@
+#pragma once
+
+// Monotonic arena for library-internal allocations during initialization
+// While an InitArena::Scope is alive, patterns, module lists and ScopedUnprotect draw their memory from the arena
+// instead of the global heap, so startup doesn't compete with (and fragment) the game's own allocator.
+// Everything is then freed in one shot by Arena::Release or the arena's destructor.
+// NOTE: Objects created inside the scope must be destroyed before the arena is released!
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace InitArena
+{
+	struct Stats
+	{
+		size_t allocations = 0;
+		size_t bytesAllocated = 0;
+		// Deallocations are no-ops for the arena, but are still tracked for the peak
+		size_t bytesInUse = 0;
+		size_t peakBytesInUse = 0;
+		// Memory obtained from the upstream resource
+		size_t bytesReserved = 0;
+		size_t peakBytesReserved = 0;
+
+		std::string ToString() const
+		{
+			char buf[256];
+			snprintf( buf, sizeof(buf), "%zu allocations, %zu bytes allocated, peak %zu bytes in use, %zu bytes reserved (peak %zu)",
+				allocations, bytesAllocated, peakBytesInUse, bytesReserved, peakBytesReserved );
+			return buf;
+		}
+	};
+
+	class Arena final : public std::pmr::memory_resource
+	{
+	public:
+		explicit Arena( size_t initialSize = 64 * 1024, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource() )
+			: m_upstream( upstream, m_stats ), m_resource( initialSize, &m_upstream )
+		{
+		}
+
+		Arena( const Arena& ) = delete;
+		Arena& operator=( const Arena& ) = delete;
+
+		// Frees everything allocated from the arena at once, stats of the peaks are kept
+		void Release()
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			m_resource.release();
+			m_stats.bytesInUse = 0;
+		}
+
+		Stats GetStats() const
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			return m_stats;
+		}
+
+	private:
+		void* do_allocate( size_t bytes, size_t alignment ) override
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			void* result = m_resource.allocate( bytes, alignment );
+
+			m_stats.allocations++;
+			m_stats.bytesAllocated += bytes;
+			m_stats.bytesInUse += bytes;
+			if ( m_stats.bytesInUse > m_stats.peakBytesInUse ) m_stats.peakBytesInUse = m_stats.bytesInUse;
+			return result;
+		}
+
+		void do_deallocate( void*, size_t bytes, size_t ) override
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			m_stats.bytesInUse -= std::min( bytes, m_stats.bytesInUse );
+		}
+
+		bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+		{
+			return this == &other;
+		}
+
+		// Counts memory reserved from upstream by the monotonic resource
+		class CountingResource final : public std::pmr::memory_resource
+		{
+		public:
+			CountingResource( std::pmr::memory_resource* upstream, Stats& stats )
+				: m_upstream( upstream ), m_stats( stats )
+			{
+			}
+
+		private:
+			void* do_allocate( size_t bytes, size_t alignment ) override
+			{
+				void* result = m_upstream->allocate( bytes, alignment );
+				m_stats.bytesReserved += bytes;
+				if ( m_stats.bytesReserved > m_stats.peakBytesReserved ) m_stats.peakBytesReserved = m_stats.bytesReserved;
+				return result;
+			}
+
+			void do_deallocate( void* p, size_t bytes, size_t alignment ) override
+			{
+				m_upstream->deallocate( p, bytes, alignment );
+				m_stats.bytesReserved -= bytes;
+			}
+
+			bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+			{
+				return this == &other;
+			}
+
+			std::pmr::memory_resource* m_upstream;
+			Stats& m_stats;
+		};
+
+		mutable std::mutex m_mutex;
+		Stats m_stats;
+		CountingResource m_upstream;
+		std::pmr::monotonic_buffer_resource m_resource;
+	};
+
+	namespace details
+	{
+		inline std::atomic<std::pmr::memory_resource*>& CurrentResource()
+		{
+			static std::atomic<std::pmr::memory_resource*> resource { nullptr };
+			return resource;
+		}
+	}
+
+	// Resource for library-internal allocations - the active arena, or the default resource if there is none
+	inline std::pmr::memory_resource* GetResource()
+	{
+		std::pmr::memory_resource* resource = details::CurrentResource().load( std::memory_order_acquire );
+		return resource != nullptr ? resource : std::pmr::get_default_resource();
+	}
+
+	// Makes the arena active for library-internal allocations for as long as the object is in scope
+	class Scope
+	{
+	public:
+		explicit Scope( Arena& arena )
+			: m_previous( details::CurrentResource().exchange( &arena, std::memory_order_acq_rel ) )
+		{
+		}
+
+		~Scope()
+		{
+			details::CurrentResource().store( m_previous, std::memory_order_release );
+		}
+
+		Scope( const Scope& ) = delete;
+		Scope& operator=( const Scope& ) = delete;
+
+	private:
+		std::pmr::memory_resource* m_previous;
+	};
+};
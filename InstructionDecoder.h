@@ -0,0 +1,701 @@
+#pragma once
+
+// Compact x86/x64 instruction decoder
+// Decodes lengths, prefixes, ModRM/SIB, displacements and immediates of the general purpose, x87, SSE and VEX/EVEX
+// encoded instructions, and classifies the common general purpose instructions into mnemonics with operands.
+// Portable (doesn't need windows.h), so it can be used from offline tools too.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+namespace hook::x86
+{
+	// Mnemonic families - conditional instructions share a family, with the condition stored separately
+#define HOOK_X86_MNEMONICS(X) \
+	X(unknown) X(mov) X(movzx) X(movsx) X(movsxd) X(lea) X(push) X(pop) X(call) X(jmp) X(ret) X(jcc) \
+	X(add) X(or) X(adc) X(sbb) X(and) X(sub) X(xor) X(cmp) X(test) X(inc) X(dec) \
+	X(rol) X(ror) X(rcl) X(rcr) X(shl) X(shr) X(sar) X(not) X(neg) X(mul) X(imul) X(div) X(idiv) \
+	X(nop) X(int3) X(xchg) X(cmovcc) X(setcc) X(cdq) X(cwde) X(leave) X(movs) X(stos) \
+	X(movups) X(movupd) X(movss) X(movsd) X(movaps) X(movapd) X(xorps) X(cvtsi2ss) X(cvttss2si) X(comiss) X(ucomiss)
+
+	enum class mnemonic : uint8_t
+	{
+#define X(name) name##_,
+		HOOK_X86_MNEMONICS(X)
+#undef X
+		count
+	};
+
+	inline const char* mnemonic_name( mnemonic m )
+	{
+		static const char* const names[] = {
+#define X(name) #name,
+			HOOK_X86_MNEMONICS(X)
+#undef X
+		};
+		return m < mnemonic::count ? names[static_cast<size_t>(m)] : "";
+	}
+
+	enum class operand_type : uint8_t
+	{
+		none,
+		reg,
+		mem,
+		imm,
+		rel,
+	};
+
+	constexpr uint8_t NO_REG = 0xFF;
+	constexpr uint8_t RIP_REG = 0xFE;
+
+	struct operand
+	{
+		operand_type type = operand_type::none;
+		// In bits
+		uint8_t size = 0;
+
+		// reg - register number (REX extended), high8 for ah/ch/dh/bh
+		uint8_t reg = NO_REG;
+		bool high8 = false;
+
+		// mem - base/index registers (NO_REG if absent, RIP_REG for RIP-relative), disp for mem, value for imm/rel
+		uint8_t base = NO_REG;
+		uint8_t index = NO_REG;
+		uint8_t scale = 0;
+		int64_t value = 0;
+	};
+
+	struct instruction
+	{
+		uint8_t length = 0;
+
+		uint8_t rex = 0;
+		bool opsize = false; // 66
+		bool addrsize = false; // 67
+		uint8_t rep = 0; // F2 or F3
+		bool lock = false;
+		bool vex = false;
+
+		// 0 - one byte, 1 - 0F, 2 - 0F38, 3 - 0F3A
+		uint8_t map = 0;
+		uint8_t opcode = 0;
+
+		bool hasModRM = false;
+		uint8_t modrm = 0;
+		bool hasSIB = false;
+		uint8_t sib = 0;
+
+		uint8_t dispOffset = 0;
+		uint8_t dispSize = 0;
+		int32_t disp = 0;
+
+		uint8_t immOffset = 0;
+		uint8_t immSize = 0;
+		// Second immediate (enter, far pointers)
+		uint8_t imm2Size = 0;
+		int64_t imm = 0;
+
+		bool ripRelative = false;
+		// Branch with a relative target (call/jmp/jcc/loop)
+		bool relative = false;
+
+		mnemonic family = mnemonic::unknown_;
+		// Condition code for jcc/cmovcc/setcc
+		uint8_t condition = 0;
+		uint8_t numOperands = 0;
+		operand operands[3];
+
+		uint8_t mod() const { return modrm >> 6; }
+		uint8_t reg() const { return ((modrm >> 3) & 7) | ((rex & 4) << 1); }
+		uint8_t rm() const { return (modrm & 7) | ((rex & 1) << 3); }
+		uint8_t regOpcode() const { return (modrm >> 3) & 7; }
+
+		// Target of a relative branch or a RIP-relative operand, given the runtime address of the instruction
+		uintptr_t branch_target( uintptr_t address ) const { return address + length + static_cast<intptr_t>(imm); }
+		uintptr_t rip_target( uintptr_t address ) const { return address + length + static_cast<intptr_t>(disp); }
+	};
+
+	namespace details
+	{
+		// Operand encodings for the opcode tables
+		enum : uint8_t
+		{
+			NONE = 0,
+			M = 1, // ModRM
+			IB = 2, // imm8
+			IW = 4, // imm16
+			IZ = 8, // imm16/32 depending on operand size
+			IV = 16, // imm16/32/64 depending on operand size (mov r, imm)
+			MOFFS = 32, // address sized offset
+			BAD = 64, // invalid/prefix - handled separately
+			GROUP3 = 128, // F6/F7 - immediate only for /0 and /1
+		};
+
+		inline const uint8_t* one_byte_table()
+		{
+			static const uint8_t table[256] = {
+				// 00
+				M, M, M, M, IB, IZ, NONE, NONE, M, M, M, M, IB, IZ, NONE, BAD,
+				// 10
+				M, M, M, M, IB, IZ, NONE, NONE, M, M, M, M, IB, IZ, NONE, NONE,
+				// 20
+				M, M, M, M, IB, IZ, BAD, NONE, M, M, M, M, IB, IZ, BAD, NONE,
+				// 30
+				M, M, M, M, IB, IZ, BAD, NONE, M, M, M, M, IB, IZ, BAD, NONE,
+				// 40
+				NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE,
+				// 50
+				NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE,
+				// 60
+				NONE, NONE, M, M, BAD, BAD, BAD, BAD, IZ, M|IZ, IB, M|IB, NONE, NONE, NONE, NONE,
+				// 70
+				IB, IB, IB, IB, IB, IB, IB, IB, IB, IB, IB, IB, IB, IB, IB, IB,
+				// 80
+				M|IB, M|IZ, M|IB, M|IB, M, M, M, M, M, M, M, M, M, M, M, M,
+				// 90
+				NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE, IZ|IW, NONE, NONE, NONE, NONE, NONE,
+				// A0
+				MOFFS, MOFFS, MOFFS, MOFFS, NONE, NONE, NONE, NONE, IB, IZ, NONE, NONE, NONE, NONE, NONE, NONE,
+				// B0
+				IB, IB, IB, IB, IB, IB, IB, IB, IV, IV, IV, IV, IV, IV, IV, IV,
+				// C0
+				M|IB, M|IB, IW, NONE, M, M, M|IB, M|IZ, IW|IB, NONE, IW, NONE, NONE, IB, NONE, NONE,
+				// D0
+				M, M, M, M, IB, IB, NONE, NONE, M, M, M, M, M, M, M, M,
+				// E0
+				IB, IB, IB, IB, IB, IB, IB, IB, IZ, IZ, IZ|IW, IB, NONE, NONE, NONE, NONE,
+				// F0
+				BAD, NONE, BAD, BAD, NONE, NONE, M|GROUP3, M|GROUP3, NONE, NONE, NONE, NONE, NONE, NONE, M, M,
+			};
+			return table;
+		}
+
+		inline const uint8_t* two_byte_table()
+		{
+			static const uint8_t table[256] = {
+				// 00
+				M, M, M, M, BAD, NONE, NONE, NONE, NONE, NONE, BAD, NONE, BAD, M, NONE, M|IB,
+				// 10
+				M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+				// 20
+				M, M, M, M, BAD, BAD, BAD, BAD, M, M, M, M, M, M, M, M,
+				// 30
+				NONE, NONE, NONE, NONE, NONE, NONE, BAD, NONE, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+				// 40
+				M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+				// 50
+				M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+				// 60
+				M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+				// 70
+				M|IB, M|IB, M|IB, M|IB, M, M, M, NONE, M, M, M, M, M, M, M, M,
+				// 80
+				IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ,
+				// 90
+				M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+				// A0
+				NONE, NONE, NONE, M, M|IB, M, BAD, BAD, NONE, NONE, NONE, M, M|IB, M, M, M,
+				// B0
+				M, M, M, M, M, M, M, M, M, M, M|IB, M, M, M, M, M,
+				// C0
+				M, M, M|IB, M, M|IB, M|IB, M|IB, M, NONE, NONE, NONE, NONE, NONE, NONE, NONE, NONE,
+				// D0
+				M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+				// E0
+				M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+				// F0
+				M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+			};
+			return table;
+		}
+
+		template<typename T>
+		inline int64_t read_signed( const uint8_t* code )
+		{
+			T value;
+			memcpy( &value, code, sizeof(value) );
+			return static_cast<int64_t>(value);
+		}
+
+		inline int64_t read_imm( const uint8_t* code, uint8_t size )
+		{
+			switch ( size )
+			{
+			case 1: return read_signed<int8_t>( code );
+			case 2: return read_signed<int16_t>( code );
+			case 4: return read_signed<int32_t>( code );
+			case 8: return read_signed<int64_t>( code );
+			default: return 0;
+			}
+		}
+
+		// Decodes ModRM/SIB/displacement, returns false if out of bounds
+		inline bool decode_modrm( const uint8_t* code, size_t size, size_t& pos, bool is64, instruction& ins )
+		{
+			if ( pos >= size ) return false;
+
+			ins.hasModRM = true;
+			ins.modrm = code[pos++];
+
+			const uint8_t mod = ins.mod();
+			const uint8_t rm = ins.modrm & 7;
+			if ( mod == 3 ) return true;
+
+			uint8_t dispSize = 0;
+			if ( !is64 && ins.addrsize )
+			{
+				// 16-bit addressing
+				if ( mod == 0 && rm == 6 ) dispSize = 2;
+				else if ( mod == 1 ) dispSize = 1;
+				else if ( mod == 2 ) dispSize = 2;
+			}
+			else
+			{
+				if ( rm == 4 )
+				{
+					if ( pos >= size ) return false;
+					ins.hasSIB = true;
+					ins.sib = code[pos++];
+					if ( mod == 0 && (ins.sib & 7) == 5 ) dispSize = 4;
+				}
+				if ( mod == 0 && rm == 5 )
+				{
+					dispSize = 4;
+					ins.ripRelative = is64;
+				}
+				else if ( mod == 1 ) dispSize = 1;
+				else if ( mod == 2 ) dispSize = 4;
+			}
+
+			if ( dispSize != 0 )
+			{
+				if ( pos + dispSize > size ) return false;
+				ins.dispOffset = static_cast<uint8_t>(pos);
+				ins.dispSize = dispSize;
+				ins.disp = static_cast<int32_t>(read_imm( code + pos, dispSize ));
+				pos += dispSize;
+			}
+			return true;
+		}
+
+		inline uint8_t operand_size( const instruction& ins, bool is64, bool defaults64 = false )
+		{
+			if ( ins.rex & 8 ) return 64;
+			if ( ins.opsize ) return 16;
+			return is64 && defaults64 ? 64 : 32;
+		}
+
+		inline operand make_reg( uint8_t reg, uint8_t size, const instruction& ins )
+		{
+			operand result;
+			result.type = operand_type::reg;
+			result.size = size;
+			result.reg = reg;
+			// Without REX, registers 4-7 of byte size are ah/ch/dh/bh
+			result.high8 = size == 8 && ins.rex == 0 && reg >= 4 && reg < 8;
+			return result;
+		}
+
+		inline operand make_rm( const instruction& ins, uint8_t size, bool is64 )
+		{
+			if ( ins.mod() == 3 )
+			{
+				return make_reg( ins.rm(), size, ins );
+			}
+
+			operand result;
+			result.type = operand_type::mem;
+			result.size = size;
+			result.value = ins.disp;
+			if ( ins.ripRelative )
+			{
+				result.base = RIP_REG;
+			}
+			else if ( ins.hasSIB )
+			{
+				const uint8_t base = (ins.sib & 7) | ((ins.rex & 1) << 3);
+				const uint8_t index = ((ins.sib >> 3) & 7) | ((ins.rex & 2) << 2);
+				result.base = (ins.mod() == 0 && (ins.sib & 7) == 5) ? NO_REG : base;
+				result.index = index == 4 ? NO_REG : index;
+				result.scale = static_cast<uint8_t>(1 << (ins.sib >> 6));
+			}
+			else if ( !(ins.mod() == 0 && (ins.modrm & 7) == 5) )
+			{
+				result.base = ins.rm();
+			}
+			(void)is64;
+			return result;
+		}
+
+		inline operand make_imm( const instruction& ins, operand_type type = operand_type::imm )
+		{
+			operand result;
+			result.type = type;
+			result.size = static_cast<uint8_t>(ins.immSize * 8);
+			result.value = ins.imm;
+			return result;
+		}
+
+		// Assigns mnemonics and operands to the common general purpose instructions
+		inline void classify( instruction& ins, bool is64 )
+		{
+			const uint8_t op = ins.opcode;
+			const uint8_t ext = ins.hasModRM ? ins.regOpcode() : 0;
+			const uint8_t size = operand_size( ins, is64 );
+
+			auto set = [&ins]( mnemonic family, std::initializer_list<operand> operands ) {
+				ins.family = family;
+				ins.numOperands = 0;
+				for ( const operand& o : operands )
+				{
+					ins.operands[ins.numOperands++] = o;
+				}
+			};
+
+			static constexpr mnemonic alu[] = { mnemonic::add_, mnemonic::or_, mnemonic::adc_, mnemonic::sbb_, mnemonic::and_, mnemonic::sub_, mnemonic::xor_, mnemonic::cmp_ };
+			static constexpr mnemonic shifts[] = { mnemonic::rol_, mnemonic::ror_, mnemonic::rcl_, mnemonic::rcr_, mnemonic::shl_, mnemonic::shr_, mnemonic::shl_, mnemonic::sar_ };
+			static constexpr mnemonic group3[] = { mnemonic::test_, mnemonic::test_, mnemonic::not_, mnemonic::neg_, mnemonic::mul_, mnemonic::imul_, mnemonic::div_, mnemonic::idiv_ };
+
+			if ( ins.vex ) return;
+
+			if ( ins.map == 0 )
+			{
+				if ( op < 0x40 && (op & 7) < 6 )
+				{
+					const mnemonic family = alu[op >> 3];
+					switch ( op & 7 )
+					{
+					case 0: set( family, { make_rm( ins, 8, is64 ), make_reg( ins.reg(), 8, ins ) } ); break;
+					case 1: set( family, { make_rm( ins, size, is64 ), make_reg( ins.reg(), size, ins ) } ); break;
+					case 2: set( family, { make_reg( ins.reg(), 8, ins ), make_rm( ins, 8, is64 ) } ); break;
+					case 3: set( family, { make_reg( ins.reg(), size, ins ), make_rm( ins, size, is64 ) } ); break;
+					case 4: set( family, { make_reg( 0, 8, ins ), make_imm( ins ) } ); break;
+					case 5: set( family, { make_reg( 0, size, ins ), make_imm( ins ) } ); break;
+					}
+					return;
+				}
+
+				if ( op >= 0x40 && op < 0x50 ) // x86 only, REX in x64
+				{
+					set( op < 0x48 ? mnemonic::inc_ : mnemonic::dec_, { make_reg( op & 7, size, ins ) } );
+					return;
+				}
+				if ( op >= 0x50 && op < 0x60 )
+				{
+					set( op < 0x58 ? mnemonic::push_ : mnemonic::pop_, { make_reg( (op & 7) | ((ins.rex & 1) << 3), operand_size( ins, is64, true ), ins ) } );
+					return;
+				}
+				if ( op >= 0x70 && op < 0x80 )
+				{
+					ins.condition = op & 0xF;
+					set( mnemonic::jcc_, { make_imm( ins, operand_type::rel ) } );
+					return;
+				}
+				if ( op >= 0x91 && op < 0x98 )
+				{
+					set( mnemonic::xchg_, { make_reg( (op & 7) | ((ins.rex & 1) << 3), size, ins ), make_reg( 0, size, ins ) } );
+					return;
+				}
+				if ( op >= 0xB0 && op < 0xB8 )
+				{
+					set( mnemonic::mov_, { make_reg( (op & 7) | ((ins.rex & 1) << 3), 8, ins ), make_imm( ins ) } );
+					return;
+				}
+				if ( op >= 0xB8 && op < 0xC0 )
+				{
+					set( mnemonic::mov_, { make_reg( (op & 7) | ((ins.rex & 1) << 3), size, ins ), make_imm( ins ) } );
+					return;
+				}
+
+				switch ( op )
+				{
+				case 0x63:
+					if ( is64 ) set( mnemonic::movsxd_, { make_reg( ins.reg(), size, ins ), make_rm( ins, 32, is64 ) } );
+					break;
+				case 0x68: case 0x6A: set( mnemonic::push_, { make_imm( ins ) } ); break;
+				case 0x69: case 0x6B: set( mnemonic::imul_, { make_reg( ins.reg(), size, ins ), make_rm( ins, size, is64 ), make_imm( ins ) } ); break;
+				case 0x80: case 0x82: set( alu[ext], { make_rm( ins, 8, is64 ), make_imm( ins ) } ); break;
+				case 0x81: case 0x83: set( alu[ext], { make_rm( ins, size, is64 ), make_imm( ins ) } ); break;
+				case 0x84: set( mnemonic::test_, { make_rm( ins, 8, is64 ), make_reg( ins.reg(), 8, ins ) } ); break;
+				case 0x85: set( mnemonic::test_, { make_rm( ins, size, is64 ), make_reg( ins.reg(), size, ins ) } ); break;
+				case 0x86: set( mnemonic::xchg_, { make_rm( ins, 8, is64 ), make_reg( ins.reg(), 8, ins ) } ); break;
+				case 0x87: set( mnemonic::xchg_, { make_rm( ins, size, is64 ), make_reg( ins.reg(), size, ins ) } ); break;
+				case 0x88: set( mnemonic::mov_, { make_rm( ins, 8, is64 ), make_reg( ins.reg(), 8, ins ) } ); break;
+				case 0x89: set( mnemonic::mov_, { make_rm( ins, size, is64 ), make_reg( ins.reg(), size, ins ) } ); break;
+				case 0x8A: set( mnemonic::mov_, { make_reg( ins.reg(), 8, ins ), make_rm( ins, 8, is64 ) } ); break;
+				case 0x8B: set( mnemonic::mov_, { make_reg( ins.reg(), size, ins ), make_rm( ins, size, is64 ) } ); break;
+				case 0x8D: set( mnemonic::lea_, { make_reg( ins.reg(), size, ins ), make_rm( ins, size, is64 ) } ); break;
+				case 0x8F: if ( ext == 0 ) set( mnemonic::pop_, { make_rm( ins, operand_size( ins, is64, true ), is64 ) } ); break;
+				case 0x90: if ( ins.rex == 0 || ins.rex == 0x40 ) set( mnemonic::nop_, {} ); else set( mnemonic::xchg_, { make_reg( 8, size, ins ), make_reg( 0, size, ins ) } ); break;
+				case 0x98: set( mnemonic::cwde_, {} ); break;
+				case 0x99: set( mnemonic::cdq_, {} ); break;
+				case 0xA4: case 0xA5: set( mnemonic::movs_, {} ); break;
+				case 0xA8: set( mnemonic::test_, { make_reg( 0, 8, ins ), make_imm( ins ) } ); break;
+				case 0xA9: set( mnemonic::test_, { make_reg( 0, size, ins ), make_imm( ins ) } ); break;
+				case 0xAA: case 0xAB: set( mnemonic::stos_, {} ); break;
+				case 0xC0: set( shifts[ext], { make_rm( ins, 8, is64 ), make_imm( ins ) } ); break;
+				case 0xC1: set( shifts[ext], { make_rm( ins, size, is64 ), make_imm( ins ) } ); break;
+				case 0xD0: case 0xD2: set( shifts[ext], { make_rm( ins, 8, is64 ) } ); break;
+				case 0xD1: case 0xD3: set( shifts[ext], { make_rm( ins, size, is64 ) } ); break;
+				case 0xC2: set( mnemonic::ret_, { make_imm( ins ) } ); break;
+				case 0xC3: set( mnemonic::ret_, {} ); break;
+				case 0xC6: if ( ext == 0 ) set( mnemonic::mov_, { make_rm( ins, 8, is64 ), make_imm( ins ) } ); break;
+				case 0xC7: if ( ext == 0 ) set( mnemonic::mov_, { make_rm( ins, size, is64 ), make_imm( ins ) } ); break;
+				case 0xC9: set( mnemonic::leave_, {} ); break;
+				case 0xCC: set( mnemonic::int3_, {} ); break;
+				case 0xE8: set( mnemonic::call_, { make_imm( ins, operand_type::rel ) } ); break;
+				case 0xE9: case 0xEB: set( mnemonic::jmp_, { make_imm( ins, operand_type::rel ) } ); break;
+				case 0xF6: set( group3[ext], ext < 2 ? std::initializer_list<operand>{ make_rm( ins, 8, is64 ), make_imm( ins ) } : std::initializer_list<operand>{ make_rm( ins, 8, is64 ) } ); break;
+				case 0xF7: set( group3[ext], ext < 2 ? std::initializer_list<operand>{ make_rm( ins, size, is64 ), make_imm( ins ) } : std::initializer_list<operand>{ make_rm( ins, size, is64 ) } ); break;
+				case 0xFE: if ( ext < 2 ) set( ext == 0 ? mnemonic::inc_ : mnemonic::dec_, { make_rm( ins, 8, is64 ) } ); break;
+				case 0xFF:
+					switch ( ext )
+					{
+					case 0: set( mnemonic::inc_, { make_rm( ins, size, is64 ) } ); break;
+					case 1: set( mnemonic::dec_, { make_rm( ins, size, is64 ) } ); break;
+					case 2: set( mnemonic::call_, { make_rm( ins, is64 ? 64 : 32, is64 ) } ); break;
+					case 4: set( mnemonic::jmp_, { make_rm( ins, is64 ? 64 : 32, is64 ) } ); break;
+					case 6: set( mnemonic::push_, { make_rm( ins, operand_size( ins, is64, true ), is64 ) } ); break;
+					}
+					break;
+				}
+				return;
+			}
+
+			if ( ins.map == 1 )
+			{
+				if ( op >= 0x80 && op < 0x90 )
+				{
+					ins.condition = op & 0xF;
+					set( mnemonic::jcc_, { make_imm( ins, operand_type::rel ) } );
+					return;
+				}
+				if ( op >= 0x40 && op < 0x50 )
+				{
+					ins.condition = op & 0xF;
+					set( mnemonic::cmovcc_, { make_reg( ins.reg(), size, ins ), make_rm( ins, size, is64 ) } );
+					return;
+				}
+				if ( op >= 0x90 && op < 0xA0 )
+				{
+					ins.condition = op & 0xF;
+					set( mnemonic::setcc_, { make_rm( ins, 8, is64 ) } );
+					return;
+				}
+
+				// SSE moves keep their xmm register numbers in 'reg', with size 128
+				auto xmm = [&ins]( uint8_t reg ) {
+					operand result;
+					result.type = operand_type::reg;
+					result.size = 128;
+					result.reg = reg;
+					return result;
+				};
+				auto xmmRm = [&]( uint8_t memSize ) {
+					return ins.mod() == 3 ? xmm( ins.rm() ) : make_rm( ins, memSize, is64 );
+				};
+
+				switch ( op )
+				{
+				case 0x10: case 0x11:
+				{
+					const mnemonic family = ins.rep == 0xF3 ? mnemonic::movss_ : ins.rep == 0xF2 ? mnemonic::movsd_ : ins.opsize ? mnemonic::movupd_ : mnemonic::movups_;
+					const uint8_t memSize = ins.rep == 0xF3 ? 32 : ins.rep == 0xF2 ? 64 : 128;
+					if ( op == 0x10 ) set( family, { xmm( ins.reg() ), xmmRm( memSize ) } );
+					else set( family, { xmmRm( memSize ), xmm( ins.reg() ) } );
+					break;
+				}
+				case 0x1F: set( mnemonic::nop_, { make_rm( ins, size, is64 ) } ); break;
+				case 0x28: set( ins.opsize ? mnemonic::movapd_ : mnemonic::movaps_, { xmm( ins.reg() ), xmmRm( 128 ) } ); break;
+				case 0x29: set( ins.opsize ? mnemonic::movapd_ : mnemonic::movaps_, { xmmRm( 128 ), xmm( ins.reg() ) } ); break;
+				case 0x2A: if ( ins.rep == 0xF3 ) set( mnemonic::cvtsi2ss_, { xmm( ins.reg() ), make_rm( ins, size, is64 ) } ); break;
+				case 0x2C: if ( ins.rep == 0xF3 ) set( mnemonic::cvttss2si_, { make_reg( ins.reg(), size, ins ), xmmRm( 32 ) } ); break;
+				case 0x2E: if ( ins.rep == 0 && !ins.opsize ) set( mnemonic::ucomiss_, { xmm( ins.reg() ), xmmRm( 32 ) } ); break;
+				case 0x2F: if ( ins.rep == 0 && !ins.opsize ) set( mnemonic::comiss_, { xmm( ins.reg() ), xmmRm( 32 ) } ); break;
+				case 0x57: if ( ins.rep == 0 && !ins.opsize ) set( mnemonic::xorps_, { xmm( ins.reg() ), xmmRm( 128 ) } ); break;
+				case 0xAF: set( mnemonic::imul_, { make_reg( ins.reg(), size, ins ), make_rm( ins, size, is64 ) } ); break;
+				case 0xB6: set( mnemonic::movzx_, { make_reg( ins.reg(), size, ins ), make_rm( ins, 8, is64 ) } ); break;
+				case 0xB7: set( mnemonic::movzx_, { make_reg( ins.reg(), size, ins ), make_rm( ins, 16, is64 ) } ); break;
+				case 0xBE: set( mnemonic::movsx_, { make_reg( ins.reg(), size, ins ), make_rm( ins, 8, is64 ) } ); break;
+				case 0xBF: set( mnemonic::movsx_, { make_reg( ins.reg(), size, ins ), make_rm( ins, 16, is64 ) } ); break;
+				}
+			}
+		}
+	}
+
+	// Decodes one instruction, returns false if the bytes don't form a valid instruction within 'size'
+	inline bool decode( const uint8_t* code, size_t size, bool is64, instruction& ins )
+	{
+		using namespace details;
+
+		ins = instruction();
+
+		constexpr size_t MAX_LENGTH = 15;
+		if ( size > MAX_LENGTH ) size = MAX_LENGTH;
+
+		size_t pos = 0;
+
+		// Legacy prefixes
+		for ( ; pos < size; pos++ )
+		{
+			const uint8_t b = code[pos];
+			if ( b == 0x66 ) ins.opsize = true;
+			else if ( b == 0x67 ) ins.addrsize = true;
+			else if ( b == 0xF2 || b == 0xF3 ) ins.rep = b;
+			else if ( b == 0xF0 ) ins.lock = true;
+			else if ( b == 0x26 || b == 0x2E || b == 0x36 || b == 0x3E || b == 0x64 || b == 0x65 ) continue;
+			else break;
+		}
+		if ( pos >= size ) return false;
+
+		if ( is64 && (code[pos] & 0xF0) == 0x40 )
+		{
+			ins.rex = code[pos++];
+			if ( pos >= size ) return false;
+		}
+
+		uint8_t op = code[pos++];
+
+		// VEX/EVEX - in 32-bit mode, only if the following byte would be an invalid ModRM for LES/LDS/BOUND
+		const bool vexPossible = pos < size && (is64 || (code[pos] & 0xC0) == 0xC0);
+		if ( (op == 0xC4 || op == 0xC5 || op == 0x62) && vexPossible && ins.rex == 0 )
+		{
+			ins.vex = true;
+			uint8_t map = 1;
+			if ( op == 0xC5 )
+			{
+				if ( pos + 1 > size ) return false;
+				const uint8_t p0 = code[pos];
+				ins.rex = 0x40 | ((~p0 >> 5) & 4);
+				ins.opsize = (p0 & 3) == 1;
+				ins.rep = (p0 & 3) == 2 ? 0xF3 : (p0 & 3) == 3 ? 0xF2 : 0;
+				pos += 1;
+			}
+			else
+			{
+				const size_t prefixSize = op == 0xC4 ? 2 : 3;
+				if ( pos + prefixSize > size ) return false;
+				const uint8_t p0 = code[pos];
+				const uint8_t p1 = code[pos + 1];
+				map = p0 & (op == 0xC4 ? 0x1F : 0x07);
+				ins.rex = 0x40 | ((~p0 >> 5) & 7) | ((p1 >> 4) & 8);
+				ins.opsize = (p1 & 3) == 1;
+				ins.rep = (p1 & 3) == 2 ? 0xF3 : (p1 & 3) == 3 ? 0xF2 : 0;
+				pos += prefixSize;
+			}
+			if ( map < 1 || map > 3 || pos >= size ) return false;
+
+			ins.map = map;
+			ins.opcode = code[pos++];
+
+			// All VEX/EVEX instructions have ModRM, 0F3A map ones also have imm8
+			if ( !decode_modrm( code, size, pos, is64, ins ) ) return false;
+			if ( map == 3 || (map == 1 && ins.opcode >= 0x70 && ins.opcode <= 0x73) || (map == 1 && (ins.opcode == 0xC2 || ins.opcode == 0xC4 || ins.opcode == 0xC5 || ins.opcode == 0xC6)) )
+			{
+				if ( pos + 1 > size ) return false;
+				ins.immOffset = static_cast<uint8_t>(pos);
+				ins.immSize = 1;
+				ins.imm = read_imm( code + pos, 1 );
+				pos += 1;
+			}
+			ins.length = static_cast<uint8_t>(pos);
+			return true;
+		}
+
+		uint8_t flags;
+		if ( op == 0x0F )
+		{
+			if ( pos >= size ) return false;
+			op = code[pos++];
+			if ( op == 0x38 || op == 0x3A )
+			{
+				if ( pos >= size ) return false;
+				ins.map = op == 0x38 ? 2 : 3;
+				op = code[pos++];
+				flags = ins.map == 2 ? M : M|IB;
+			}
+			else
+			{
+				ins.map = 1;
+				flags = two_byte_table()[op];
+			}
+		}
+		else
+		{
+			flags = one_byte_table()[op];
+
+			// Opcodes invalid in 64-bit mode
+			if ( is64 && (op == 0x06 || op == 0x07 || op == 0x0E || op == 0x16 || op == 0x17 || op == 0x1E || op == 0x1F ||
+				op == 0x27 || op == 0x2F || op == 0x37 || op == 0x3F || op == 0x60 || op == 0x61 || op == 0x82 ||
+				op == 0x9A || op == 0xC4 || op == 0xC5 || op == 0xCE || op == 0xD4 || op == 0xD5 || op == 0xD6 || op == 0xEA) )
+			{
+				return false;
+			}
+		}
+		ins.opcode = op;
+
+		if ( flags & BAD ) return false;
+
+		if ( flags & M )
+		{
+			if ( !decode_modrm( code, size, pos, is64, ins ) ) return false;
+
+			// 8F with a non-zero reg field is the XOP escape, not pop
+			if ( ins.map == 0 && op == 0x8F && ins.regOpcode() != 0 ) return false;
+		}
+
+		uint8_t immSize = 0;
+		if ( flags & GROUP3 )
+		{
+			if ( ins.regOpcode() < 2 ) immSize = op == 0xF6 ? 1 : (ins.opsize ? 2 : 4);
+		}
+		else if ( flags & MOFFS )
+		{
+			immSize = is64 ? (ins.addrsize ? 4 : 8) : (ins.addrsize ? 2 : 4);
+		}
+		else if ( flags & IV )
+		{
+			immSize = (ins.rex & 8) ? 8 : ins.opsize ? 2 : 4;
+		}
+		else if ( flags & IW )
+		{
+			// ret iw, enter iw, ib and far pointers (offset followed by a 16-bit selector)
+			if ( flags & IZ )
+			{
+				immSize = ins.opsize ? 2 : 4;
+				ins.imm2Size = 2;
+			}
+			else
+			{
+				immSize = 2;
+				ins.imm2Size = (flags & IB) ? 1 : 0;
+			}
+		}
+		else
+		{
+			// Relative branches ignore the operand size prefix in 64-bit mode
+			const bool branch = (ins.map == 0 && (op == 0xE8 || op == 0xE9)) || (ins.map == 1 && op >= 0x80 && op < 0x90);
+			if ( flags & IZ ) immSize += (ins.opsize && !(is64 && branch)) ? 2 : 4;
+			if ( flags & IB ) immSize += 1;
+		}
+
+		if ( immSize != 0 )
+		{
+			const size_t total = immSize + ins.imm2Size;
+			if ( pos + total > size ) return false;
+			ins.immOffset = static_cast<uint8_t>(pos);
+			ins.immSize = immSize;
+			ins.imm = read_imm( code + pos, immSize );
+			pos += total;
+		}
+
+		ins.relative = (ins.map == 0 && (op == 0xE8 || op == 0xE9 || op == 0xEB || (op >= 0x70 && op < 0x80) || (op >= 0xE0 && op <= 0xE3))) ||
+			(ins.map == 1 && op >= 0x80 && op < 0x90);
+
+		ins.length = static_cast<uint8_t>(pos);
+		classify( ins, is64 );
+		return true;
+	}
+}
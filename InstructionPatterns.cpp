@@ -0,0 +1,654 @@
+#include "InstructionPatterns.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <windows.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#endif
+
+namespace hook
+{
+	static_assert(size_t(x86::mnemonic::count) <= 64, "Sequence keys pack mnemonics into 6 bits each");
+
+	static constexpr uint32_t NUM_SEQUENCE_KEYS = 1u << 18;
+
+	static void BuildBuckets(std::vector<std::pair<uint32_t, uint32_t>>& items, uint32_t numKeys, std::vector<uint32_t>& start, std::vector<uint32_t>& index)
+	{
+		std::stable_sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+		start.assign(numKeys + 1, 0);
+		index.clear();
+		index.reserve(items.size());
+		for (const auto& item : items)
+		{
+			start[item.first + 1]++;
+			index.push_back(item.second);
+		}
+		for (size_t i = 1; i < start.size(); i++)
+		{
+			start[i] += start[i - 1];
+		}
+	}
+
+	void instruction_stream::add_range(const uint8_t* begin, const uint8_t* end)
+	{
+		assert(begin >= m_base && end >= begin);
+
+		m_entries.reserve(m_entries.size() + (end - begin) / 4);
+
+		x86::instruction ins;
+		for (const uint8_t* ptr = begin; ptr < end; )
+		{
+			if (!x86::decode(ptr, end - ptr, m_is64, ins))
+			{
+				ptr++;
+				continue;
+			}
+
+			m_entries.push_back({ static_cast<uint32_t>(ptr - m_base), ins.length, ins.family, ins.condition });
+			ptr += ins.length;
+		}
+	}
+
+	void instruction_stream::build_index()
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> items;
+		items.reserve(m_entries.size());
+
+		for (size_t i = 0; i + SEQUENCE_LENGTH <= m_entries.size(); i++)
+		{
+			if (!contiguous(i) || !contiguous(i + 1))
+			{
+				continue;
+			}
+			items.emplace_back(sequence_key(m_entries[i].family, m_entries[i + 1].family, m_entries[i + 2].family), static_cast<uint32_t>(i));
+		}
+		BuildBuckets(items, NUM_SEQUENCE_KEYS, m_sequenceStart, m_sequenceIndex);
+
+		items.clear();
+		for (size_t i = 0; i < m_entries.size(); i++)
+		{
+			items.emplace_back(static_cast<uint32_t>(m_entries[i].family), static_cast<uint32_t>(i));
+		}
+		BuildBuckets(items, static_cast<uint32_t>(x86::mnemonic::count), m_familyStart, m_familyIndex);
+	}
+
+	std::basic_string_view<uint32_t> instruction_stream::sequences(uint32_t key) const
+	{
+		if (key >= NUM_SEQUENCE_KEYS || m_sequenceStart.empty())
+		{
+			return {};
+		}
+		return { m_sequenceIndex.data() + m_sequenceStart[key], m_sequenceStart[key + 1] - m_sequenceStart[key] };
+	}
+
+	std::basic_string_view<uint32_t> instruction_stream::instructions(x86::mnemonic family) const
+	{
+		const uint32_t key = static_cast<uint32_t>(family);
+		if (key >= static_cast<uint32_t>(x86::mnemonic::count) || m_familyStart.empty())
+		{
+			return {};
+		}
+		return { m_familyIndex.data() + m_familyStart[key], m_familyStart[key + 1] - m_familyStart[key] };
+	}
+
+#ifdef _WIN32
+	const instruction_stream& instruction_stream::for_module(void* module)
+	{
+		static std::mutex mutex;
+		static std::map<void*, std::unique_ptr<instruction_stream>> streams;
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto& stream = streams[module];
+		if (!stream)
+		{
+			const uint8_t* base = static_cast<const uint8_t*>(module);
+			const PIMAGE_DOS_HEADER dosHeader = reinterpret_cast<PIMAGE_DOS_HEADER>(module);
+			const PIMAGE_NT_HEADERS ntHeader = reinterpret_cast<PIMAGE_NT_HEADERS>(reinterpret_cast<uintptr_t>(module) + dosHeader->e_lfanew);
+
+			stream = std::make_unique<instruction_stream>(base, ntHeader->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC);
+
+			const PIMAGE_SECTION_HEADER sections = IMAGE_FIRST_SECTION(ntHeader);
+			for (WORD i = 0; i < ntHeader->FileHeader.NumberOfSections; i++)
+			{
+				if ((sections[i].Characteristics & IMAGE_SCN_MEM_EXECUTE) != 0)
+				{
+					const uint8_t* begin = base + sections[i].VirtualAddress;
+					stream->add_range(begin, begin + sections[i].Misc.VirtualSize);
+				}
+			}
+			stream->build_index();
+		}
+		return *stream;
+	}
+#endif
+
+	static std::string_view Trim(std::string_view text)
+	{
+		while (!text.empty() && isspace(static_cast<unsigned char>(text.front()))) text.remove_prefix(1);
+		while (!text.empty() && isspace(static_cast<unsigned char>(text.back()))) text.remove_suffix(1);
+		return text;
+	}
+
+	static std::string ToLower(std::string_view text)
+	{
+		std::string result(text);
+		std::transform(result.begin(), result.end(), result.begin(), [](unsigned char ch) { return static_cast<char>(tolower(ch)); });
+		return result;
+	}
+
+	// 0x10, 10h or 16, optionally negative
+	static bool ParseNumber(std::string_view text, int64_t& value)
+	{
+		text = Trim(text);
+		bool negative = false;
+		if (!text.empty() && (text.front() == '-' || text.front() == '+'))
+		{
+			negative = text.front() == '-';
+			text = Trim(text.substr(1));
+		}
+		if (text.empty())
+		{
+			return false;
+		}
+
+		int base = 10;
+		if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+		{
+			base = 16;
+			text.remove_prefix(2);
+		}
+		else if (text.back() == 'h' || text.back() == 'H')
+		{
+			base = 16;
+			text.remove_suffix(1);
+		}
+
+		const std::string digits(text);
+		char* end;
+		const uint64_t parsed = strtoull(digits.c_str(), &end, base);
+		if (digits.empty() || *end != '\0')
+		{
+			return false;
+		}
+		value = negative ? -static_cast<int64_t>(parsed) : static_cast<int64_t>(parsed);
+		return true;
+	}
+
+	// Register name to number/size, high8 for ah/ch/dh/bh
+	static bool ParseRegister(std::string_view name, uint8_t& reg, uint8_t& size, bool& high8)
+	{
+		static const char* const regs64[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi" };
+		static const char* const regs32[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+		static const char* const regs16[] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" };
+		static const char* const regs8[] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil" };
+		static const char* const regsHigh8[] = { "ah", "ch", "dh", "bh" };
+
+		high8 = false;
+		for (uint8_t i = 0; i < 8; i++)
+		{
+			if (name == regs64[i]) { reg = i; size = 64; return true; }
+			if (name == regs32[i]) { reg = i; size = 32; return true; }
+			if (name == regs16[i]) { reg = i; size = 16; return true; }
+			if (name == regs8[i]) { reg = i; size = 8; return true; }
+			if (i < 4 && name == regsHigh8[i]) { reg = i + 4; size = 8; high8 = true; return true; }
+		}
+
+		// r8-r15 with d/w/b suffixes, xmm0-15
+		const bool xmm = name.substr(0, 3) == "xmm";
+		if (!xmm && (name.size() < 2 || name[0] != 'r'))
+		{
+			return false;
+		}
+		name.remove_prefix(xmm ? 3 : 1);
+
+		size = xmm ? 128 : 64;
+		if (!xmm && !name.empty())
+		{
+			switch (name.back())
+			{
+			case 'd': size = 32; name.remove_suffix(1); break;
+			case 'w': size = 16; name.remove_suffix(1); break;
+			case 'b': size = 8; name.remove_suffix(1); break;
+			}
+		}
+
+		int64_t number;
+		if (name.empty() || !isdigit(static_cast<unsigned char>(name[0])) || !ParseNumber(name, number) || number > 15 || (!xmm && number < 8))
+		{
+			return false;
+		}
+		reg = static_cast<uint8_t>(number);
+		return true;
+	}
+
+	static int8_t ParseCondition(std::string_view name)
+	{
+		static const std::pair<const char*, int8_t> conditions[] = {
+			{ "o", 0 }, { "no", 1 }, { "b", 2 }, { "c", 2 }, { "nae", 2 }, { "ae", 3 }, { "nb", 3 }, { "nc", 3 },
+			{ "e", 4 }, { "z", 4 }, { "ne", 5 }, { "nz", 5 }, { "be", 6 }, { "na", 6 }, { "a", 7 }, { "nbe", 7 },
+			{ "s", 8 }, { "ns", 9 }, { "p", 10 }, { "pe", 10 }, { "np", 11 }, { "po", 11 },
+			{ "l", 12 }, { "nge", 12 }, { "ge", 13 }, { "nl", 13 }, { "le", 14 }, { "ng", 14 }, { "g", 15 }, { "nle", 15 },
+		};
+
+		for (const auto& condition : conditions)
+		{
+			if (name == condition.first)
+			{
+				return condition.second;
+			}
+		}
+		return -1;
+	}
+
+	bool instruction_pattern::ParseOperand(std::string_view text, operand_pattern& operand)
+	{
+		const std::string lower = ToLower(Trim(text));
+		std::string_view op = lower;
+
+		if (op == "*") { operand.type = operand_pattern::kind::any; return true; }
+		if (op == "imm") { operand.type = operand_pattern::kind::imm_any; return true; }
+		if (op == "rel") { operand.type = operand_pattern::kind::rel; return true; }
+
+		static const std::pair<const char*, uint8_t> classes[] = {
+			{ "reg", 0 }, { "r64", 64 }, { "r32", 32 }, { "r16", 16 }, { "reg8", 8 }, { "xmm", 128 },
+		};
+		for (const auto& regClass : classes)
+		{
+			if (op == regClass.first)
+			{
+				operand.type = operand_pattern::kind::reg_class;
+				operand.size = regClass.second;
+				return true;
+			}
+		}
+
+		if (ParseRegister(op, operand.reg, operand.size, operand.high8))
+		{
+			operand.type = operand_pattern::kind::reg;
+			return true;
+		}
+
+		const size_t bracket = op.find('[');
+		if (bracket == std::string_view::npos)
+		{
+			operand.type = operand_pattern::kind::imm;
+			return ParseNumber(op, operand.value);
+		}
+
+		// Optional access size
+		std::string_view prefix = Trim(op.substr(0, bracket));
+		if (prefix.size() >= 3 && prefix.substr(prefix.size() - 3) == "ptr")
+		{
+			prefix = Trim(prefix.substr(0, prefix.size() - 3));
+		}
+		static const std::pair<const char*, uint8_t> sizes[] = {
+			{ "byte", 8 }, { "word", 16 }, { "dword", 32 }, { "qword", 64 }, { "xmmword", 128 },
+		};
+		operand.size = 0;
+		for (const auto& size : sizes)
+		{
+			if (prefix == size.first)
+			{
+				operand.size = size.second;
+			}
+		}
+		if (!prefix.empty() && operand.size == 0)
+		{
+			return false;
+		}
+
+		if (op.back() != ']')
+		{
+			return false;
+		}
+		const std::string_view contents = Trim(op.substr(bracket + 1, op.size() - bracket - 2));
+		if (contents == "*")
+		{
+			operand.type = operand_pattern::kind::mem_any;
+			return true;
+		}
+
+		operand.type = operand_pattern::kind::mem;
+		operand.value = 0;
+		for (size_t pos = 0; pos < contents.size(); )
+		{
+			const bool negative = contents[pos] == '-';
+			if (contents[pos] == '+' || contents[pos] == '-')
+			{
+				pos++;
+			}
+
+			const size_t next = contents.find_first_of("+-", pos);
+			const std::string_view term = Trim(contents.substr(pos, next == std::string_view::npos ? std::string_view::npos : next - pos));
+			pos = next == std::string_view::npos ? contents.size() : next;
+
+			uint8_t reg, size;
+			bool high8;
+			int64_t value;
+			const size_t star = term.find('*');
+			if (term == "*")
+			{
+				operand.anyDisp = true;
+			}
+			else if (term == "rip")
+			{
+				operand.base = x86::RIP_REG;
+			}
+			else if (star != std::string_view::npos && ParseRegister(Trim(term.substr(0, star)), reg, size, high8) && ParseNumber(term.substr(star + 1), value))
+			{
+				operand.index = reg;
+				operand.scale = static_cast<uint8_t>(value);
+			}
+			else if (ParseRegister(term, reg, size, high8))
+			{
+				if (operand.base == x86::NO_REG)
+				{
+					operand.base = reg;
+				}
+				else
+				{
+					operand.index = reg;
+					operand.scale = 1;
+				}
+			}
+			else if (ParseNumber(term, value))
+			{
+				operand.value += negative ? -value : value;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool instruction_pattern::ParseInstruction(std::string_view text, instruction_token& token)
+	{
+		text = Trim(text);
+
+		const size_t space = text.find_first_of(" \t");
+		const std::string name = ToLower(text.substr(0, space));
+		const std::string_view operands = space == std::string_view::npos ? std::string_view() : Trim(text.substr(space));
+
+		if (name == "*")
+		{
+			token.any = true;
+			return operands.empty();
+		}
+
+		static const std::pair<const char*, x86::mnemonic> aliases[] = {
+			{ "sal", x86::mnemonic::shl_ }, { "retn", x86::mnemonic::ret_ }, { "cwd", x86::mnemonic::cdq_ }, { "cqo", x86::mnemonic::cdq_ },
+			{ "cbw", x86::mnemonic::cwde_ }, { "cdqe", x86::mnemonic::cwde_ },
+		};
+
+		bool found = false;
+		for (size_t i = 1; i < size_t(x86::mnemonic::count) && !found; i++)
+		{
+			if (name == x86::mnemonic_name(x86::mnemonic(i)))
+			{
+				token.family = x86::mnemonic(i);
+				found = true;
+			}
+		}
+		for (const auto& alias : aliases)
+		{
+			if (!found && name == alias.first)
+			{
+				token.family = alias.second;
+				found = true;
+			}
+		}
+
+		// Specific conditions
+		static const std::pair<const char*, x86::mnemonic> conditionals[] = {
+			{ "j", x86::mnemonic::jcc_ }, { "cmov", x86::mnemonic::cmovcc_ }, { "set", x86::mnemonic::setcc_ },
+		};
+		for (const auto& conditional : conditionals)
+		{
+			const std::string_view prefix = conditional.first;
+			if (!found && name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0)
+			{
+				token.condition = ParseCondition(std::string_view(name).substr(prefix.size()));
+				if (token.condition >= 0)
+				{
+					token.family = conditional.second;
+					found = true;
+				}
+			}
+		}
+
+		if (!found)
+		{
+			return false;
+		}
+
+		if (operands.empty())
+		{
+			return true;
+		}
+
+		token.anyOperands = false;
+		for (size_t pos = 0; pos <= operands.size(); )
+		{
+			const size_t comma = operands.find(',', pos);
+			const std::string_view operandText = operands.substr(pos, comma == std::string_view::npos ? std::string_view::npos : comma - pos);
+
+			operand_pattern operand;
+			if (!ParseOperand(operandText, operand))
+			{
+				return false;
+			}
+			token.operands.push_back(operand);
+
+			if (comma == std::string_view::npos)
+			{
+				break;
+			}
+			pos = comma + 1;
+		}
+		return token.operands.size() <= 3;
+	}
+
+	instruction_pattern::instruction_pattern(std::string_view signature)
+	{
+		m_valid = true;
+		for (size_t pos = 0; pos < signature.size(); )
+		{
+			const size_t end = signature.find_first_of(";\n", pos);
+			const std::string_view text = Trim(signature.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos));
+			pos = end == std::string_view::npos ? signature.size() : end + 1;
+
+			if (text.empty())
+			{
+				continue;
+			}
+
+			instruction_token token;
+			if (!ParseInstruction(text, token))
+			{
+				m_valid = false;
+				break;
+			}
+			m_instructions.push_back(std::move(token));
+		}
+
+		m_valid = m_valid && !m_instructions.empty();
+		assert(m_valid);
+	}
+
+	bool instruction_pattern::MatchOperand(const operand_pattern& pattern, const x86::operand& operand)
+	{
+		using kind = operand_pattern::kind;
+
+		switch (pattern.type)
+		{
+		case kind::any:
+			return true;
+		case kind::reg_class:
+			return operand.type == x86::operand_type::reg && (pattern.size == 0 ? operand.size <= 64 : operand.size == pattern.size);
+		case kind::reg:
+			return operand.type == x86::operand_type::reg && operand.reg == pattern.reg && operand.size == pattern.size && operand.high8 == pattern.high8;
+		case kind::mem_any:
+			return operand.type == x86::operand_type::mem && (pattern.size == 0 || operand.size == pattern.size);
+		case kind::mem:
+			return operand.type == x86::operand_type::mem && (pattern.size == 0 || operand.size == pattern.size) &&
+				operand.base == pattern.base && operand.index == pattern.index &&
+				(pattern.index == x86::NO_REG || operand.scale == pattern.scale) &&
+				(pattern.anyDisp || operand.value == pattern.value);
+		case kind::imm_any:
+			return operand.type == x86::operand_type::imm;
+		case kind::imm:
+		{
+			if (operand.type != x86::operand_type::imm)
+			{
+				return false;
+			}
+			// Immediates are sign extended, so compare them truncated to their encoded size too (e.g. 0FFh vs -1)
+			const uint64_t mask = operand.size >= 64 ? UINT64_MAX : (uint64_t(1) << operand.size) - 1;
+			return operand.value == pattern.value || (uint64_t(operand.value) & mask) == uint64_t(pattern.value);
+		}
+		case kind::rel:
+			return operand.type == x86::operand_type::rel;
+		}
+		return false;
+	}
+
+	bool instruction_pattern::MatchInstruction(const instruction_token& token, const instruction_stream& stream, size_t index) const
+	{
+		if (token.any)
+		{
+			return true;
+		}
+
+		const instruction_stream::entry& entry = stream[index];
+		if (entry.family != token.family || (token.condition >= 0 && entry.condition != token.condition))
+		{
+			return false;
+		}
+		if (token.anyOperands)
+		{
+			return true;
+		}
+
+		x86::instruction ins;
+		if (!stream.decode(index, ins) || ins.numOperands != token.operands.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < token.operands.size(); i++)
+		{
+			if (!MatchOperand(token.operands[i], ins.operands[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool instruction_pattern::match_at(const instruction_stream& stream, size_t index) const
+	{
+		if (!m_valid || index + m_instructions.size() > stream.size())
+		{
+			return false;
+		}
+
+		for (size_t i = 0; i < m_instructions.size(); i++)
+		{
+			if (i != 0 && !stream.contiguous(index + i - 1))
+			{
+				return false;
+			}
+			if (!MatchInstruction(m_instructions[i], stream, index + i))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::vector<pattern_match> instruction_pattern::find(const instruction_stream& stream) const
+	{
+		std::vector<pattern_match> matches;
+		if (!m_valid)
+		{
+			return matches;
+		}
+
+		// Pick the most selective anchor - a sequence of three known mnemonics, or a single one
+		std::basic_string_view<uint32_t> candidates;
+		size_t anchor = 0;
+		bool anchored = false;
+
+		auto consider = [&](std::basic_string_view<uint32_t> list, size_t position) {
+			if (!anchored || list.size() < candidates.size())
+			{
+				candidates = list;
+				anchor = position;
+				anchored = true;
+			}
+		};
+
+		const size_t length = m_instructions.size();
+		for (size_t i = 0; i + instruction_stream::SEQUENCE_LENGTH <= length; i++)
+		{
+			if (!m_instructions[i].any && !m_instructions[i + 1].any && !m_instructions[i + 2].any)
+			{
+				consider(stream.sequences(instruction_stream::sequence_key(m_instructions[i].family, m_instructions[i + 1].family, m_instructions[i + 2].family)), i);
+			}
+		}
+		if (!anchored)
+		{
+			for (size_t i = 0; i < length; i++)
+			{
+				if (!m_instructions[i].any)
+				{
+					consider(stream.instructions(m_instructions[i].family), i);
+				}
+			}
+		}
+
+		if (!anchored)
+		{
+			// Wildcards only
+			for (size_t i = 0; i + length <= stream.size(); i++)
+			{
+				if (match_at(stream, i))
+				{
+					matches.emplace_back(const_cast<uint8_t*>(stream.base() + stream[i].offset));
+				}
+			}
+			return matches;
+		}
+
+		for (uint32_t candidate : candidates)
+		{
+			if (candidate < anchor)
+			{
+				continue;
+			}
+
+			const size_t start = candidate - anchor;
+			if (match_at(stream, start))
+			{
+				matches.emplace_back(const_cast<uint8_t*>(stream.base() + stream[start].offset));
+			}
+		}
+		return matches;
+	}
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+// Instruction-level signatures
+// Unlike byte patterns, these survive changes in register allocation, displacement sizes and instruction encodings,
+// as long as the instruction sequence itself stays the same. Example:
+//   mov r64, [rip+*]; call *; test eax, eax; jz *
+//
+// Syntax - instructions separated by ';' (or new lines), each being a mnemonic optionally followed by operands:
+//   *                     any instruction
+//   jcc, cmovcc, setcc    any condition, or a specific one (je, jnz, cmovl, setg...)
+//   no operands given     any operands
+// Operands:
+//   *                     anything
+//   rax, ecx, r8, r9d...  a specific register, xmm0-15 for SSE registers
+//   r64, r32, r16, reg8   any general purpose register of the given size, 'reg' for any size, 'xmm' for any SSE register
+//   [*]                   any memory operand
+//   [rip+*], [rsp+20h]    memory with the given base/index and displacement, '*' accepts any displacement
+//   imm, 10h, -1          any or a specific immediate
+//   rel                   a relative branch target
+// Memory operands may be prefixed with byte/word/dword/qword/xmmword (ptr) to also require the access size.
+//
+// Matching is done against instruction_stream, which decodes the code once and indexes every sequence
+// of three consecutive instructions by their mnemonics, so a query only verifies a handful of candidates.
+// Everything but instruction_stream::for_module is portable, so streams can also be built offline over a file.
+
+#include "InstructionDecoder.h"
+#include "Patterns.h"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace hook
+{
+	class instruction_stream
+	{
+	public:
+		struct entry
+		{
+			uint32_t offset;
+			uint8_t length;
+			x86::mnemonic family;
+			uint8_t condition;
+		};
+
+		// Offsets of all instructions are relative to base
+		instruction_stream(const uint8_t* base, bool is64)
+			: m_base(base), m_is64(is64)
+		{
+		}
+
+		// Decodes [begin, end) with a linear sweep, undecodable bytes are skipped
+		// Call build_index after adding all ranges
+		void add_range(const uint8_t* begin, const uint8_t* end);
+		void build_index();
+
+#ifdef _WIN32
+		// Executable sections of a loaded module, decoded and indexed on the first use
+		static const instruction_stream& for_module(void* module);
+#endif
+
+		const uint8_t* base() const { return m_base; }
+		bool is64() const { return m_is64; }
+		size_t size() const { return m_entries.size(); }
+		const entry& operator[](size_t index) const { return m_entries[index]; }
+
+		// Decodes the instruction in full again, for operands
+		bool decode(size_t index, x86::instruction& ins) const
+		{
+			const entry& e = m_entries[index];
+			return x86::decode(m_base + e.offset, e.length, m_is64, ins);
+		}
+
+		// Is instruction 'index' directly followed by 'index + 1'
+		bool contiguous(size_t index) const
+		{
+			return index + 1 < m_entries.size() && m_entries[index].offset + m_entries[index].length == m_entries[index + 1].offset;
+		}
+
+		static constexpr size_t SEQUENCE_LENGTH = 3;
+		static constexpr uint32_t sequence_key(x86::mnemonic a, x86::mnemonic b, x86::mnemonic c)
+		{
+			return (uint32_t(a) << 12) | (uint32_t(b) << 6) | uint32_t(c);
+		}
+
+		// Indices of instructions starting a contiguous sequence with this key
+		std::basic_string_view<uint32_t> sequences(uint32_t key) const;
+		// Indices of instructions of this family
+		std::basic_string_view<uint32_t> instructions(x86::mnemonic family) const;
+
+	private:
+		const uint8_t* m_base;
+		bool m_is64;
+
+		std::vector<entry> m_entries;
+
+		// Buckets for key k are [start[k], start[k + 1])
+		std::vector<uint32_t> m_sequenceStart, m_sequenceIndex;
+		std::vector<uint32_t> m_familyStart, m_familyIndex;
+	};
+
+	class instruction_pattern
+	{
+	public:
+		explicit instruction_pattern(std::string_view signature);
+
+		bool valid() const { return m_valid; }
+		size_t size() const { return m_instructions.size(); }
+
+		// Matches point to the first instruction of the sequence
+		std::vector<pattern_match> find(const instruction_stream& stream) const;
+
+		// Does the sequence match starting at instruction 'index'
+		bool match_at(const instruction_stream& stream, size_t index) const;
+
+	private:
+		struct operand_pattern
+		{
+			enum class kind : uint8_t
+			{
+				any,
+				reg_class,
+				reg,
+				mem_any,
+				mem,
+				imm_any,
+				imm,
+				rel,
+			};
+
+			kind type = kind::any;
+			// Size in bits, 0 for any
+			uint8_t size = 0;
+			uint8_t reg = x86::NO_REG;
+			bool high8 = false;
+			uint8_t base = x86::NO_REG;
+			uint8_t index = x86::NO_REG;
+			uint8_t scale = 0;
+			bool anyDisp = false;
+			int64_t value = 0;
+		};
+
+		struct instruction_token
+		{
+			bool any = false;
+			x86::mnemonic family = x86::mnemonic::unknown_;
+			// -1 for any
+			int8_t condition = -1;
+			bool anyOperands = true;
+			std::vector<operand_pattern> operands;
+		};
+
+		bool ParseInstruction(std::string_view text, instruction_token& token);
+		static bool ParseOperand(std::string_view text, operand_pattern& operand);
+		static bool MatchOperand(const operand_pattern& pattern, const x86::operand& operand);
+		bool MatchInstruction(const instruction_token& token, const instruction_stream& stream, size_t index) const;
+
+		std::vector<instruction_token> m_instructions;
+		bool m_valid = false;
+	};
+
+#ifdef _WIN32
+	inline std::vector<pattern_match> find_instructions(void* module, std::string_view signature)
+	{
+		return instruction_pattern(signature).find(instruction_stream::for_module(module));
+	}
+
+	inline std::vector<pattern_match> find_instructions(std::string_view signature)
+	{
+		return find_instructions(reinterpret_cast<void*>(details::get_process_base()), signature);
+	}
+#endif
+}
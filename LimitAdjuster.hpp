@@ -0,0 +1,396 @@
+#pragma once
+
+// Moves a static array to a bigger allocation and rewrites everything referencing it
+// References anywhere from the start to the end of the array are found by decoding the module's code
+// (RIP-relative and absolute displacements, and absolute immediates) and/or from the module's base relocations,
+// which also catch pointers stored in data. Old executables often have their relocations stripped, so use both if unsure.
+// All references are then rewritten in one go - if any of them can't be encoded against the new array, nothing is touched.
+//
+// Rewriting is stride-aware: a reference to base+offset keeps its offset, so accesses to element fields keep working,
+// while references to the end of the array (and past it) follow the new end.
+// Immediates holding the element count (or count - 1, or the size in bytes) can be found too, but as there's no telling
+// them apart from unrelated constants, only instructions close to array references are considered. Review them!
+//
+// NOTE: RIP-relative references only reach +-2GB, so on x64 allocate the new array with LimitAdjuster::AllocateNear.
+//
+// Example:
+//   LimitAdjuster::StaticArray peds( module, pedPool, sizeof(CPed), 140 );
+//   peds.FindReferences();
+//   peds.FindCountReferences();
+//   peds.Relocate( LimitAdjuster::AllocateNear( module, 1000 * sizeof(CPed), alignof(CPed) ), 1000 );
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "InstructionPatterns.h"
+#include "ScopedUnprotect.hpp"
+#include "Trampoline.h"
+
+namespace LimitAdjuster
+{
+	enum Source : uint32_t
+	{
+		DecodeCode = 1,
+		BaseRelocations = 2,
+	};
+
+	enum class ReferenceType : uint8_t
+	{
+		// Address stored as is - a displacement, an immediate or a pointer in data
+		Absolute,
+		// rel32 relative to the next instruction
+		RipRelative,
+		// Element count
+		Count,
+		// Element count - 1
+		LastIndex,
+		// Element count * stride
+		ByteSize,
+	};
+
+	struct Reference
+	{
+		// Field holding the reference
+		uintptr_t site;
+		// Instruction holding the field, 0 if it was found through relocations only
+		uintptr_t instruction;
+		// Address of the next instruction, for RIP-relative references
+		uintptr_t next;
+		// Referenced address, or the immediate for count references
+		int64_t value;
+		uint8_t size;
+		ReferenceType type;
+	};
+
+	// Allocates memory in reach of RIP-relative references from the module
+	inline void* AllocateNear( HMODULE module, size_t size, size_t align = 16 )
+	{
+#ifdef _WIN64
+		return Trampoline::MakeTrampoline( module, size, align )->RawSpace( size, align );
+#else
+		// Everything is in reach on x86, and VirtualAlloc's alignment is plenty
+		(void)module; (void)align;
+		return VirtualAlloc( nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+#endif
+	}
+
+	class StaticArray
+	{
+	public:
+		StaticArray( HMODULE module, void* base, size_t stride, size_t count )
+			: m_module( module ), m_base( reinterpret_cast<uintptr_t>(base) ), m_stride( stride ), m_count( count )
+		{
+			const PIMAGE_DOS_HEADER dosHeader = reinterpret_cast<PIMAGE_DOS_HEADER>(module);
+			const PIMAGE_NT_HEADERS ntHeader = reinterpret_cast<PIMAGE_NT_HEADERS>(reinterpret_cast<uintptr_t>(module) + dosHeader->e_lfanew);
+			m_is64 = ntHeader->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+		}
+
+		// Finds references to [base - slack, end + slack], returns the total number of references found so far
+		size_t FindReferences( uint32_t sources = DecodeCode | BaseRelocations, size_t slack = 0 )
+		{
+			m_slack = slack;
+			if ( (sources & DecodeCode) != 0 )
+			{
+				FindInCode();
+			}
+			if ( (sources & BaseRelocations) != 0 )
+			{
+				FindInRelocations();
+			}
+			Deduplicate();
+			return m_references.size();
+		}
+
+		// Finds count immediates in instructions up to 'window' bytes away from an array reference found before
+		size_t FindCountReferences( size_t window = 64 )
+		{
+			const hook::instruction_stream& stream = hook::instruction_stream::for_module( m_module );
+			const uintptr_t streamBase = reinterpret_cast<uintptr_t>(stream.base());
+
+			const int64_t count = static_cast<int64_t>(m_count);
+			const int64_t byteSize = static_cast<int64_t>(m_count * m_stride);
+
+			std::vector<uintptr_t> anchors;
+			for ( const Reference& reference : m_references )
+			{
+				if ( reference.instruction != 0 && (reference.type == ReferenceType::Absolute || reference.type == ReferenceType::RipRelative) )
+				{
+					anchors.push_back( reference.instruction );
+				}
+			}
+
+			for ( uintptr_t anchor : anchors )
+			{
+				const uintptr_t first = anchor > streamBase + window ? anchor - window - streamBase : 0;
+				for ( size_t i = LowerBound( stream, first ); i < stream.size(); i++ )
+				{
+					const uintptr_t address = streamBase + stream[i].offset;
+					if ( address > anchor + window ) break;
+
+					hook::x86::instruction ins;
+					if ( !stream.decode( i, ins ) || ins.relative || ins.immSize == 0 || ins.immSize > 4 ) continue;
+
+					ReferenceType type;
+					if ( ins.imm == count ) type = ReferenceType::Count;
+					else if ( ins.imm == count - 1 ) type = ReferenceType::LastIndex;
+					else if ( ins.imm == byteSize ) type = ReferenceType::ByteSize;
+					else continue;
+
+					m_references.push_back( { address + ins.immOffset, address, address + ins.length, ins.imm, ins.immSize, type } );
+				}
+			}
+			Deduplicate();
+			return m_references.size();
+		}
+
+		// For references the scans can't see
+		void AddReference( const Reference& reference )
+		{
+			m_references.push_back( reference );
+			Deduplicate();
+		}
+
+		const std::vector<Reference>& References() const { return m_references; }
+
+		// Rewrites all references against the new array, optionally copying the old contents over
+		// Either all references are rewritten, or none if any of them can't be encoded
+		bool Relocate( void* newBase, size_t newCount, bool copyContents = true )
+		{
+			const uintptr_t newAddress = reinterpret_cast<uintptr_t>(newBase);
+
+			std::vector<int64_t> values;
+			values.reserve( m_references.size() );
+			for ( const Reference& reference : m_references )
+			{
+				int64_t value;
+				switch ( reference.type )
+				{
+				case ReferenceType::Absolute:
+					value = static_cast<int64_t>(Translate( static_cast<uintptr_t>(reference.value), newAddress, newCount ));
+					break;
+				case ReferenceType::RipRelative:
+					value = static_cast<int64_t>(Translate( static_cast<uintptr_t>(reference.value), newAddress, newCount ) - reference.next);
+					break;
+				case ReferenceType::Count:
+					value = static_cast<int64_t>(newCount);
+					break;
+				case ReferenceType::LastIndex:
+					value = static_cast<int64_t>(newCount) - 1;
+					break;
+				case ReferenceType::ByteSize:
+					value = static_cast<int64_t>(newCount * m_stride);
+					break;
+				default:
+					return false;
+				}
+
+				if ( !Fits( reference, value ) )
+				{
+					return false;
+				}
+				values.push_back( value );
+			}
+
+			{
+				ScopedUnprotect::FullModule unprotect( m_module );
+
+				if ( copyContents )
+				{
+					memcpy( newBase, reinterpret_cast<void*>(m_base), std::min( m_count, newCount ) * m_stride );
+				}
+
+				for ( size_t i = 0; i < m_references.size(); i++ )
+				{
+					// Little endian - the low bytes are the field
+					memcpy( reinterpret_cast<void*>(m_references[i].site), &values[i], m_references[i].size );
+				}
+			}
+
+			// Keep the references valid for the new array, so it can be relocated again
+			for ( size_t i = 0; i < m_references.size(); i++ )
+			{
+				Reference& reference = m_references[i];
+				reference.value = reference.type == ReferenceType::RipRelative ? static_cast<int64_t>(reference.next + values[i]) : values[i];
+			}
+			m_base = newAddress;
+			m_count = newCount;
+			return true;
+		}
+
+	private:
+		bool InRange( uintptr_t address ) const
+		{
+			return address >= m_base - m_slack && address <= m_base + m_count * m_stride + m_slack;
+		}
+
+		uintptr_t Translate( uintptr_t address, uintptr_t newBase, size_t newCount ) const
+		{
+			const ptrdiff_t offset = static_cast<ptrdiff_t>(address - m_base);
+			const ptrdiff_t oldSize = static_cast<ptrdiff_t>(m_count * m_stride);
+			if ( offset >= oldSize )
+			{
+				// End of the array and past it
+				return newBase + newCount * m_stride + (offset - oldSize);
+			}
+			return newBase + offset;
+		}
+
+		bool Fits( const Reference& reference, int64_t value ) const
+		{
+			switch ( reference.size )
+			{
+			case 1:
+				return value >= INT8_MIN && value <= INT8_MAX;
+			case 2:
+				return value >= INT16_MIN && value <= INT16_MAX;
+			case 4:
+				// 32-bit absolute addresses are zero extended on x86, anything else is sign extended
+				if ( reference.type == ReferenceType::Absolute && !m_is64 )
+				{
+					return value >= 0 && value <= UINT32_MAX;
+				}
+				return value >= INT32_MIN && value <= INT32_MAX;
+			case 8:
+				return true;
+			}
+			return false;
+		}
+
+		void FindInCode()
+		{
+			const hook::instruction_stream& stream = hook::instruction_stream::for_module( m_module );
+			const uintptr_t streamBase = reinterpret_cast<uintptr_t>(stream.base());
+
+			for ( size_t i = 0; i < stream.size(); i++ )
+			{
+				hook::x86::instruction ins;
+				if ( !stream.decode( i, ins ) || ins.relative ) continue;
+
+				const uintptr_t address = streamBase + stream[i].offset;
+				if ( ins.dispSize == 4 )
+				{
+					if ( ins.ripRelative )
+					{
+						const uintptr_t target = ins.rip_target( address );
+						if ( InRange( target ) )
+						{
+							m_references.push_back( { address + ins.dispOffset, address, address + ins.length, static_cast<int64_t>(target), 4, ReferenceType::RipRelative } );
+						}
+					}
+					else
+					{
+						const uintptr_t target = m_is64 ? static_cast<uintptr_t>(static_cast<intptr_t>(ins.disp)) : static_cast<uint32_t>(ins.disp);
+						if ( InRange( target ) )
+						{
+							m_references.push_back( { address + ins.dispOffset, address, 0, static_cast<int64_t>(target), 4, ReferenceType::Absolute } );
+						}
+					}
+				}
+
+				// Pointer sized immediates (mov r64, imm64 and moffs on x64)
+				if ( ins.immSize == (m_is64 ? 8 : 4) )
+				{
+					const uintptr_t target = m_is64 ? static_cast<uintptr_t>(ins.imm) : static_cast<uint32_t>(ins.imm);
+					if ( InRange( target ) )
+					{
+						m_references.push_back( { address + ins.immOffset, address, 0, static_cast<int64_t>(target), ins.immSize, ReferenceType::Absolute } );
+					}
+				}
+			}
+		}
+
+		void FindInRelocations()
+		{
+			const uintptr_t module = reinterpret_cast<uintptr_t>(m_module);
+			const PIMAGE_DOS_HEADER dosHeader = reinterpret_cast<PIMAGE_DOS_HEADER>(module);
+			const PIMAGE_NT_HEADERS ntHeader = reinterpret_cast<PIMAGE_NT_HEADERS>(module + dosHeader->e_lfanew);
+
+			// Loaded modules always match the bitness of the process
+			const IMAGE_DATA_DIRECTORY& directory = ntHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+			const DWORD relocRVA = directory.VirtualAddress;
+			const DWORD relocSize = directory.Size;
+
+			for ( DWORD offset = 0; relocRVA != 0 && offset + sizeof(IMAGE_BASE_RELOCATION) <= relocSize; )
+			{
+				const auto* block = reinterpret_cast<const IMAGE_BASE_RELOCATION*>(module + relocRVA + offset);
+				if ( block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION) ) break;
+
+				const WORD* entries = reinterpret_cast<const WORD*>(block + 1);
+				const size_t numEntries = (block->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(WORD);
+				for ( size_t i = 0; i < numEntries; i++ )
+				{
+					const int type = entries[i] >> 12;
+					const uintptr_t site = module + block->VirtualAddress + (entries[i] & 0xFFF);
+
+					uintptr_t target;
+					uint8_t size;
+					if ( type == IMAGE_REL_BASED_HIGHLOW )
+					{
+						uint32_t value;
+						memcpy( &value, reinterpret_cast<const void*>(site), sizeof(value) );
+						target = value;
+						size = 4;
+					}
+					else if ( type == IMAGE_REL_BASED_DIR64 )
+					{
+						uint64_t value;
+						memcpy( &value, reinterpret_cast<const void*>(site), sizeof(value) );
+						target = static_cast<uintptr_t>(value);
+						size = 8;
+					}
+					else continue;
+
+					if ( InRange( target ) )
+					{
+						m_references.push_back( { site, 0, 0, static_cast<int64_t>(target), size, ReferenceType::Absolute } );
+					}
+				}
+				offset += block->SizeOfBlock;
+			}
+		}
+
+		// One reference per site, preferring the ones found by decoding (they know their instruction)
+		void Deduplicate()
+		{
+			std::stable_sort( m_references.begin(), m_references.end(), []( const Reference& a, const Reference& b ) {
+				return a.site < b.site || (a.site == b.site && a.instruction > b.instruction);
+			} );
+			m_references.erase( std::unique( m_references.begin(), m_references.end(), []( const Reference& a, const Reference& b ) {
+				return a.site == b.site;
+			} ), m_references.end() );
+		}
+
+		static size_t LowerBound( const hook::instruction_stream& stream, uintptr_t offset )
+		{
+			size_t first = 0, count = stream.size();
+			while ( count > 0 )
+			{
+				const size_t step = count / 2;
+				if ( stream[first + step].offset < offset )
+				{
+					first += step + 1;
+					count -= step + 1;
+				}
+				else
+				{
+					count = step;
+				}
+			}
+			return first;
+		}
+
+		HMODULE m_module;
+		uintptr_t m_base;
+		size_t m_stride;
+		size_t m_count;
+		size_t m_slack = 0;
+		bool m_is64;
+
+		std::vector<Reference> m_references;
+	};
+};
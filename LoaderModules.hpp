@@ -0,0 +1,229 @@
+#pragma once
+
+// Enumerates loaded modules by walking the loader's own data structures
+// - the PEB's InLoadOrderModuleList on Windows, and the program headers from dl_iterate_phdr on Linux.
+// No system calls and no copies - names are views of the strings owned by the loader,
+// so they are only valid for as long as the module stays loaded.
+//
+// NOTE: ForEach holds the loader lock for the duration of the walk. On Windows it's recursive, so it's fine to call
+// from DllMain. On Linux, func must not dlopen or dlclose.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <link.h>
+#endif
+
+namespace LoaderModules
+{
+#ifdef _WIN32
+	using char_type = wchar_t;
+	constexpr char_type PATH_SEPARATOR = L'\\';
+#else
+	using char_type = char;
+	constexpr char_type PATH_SEPARATOR = '/';
+#endif
+	using string_view = std::basic_string_view<char_type>;
+
+	struct Module
+	{
+		void* base;
+		// Span of the mapped image
+		size_t size;
+		// Full path, empty for the main executable on Linux
+		string_view path;
+		// File name with extension
+		string_view name;
+	};
+
+	namespace details
+	{
+#ifdef _WIN32
+		// Stable, documented parts of the loader structures
+		struct UNICODE_STRING_T
+		{
+			USHORT Length;
+			USHORT MaximumLength;
+			PWSTR Buffer;
+		};
+
+		struct LDR_DATA_TABLE_ENTRY_T
+		{
+			LIST_ENTRY InLoadOrderLinks;
+			LIST_ENTRY InMemoryOrderLinks;
+			LIST_ENTRY InInitializationOrderLinks;
+			PVOID DllBase;
+			PVOID EntryPoint;
+			ULONG SizeOfImage;
+			UNICODE_STRING_T FullDllName;
+			UNICODE_STRING_T BaseDllName;
+		};
+
+		struct PEB_LDR_DATA_T
+		{
+			ULONG Length;
+			BOOLEAN Initialized;
+			PVOID SsHandle;
+			LIST_ENTRY InLoadOrderModuleList;
+		};
+
+		struct PEB_T
+		{
+			BOOLEAN InheritedAddressSpace;
+			BOOLEAN ReadImageFileExecOptions;
+			BOOLEAN BeingDebugged;
+			BOOLEAN BitField;
+			PVOID Mutant;
+			PVOID ImageBaseAddress;
+			PEB_LDR_DATA_T* Ldr;
+		};
+
+		inline PEB_T* GetPEB()
+		{
+#ifdef _WIN64
+			return reinterpret_cast<PEB_T*>(__readgsqword( 0x60 ));
+#else
+			return reinterpret_cast<PEB_T*>(__readfsdword( 0x30 ));
+#endif
+		}
+
+		inline string_view ToStringView( const UNICODE_STRING_T& str )
+		{
+			return str.Buffer != nullptr ? string_view( str.Buffer, str.Length / sizeof(wchar_t) ) : string_view();
+		}
+
+		class LoaderLock
+		{
+		public:
+			LoaderLock()
+			{
+				const auto& functions = GetFunctions();
+				if ( functions.lock == nullptr || functions.lock( 0, nullptr, &m_cookie ) < 0 )
+				{
+					m_cookie = 0;
+				}
+			}
+
+			~LoaderLock()
+			{
+				if ( m_cookie != 0 )
+				{
+					GetFunctions().unlock( 0, m_cookie );
+				}
+			}
+
+			LoaderLock( const LoaderLock& ) = delete;
+			LoaderLock& operator=( const LoaderLock& ) = delete;
+
+		private:
+			struct Functions
+			{
+				LONG (NTAPI* lock)( ULONG flags, ULONG* disposition, ULONG_PTR* cookie );
+				LONG (NTAPI* unlock)( ULONG flags, ULONG_PTR cookie );
+			};
+
+			static const Functions& GetFunctions()
+			{
+				static const Functions functions = [] {
+					Functions result {};
+					const HMODULE ntdll = GetModuleHandleW( L"ntdll" );
+					if ( ntdll != nullptr )
+					{
+						result.lock = reinterpret_cast<decltype(result.lock)>(GetProcAddress( ntdll, "LdrLockLoaderLock" ));
+						result.unlock = reinterpret_cast<decltype(result.unlock)>(GetProcAddress( ntdll, "LdrUnlockLoaderLock" ));
+						if ( result.unlock == nullptr ) result.lock = nullptr;
+					}
+					return result;
+				}();
+				return functions;
+			}
+
+			ULONG_PTR m_cookie = 0;
+		};
+#endif
+
+#ifndef _WIN32
+		// l_addr/dlpi_addr is only the load bias, which is 0 for non-PIE executables - the image starts at the lowest segment
+		inline Module ToModule( const dl_phdr_info& info )
+		{
+			uintptr_t begin = UINTPTR_MAX, end = 0;
+			for ( ElfW(Half) i = 0; i < info.dlpi_phnum; i++ )
+			{
+				const ElfW(Phdr)& phdr = info.dlpi_phdr[i];
+				if ( phdr.p_type == PT_LOAD )
+				{
+					begin = std::min<uintptr_t>( begin, info.dlpi_addr + phdr.p_vaddr );
+					end = std::max<uintptr_t>( end, info.dlpi_addr + phdr.p_vaddr + phdr.p_memsz );
+				}
+			}
+			if ( begin > end )
+			{
+				begin = end = info.dlpi_addr;
+			}
+
+			const string_view path = info.dlpi_name != nullptr ? string_view( info.dlpi_name ) : string_view();
+			const size_t separator = path.rfind( PATH_SEPARATOR );
+			const string_view name = separator != string_view::npos ? path.substr( separator + 1 ) : path;
+			return { reinterpret_cast<void*>(begin), end - begin, path, name };
+		}
+#endif
+
+		template<typename Func>
+		inline bool Invoke( Func& func, const Module& module )
+		{
+			if constexpr ( std::is_same_v<std::invoke_result_t<Func&, const Module&>, bool> )
+			{
+				return func( module );
+			}
+			else
+			{
+				func( module );
+				return true;
+			}
+		}
+	}
+
+	// Calls func( const Module& ) for every loaded module in load order, the main executable first
+	// If func returns bool, returning false stops the enumeration
+	template<typename Func>
+	inline void ForEach( Func&& func )
+	{
+#ifdef _WIN32
+		details::LoaderLock lock;
+
+		const details::PEB_LDR_DATA_T* ldr = details::GetPEB()->Ldr;
+		const LIST_ENTRY* head = &ldr->InLoadOrderModuleList;
+		for ( const LIST_ENTRY* entry = head->Flink; entry != head; entry = entry->Flink )
+		{
+			// InLoadOrderLinks is the first member
+			const auto* ldrEntry = reinterpret_cast<const details::LDR_DATA_TABLE_ENTRY_T*>(entry);
+			if ( ldrEntry->DllBase == nullptr ) continue;
+
+			const Module module { ldrEntry->DllBase, ldrEntry->SizeOfImage, details::ToStringView( ldrEntry->FullDllName ), details::ToStringView( ldrEntry->BaseDllName ) };
+			if ( !details::Invoke( func, module ) ) break;
+		}
+#else
+		dl_iterate_phdr( []( dl_phdr_info* info, size_t, void* data ) {
+			return details::Invoke( *static_cast<std::remove_reference_t<Func>*>(data), details::ToModule( *info ) ) ? 0 : 1;
+		}, const_cast<void*>(static_cast<const void*>(std::addressof(func))) );
+#endif
+	}
+
+	// Strips the extension from a module name
+	inline string_view StemOf( string_view name )
+	{
+		const size_t dot = name.rfind( char_type('.') );
+		return dot != string_view::npos ? name.substr( 0, dot ) : name;
+	}
+}
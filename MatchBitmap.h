@@ -0,0 +1,625 @@
+#pragma once
+
+// Compressed set of match offsets, for patterns with huge numbers of matches (every call, every padding byte...)
+// Roaring-style: offsets are split by their upper 16 bits into containers, each stored either as a sorted array
+// of the lower 16 bits (sparse, up to 4096 entries) or as a 65536 bit bitmap (dense, always 8KB).
+// A million matches take 2-8 bytes each instead of 8 for a pattern_match, in a handful of allocations.
+//
+// hook::match_bitmap calls = hook::pattern("E8 ? ? ? ?").to_bitmap();
+// hook::match_bitmap jumps = hook::pattern("E9 ? ? ? ?").to_bitmap();
+// hook::match_bitmap both = calls & jumps.shifted(-0x10); // Calls followed by a jump 16 bytes later
+//
+// Offsets are relative to base() - the module base for module patterns, so they are RVAs, and the start of the range for range patterns.
+// NOTE: Like the rest of the pattern code, not safe to modify while other threads read it.
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "Patterns.h"
+
+namespace hook
+{
+	class match_bitmap
+	{
+	private:
+		static constexpr uint32_t ARRAY_MAX = 4096;
+		static constexpr uint32_t BITMAP_WORDS = 65536 / 64;
+
+		static uint32_t popcount(uint64_t value)
+		{
+			value = value - ((value >> 1) & 0x5555555555555555ull);
+			value = (value & 0x3333333333333333ull) + ((value >> 2) & 0x3333333333333333ull);
+			value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+			return static_cast<uint32_t>((value * 0x0101010101010101ull) >> 56);
+		}
+
+		static uint32_t lowest_bit(uint64_t value)
+		{
+			return popcount((value & (0 - value)) - 1);
+		}
+
+		struct container
+		{
+			uint16_t key = 0;
+			uint32_t cardinality = 0;
+			// Elements in all the containers before this one, for rank/select
+			size_t start = 0;
+
+			// Exactly one of these is in use
+			std::vector<uint16_t> array;
+			std::vector<uint64_t> bits;
+
+			bool is_bitmap() const
+			{
+				return !bits.empty();
+			}
+
+			bool contains(uint16_t low) const
+			{
+				if (is_bitmap())
+				{
+					return (bits[low >> 6] >> (low & 63)) & 1;
+				}
+				return std::binary_search(array.begin(), array.end(), low);
+			}
+
+			bool insert(uint16_t low)
+			{
+				if (is_bitmap())
+				{
+					uint64_t& word = bits[low >> 6];
+					const uint64_t bit = uint64_t(1) << (low & 63);
+					if ((word & bit) != 0)
+					{
+						return false;
+					}
+					word |= bit;
+				}
+				else if (array.empty() || array.back() < low)
+				{
+					// Scans produce ascending offsets, so this is the common case
+					array.push_back(low);
+				}
+				else
+				{
+					auto it = std::lower_bound(array.begin(), array.end(), low);
+					if (*it == low)
+					{
+						return false;
+					}
+					array.insert(it, low);
+				}
+
+				cardinality++;
+				normalize();
+				return true;
+			}
+
+			// Elements lower than low
+			uint32_t rank(uint16_t low) const
+			{
+				if (!is_bitmap())
+				{
+					return static_cast<uint32_t>(std::lower_bound(array.begin(), array.end(), low) - array.begin());
+				}
+
+				uint32_t result = 0;
+				for (uint32_t i = 0; i < (low >> 6u); i++)
+				{
+					result += popcount(bits[i]);
+				}
+				return result + popcount(bits[low >> 6] & ((uint64_t(1) << (low & 63)) - 1));
+			}
+
+			uint16_t select(uint32_t index) const
+			{
+				assert(index < cardinality);
+				if (!is_bitmap())
+				{
+					return array[index];
+				}
+
+				for (uint32_t i = 0; ; i++)
+				{
+					const uint32_t count = popcount(bits[i]);
+					if (index < count)
+					{
+						uint64_t word = bits[i];
+						for (; index != 0; index--)
+						{
+							word &= word - 1;
+						}
+						return static_cast<uint16_t>(i * 64 + lowest_bit(word));
+					}
+					index -= count;
+				}
+			}
+
+			// Picks the cheaper representation for the current cardinality
+			void normalize()
+			{
+				if (is_bitmap() && cardinality <= ARRAY_MAX)
+				{
+					std::vector<uint16_t> newArray;
+					newArray.reserve(cardinality);
+					for (uint32_t i = 0; i < BITMAP_WORDS; i++)
+					{
+						for (uint64_t word = bits[i]; word != 0; word &= word - 1)
+						{
+							newArray.push_back(static_cast<uint16_t>(i * 64 + lowest_bit(word)));
+						}
+					}
+					array.swap(newArray);
+					bits.clear();
+					bits.shrink_to_fit();
+				}
+				else if (!is_bitmap() && cardinality > ARRAY_MAX)
+				{
+					bits.assign(BITMAP_WORDS, 0);
+					for (uint16_t low : array)
+					{
+						bits[low >> 6] |= uint64_t(1) << (low & 63);
+					}
+					array.clear();
+					array.shrink_to_fit();
+				}
+			}
+
+			void recount()
+			{
+				cardinality = 0;
+				for (uint64_t word : bits)
+				{
+					cardinality += popcount(word);
+				}
+			}
+
+			std::vector<uint64_t> to_bits() const
+			{
+				if (is_bitmap())
+				{
+					return bits;
+				}
+
+				std::vector<uint64_t> result(BITMAP_WORDS, 0);
+				for (uint16_t low : array)
+				{
+					result[low >> 6] |= uint64_t(1) << (low & 63);
+				}
+				return result;
+			}
+		};
+
+	public:
+		class const_iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = uint32_t;
+			using difference_type = ptrdiff_t;
+			using pointer = const uint32_t*;
+			using reference = uint32_t;
+
+			const_iterator() = default;
+
+			uint32_t operator*() const
+			{
+				const container& c = m_bitmap->m_containers[m_container];
+				const uint32_t low = c.is_bitmap() ? m_pos * 64 + lowest_bit(m_word) : c.array[m_pos];
+				return (uint32_t(c.key) << 16) | low;
+			}
+
+			const_iterator& operator++()
+			{
+				if (m_bitmap->m_containers[m_container].is_bitmap())
+				{
+					m_word &= m_word - 1;
+				}
+				else
+				{
+					m_pos++;
+				}
+				settle();
+				return *this;
+			}
+
+			const_iterator operator++(int)
+			{
+				const_iterator result = *this;
+				++*this;
+				return result;
+			}
+
+			bool operator==(const const_iterator& other) const
+			{
+				return m_container == other.m_container && m_pos == other.m_pos && m_word == other.m_word;
+			}
+
+			bool operator!=(const const_iterator& other) const
+			{
+				return !(*this == other);
+			}
+
+		private:
+			friend class match_bitmap;
+
+			const_iterator(const match_bitmap* bitmap, size_t containerIndex)
+				: m_bitmap(bitmap), m_container(containerIndex)
+			{
+				enter();
+				settle();
+			}
+
+			void enter()
+			{
+				m_pos = 0;
+				m_word = 0;
+				if (m_container < m_bitmap->m_containers.size() && m_bitmap->m_containers[m_container].is_bitmap())
+				{
+					m_word = m_bitmap->m_containers[m_container].bits[0];
+				}
+			}
+
+			// Moves on to the next element if the current position holds none
+			void settle()
+			{
+				while (m_container < m_bitmap->m_containers.size())
+				{
+					const container& c = m_bitmap->m_containers[m_container];
+					if (c.is_bitmap())
+					{
+						while (m_word == 0 && ++m_pos < BITMAP_WORDS)
+						{
+							m_word = c.bits[m_pos];
+						}
+						if (m_word != 0)
+						{
+							return;
+						}
+					}
+					else if (m_pos < c.array.size())
+					{
+						return;
+					}
+
+					m_container++;
+					enter();
+				}
+				m_pos = 0;
+				m_word = 0;
+			}
+
+			const match_bitmap* m_bitmap = nullptr;
+			size_t m_container = 0;
+			// Array index, or bitmap word index
+			uint32_t m_pos = 0;
+			// Bits of the current bitmap word not visited yet
+			uint64_t m_word = 0;
+		};
+
+		match_bitmap() = default;
+
+		explicit match_bitmap(uintptr_t base)
+			: m_base(base)
+		{
+		}
+
+		inline uintptr_t base() const
+		{
+			return m_base;
+		}
+
+		inline size_t size() const
+		{
+			return m_size;
+		}
+
+		inline bool empty() const
+		{
+			return m_size == 0;
+		}
+
+		void clear()
+		{
+			m_containers.clear();
+			m_size = 0;
+		}
+
+		// Fastest when offsets come in ascending order
+		bool add(uint32_t offset)
+		{
+			const uint16_t key = static_cast<uint16_t>(offset >> 16);
+			const uint16_t low = static_cast<uint16_t>(offset);
+
+			size_t index;
+			if (!m_containers.empty() && m_containers.back().key == key)
+			{
+				index = m_containers.size() - 1;
+			}
+			else if (m_containers.empty() || m_containers.back().key < key)
+			{
+				index = m_containers.size();
+				m_containers.emplace_back();
+				m_containers.back().key = key;
+				m_containers.back().start = m_size;
+			}
+			else
+			{
+				index = find_container(key);
+				if (index == m_containers.size() || m_containers[index].key != key)
+				{
+					container c;
+					c.key = key;
+					c.start = m_containers[index].start;
+					m_containers.insert(m_containers.begin() + index, std::move(c));
+				}
+			}
+
+			if (!m_containers[index].insert(low))
+			{
+				return false;
+			}
+
+			m_size++;
+			for (size_t i = index + 1; i < m_containers.size(); i++)
+			{
+				m_containers[i].start++;
+			}
+			return true;
+		}
+
+		inline bool add_address(uintptr_t address)
+		{
+			assert(address >= m_base && address - m_base <= UINT32_MAX);
+			return add(static_cast<uint32_t>(address - m_base));
+		}
+
+		bool contains(uint32_t offset) const
+		{
+			const size_t index = find_container(static_cast<uint16_t>(offset >> 16));
+			return index < m_containers.size() && m_containers[index].key == (offset >> 16) && m_containers[index].contains(static_cast<uint16_t>(offset));
+		}
+
+		// Number of offsets lower than offset
+		size_t rank(uint32_t offset) const
+		{
+			const uint16_t key = static_cast<uint16_t>(offset >> 16);
+			const size_t index = find_container(key);
+			if (index == m_containers.size())
+			{
+				return m_size;
+			}
+
+			const container& c = m_containers[index];
+			return c.key == key ? c.start + c.rank(static_cast<uint16_t>(offset)) : c.start;
+		}
+
+		// The index-th lowest offset
+		uint32_t select(size_t index) const
+		{
+			assert(index < m_size);
+			auto it = std::upper_bound(m_containers.begin(), m_containers.end(), index, [](size_t i, const container& c) {
+				return i < c.start;
+			}) - 1;
+			return (uint32_t(it->key) << 16) | it->select(static_cast<uint32_t>(index - it->start));
+		}
+
+		inline uintptr_t address(size_t index) const
+		{
+			return m_base + select(index);
+		}
+
+		inline pattern_match get(size_t index) const
+		{
+			return pattern_match(reinterpret_cast<void*>(address(index)));
+		}
+
+		const_iterator begin() const
+		{
+			return const_iterator(this, 0);
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator(this, m_containers.size());
+		}
+
+		template <typename Pred>
+		inline Pred for_each_result(Pred pred) const
+		{
+			for (uint32_t offset : *this)
+			{
+				pred(pattern_match(reinterpret_cast<void*>(m_base + offset)));
+			}
+			return pred;
+		}
+
+		// Same offsets moved by delta, dropping the ones that would fall outside of the 32-bit range
+		match_bitmap shifted(int64_t delta) const
+		{
+			match_bitmap result(m_base);
+			for (uint32_t offset : *this)
+			{
+				const int64_t shifted = int64_t(offset) + delta;
+				if (shifted >= 0 && shifted <= int64_t(UINT32_MAX))
+				{
+					result.add(static_cast<uint32_t>(shifted));
+				}
+			}
+			return result;
+		}
+
+		// Set operations - both bitmaps must share the base
+		match_bitmap& operator&=(const match_bitmap& other)
+		{
+			return combine(other, operation::intersect);
+		}
+
+		match_bitmap& operator|=(const match_bitmap& other)
+		{
+			return combine(other, operation::unite);
+		}
+
+		match_bitmap& operator-=(const match_bitmap& other)
+		{
+			return combine(other, operation::subtract);
+		}
+
+		friend match_bitmap operator&(match_bitmap a, const match_bitmap& b) { return a &= b; }
+		friend match_bitmap operator|(match_bitmap a, const match_bitmap& b) { return a |= b; }
+		friend match_bitmap operator-(match_bitmap a, const match_bitmap& b) { return a -= b; }
+
+		// Approximate heap usage, for comparing against a plain match list
+		size_t memory_usage() const
+		{
+			size_t result = m_containers.capacity() * sizeof(container);
+			for (const container& c : m_containers)
+			{
+				result += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+			}
+			return result;
+		}
+
+		void shrink_to_fit()
+		{
+			m_containers.shrink_to_fit();
+			for (container& c : m_containers)
+			{
+				c.array.shrink_to_fit();
+			}
+		}
+
+	private:
+		enum class operation
+		{
+			intersect,
+			unite,
+			subtract,
+		};
+
+		// First container with a key not lower than key
+		size_t find_container(uint16_t key) const
+		{
+			return std::lower_bound(m_containers.begin(), m_containers.end(), key, [](const container& c, uint16_t k) {
+				return c.key < k;
+			}) - m_containers.begin();
+		}
+
+		static container combine_containers(const container& a, const container& b, operation op)
+		{
+			container result;
+			result.key = a.key;
+
+			if (!a.is_bitmap() && !b.is_bitmap())
+			{
+				switch (op)
+				{
+				case operation::intersect:
+					std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+					break;
+				case operation::unite:
+					std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+					break;
+				case operation::subtract:
+					std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+					break;
+				}
+				result.cardinality = static_cast<uint32_t>(result.array.size());
+			}
+			else if (op == operation::intersect && (!a.is_bitmap() || !b.is_bitmap()))
+			{
+				// Array filtered by the bitmap - never needs more than the array had
+				const container& sparse = a.is_bitmap() ? b : a;
+				const container& dense = a.is_bitmap() ? a : b;
+				std::copy_if(sparse.array.begin(), sparse.array.end(), std::back_inserter(result.array), [&](uint16_t low) {
+					return dense.contains(low);
+				});
+				result.cardinality = static_cast<uint32_t>(result.array.size());
+			}
+			else if (op == operation::subtract && !a.is_bitmap())
+			{
+				std::copy_if(a.array.begin(), a.array.end(), std::back_inserter(result.array), [&](uint16_t low) {
+					return !b.contains(low);
+				});
+				result.cardinality = static_cast<uint32_t>(result.array.size());
+			}
+			else
+			{
+				result.bits = a.to_bits();
+				const std::vector<uint64_t> other = b.to_bits();
+				for (uint32_t i = 0; i < BITMAP_WORDS; i++)
+				{
+					switch (op)
+					{
+					case operation::intersect: result.bits[i] &= other[i]; break;
+					case operation::unite:     result.bits[i] |= other[i]; break;
+					case operation::subtract:  result.bits[i] &= ~other[i]; break;
+					}
+				}
+				result.recount();
+			}
+
+			result.normalize();
+			return result;
+		}
+
+		match_bitmap& combine(const match_bitmap& other, operation op)
+		{
+			assert(m_base == other.m_base);
+
+			std::vector<container> result;
+			result.reserve(op == operation::unite ? m_containers.size() + other.m_containers.size() : m_containers.size());
+
+			auto a = m_containers.begin();
+			auto b = other.m_containers.begin();
+			while (a != m_containers.end() || b != other.m_containers.end())
+			{
+				if (b == other.m_containers.end() || (a != m_containers.end() && a->key < b->key))
+				{
+					// Only in this one
+					if (op != operation::intersect)
+					{
+						result.push_back(std::move(*a));
+					}
+					++a;
+				}
+				else if (a == m_containers.end() || b->key < a->key)
+				{
+					// Only in the other one
+					if (op == operation::unite)
+					{
+						result.push_back(*b);
+					}
+					++b;
+				}
+				else
+				{
+					container c = combine_containers(*a, *b, op);
+					if (c.cardinality != 0)
+					{
+						result.push_back(std::move(c));
+					}
+					++a;
+					++b;
+				}
+			}
+
+			m_containers.swap(result);
+			m_size = 0;
+			for (container& c : m_containers)
+			{
+				c.start = m_size;
+				m_size += c.cardinality;
+			}
+			return *this;
+		}
+
+		uintptr_t m_base = 0;
+		size_t m_size = 0;
+		std::vector<container> m_containers;
+	};
+}
@@ -46,14 +46,26 @@ namespace Memory
 		Jump,
 	};
 
+	namespace details
+	{
+		// Non-zero while patching an executable image loaded elsewhere (see StaticPatcher.hpp)
+		// hook::pattern reads it too, hook::details::set_process_base is the same override
+		inline uintptr_t& ProcessBaseOverride()
+		{
+			static uintptr_t base = 0;
+			return base;
+		}
+	}
+
 	template<typename AT>
 	inline AT DynBaseAddress(AT address)
 	{
 		static_assert(sizeof(AT) == sizeof(uintptr_t), "AT must be pointer sized");
+		const uintptr_t base = details::ProcessBaseOverride() != 0 ? details::ProcessBaseOverride() : (uintptr_t)GetModuleHandle(nullptr);
 	#ifdef _WIN64
-		return (ptrdiff_t)GetModuleHandle(nullptr) - 0x140000000 + address;
+		return (ptrdiff_t)base - 0x140000000 + address;
 	#else
-		return (ptrdiff_t)GetModuleHandle(nullptr) - 0x400000 + address;
+		return (ptrdiff_t)base - 0x400000 + address;
 	#endif
 	}
 
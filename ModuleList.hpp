@@ -3,8 +3,12 @@
 #include <vector>
 #include <algorithm>
 #include <cassert>
+#include <memory_resource>
 #include <string>
 
+#include "InitArena.hpp"
+#include "LoaderModules.hpp"
+
 // Stores a list of loaded modules with their names, WITHOUT extension
 class ModuleList
 {
@@ -28,63 +32,10 @@ public:
 		// Cannot enumerate twice without cleaing
 		assert( m_moduleList.size() == 0 );
 
-		constexpr size_t INITIAL_SIZE = sizeof(HMODULE) * 256;
-		HMODULE* modules = static_cast<HMODULE*>(malloc( INITIAL_SIZE ));
-		if ( modules != nullptr )
+		EnumerateFromLoader();
+		if ( m_moduleList.empty() )
 		{
-			typedef BOOL (WINAPI * Func)(HANDLE hProcess, HMODULE *lphModule, DWORD cb, LPDWORD lpcbNeeded);
-
-			HMODULE hLib = LoadLibrary( TEXT("kernel32") );
-			assert( hLib != nullptr ); // If this fails then everything is probably broken anyway
-
-			Func pEnumProcessModules = reinterpret_cast<Func>(GetProcAddress( hLib, "K32EnumProcessModules" ));
-			if ( pEnumProcessModules == nullptr )
-			{
-				// Try psapi
-				FreeLibrary( hLib );
-				hLib = LoadLibrary( TEXT("psapi") );
-				if ( hLib != nullptr )
-				{
-					pEnumProcessModules = reinterpret_cast<Func>(GetProcAddress( hLib, "EnumProcessModules" ));
-				}
-			}
-
-			if ( pEnumProcessModules != nullptr )
-			{
-				const HANDLE currentProcess = GetCurrentProcess();
-				DWORD cbNeeded = 0;
-				if ( pEnumProcessModules( currentProcess, modules, INITIAL_SIZE, &cbNeeded ) != 0 )
-				{
-					if ( cbNeeded > INITIAL_SIZE )
-					{
-						HMODULE* newModules = static_cast<HMODULE*>(realloc( modules, cbNeeded ));
-						if ( newModules != nullptr )
-						{
-							modules = newModules;
-
-							if ( pEnumProcessModules( currentProcess, modules, cbNeeded, &cbNeeded ) != 0 )
-							{
-								EnumerateInternal( modules, cbNeeded / sizeof(HMODULE) );
-							}
-						}
-						else
-						{
-							EnumerateInternal( modules, INITIAL_SIZE / sizeof(HMODULE) );
-						}
-					}
-					else
-					{
-						EnumerateInternal( modules, cbNeeded / sizeof(HMODULE) );
-					}
-				}
-			}
-
-			if ( hLib != nullptr )
-			{
-				FreeLibrary( hLib );
-			}
-
-			free( modules );
+			EnumerateFromPSAPI();
 		}
 	}
 
@@ -164,6 +115,77 @@ public:
 	}
 
 private:
+	void EnumerateFromLoader()
+	{
+		LoaderModules::ForEach( [this]( const LoaderModules::Module& module ) {
+			const LoaderModules::string_view name = LoaderModules::StemOf( module.name );
+			m_moduleList.emplace_back( std::piecewise_construct, std::forward_as_tuple(static_cast<HMODULE>(module.base)), std::forward_as_tuple(name.begin(), name.end()) );
+		} );
+	}
+
+	// Fallback if the loader structures can't be walked
+	void EnumerateFromPSAPI()
+	{
+		constexpr size_t INITIAL_SIZE = sizeof(HMODULE) * 256;
+		HMODULE* modules = static_cast<HMODULE*>(malloc( INITIAL_SIZE ));
+		if ( modules != nullptr )
+		{
+			typedef BOOL (WINAPI * Func)(HANDLE hProcess, HMODULE *lphModule, DWORD cb, LPDWORD lpcbNeeded);
+
+			HMODULE hLib = LoadLibrary( TEXT("kernel32") );
+			assert( hLib != nullptr ); // If this fails then everything is probably broken anyway
+
+			Func pEnumProcessModules = reinterpret_cast<Func>(GetProcAddress( hLib, "K32EnumProcessModules" ));
+			if ( pEnumProcessModules == nullptr )
+			{
+				// Try psapi
+				FreeLibrary( hLib );
+				hLib = LoadLibrary( TEXT("psapi") );
+				if ( hLib != nullptr )
+				{
+					pEnumProcessModules = reinterpret_cast<Func>(GetProcAddress( hLib, "EnumProcessModules" ));
+				}
+			}
+
+			if ( pEnumProcessModules != nullptr )
+			{
+				const HANDLE currentProcess = GetCurrentProcess();
+				DWORD cbNeeded = 0;
+				if ( pEnumProcessModules( currentProcess, modules, INITIAL_SIZE, &cbNeeded ) != 0 )
+				{
+					if ( cbNeeded > INITIAL_SIZE )
+					{
+						HMODULE* newModules = static_cast<HMODULE*>(realloc( modules, cbNeeded ));
+						if ( newModules != nullptr )
+						{
+							modules = newModules;
+
+							if ( pEnumProcessModules( currentProcess, modules, cbNeeded, &cbNeeded ) != 0 )
+							{
+								EnumerateInternal( modules, cbNeeded / sizeof(HMODULE) );
+							}
+						}
+						else
+						{
+							EnumerateInternal( modules, INITIAL_SIZE / sizeof(HMODULE) );
+						}
+					}
+					else
+					{
+						EnumerateInternal( modules, cbNeeded / sizeof(HMODULE) );
+					}
+				}
+			}
+
+			if ( hLib != nullptr )
+			{
+				FreeLibrary( hLib );
+			}
+
+			free( modules );
+		}
+	}
+
 	void EnumerateInternal( HMODULE* modules, size_t numModules )
 	{
 		size_t moduleNameLength = MAX_PATH;
@@ -210,5 +232,5 @@ private:
 		}
 	}
 
-	std::vector< std::pair<HMODULE, std::wstring> > m_moduleList;
+	std::pmr::vector< std::pair<HMODULE, std::pmr::wstring> > m_moduleList { InitArena::GetResource() };
 };
\ No newline at end of file
@@ -0,0 +1,378 @@
+#pragma once
+
+// Static cost analysis of patterns, modelling the Horspool variant used by hook::pattern
+// Given byte frequencies (uniform, or measured from a code corpus), estimates how far the scanner skips per candidate,
+// how many candidates get verified and which wildcards limit the skips, then suggests cheaper equivalent forms.
+// Without a corpus, suggestions cannot be verified to keep the pattern unique - check them before use!
+// Portable, so it can be used from offline tools (see tools/PatternAnalyzer.cpp).
+
+#include "Patterns.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace hook::analysis
+{
+	struct byte_frequencies
+	{
+		double freq[256];
+
+		static byte_frequencies uniform()
+		{
+			byte_frequencies result;
+			std::fill( std::begin(result.freq), std::end(result.freq), 1.0 / 256.0 );
+			return result;
+		}
+
+		static byte_frequencies from_corpus( const uint8_t* data, size_t size )
+		{
+			size_t counts[256] {};
+			for ( size_t i = 0; i < size; i++ )
+			{
+				counts[data[i]]++;
+			}
+
+			// Laplace smoothing, so bytes absent from the corpus are still considered possible
+			byte_frequencies result;
+			for ( size_t i = 0; i < 256; i++ )
+			{
+				result.freq[i] = static_cast<double>(counts[i] + 1) / static_cast<double>(size + 256);
+			}
+			return result;
+		}
+	};
+
+	struct parsed_pattern
+	{
+		std::basic_string<uint8_t> bytes;
+		std::basic_string<uint8_t> mask;
+
+		explicit parsed_pattern( std::string_view pattern )
+		{
+			hook::details::TransformPattern( pattern, bytes, mask );
+		}
+
+		parsed_pattern( std::basic_string<uint8_t> bytes, std::basic_string<uint8_t> mask )
+			: bytes( std::move(bytes) ), mask( std::move(mask) )
+		{
+		}
+
+		size_t size() const { return mask.size(); }
+		bool wildcard( size_t i ) const { return mask[i] == 0; }
+
+		parsed_pattern substr( size_t pos, size_t count = std::string::npos ) const
+		{
+			return parsed_pattern( bytes.substr( pos, count ), mask.substr( pos, count ) );
+		}
+
+		// Formats back to IDA format, with single character wildcards
+		std::string to_string() const
+		{
+			std::string result;
+			for ( size_t i = 0; i < size(); i++ )
+			{
+				if ( i != 0 ) result.push_back( ' ' );
+				if ( wildcard(i) )
+				{
+					result.push_back( '?' );
+				}
+				else
+				{
+					char buf[4];
+					snprintf( buf, sizeof(buf), "%02X", bytes[i] );
+					result.append( buf );
+				}
+			}
+			return result;
+		}
+	};
+
+	struct pattern_cost
+	{
+		size_t length = 0;
+		size_t fixedBytes = 0;
+		size_t leadingWildcards = 0;
+		size_t trailingWildcards = 0;
+
+		// Last wildcard position, or -1 - no shift can ever skip past it
+		ptrdiff_t lastWildcard = -1;
+		size_t maxShift = 0;
+
+		// Per candidate position
+		double expectedShift = 0.0;
+		double expectedComparisons = 0.0;
+
+		// Byte compared first by the scanner, and the rarest fixed byte of the pattern
+		size_t anchorOffset = 0;
+		double anchorFrequency = 0.0;
+		size_t rarestOffset = 0;
+		double rarestFrequency = 0.0;
+
+		// Candidates passing the first comparison and getting verified further, per MB of scanned code
+		double verificationsPerMB = 0.0;
+		// Byte comparisons per scanned byte
+		double costPerByte = 0.0;
+
+		// Wildcards capping the shift below half of the pattern length
+		std::vector<size_t> limitingWildcards;
+	};
+
+	// Actual scanner statistics over a corpus
+	struct corpus_stats
+	{
+		size_t positions = 0;
+		size_t comparisons = 0;
+		size_t verifications = 0;
+		std::vector<size_t> matches;
+	};
+
+	struct rewrite_suggestion
+	{
+		std::string pattern;
+		// Has to be added to the offset used with the original pattern
+		ptrdiff_t offsetAdjustment = 0;
+		std::string reason;
+		double expectedShift = 0.0;
+		double costPerByte = 0.0;
+		// True if the corpus was given and this form yields the same matches
+		bool verified = false;
+	};
+
+	namespace details
+	{
+		// Same skip table as basic_pattern_impl::EnsureMatches
+		inline void BuildSkipTable( const parsed_pattern& pattern, ptrdiff_t (&Last)[256] )
+		{
+			const size_t lastWild = pattern.mask.find_last_not_of( uint8_t(0xFF) );
+			std::fill( std::begin(Last), std::end(Last), lastWild == std::string::npos ? -1 : static_cast<ptrdiff_t>(lastWild) );
+
+			for ( ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(pattern.size()); ++i )
+			{
+				if ( Last[ pattern.bytes[i] ] < i )
+				{
+					Last[ pattern.bytes[i] ] = i;
+				}
+			}
+		}
+	}
+
+	inline pattern_cost analyze( const parsed_pattern& pattern, const byte_frequencies& frequencies )
+	{
+		pattern_cost result;
+
+		const size_t m = pattern.size();
+		result.length = m;
+		if ( m == 0 )
+		{
+			return result;
+		}
+
+		while ( result.leadingWildcards < m && pattern.wildcard(result.leadingWildcards) ) result.leadingWildcards++;
+		while ( result.trailingWildcards < m && pattern.wildcard(m - 1 - result.trailingWildcards) ) result.trailingWildcards++;
+
+		ptrdiff_t Last[256];
+		details::BuildSkipTable( pattern, Last );
+
+		const double* freq = frequencies.freq;
+		result.rarestFrequency = 1.0;
+		bool anchorFound = false;
+		for ( size_t i = m; i-- > 0; )
+		{
+			if ( pattern.wildcard(i) )
+			{
+				if ( result.lastWildcard < 0 ) result.lastWildcard = static_cast<ptrdiff_t>(i);
+				if ( (m - 1 - i) < m / 2 ) result.limitingWildcards.push_back( i );
+				continue;
+			}
+
+			result.fixedBytes++;
+			if ( !anchorFound )
+			{
+				anchorFound = true;
+				result.anchorOffset = i;
+				result.anchorFrequency = freq[pattern.bytes[i]];
+			}
+			if ( freq[pattern.bytes[i]] < result.rarestFrequency )
+			{
+				result.rarestOffset = i;
+				result.rarestFrequency = freq[pattern.bytes[i]];
+			}
+		}
+		std::reverse( result.limitingWildcards.begin(), result.limitingWildcards.end() );
+
+		for ( size_t b = 0; b < 256; b++ )
+		{
+			result.maxShift = std::max( result.maxShift, static_cast<size_t>(std::max( ptrdiff_t(1), static_cast<ptrdiff_t>(m - 1) - Last[b] )) );
+		}
+
+		// Compare from the end, like the scanner does - on a mismatch at j, the shift is max(1, j - Last[byte])
+		double reach = 1.0;
+		for ( ptrdiff_t j = m - 1; j >= 0; j-- )
+		{
+			result.expectedComparisons += reach;
+			if ( pattern.wildcard(j) )
+			{
+				continue;
+			}
+
+			const uint8_t expected = pattern.bytes[j];
+			double mismatchShift = 0.0;
+			for ( size_t b = 0; b < 256; b++ )
+			{
+				if ( b != expected )
+				{
+					mismatchShift += freq[b] * static_cast<double>(std::max( ptrdiff_t(1), j - Last[b] ));
+				}
+			}
+			result.expectedShift += reach * mismatchShift;
+			reach *= freq[expected];
+		}
+		result.expectedShift += reach;
+
+		result.costPerByte = result.expectedComparisons / result.expectedShift;
+		result.verificationsPerMB = (1024.0 * 1024.0 / result.expectedShift) * (anchorFound ? result.anchorFrequency : 1.0);
+		return result;
+	}
+
+	// Runs the scanner over the corpus, counting the work done
+	inline corpus_stats measure( const parsed_pattern& pattern, const uint8_t* data, size_t size )
+	{
+		corpus_stats result;
+
+		const size_t maskSize = pattern.size();
+		if ( maskSize == 0 || size < maskSize )
+		{
+			return result;
+		}
+
+		ptrdiff_t Last[256];
+		details::BuildSkipTable( pattern, Last );
+
+		// Comparisons done before the first fixed byte is tested - any more than that is a verification
+		const size_t anchorComparisons = maskSize - pattern.mask.find_last_of( uint8_t(0xFF) );
+
+		const uint8_t* bytes = pattern.bytes.data();
+		const uint8_t* mask = pattern.mask.data();
+		for ( size_t i = 0, end = size - maskSize; i <= end; )
+		{
+			const uint8_t* ptr = data + i;
+			ptrdiff_t j = maskSize - 1;
+
+			size_t comparisons = 0;
+			while ( j >= 0 )
+			{
+				comparisons++;
+				if ( bytes[j] != (ptr[j] & mask[j]) ) break;
+				j--;
+			}
+
+			result.positions++;
+			result.comparisons += comparisons;
+			if ( comparisons > anchorComparisons )
+			{
+				result.verifications++;
+			}
+
+			if ( j < 0 )
+			{
+				result.matches.push_back( i );
+				i++;
+			}
+			else i += std::max( ptrdiff_t(1), j - Last[ ptr[j] ] );
+		}
+		return result;
+	}
+
+	inline std::vector<rewrite_suggestion> suggest( const parsed_pattern& pattern, const byte_frequencies& frequencies, const uint8_t* corpus = nullptr, size_t corpusSize = 0 )
+	{
+		// Rewrites shorter than this are unlikely to stay unique
+		constexpr size_t MIN_FIXED_BYTES = 6;
+
+		std::vector<rewrite_suggestion> result;
+
+		const pattern_cost cost = analyze( pattern, frequencies );
+		if ( cost.fixedBytes == 0 )
+		{
+			return result;
+		}
+
+		std::vector<size_t> originalMatches;
+		if ( corpus != nullptr )
+		{
+			originalMatches = measure( pattern, corpus, corpusSize ).matches;
+		}
+
+		auto fixedCount = [&]( size_t pos, size_t count ) {
+			return static_cast<size_t>(std::count( pattern.mask.begin() + pos, pattern.mask.begin() + pos + count, uint8_t(0xFF) ));
+		};
+
+		auto addSuggestion = [&]( size_t pos, size_t count, std::string reason ) {
+			const parsed_pattern rewritten = pattern.substr( pos, count );
+			if ( rewritten.size() == pattern.size() || fixedCount( pos, count ) < std::min( MIN_FIXED_BYTES, cost.fixedBytes ) )
+			{
+				return;
+			}
+
+			const pattern_cost newCost = analyze( rewritten, frequencies );
+			if ( newCost.costPerByte >= cost.costPerByte && newCost.verificationsPerMB >= cost.verificationsPerMB )
+			{
+				return;
+			}
+
+			rewrite_suggestion suggestion;
+			suggestion.pattern = rewritten.to_string();
+			suggestion.offsetAdjustment = static_cast<ptrdiff_t>(pos);
+			suggestion.reason = std::move(reason);
+			suggestion.expectedShift = newCost.expectedShift;
+			suggestion.costPerByte = newCost.costPerByte;
+			if ( corpus != nullptr )
+			{
+				std::vector<size_t> matches = measure( rewritten, corpus, corpusSize ).matches;
+				for ( size_t& match : matches ) match -= pos;
+
+				// Matches right at the corpus edges are impossible to compare, so ignore those
+				matches.erase( std::remove_if( matches.begin(), matches.end(), [&]( size_t match ) {
+					return match > corpusSize || corpusSize - match < pattern.size();
+				} ), matches.end() );
+				suggestion.verified = matches == originalMatches;
+			}
+
+			const bool duplicate = std::any_of( result.begin(), result.end(), [&]( const auto& e ) { return e.pattern == suggestion.pattern; } );
+			if ( !duplicate )
+			{
+				result.push_back( std::move(suggestion) );
+			}
+		};
+
+		const size_t begin = cost.leadingWildcards;
+		const size_t end = cost.length - cost.trailingWildcards;
+		if ( cost.trailingWildcards != 0 || cost.leadingWildcards != 0 )
+		{
+			addSuggestion( begin, end - begin, "trim leading/trailing wildcards (a trailing wildcard limits every shift to 1 byte)" );
+		}
+
+		// Wildcards late in the pattern cap the shift - try keeping only the part before or after the last run of them
+		const parsed_pattern trimmed = pattern.substr( begin, end - begin );
+		const size_t lastWild = trimmed.mask.find_last_not_of( uint8_t(0xFF) );
+		if ( lastWild != std::string::npos && lastWild >= trimmed.size() / 2 )
+		{
+			const size_t lastFixed = trimmed.mask.find_last_of( uint8_t(0xFF), lastWild );
+			const size_t firstWild = lastFixed != std::string::npos ? lastFixed + 1 : 0;
+			addSuggestion( begin, firstWild, "cut before the wildcards at +" + std::to_string(begin + firstWild) + ", which limit shifts" );
+			addSuggestion( begin + lastWild + 1, end - begin - lastWild - 1, "keep only the wildcard-free tail after +" + std::to_string(begin + lastWild) );
+		}
+
+		// The last fixed byte is compared first - end the pattern on a rarer byte to reduce verifications
+		if ( cost.rarestOffset != cost.anchorOffset && cost.rarestFrequency * 2.0 < cost.anchorFrequency )
+		{
+			addSuggestion( begin, cost.rarestOffset + 1 - begin, "anchor on the rarer byte at +" + std::to_string(cost.rarestOffset) );
+		}
+
+		std::sort( result.begin(), result.end(), []( const auto& a, const auto& b ) {
+			return a.costPerByte < b.costPerByte;
+		} );
+		return result;
+	}
+}
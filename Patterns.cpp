@@ -15,9 +15,16 @@
 
 #include <windows.h>
 #include <algorithm>
-
-#if PATTERNS_USE_HINTS
 #include <map>
+#include <mutex>
+
+#include "LoaderModules.hpp"
+#include "MatchBitmap.h"
+#include "MemoryMgr.h"
+#include "TaskPool.hpp"
+
+#if PATTERNS_USE_SHARED_CACHE
+#include <cwchar>
 #endif
 
 
@@ -50,9 +57,16 @@ typedef basic_fnv_1<fnv_prime, fnv_offset_basis> fnv_1;
 namespace hook
 {
 
+// Shares the override with Memory::DynBaseAddress, so both always agree
 ptrdiff_t details::get_process_base()
 {
-	return ptrdiff_t(GetModuleHandle(nullptr));
+	const uintptr_t base = Memory::details::ProcessBaseOverride();
+	return base != 0 ? ptrdiff_t(base) : ptrdiff_t(GetModuleHandle(nullptr));
+}
+
+void details::set_process_base(ptrdiff_t base)
+{
+	Memory::details::ProcessBaseOverride() = uintptr_t(base);
 }
 
 
@@ -62,51 +76,14 @@ static auto& getHints()
 	static std::multimap<uint64_t, uintptr_t> hints;
 	return hints;
 }
-#endif
 
-static void TransformPattern(std::string_view pattern, std::basic_string<uint8_t>& data, std::basic_string<uint8_t>& mask)
+// Patterns may be scanned from several threads at once
+static std::mutex& getHintsMutex()
 {
-	uint8_t tempDigit = 0;
-	bool tempFlag = false;
-
-	auto tol = [] (char ch) -> uint8_t
-	{
-		if (ch >= 'A' && ch <= 'F') return uint8_t(ch - 'A' + 10);
-		if (ch >= 'a' && ch <= 'f') return uint8_t(ch - 'a' + 10);
-		return uint8_t(ch - '0');
-	};
-
-	for (auto ch : pattern)
-	{
-		if (ch == ' ')
-		{
-			continue;
-		}
-		else if (ch == '?')
-		{
-			data.push_back(0);
-			mask.push_back(0);
-		}
-		else if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'F') || (ch >= 'a' && ch <= 'f'))
-		{
-			uint8_t thisDigit = tol(ch);
-
-			if (!tempFlag)
-			{
-				tempDigit = thisDigit << 4;
-				tempFlag = true;
-			}
-			else
-			{
-				tempDigit |= thisDigit;
-				tempFlag = false;
-
-				data.push_back(tempDigit);
-				mask.push_back(0xFF);
-			}
-		}
-	}
+	static std::mutex mutex;
+	return mutex;
 }
+#endif
 
 class executable_meta
 {
@@ -147,6 +124,304 @@ public:
 	inline uintptr_t end() const   { return m_end; }
 };
 
+// Headers are only parsed once per module
+// Entries are keyed by the timestamp and size too, in case another module gets loaded at the same address later
+static executable_meta get_executable_meta(uintptr_t module)
+{
+	struct cached_meta
+	{
+		DWORD timeDateStamp;
+		DWORD sizeOfImage;
+		executable_meta meta;
+	};
+
+	static std::mutex mutex;
+	static std::map<uintptr_t, cached_meta> modules;
+
+	PIMAGE_DOS_HEADER dosHeader = reinterpret_cast<PIMAGE_DOS_HEADER>(module);
+	PIMAGE_NT_HEADERS ntHeader = reinterpret_cast<PIMAGE_NT_HEADERS>(module + dosHeader->e_lfanew);
+	const DWORD timeDateStamp = ntHeader->FileHeader.TimeDateStamp;
+	const DWORD sizeOfImage = ntHeader->OptionalHeader.SizeOfImage;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = modules.find(module);
+	if (it == modules.end() || it->second.timeDateStamp != timeDateStamp || it->second.sizeOfImage != sizeOfImage)
+	{
+		it = modules.insert_or_assign(module, cached_meta{ timeDateStamp, sizeOfImage, executable_meta(module) }).first;
+	}
+	return it->second.meta;
+}
+
+// Bounded, so a function without padding around it can't make the window excessively large
+static constexpr uintptr_t MAX_FUNCTION_SEARCH = 256 * 1024;
+
+std::pair<uintptr_t, uintptr_t> details::get_function_range(uintptr_t address)
+{
+#ifdef _WIN64
+	DWORD64 imageBase;
+	if (PRUNTIME_FUNCTION function = RtlLookupFunctionEntry(address, &imageBase, nullptr); function != nullptr)
+	{
+		return { uintptr_t(imageBase + function->BeginAddress), uintptr_t(imageBase + function->EndAddress) };
+	}
+#endif
+
+	// No unwind info (x86, or a leaf function) - functions start and end at 16 byte boundaries next to int3 padding
+	// Without padding the range extends into the neighbouring functions, which is wider than needed but still correct
+	MEMORY_BASIC_INFORMATION info;
+	if (VirtualQuery(reinterpret_cast<LPCVOID>(address), &info, sizeof(info)) == 0)
+	{
+		return { address, address };
+	}
+
+	const uintptr_t regionBegin = reinterpret_cast<uintptr_t>(info.BaseAddress);
+	const uintptr_t regionEnd = regionBegin + info.RegionSize;
+	const uintptr_t lowest = address - std::min(address - regionBegin, MAX_FUNCTION_SEARCH);
+	const uintptr_t highest = address + std::min(regionEnd - address, MAX_FUNCTION_SEARCH);
+
+	uintptr_t begin = address & ~uintptr_t(15);
+	while (begin > lowest && *reinterpret_cast<const uint8_t*>(begin - 1) != 0xCC)
+	{
+		begin = begin - lowest > 16 ? begin - 16 : lowest;
+	}
+
+	uintptr_t end = std::min((address + 16) & ~uintptr_t(15), highest);
+	while (end < highest && *reinterpret_cast<const uint8_t*>(end - 1) != 0xCC)
+	{
+		end = highest - end > 16 ? end + 16 : highest;
+	}
+
+	return { begin, end };
+}
+
+// Horspool scan of [begin, end) - calls onMatch(address) for every match, until it returns true
+template<typename Func>
+static void scan_range(const uint8_t* pattern, const uint8_t* mask, size_t maskSize, uint32_t alignment, uintptr_t begin, uintptr_t end, Func&& onMatch)
+{
+	if (end < begin || end - begin < maskSize)
+	{
+		return;
+	}
+
+	const size_t lastWild = std::basic_string_view<uint8_t>(mask, maskSize).find_last_not_of(uint8_t(0xFF));
+
+	ptrdiff_t Last[256];
+
+	std::fill(std::begin(Last), std::end(Last), lastWild == std::string::npos ? -1 : static_cast<ptrdiff_t>(lastWild) );
+
+	for ( ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(maskSize); ++i )
+	{
+		if ( Last[ pattern[i] ] < i )
+		{
+			Last[ pattern[i] ] = i;
+		}
+	}
+
+	// With an alignment constraint, every shift is rounded up to the next aligned candidate
+	const uintptr_t alignMask = alignment - 1;
+
+	for (uintptr_t i = (begin + alignMask) & ~alignMask, last = end - maskSize; i <= last;)
+	{
+		uint8_t* ptr = reinterpret_cast<uint8_t*>(i);
+		ptrdiff_t j = maskSize - 1;
+
+		while((j >= 0) && pattern[j] == (ptr[j] & mask[j])) j--;
+
+		if(j < 0)
+		{
+			if (onMatch(i))
+			{
+				break;
+			}
+			i += alignment;
+		}
+		else i = (i + std::max(ptrdiff_t(1), j - Last[ ptr[j] ]) + alignMask) & ~alignMask;
+	}
+}
+
+#if PATTERNS_USE_SHARED_CACHE
+// Process-wide cache of pattern results, shared by all modules built with PATTERNS_USE_SHARED_CACHE,
+// so mods resolving the same signatures don't all scan the same executable over again
+// It's a lock-free open addressed table in a named mapping, keyed by the module's fingerprint and the canonical pattern.
+// Results are verified against the pattern before they're reused, so a stale or colliding entry only costs a rescan.
+// That can't catch matches a patch has added though, so invalidate_code bumps the generation the keys include,
+// and every entry from before it goes stale at once - in all modules, as the table is shared. Stale entries keep their slots,
+// so invalidating often fills the table up, and scans past that point just aren't cached.
+namespace shared_cache
+{
+	static constexpr uint32_t MAGIC = 0x48435450; // 'PTCH'
+	static constexpr LONG NUM_ENTRIES = 4096;
+	static constexpr LONG MAX_PROBES = 32;
+	static constexpr uint32_t MAX_MATCHES = 16;
+
+	enum : LONG
+	{
+		STATE_WRITING = 0,
+		STATE_READY = 1,
+	};
+
+	struct entry
+	{
+		// Zero if free, claimed by the first writer
+		volatile LONG64 key;
+		volatile LONG state;
+		// Zero if the scan stopped early (or found more than MAX_MATCHES), so only the first matches are known
+		uint32_t complete;
+		uint32_t numMatches;
+		uint32_t rvas[MAX_MATCHES];
+	};
+
+	struct header
+	{
+		volatile LONG magic;
+		uint32_t headerSize;
+		// Bumped by invalidate_code
+		volatile LONG generation;
+		entry entries[NUM_ENTRIES];
+	};
+
+	static header* get_header()
+	{
+		static header* const cache = [] () -> header* {
+			// Versioned in the name, so incompatible layouts never share a mapping
+			wchar_t name[64];
+			swprintf(name, _countof(name), L"Local\\ModUtils.PatternCache.v2.%lu", GetCurrentProcessId());
+
+			// Deliberately never closed, the cache lives for as long as the process
+			HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(header), name);
+			if (mapping == nullptr) return nullptr;
+
+			header* view = static_cast<header*>(MapViewOfFile(mapping, FILE_MAP_READ|FILE_MAP_WRITE, 0, 0, sizeof(header)));
+			if (view == nullptr) return nullptr;
+
+			// A fresh mapping is zeroed, which is a valid empty table
+			InterlockedCompareExchange(&view->magic, MAGIC, 0);
+			if (view->magic != MAGIC) return nullptr;
+			if (view->headerSize == 0) view->headerSize = sizeof(header);
+			return view->headerSize == sizeof(header) ? view : nullptr;
+		}();
+		return cache;
+	}
+
+	// Read before scanning and passed to publish, so results of a scan racing with an invalidation are never published as fresh
+	static LONG generation()
+	{
+		header* cache = get_header();
+		return cache != nullptr ? InterlockedCompareExchange(&cache->generation, 0, 0) : 0;
+	}
+
+	static void invalidate()
+	{
+		header* cache = get_header();
+		if (cache != nullptr) InterlockedIncrement(&cache->generation);
+	}
+
+	static LONG64 make_key(LONG generation, uintptr_t module, std::basic_string_view<uint8_t> bytes, std::basic_string_view<uint8_t> mask, uint32_t alignment)
+	{
+		PIMAGE_DOS_HEADER dosHeader = reinterpret_cast<PIMAGE_DOS_HEADER>(module);
+		PIMAGE_NT_HEADERS ntHeader = reinterpret_cast<PIMAGE_NT_HEADERS>(module + dosHeader->e_lfanew);
+
+		uint64_t hash = 14695981039346656037u;
+		auto add = [&hash] (const void* data, size_t size)
+		{
+			for (size_t i = 0; i < size; i++)
+			{
+				hash ^= static_cast<const uint8_t*>(data)[i];
+				hash *= 1099511628211u;
+			}
+		};
+
+		// Fingerprint of the module - identical files give identical RVAs, wherever they are loaded
+		add(&ntHeader->FileHeader.TimeDateStamp, sizeof(ntHeader->FileHeader.TimeDateStamp));
+		add(&ntHeader->OptionalHeader.SizeOfImage, sizeof(ntHeader->OptionalHeader.SizeOfImage));
+		add(&ntHeader->OptionalHeader.CheckSum, sizeof(ntHeader->OptionalHeader.CheckSum));
+		add(&ntHeader->OptionalHeader.AddressOfEntryPoint, sizeof(ntHeader->OptionalHeader.AddressOfEntryPoint));
+
+		// Canonical pattern, so spelling and spacing don't matter
+		add(bytes.data(), bytes.size());
+		add(mask.data(), mask.size());
+		add(&alignment, sizeof(alignment));
+		add(&generation, sizeof(generation));
+
+		return hash != 0 ? static_cast<LONG64>(hash) : 1;
+	}
+
+	static bool lookup(LONG generation, uintptr_t module, std::basic_string_view<uint8_t> bytes, std::basic_string_view<uint8_t> mask, uint32_t alignment,
+		uint32_t maxCount, std::pmr::vector<pattern_match>& matches)
+	{
+		header* cache = get_header();
+		if (cache == nullptr) return false;
+
+		const LONG64 key = make_key(generation, module, bytes, mask, alignment);
+		for (LONG probe = 0; probe < MAX_PROBES; probe++)
+		{
+			entry& e = cache->entries[(static_cast<uint64_t>(key) + probe) % NUM_ENTRIES];
+
+			const LONG64 entryKey = InterlockedCompareExchange64(&e.key, 0, 0);
+			if (entryKey == 0) return false;
+			if (entryKey != key) continue;
+
+			// Still being written - just scan ourselves
+			if (InterlockedCompareExchange(&e.state, 0, 0) != STATE_READY) return false;
+
+			const uint32_t numMatches = std::min(e.numMatches, MAX_MATCHES);
+			if (e.complete == 0 && numMatches < maxCount) return false;
+
+			PIMAGE_DOS_HEADER dosHeader = reinterpret_cast<PIMAGE_DOS_HEADER>(module);
+			PIMAGE_NT_HEADERS ntHeader = reinterpret_cast<PIMAGE_NT_HEADERS>(module + dosHeader->e_lfanew);
+			const uint32_t sizeOfImage = ntHeader->OptionalHeader.SizeOfImage;
+
+			const uint32_t count = std::min(numMatches, maxCount);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const uint32_t rva = e.rvas[i];
+				if (rva > sizeOfImage || sizeOfImage - rva < mask.size() || (rva & (alignment - 1)) != 0) return false;
+
+				const uint8_t* ptr = reinterpret_cast<const uint8_t*>(module + rva);
+				for (size_t j = 0; j < mask.size(); j++)
+				{
+					if (bytes[j] != (ptr[j] & mask[j])) return false;
+				}
+			}
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				matches.emplace_back(reinterpret_cast<void*>(module + e.rvas[i]));
+			}
+			return true;
+		}
+		return false;
+	}
+
+	static void publish(LONG generation, uintptr_t module, std::basic_string_view<uint8_t> bytes, std::basic_string_view<uint8_t> mask, uint32_t alignment,
+		bool complete, const std::pmr::vector<pattern_match>& matches)
+	{
+		header* cache = get_header();
+		if (cache == nullptr) return;
+
+		const LONG64 key = make_key(generation, module, bytes, mask, alignment);
+		for (LONG probe = 0; probe < MAX_PROBES; probe++)
+		{
+			entry& e = cache->entries[(static_cast<uint64_t>(key) + probe) % NUM_ENTRIES];
+
+			const LONG64 entryKey = InterlockedCompareExchange64(&e.key, key, 0);
+			if (entryKey == key) return; // Somebody else published (or is publishing) it already
+			if (entryKey != 0) continue;
+
+			// Claimed - fill it in, then publish
+			const uint32_t numMatches = static_cast<uint32_t>(std::min<size_t>(matches.size(), MAX_MATCHES));
+			for (uint32_t i = 0; i < numMatches; i++)
+			{
+				e.rvas[i] = static_cast<uint32_t>(matches[i].get_uintptr() - module);
+			}
+			e.numMatches = numMatches;
+			e.complete = complete && matches.size() <= MAX_MATCHES ? 1 : 0;
+			InterlockedExchange(&e.state, STATE_READY);
+			return;
+		}
+	}
+}
+#endif
+
 namespace details
 {
 
@@ -166,13 +441,18 @@ void basic_pattern_impl::Initialize(std::string_view pattern)
 	if (m_rangeStart == reinterpret_cast<uintptr_t>(GetModuleHandle(nullptr)))
 #endif
 	{
+		std::lock_guard<std::mutex> lock(getHintsMutex());
 		auto range = getHints().equal_range(m_hash);
 
 		if (range.first != range.second)
 		{
 			std::for_each(range.first, range.second, [&] (const auto& hint)
 			{
-				ConsiderHint(hint.second);
+				// Ranged patterns only take the hints within their range
+				if (m_rangeEnd == 0 || (hint.second >= m_rangeStart && hint.second < m_rangeEnd))
+				{
+					ConsiderHint(hint.second);
+				}
 			});
 
 			// if the hints succeeded, we don't need to do anything more
@@ -193,58 +473,79 @@ void basic_pattern_impl::EnsureMatches(uint32_t maxCount)
 		return;
 	}
 
+#if PATTERNS_USE_SHARED_CACHE
+	// Only whole module scans are shared
+	const bool useSharedCache = m_rangeEnd == 0;
+	const LONG cacheGeneration = useSharedCache ? shared_cache::generation() : 0;
+	if (useSharedCache && shared_cache::lookup(cacheGeneration, m_rangeStart, m_bytes, m_mask, m_alignment, maxCount, m_matches))
+	{
+		m_matched = true;
+		return;
+	}
+#endif
+
 	// scan the executable for code
-	executable_meta executable = m_rangeStart != 0 && m_rangeEnd != 0 ? executable_meta(m_rangeStart, m_rangeEnd) : executable_meta(m_rangeStart);
+	const executable_meta executable = m_rangeStart != 0 && m_rangeEnd != 0 ? executable_meta(m_rangeStart, m_rangeEnd) : get_executable_meta(m_rangeStart);
 
 	auto matchSuccess = [&] (uintptr_t address)
 	{
+		m_matches.emplace_back(reinterpret_cast<void*>(address));
+
 #if PATTERNS_USE_HINTS
-		getHints().emplace(m_hash, address);
-#else
-		(void)address;
+		// Matches of a ranged scan aren't all the matches in the module, so they'd make poor hints for whole module scans
+		// Hints are keyed by the pattern string alone, so the same goes for aligned scans - unaligned ones would only see the aligned subset
+		if (m_rangeEnd == 0 && m_alignment == 1)
+		{
+			std::lock_guard<std::mutex> lock(getHintsMutex());
+			getHints().emplace(m_hash, address);
+		}
 #endif
 
 		return (m_matches.size() == maxCount);
 	};
 
-	const uint8_t* pattern = m_bytes.data();
-	const uint8_t* mask = m_mask.data();
-	const size_t maskSize = m_mask.size();
-	const size_t lastWild = m_mask.find_last_not_of(uint8_t(0xFF));
-
-	ptrdiff_t Last[256];
+	scan_range(m_bytes.data(), m_mask.data(), m_mask.size(), m_alignment, executable.begin(), executable.end(), matchSuccess);
 
-	std::fill(std::begin(Last), std::end(Last), lastWild == std::string::npos ? -1 : static_cast<ptrdiff_t>(lastWild) );
-
-	for ( ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(maskSize); ++i )
+#if PATTERNS_USE_SHARED_CACHE
+	if (useSharedCache)
 	{
-		if ( Last[ pattern[i] ] < i )
-		{
-			Last[ pattern[i] ] = i;
-		}
+		// Reaching maxCount means the scan may have stopped early
+		shared_cache::publish(cacheGeneration, m_rangeStart, m_bytes, m_mask, m_alignment, m_matches.size() < maxCount, m_matches);
 	}
+#endif
 
-	for (uintptr_t i = executable.begin(), end = executable.end() - maskSize; i <= end;)
-	{
-		uint8_t* ptr = reinterpret_cast<uint8_t*>(i);
-		ptrdiff_t j = maskSize - 1;
+	m_matched = true;
+}
 
-		while((j >= 0) && pattern[j] == (ptr[j] & mask[j])) j--;
+void basic_pattern_impl::SetAlignment(uint32_t alignment)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+	m_alignment = alignment;
 
-		if(j < 0)
-		{
-			m_matches.emplace_back(ptr);
+	// Matches obtained from hints may not respect the alignment
+	if (m_matched)
+	{
+		m_matches.erase(std::remove_if(m_matches.begin(), m_matches.end(), [alignment](const pattern_match& match) {
+			return (match.get_uintptr() & (alignment - 1)) != 0;
+		}), m_matches.end());
 
-			if (matchSuccess(i))
-			{
-				break;
-			}
-			i++;
+		if (m_matches.empty())
+		{
+			m_matched = false;
 		}
-		else i += std::max(ptrdiff_t(1), j - Last[ ptr[j] ]);
 	}
+}
 
-	m_matched = true;
+void basic_pattern_impl::CollectBitmap(match_bitmap& bitmap)
+{
+	// Always scans - a match list from hints or a count_hint scan may be missing matches
+	// Same scan as EnsureMatches, minus the match list
+	const executable_meta executable = m_rangeStart != 0 && m_rangeEnd != 0 ? executable_meta(m_rangeStart, m_rangeEnd) : get_executable_meta(m_rangeStart);
+	scan_range(m_bytes.data(), m_mask.data(), m_mask.size(), m_alignment, executable.begin(), executable.end(), [&](uintptr_t address)
+	{
+		bitmap.add_address(address);
+		return false;
+	});
 }
 
 bool basic_pattern_impl::ConsiderHint(uintptr_t offset)
@@ -272,6 +573,7 @@ bool basic_pattern_impl::ConsiderHint(uintptr_t offset)
 #if PATTERNS_USE_HINTS && PATTERNS_CAN_SERIALIZE_HINTS
 void basic_pattern_impl::hint(uint64_t hash, uintptr_t address)
 {
+	std::lock_guard<std::mutex> lock(getHintsMutex());
 	auto& hints = getHints();
 
 	auto range = hints.equal_range(hash);
@@ -289,4 +591,95 @@ void basic_pattern_impl::hint(uint64_t hash, uintptr_t address)
 #endif
 
 }
+
+std::vector<module_match> find_pattern_in_modules(std::string_view pattern_string, const std::vector<void*>& modules)
+{
+	std::basic_string<uint8_t> bytes, mask;
+	details::TransformPattern(pattern_string, bytes, mask);
+
+	std::vector<void*> allModules;
+	if (modules.empty())
+	{
+		LoaderModules::ForEach([&](const LoaderModules::Module& module) {
+			allModules.push_back(module.base);
+		});
+	}
+	const std::vector<void*>& searchedModules = modules.empty() ? allModules : modules;
+
+	// Big modules are split into chunks, overlapping by the pattern length so matches crossing chunk boundaries aren't lost
+	constexpr uintptr_t CHUNK_SIZE = 512 * 1024;
+	struct chunk
+	{
+		size_t module;
+		uintptr_t begin;
+		uintptr_t end;
+	};
+
+	std::vector<chunk> chunks;
+	for (size_t i = 0; i < searchedModules.size(); i++)
+	{
+		const executable_meta executable = get_executable_meta(reinterpret_cast<uintptr_t>(searchedModules[i]));
+		for (uintptr_t begin = executable.begin(); begin < executable.end(); begin += CHUNK_SIZE)
+		{
+			const uintptr_t end = std::min(executable.end(), begin + CHUNK_SIZE + mask.size() - 1);
+			chunks.push_back({ i, begin, end });
+		}
+	}
+
+	std::vector<std::vector<uintptr_t>> chunkMatches(chunks.size());
+	TaskPool::ParallelFor(0, chunks.size(), 1, [&](size_t index)
+	{
+		const chunk& c = chunks[index];
+		scan_range(bytes.data(), mask.data(), mask.size(), 1, c.begin, c.end, [&](uintptr_t address)
+		{
+			chunkMatches[index].push_back(address);
+			return false;
+		});
+	});
+
+	// Chunks are in module and address order already
+	std::vector<module_match> results;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		for (uintptr_t address : chunkMatches[i])
+		{
+			results.push_back({ searchedModules[chunks[i].module], pattern_match(reinterpret_cast<void*>(address)) });
+		}
+	}
+	return results;
+}
+
+void invalidate_code(uintptr_t begin, uintptr_t end)
+{
+#if PATTERNS_USE_SHARED_CACHE
+	shared_cache::invalidate();
+#endif
+
+#if PATTERNS_USE_HINTS
+	// Hints don't know the length of their pattern, so matches starting a little before the range may overlap it too
+	constexpr uintptr_t MAX_HINT_OVERLAP = 256;
+	const uintptr_t from = begin - std::min(begin, MAX_HINT_OVERLAP);
+
+	std::lock_guard<std::mutex> lock(getHintsMutex());
+	auto& hints = getHints();
+
+	// A pattern with only some of its hints left would only see those matches, so all of them go
+	std::vector<uint64_t> affected;
+	for (const auto& hint : hints)
+	{
+		if (hint.second >= from && hint.second < end && (affected.empty() || affected.back() != hint.first))
+		{
+			affected.push_back(hint.first);
+		}
+	}
+	for (uint64_t hash : affected)
+	{
+		hints.erase(hash);
+	}
+#else
+	(void)begin;
+	(void)end;
+#endif
+}
+
 }
@@ -8,10 +8,15 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <memory_resource>
 #include <vector>
 #include <string>
 #include <string_view>
+#include <utility>
+
+#include "InitArena.hpp"
 
 #if (defined(_CPPUNWIND) || defined(__EXCEPTIONS)) && !defined(PATTERNS_SUPPRESS_EXCEPTIONS)
 #define PATTERNS_ENABLE_EXCEPTIONS
@@ -19,6 +24,9 @@
 
 namespace hook
 {
+	// See MatchBitmap.h
+	class match_bitmap;
+
 	struct assert_err_policy
 	{
 		static void count([[maybe_unused]] bool countMatches) { assert(countMatches); }
@@ -42,6 +50,9 @@ namespace hook
 	};
 #endif
 
+	template<typename err_policy>
+	class basic_pattern;
+
 	class pattern_match
 	{
 	private:
@@ -53,6 +64,15 @@ namespace hook
 		{
 		}
 
+		// Chained queries - the pattern is only scanned for in a small window around this match, not the whole module
+		// Starting at this match, the pattern has to lie within maxDistance bytes
+		template<typename err_policy = assert_err_policy>
+		basic_pattern<err_policy> then(std::string_view pattern, size_t maxDistance) const;
+
+		// Within the function containing this match
+		template<typename err_policy = assert_err_policy>
+		basic_pattern<err_policy> within_function(std::string_view pattern) const;
+
 		template<typename T>
 		T* get(ptrdiff_t offset = 0) const
 		{
@@ -70,20 +90,78 @@ namespace hook
 	{
 		ptrdiff_t get_process_base();
 
+		// Redirects patterns without an explicit module to another image, 0 restores the default
+		// The same as Memory::details::ProcessBaseOverride, so DynBaseAddress follows along
+		void set_process_base(ptrdiff_t base);
+
+		// Bounds of the function containing the address - from the exception directory on x64,
+		// otherwise from the int3 padding compilers leave between functions
+		std::pair<uintptr_t, uintptr_t> get_function_range(uintptr_t address);
+
+		// Transforms a pattern from IDA format to canonical format (bytes + mask)
+		template<typename String>
+		inline void TransformPattern(std::string_view pattern, String& data, String& mask)
+		{
+			uint8_t tempDigit = 0;
+			bool tempFlag = false;
+
+			auto tol = [] (char ch) -> uint8_t
+			{
+				if (ch >= 'A' && ch <= 'F') return uint8_t(ch - 'A' + 10);
+				if (ch >= 'a' && ch <= 'f') return uint8_t(ch - 'a' + 10);
+				return uint8_t(ch - '0');
+			};
+
+			for (auto ch : pattern)
+			{
+				if (ch == ' ')
+				{
+					continue;
+				}
+				else if (ch == '?')
+				{
+					data.push_back(0);
+					mask.push_back(0);
+				}
+				else if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'F') || (ch >= 'a' && ch <= 'f'))
+				{
+					uint8_t thisDigit = tol(ch);
+
+					if (!tempFlag)
+					{
+						tempDigit = thisDigit << 4;
+						tempFlag = true;
+					}
+					else
+					{
+						tempDigit |= thisDigit;
+						tempFlag = false;
+
+						data.push_back(tempDigit);
+						mask.push_back(0xFF);
+					}
+				}
+			}
+		}
+
 		class basic_pattern_impl
 		{
 		protected:
-			std::basic_string<uint8_t> m_bytes;
-			std::basic_string<uint8_t> m_mask;
+			// Drawn from InitArena's resource, if any is active
+			std::pmr::basic_string<uint8_t> m_bytes;
+			std::pmr::basic_string<uint8_t> m_mask;
 
 #if PATTERNS_USE_HINTS
 			uint64_t m_hash = 0;
 #endif
 
-			std::vector<pattern_match> m_matches;
+			std::pmr::vector<pattern_match> m_matches;
 
 			bool m_matched = false;
 
+			// Candidates are only considered at addresses aligned to this
+			uint32_t m_alignment = 1;
+
 			uintptr_t m_rangeStart;
 			uintptr_t m_rangeEnd;
 
@@ -94,6 +172,10 @@ namespace hook
 
 			void EnsureMatches(uint32_t maxCount);
 
+			void SetAlignment(uint32_t alignment);
+
+			void CollectBitmap(match_bitmap& bitmap);
+
 			inline pattern_match _get_internal(size_t index) const
 			{
 				return m_matches[index];
@@ -101,7 +183,8 @@ namespace hook
 
 		private:
 			explicit basic_pattern_impl(uintptr_t begin, uintptr_t end = 0)
-				: m_rangeStart(begin), m_rangeEnd(end)
+				: m_bytes(InitArena::GetResource()), m_mask(InitArena::GetResource()), m_matches(InitArena::GetResource())
+				, m_rangeStart(begin), m_rangeEnd(end)
 			{
 			}
 
@@ -170,6 +253,14 @@ namespace hook
 			return std::forward<basic_pattern>(*this);
 		}
 
+		// Only match at addresses aligned to 'alignment' (a power of two), e.g. 16 for function entries
+		// Must be specified before any of the matching methods
+		inline basic_pattern&& aligned(uint32_t alignment)
+		{
+			SetAlignment(alignment);
+			return std::forward<basic_pattern>(*this);
+		}
+
 		inline basic_pattern&& count_hint(uint32_t expected)
 		{
 			EnsureMatches(expected);
@@ -222,6 +313,17 @@ namespace hook
 			return pred;
 		}
 
+		// Collects all matches into a compressed bitmap (needs MatchBitmap.h), scanning again even if the pattern has matched already
+		// Offsets are from the module base, or from the start of the range for range patterns
+		// For patterns matching so often that a match list would be too big - they aren't stored in the pattern itself
+		template<typename Bitmap = match_bitmap>
+		inline Bitmap to_bitmap()
+		{
+			Bitmap bitmap(m_rangeStart);
+			CollectBitmap(bitmap);
+			return bitmap;
+		}
+
 	public:
 #if PATTERNS_USE_HINTS && PATTERNS_CAN_SERIALIZE_HINTS
 		// define a hint
@@ -234,6 +336,20 @@ namespace hook
 
 	using pattern = basic_pattern<assert_err_policy>;
 
+	template<typename err_policy>
+	inline basic_pattern<err_policy> pattern_match::then(std::string_view pattern, size_t maxDistance) const
+	{
+		const uintptr_t begin = get_uintptr();
+		return basic_pattern<err_policy>(begin, begin + maxDistance, std::move(pattern));
+	}
+
+	template<typename err_policy>
+	inline basic_pattern<err_policy> pattern_match::within_function(std::string_view pattern) const
+	{
+		const auto [begin, end] = details::get_function_range(get_uintptr());
+		return basic_pattern<err_policy>(begin, end, std::move(pattern));
+	}
+
 	inline auto make_module_pattern(void* module, std::string_view bytes)
 	{
 		return pattern(module, std::move(bytes));
@@ -255,6 +371,21 @@ namespace hook
 		return pattern(std::move(pattern_string)).get_one().get_uintptr(offset);
 	}
 
+	struct module_match
+	{
+		void* module;
+		pattern_match match;
+	};
+
+	// Scans the code of the given modules (all loaded modules if none) for the pattern, in parallel on TaskPool
+	// Results are ordered by module, then by address. Hints are not used
+	std::vector<module_match> find_pattern_in_modules(std::string_view pattern_string, const std::vector<void*>& modules = {});
+
+	// Forgets cached results that [begin, end) changing could have affected, e.g. after another mod patched it (see CodeTracker.hpp)
+	// Hints of patterns with a match near the range are dropped, so those patterns get scanned again. All other hints stay.
+	// The whole shared cache goes stale, as it can't tell which of its results - e.g. patterns with no matches - the change affects
+	void invalidate_code(uintptr_t begin, uintptr_t end);
+
 	namespace txn
 	{
 		using pattern = hook::basic_pattern<exception_err_policy>;
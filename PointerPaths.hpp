@@ -0,0 +1,557 @@
+#pragma once
+
+// Pointer path search - finds chains of pointers leading from statics in loaded modules to a dynamic object,
+// so objects living on the heap (player ped, camera...) can be found again at runtime without per-version tools.
+//
+// PointerMap snapshots every pointer stored in readable, non-executable memory, in parallel on TaskPool,
+// as a map from the value to where it's stored. FindPaths then walks that map backwards from the target:
+// every pointer to within maxOffset bytes below the current address is a step, until a pointer stored inside a module
+// (a static) is reached. Paths are stored relative to the module, so they survive ASLR.
+//
+// Example:
+//   PointerPaths::PointerMap map;
+//   std::vector<PointerPaths::Path> paths = PointerPaths::FindPaths( map, reinterpret_cast<uintptr_t>(playerPed) );
+//   // Later (or after a restart), keep only paths which still lead to the object
+//   paths = PointerPaths::FilterPaths( std::move(paths), reinterpret_cast<uintptr_t>(newPlayerPed) );
+//
+// NOTE: The snapshot is not atomic, so FindPaths only returns paths which still resolve to the target once found.
+// Many paths run through short-lived objects too, so always filter them over a few runs before relying on any!
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "LoaderModules.hpp"
+#include "TaskPool.hpp"
+
+#ifndef _WIN32
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace PointerPaths
+{
+	using string = std::basic_string<LoaderModules::char_type>;
+
+	struct Options
+	{
+		// Maximum number of dereferences
+		size_t maxDepth = 5;
+		// Maximum offset added after each dereference
+		uint32_t maxOffset = 0x1000;
+		size_t maxResults = 1000;
+		// The search tree grows exponentially, so only this many pointers are followed per level
+		size_t maxNodesPerLevel = 200000;
+	};
+
+	namespace details
+	{
+		// Reads memory that may get freed or protected at any time, without faulting
+		inline bool ReadMemory( uintptr_t address, void* buffer, size_t size )
+		{
+#ifdef _WIN32
+			SIZE_T bytesRead = 0;
+			return ReadProcessMemory( GetCurrentProcess(), reinterpret_cast<LPCVOID>(address), buffer, size, &bytesRead ) != FALSE && bytesRead == size;
+#else
+			iovec local = { buffer, size };
+			iovec remote = { reinterpret_cast<void*>(address), size };
+			return process_vm_readv( getpid(), &local, 1, &remote, 1, 0 ) == static_cast<ssize_t>(size);
+#endif
+		}
+
+		// Stack of the calling thread - values there change all the time, so they can't be a part of any lasting path
+		inline std::pair<uintptr_t, uintptr_t> CurrentThreadStack()
+		{
+#ifdef _WIN32
+			MEMORY_BASIC_INFORMATION info;
+			if ( VirtualQuery( &info, &info, sizeof(info) ) != sizeof(info) )
+			{
+				return {};
+			}
+			const NT_TIB* tib = reinterpret_cast<const NT_TIB*>(NtCurrentTeb());
+			return { reinterpret_cast<uintptr_t>(info.AllocationBase), reinterpret_cast<uintptr_t>(tib->StackBase) };
+#else
+			pthread_attr_t attr;
+			if ( pthread_getattr_np( pthread_self(), &attr ) != 0 )
+			{
+				return {};
+			}
+			void* stack = nullptr;
+			size_t size = 0;
+			pthread_attr_getstack( &attr, &stack, &size );
+			pthread_attr_destroy( &attr );
+			return { reinterpret_cast<uintptr_t>(stack), reinterpret_cast<uintptr_t>(stack) + size };
+#endif
+		}
+
+		// Allocates straight from the OS and remembers every block it handed out, so the map can leave out
+		// pointers stored in (or pointing to) its own memory - some of it ends up in the snapshot it scans
+		class PageResource final : public std::pmr::memory_resource
+		{
+		public:
+			// Sorted blocks allocated so far, including the freed ones
+			std::vector<std::pair<uintptr_t, uintptr_t>> Blocks()
+			{
+				std::lock_guard<std::mutex> lock( m_mutex );
+				std::vector<std::pair<uintptr_t, uintptr_t>> result( m_blocks );
+				std::sort( result.begin(), result.end() );
+				return result;
+			}
+
+		private:
+			void* do_allocate( size_t bytes, size_t ) override
+			{
+				bytes = std::max<size_t>( bytes, 1 );
+#ifdef _WIN32
+				void* result = VirtualAlloc( nullptr, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+				if ( result == nullptr ) throw std::bad_alloc();
+#else
+				void* result = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+				if ( result == MAP_FAILED ) throw std::bad_alloc();
+#endif
+				std::lock_guard<std::mutex> lock( m_mutex );
+				m_blocks.emplace_back( reinterpret_cast<uintptr_t>(result), reinterpret_cast<uintptr_t>(result) + bytes );
+				return result;
+			}
+
+			void do_deallocate( void* p, size_t bytes, size_t ) override
+			{
+#ifdef _WIN32
+				(void)bytes;
+				VirtualFree( p, 0, MEM_RELEASE );
+#else
+				munmap( p, std::max<size_t>( bytes, 1 ) );
+#endif
+			}
+
+			bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+			{
+				return this == &other;
+			}
+
+			std::mutex m_mutex;
+			std::vector<std::pair<uintptr_t, uintptr_t>> m_blocks;
+		};
+
+		struct Region
+		{
+			uintptr_t begin;
+			uintptr_t end;
+			// Index into the module list, NO_MODULE for dynamic memory
+			size_t module;
+		};
+		static constexpr size_t NO_MODULE = SIZE_MAX;
+
+		struct Module
+		{
+			void* base;
+			string name;
+		};
+
+		struct Entry
+		{
+			uintptr_t value;
+			uintptr_t location;
+		};
+	}
+
+	struct Path
+	{
+		// Module holding the static pointer the path starts from
+		void* module = nullptr;
+		string moduleName;
+		uintptr_t rva = 0;
+		// Added after every dereference: target = [[[module + rva] + offsets[0]] + offsets[1]] + ...
+		std::vector<uint32_t> offsets;
+
+		// 0 if any pointer on the way can't be read
+		uintptr_t Resolve() const
+		{
+			uintptr_t address = reinterpret_cast<uintptr_t>(module) + rva;
+			for ( uint32_t offset : offsets )
+			{
+				uintptr_t value;
+				if ( !details::ReadMemory( address, &value, sizeof(value) ) )
+				{
+					return 0;
+				}
+				address = value + offset;
+			}
+			return address;
+		}
+
+		// "module+RVA" -> +offset -> ...
+		string ToString() const
+		{
+			auto hex = []( uintptr_t value ) {
+				string result;
+				do
+				{
+					result.insert( result.begin(), static_cast<LoaderModules::char_type>("0123456789ABCDEF"[value & 0xF]) );
+					value >>= 4;
+				}
+				while ( value != 0 );
+				return result;
+			};
+
+			string result = moduleName;
+			result += static_cast<LoaderModules::char_type>('+');
+			result += hex( rva );
+			for ( uint32_t offset : offsets )
+			{
+				for ( char ch : " -> +" )
+				{
+					if ( ch != '\0' ) result += static_cast<LoaderModules::char_type>(ch);
+				}
+				result += hex( offset );
+			}
+			return result;
+		}
+	};
+
+	class PointerMap
+	{
+	public:
+		// Snapshots all pointers to readable memory, stored in readable non-executable memory
+		explicit PointerMap( TaskPool::Pool& pool = TaskPool::Pool::Get() )
+		{
+			EnumerateModules();
+			EnumerateRegions();
+			Build( pool );
+		}
+
+		PointerMap( const PointerMap& ) = delete;
+		PointerMap& operator=( const PointerMap& ) = delete;
+
+		size_t Size() const { return m_entries.size(); }
+
+		// Calls func( location, value ) for every pointer with a value in [begin, end], in value order
+		// Return false from func to stop
+		template<typename Func>
+		void ForEachPointerInto( uintptr_t begin, uintptr_t end, Func&& func ) const
+		{
+			auto it = std::lower_bound( m_entries.begin(), m_entries.end(), begin, []( const details::Entry& entry, uintptr_t value ) {
+				return entry.value < value;
+			} );
+			for ( ; it != m_entries.end() && it->value <= end; ++it )
+			{
+				if ( !func( it->location, it->value ) )
+				{
+					break;
+				}
+			}
+		}
+
+		// Module holding the address, nullptr if it's in dynamic memory (or unreadable)
+		const details::Module* FindModule( uintptr_t address ) const
+		{
+			const details::Region* region = FindRegion( address );
+			return region != nullptr && region->module != details::NO_MODULE ? &m_modules[region->module] : nullptr;
+		}
+
+	private:
+		const details::Region* FindRegion( uintptr_t address ) const
+		{
+			auto it = std::upper_bound( m_regions.begin(), m_regions.end(), address, []( uintptr_t value, const details::Region& region ) {
+				return value < region.begin;
+			} );
+			if ( it == m_regions.begin() )
+			{
+				return nullptr;
+			}
+			--it;
+			return address < it->end ? &*it : nullptr;
+		}
+
+		void EnumerateModules()
+		{
+#ifdef _WIN32
+			LoaderModules::ForEach( [this]( const LoaderModules::Module& module ) {
+				m_modules.push_back( { module.base, string( module.name ) } );
+			} );
+#endif
+		}
+
+		size_t AddModule( void* base, LoaderModules::string_view name )
+		{
+			for ( size_t i = 0; i < m_modules.size(); i++ )
+			{
+				if ( m_modules[i].base == base )
+				{
+					return i;
+				}
+			}
+			m_modules.push_back( { base, string( name ) } );
+			return m_modules.size() - 1;
+		}
+
+		void EnumerateRegions()
+		{
+#ifdef _WIN32
+			constexpr DWORD READABLE = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY;
+
+			MEMORY_BASIC_INFORMATION info;
+			uintptr_t address = 0;
+			while ( VirtualQuery( reinterpret_cast<LPCVOID>(address), &info, sizeof(info) ) == sizeof(info) )
+			{
+				const uintptr_t begin = reinterpret_cast<uintptr_t>(info.BaseAddress);
+				const uintptr_t end = begin + info.RegionSize;
+				if ( info.State == MEM_COMMIT && (info.Protect & READABLE) != 0 && (info.Protect & PAGE_GUARD) == 0 )
+				{
+					size_t module = details::NO_MODULE;
+					if ( info.Type == MEM_IMAGE )
+					{
+						module = AddModule( info.AllocationBase, {} );
+					}
+					m_regions.push_back( { begin, end, module } );
+				}
+
+				if ( end <= address )
+				{
+					break;
+				}
+				address = end;
+			}
+#else
+			FILE* maps = fopen( "/proc/self/maps", "r" );
+			if ( maps == nullptr )
+			{
+				return;
+			}
+
+			char line[4096];
+			size_t lastModule = details::NO_MODULE;
+			uintptr_t lastEnd = 0;
+			while ( fgets( line, sizeof(line), maps ) != nullptr )
+			{
+				unsigned long long begin, end;
+				char perms[5];
+				int pathOffset = 0;
+				if ( sscanf( line, "%llx-%llx %4s %*s %*s %*s %n", &begin, &end, perms, &pathOffset ) < 3 )
+				{
+					continue;
+				}
+
+				char* path = line + pathOffset;
+				path[strcspn( path, "\n" )] = '\0';
+
+				// File mappings belong to the module mapped from that file, and so does the anonymous .bss right after them
+				size_t module = details::NO_MODULE;
+				if ( path[0] == '/' )
+				{
+					const char* name = strrchr( path, '/' ) + 1;
+					module = lastModule != details::NO_MODULE && m_modules[lastModule].name == name ? lastModule : AddModule( reinterpret_cast<void*>(begin), name );
+				}
+				else if ( path[0] == '\0' && begin == lastEnd )
+				{
+					module = lastModule;
+				}
+				lastModule = module;
+				lastEnd = static_cast<uintptr_t>(end);
+
+				// [vvar] and friends are the kernel's, but [heap] and [stack] are fair game
+				if ( perms[0] == 'r' && perms[2] != 'x' && strncmp( path, "[v", 2 ) != 0 )
+				{
+					m_regions.push_back( { static_cast<uintptr_t>(begin), static_cast<uintptr_t>(end), module } );
+				}
+			}
+			fclose( maps );
+#endif
+		}
+
+		void Build( TaskPool::Pool& pool )
+		{
+			if ( m_regions.empty() )
+			{
+				return;
+			}
+
+			constexpr uintptr_t CHUNK_SIZE = 1024 * 1024;
+			struct Chunk
+			{
+				uintptr_t begin;
+				size_t size;
+			};
+			std::pmr::vector<Chunk> chunks( &m_resource );
+			for ( const details::Region& region : m_regions )
+			{
+				for ( uintptr_t begin = region.begin; begin < region.end; begin += CHUNK_SIZE )
+				{
+					chunks.push_back( { begin, static_cast<size_t>(std::min( region.end - begin, CHUNK_SIZE )) } );
+				}
+			}
+
+			const uintptr_t lowest = m_regions.front().begin;
+			const uintptr_t highest = m_regions.back().end;
+
+			// Stacks of the threads doing the scan change under it, leave them out too
+			std::mutex stacksMutex;
+			std::pmr::vector<std::pair<uintptr_t, uintptr_t>> stacks( 1, details::CurrentThreadStack(), &m_resource );
+			auto addStack = [&] {
+				const auto stack = details::CurrentThreadStack();
+				std::lock_guard<std::mutex> lock( stacksMutex );
+				if ( std::find( stacks.begin(), stacks.end(), stack ) == stacks.end() )
+				{
+					stacks.push_back( stack );
+				}
+			};
+
+			std::pmr::vector<std::pmr::vector<details::Entry>> chunkEntries( chunks.size(), &m_resource );
+			TaskPool::ParallelFor( 0, chunks.size(), 1, [&]( size_t index ) {
+				addStack();
+
+				const Chunk& chunk = chunks[index];
+				std::pmr::vector<uintptr_t> buffer( chunk.size / sizeof(uintptr_t), &m_resource );
+				if ( !details::ReadMemory( chunk.begin, buffer.data(), buffer.size() * sizeof(uintptr_t) ) )
+				{
+					// Parts may have been freed in the meantime - salvage what's left page by page
+					constexpr size_t PAGE_SIZE = 4096;
+					for ( size_t page = 0; page < chunk.size; page += PAGE_SIZE )
+					{
+						uintptr_t* pageData = buffer.data() + page / sizeof(uintptr_t);
+						const size_t pageSize = std::min( chunk.size - page, PAGE_SIZE );
+						if ( !details::ReadMemory( chunk.begin + page, pageData, pageSize ) )
+						{
+							std::fill_n( pageData, pageSize / sizeof(uintptr_t), uintptr_t(0) );
+						}
+					}
+				}
+
+				auto& entries = chunkEntries[index];
+				for ( size_t i = 0; i < buffer.size(); i++ )
+				{
+					const uintptr_t value = buffer[i];
+					if ( value >= lowest && value < highest && FindRegion( value ) != nullptr )
+					{
+						entries.push_back( { value, chunk.begin + i * sizeof(uintptr_t) } );
+					}
+				}
+			}, pool );
+
+			size_t numEntries = 0;
+			for ( const auto& entries : chunkEntries )
+			{
+				numEntries += entries.size();
+			}
+			m_entries.reserve( numEntries );
+
+			auto excluded = m_resource.Blocks();
+			excluded.insert( excluded.end(), stacks.begin(), stacks.end() );
+			std::sort( excluded.begin(), excluded.end() );
+			auto ours = [&excluded]( uintptr_t address ) {
+				auto it = std::upper_bound( excluded.begin(), excluded.end(), std::make_pair( address, UINTPTR_MAX ) );
+				return it != excluded.begin() && address < std::prev( it )->second;
+			};
+
+			for ( auto& entries : chunkEntries )
+			{
+				std::copy_if( entries.begin(), entries.end(), std::back_inserter( m_entries ), [&]( const details::Entry& entry ) {
+					return !ours( entry.location ) && !ours( entry.value );
+				} );
+				entries = std::pmr::vector<details::Entry>( &m_resource );
+			}
+
+			std::sort( m_entries.begin(), m_entries.end(), []( const details::Entry& a, const details::Entry& b ) {
+				return a.value != b.value ? a.value < b.value : a.location < b.location;
+			} );
+		}
+
+		details::PageResource m_resource;
+		std::pmr::vector<details::Module> m_modules { &m_resource };
+		std::pmr::vector<details::Region> m_regions { &m_resource };
+		std::pmr::vector<details::Entry> m_entries { &m_resource };
+	};
+
+	// Breadth first, so the shortest paths come first
+	inline std::vector<Path> FindPaths( const PointerMap& map, uintptr_t target, const Options& options = Options() )
+	{
+		struct Node
+		{
+			uintptr_t address;
+			size_t parent;
+			// Leads from the value stored at address to the parent's address
+			uint32_t offset;
+		};
+
+		std::vector<Path> results;
+		std::vector<Node> nodes { { target, 0, 0 } };
+		std::unordered_set<uintptr_t> visited { target };
+
+		auto makePath = [&]( const details::Module& module, uintptr_t location, uint32_t offset, size_t parent ) {
+			Path path;
+			path.module = module.base;
+			path.moduleName = module.name;
+			path.rva = location - reinterpret_cast<uintptr_t>(module.base);
+			path.offsets.push_back( offset );
+			for ( size_t node = parent; node != 0; node = nodes[node].parent )
+			{
+				path.offsets.push_back( nodes[node].offset );
+			}
+			return path;
+		};
+
+		size_t levelBegin = 0, levelEnd = 1;
+		for ( size_t depth = 1; depth <= options.maxDepth && levelBegin != levelEnd; depth++ )
+		{
+			size_t levelNodes = 0;
+			for ( size_t n = levelBegin; n < levelEnd && results.size() < options.maxResults; n++ )
+			{
+				const uintptr_t address = nodes[n].address;
+				const uintptr_t lowest = address > options.maxOffset ? address - options.maxOffset : 0;
+				map.ForEachPointerInto( lowest, address, [&]( uintptr_t location, uintptr_t value ) {
+					const uint32_t offset = static_cast<uint32_t>(address - value);
+
+					const details::Module* module = map.FindModule( location );
+					if ( module != nullptr )
+					{
+						// Pointers on the way may have changed since the snapshot, so only keep paths which resolve right now
+						Path path = makePath( *module, location, offset, n );
+						if ( path.Resolve() == target )
+						{
+							results.push_back( std::move(path) );
+						}
+						return results.size() < options.maxResults;
+					}
+
+					if ( depth < options.maxDepth && levelNodes < options.maxNodesPerLevel && visited.insert( location ).second )
+					{
+						nodes.push_back( { location, n, offset } );
+						levelNodes++;
+					}
+					return true;
+				} );
+			}
+
+			levelBegin = levelEnd;
+			levelEnd = nodes.size();
+		}
+		return results;
+	}
+
+	inline std::vector<Path> FindPaths( uintptr_t target, const Options& options = Options() )
+	{
+		const PointerMap map;
+		return FindPaths( map, target, options );
+	}
+
+	// Keeps only the paths still leading to target - call whenever the object gets recreated to weed out unstable paths
+	inline std::vector<Path> FilterPaths( std::vector<Path> paths, uintptr_t target )
+	{
+		paths.erase( std::remove_if( paths.begin(), paths.end(), [target]( const Path& path ) {
+			return path.Resolve() != target;
+		} ), paths.end() );
+		return paths;
+	}
+}
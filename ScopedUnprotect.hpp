@@ -3,6 +3,9 @@
 #include <forward_list>
 #include <tuple>
 #include <memory>
+#include <memory_resource>
+
+#include "InitArena.hpp"
 
 // Object that removes write protection from the code section or the entire module for as long as the object is in scope
 namespace ScopedUnprotect
@@ -43,7 +46,7 @@ namespace ScopedUnprotect
 		}
 
 	private:
-		std::forward_list< std::tuple< LPVOID, SIZE_T, DWORD > >	m_queriedProtects;
+		std::pmr::forward_list< std::tuple< LPVOID, SIZE_T, DWORD > >	m_queriedProtects { InitArena::GetResource() };
 	};
 
 	class Section : public Unprotect
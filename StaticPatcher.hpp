@@ -0,0 +1,501 @@
+#pragma once
+
+// Ahead-of-time patching of an executable on disk
+// For a fixed patch set, resolving patterns and applying patches on every launch is wasted startup time.
+// Instead, the same patch code can be ran once offline against a copy of the executable loaded by StaticPatch::Image,
+// and the result saved as a new executable. At runtime, StaticPatch::Bind then only verifies the patched bytes.
+//
+// Offline:
+//	StaticPatch::Image image( L"game.exe" );
+//	{
+//		StaticPatch::Session session( image );
+//		ApplyPatches();
+//	}
+//	image.Save( L"game.patched.exe", PATCH_SET_ID );
+//
+// Runtime:
+//	if ( StaticPatch::Bind( PATCH_SET_ID, hModule ) != StaticPatch::Status::Applied ) ApplyPatches();
+//
+// While a session is alive, patterns and DynBase addresses resolve into the image copy, so Memory:: functions patch it.
+// Hooks into the mod must go through StaticPatch::Target( func ) - the mod's address is only known at runtime,
+// so offline it returns a thunk in the new section jumping through a slot, which Bind fills in.
+// Outside of a session Target returns the function unchanged.
+//
+// Limitations:
+// - The image is loaded at its preferred base, so the patcher process itself must not occupy it.
+// - The patched executable has ASLR disabled, so absolute addresses written by the patches stay valid.
+// - Patches may only touch the initialized data of the sections. SwitchableHook and Trampoline allocations
+//   live outside of the image and are not supported offline.
+
+#include "MemoryMgr.h"
+#include "Patterns.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace StaticPatch
+{
+	enum class Status
+	{
+		NotPatched,
+		Applied,
+		Mismatch, // Patched with a different patch set or mod build, or modified since
+	};
+
+	class Image;
+
+	namespace details
+	{
+		constexpr char SECTION_NAME[IMAGE_SIZEOF_SHORT_NAME] = ".modutl";
+		constexpr uint32_t MAGIC = 0x5053554D; // 'MUSP'
+		constexpr uint32_t VERSION = 1;
+
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint64_t patchSetId;
+
+			// Module the thunks jump into
+			uint32_t targetTimeDateStamp;
+			uint32_t targetSizeOfImage;
+
+			uint32_t numSlots;
+			uint32_t slotsRva;
+			uint32_t numRanges;
+			uint32_t rangesRva;
+		};
+
+		struct Slot
+		{
+			uint32_t slotRva;
+			uint32_t targetRva;
+		};
+
+		struct Range
+		{
+			uint32_t rva;
+			uint32_t size;
+			uint64_t hash;
+		};
+
+		inline uint64_t Hash( const uint8_t* data, size_t size )
+		{
+			uint64_t hash = 14695981039346656037u;
+			for ( size_t i = 0; i < size; i++ )
+			{
+				hash ^= data[i];
+				hash *= 1099511628211u;
+			}
+			return hash;
+		}
+
+		inline PIMAGE_NT_HEADERS GetNtHeaders( const void* base )
+		{
+			const PIMAGE_DOS_HEADER dosHeader = (PIMAGE_DOS_HEADER)base;
+			return (PIMAGE_NT_HEADERS)((DWORD_PTR)base + dosHeader->e_lfanew);
+		}
+
+		inline PIMAGE_SECTION_HEADER FindSection( PIMAGE_NT_HEADERS ntHeader, const char* name )
+		{
+			PIMAGE_SECTION_HEADER section = IMAGE_FIRST_SECTION(ntHeader);
+			for ( WORD i = 0; i < ntHeader->FileHeader.NumberOfSections; i++, section++ )
+			{
+				if ( strncmp( (const char*)section->Name, name, IMAGE_SIZEOF_SHORT_NAME ) == 0 )
+				{
+					return section;
+				}
+			}
+			return nullptr;
+		}
+
+		// Same algorithm as CheckSumMappedFile
+		inline DWORD ComputeChecksum( const uint8_t* data, size_t size, size_t checksumOffset )
+		{
+			uint64_t sum = 0;
+			for ( size_t i = 0; i < size; i += 2 )
+			{
+				if ( i == checksumOffset || i == checksumOffset + 2 ) continue;
+
+				sum += data[i] | (i + 1 < size ? data[i + 1] << 8 : 0);
+				sum = (sum & 0xFFFF) + (sum >> 16);
+			}
+			sum = (sum & 0xFFFF) + (sum >> 16);
+			return static_cast<DWORD>(sum + size);
+		}
+
+		inline Image*& CurrentImage()
+		{
+			static Image* image = nullptr;
+			return image;
+		}
+	}
+
+	// Executable loaded from disk in image layout, with an extra section for thunks and code caves
+	class Image
+	{
+	public:
+		explicit Image( const wchar_t* path, size_t caveSize = 64 * 1024 )
+		{
+			m_file = CreateFileW( path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+			if ( m_file == INVALID_HANDLE_VALUE ) return;
+
+			LARGE_INTEGER fileSize;
+			if ( !GetFileSizeEx( m_file, &fileSize ) ) return;
+			m_fileSize = static_cast<size_t>(fileSize.QuadPart);
+
+			m_mapping = CreateFileMappingW( m_file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+			if ( m_mapping == nullptr ) return;
+
+			m_fileView = static_cast<const uint8_t*>(MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ));
+			if ( m_fileView == nullptr || m_fileSize < sizeof(IMAGE_DOS_HEADER) ) return;
+
+			const PIMAGE_DOS_HEADER dosHeader = (PIMAGE_DOS_HEADER)m_fileView;
+			if ( dosHeader->e_magic != IMAGE_DOS_SIGNATURE || size_t(dosHeader->e_lfanew) + sizeof(IMAGE_NT_HEADERS) > m_fileSize ) return;
+
+			// The patch code is native, so the executable must be too
+			const PIMAGE_NT_HEADERS ntHeader = details::GetNtHeaders( m_fileView );
+			if ( ntHeader->Signature != IMAGE_NT_SIGNATURE || ntHeader->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR_MAGIC ) return;
+
+			const DWORD sectionAlignment = ntHeader->OptionalHeader.SectionAlignment;
+			m_caveRva = AlignUp( ntHeader->OptionalHeader.SizeOfImage, sectionAlignment );
+			m_caveSize = AlignUp( static_cast<DWORD>(caveSize), sectionAlignment );
+
+			m_base = static_cast<uint8_t*>(VirtualAlloc( (LPVOID)ntHeader->OptionalHeader.ImageBase, m_caveRva + m_caveSize, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE ));
+			if ( m_base == nullptr ) return;
+
+			memcpy( m_base, m_fileView, std::min<size_t>( ntHeader->OptionalHeader.SizeOfHeaders, m_fileSize ) );
+
+			const PIMAGE_SECTION_HEADER sections = IMAGE_FIRST_SECTION(ntHeader);
+			for ( WORD i = 0; i < ntHeader->FileHeader.NumberOfSections; i++ )
+			{
+				const size_t rawSize = RawSizeInImage( sections[i] );
+				if ( size_t(sections[i].PointerToRawData) + rawSize > m_fileSize ) return;
+
+				memcpy( m_base + sections[i].VirtualAddress, m_fileView + sections[i].PointerToRawData, rawSize );
+			}
+
+			// Header goes first, and is filled in when saving
+			m_caveUsed = sizeof(details::Header);
+			m_valid = true;
+		}
+
+		~Image()
+		{
+			if ( m_base != nullptr ) VirtualFree( m_base, 0, MEM_RELEASE );
+			if ( m_fileView != nullptr ) UnmapViewOfFile( m_fileView );
+			if ( m_mapping != nullptr ) CloseHandle( m_mapping );
+			if ( m_file != INVALID_HANDLE_VALUE ) CloseHandle( m_file );
+		}
+
+		Image( const Image& ) = delete;
+		Image& operator=( const Image& ) = delete;
+
+		bool Valid() const { return m_valid; }
+		uint8_t* GetBase() const { return m_base; }
+
+		// Space in the new section, e.g. for code caves
+		void* Allocate( size_t size, size_t align = 1 )
+		{
+			const size_t offset = (m_caveUsed + align - 1) & ~(align - 1);
+			if ( offset + size > m_caveSize )
+			{
+				assert( !"Out of code cave space!" );
+				return nullptr;
+			}
+			m_caveUsed = offset + size;
+			return m_base + m_caveRva + offset;
+		}
+
+		// Thunk jumping through a slot bound to 'target' at runtime
+		void* MakeThunk( void* target )
+		{
+			HMODULE module;
+			if ( !GetModuleHandleExW( GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS|GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCWSTR)target, &module ) )
+			{
+				assert( !"Hook target is not in a module!" );
+				return nullptr;
+			}
+
+			// All targets must come from the same module, as that's the one that binds them
+			assert( m_targetModule == nullptr || m_targetModule == module );
+			m_targetModule = module;
+
+			const uint32_t targetRva = static_cast<uint32_t>((uintptr_t)target - (uintptr_t)module);
+			for ( const auto& thunk : m_thunks )
+			{
+				if ( thunk.second.targetRva == targetRva ) return thunk.first;
+			}
+
+			uintptr_t* slot = static_cast<uintptr_t*>(Allocate( sizeof(uintptr_t), alignof(uintptr_t) ));
+			uint8_t* thunk = static_cast<uint8_t*>(Allocate( 6, 8 ));
+			if ( slot == nullptr || thunk == nullptr ) return nullptr;
+
+			*slot = 0;
+
+			// jmp [slot]
+			thunk[0] = 0xFF;
+			thunk[1] = 0x25;
+#ifdef _WIN64
+			Memory::WriteOffsetValue( thunk + 2, slot );
+#else
+			// The image is loaded at its preferred base and will stay there, so absolute addresses are final
+			Memory::Patch( thunk + 2, slot );
+#endif
+
+			m_thunks.emplace_back( thunk, details::Slot{ Rva( slot ), targetRva } );
+			return thunk;
+		}
+
+		// Writes the patched executable to 'path', tagged with 'patchSetId'
+		bool Save( const wchar_t* path, uint64_t patchSetId )
+		{
+			if ( !m_valid ) return false;
+
+			std::vector<uint8_t> file( m_fileView, m_fileView + m_fileSize );
+			PIMAGE_NT_HEADERS ntHeader = details::GetNtHeaders( file.data() );
+
+			// Room for another section header
+			const size_t sectionHeaderOffset = (uint8_t*)(IMAGE_FIRST_SECTION(ntHeader) + ntHeader->FileHeader.NumberOfSections) - file.data();
+			if ( !MakeRoomForSectionHeader( file, sectionHeaderOffset ) ) return false;
+
+			// Bake the sections and record what has changed
+			std::vector<details::Range> ranges;
+			const PIMAGE_SECTION_HEADER sections = IMAGE_FIRST_SECTION(ntHeader);
+			for ( WORD i = 0; i < ntHeader->FileHeader.NumberOfSections; i++ )
+			{
+				const PIMAGE_SECTION_HEADER section = &sections[i];
+				const size_t rawSize = RawSizeInImage( *section );
+				const uint8_t* patched = m_base + section->VirtualAddress;
+				uint8_t* original = file.data() + section->PointerToRawData;
+
+				// Uninitialized data can't be persisted
+				const size_t virtualSize = std::min<size_t>( section->Misc.VirtualSize, m_caveRva - section->VirtualAddress );
+				for ( size_t j = rawSize; j < virtualSize; j++ )
+				{
+					if ( patched[j] != 0 ) return false;
+				}
+
+				for ( size_t j = 0; j < rawSize; )
+				{
+					if ( patched[j] == original[j] )
+					{
+						j++;
+						continue;
+					}
+
+					// Merge changes which are close together
+					size_t end = j + 1, lastChange = j;
+					for ( ; end < rawSize && end - lastChange < 16; end++ )
+					{
+						if ( patched[end] != original[end] ) lastChange = end;
+					}
+					const size_t size = lastChange + 1 - j;
+					ranges.push_back( { static_cast<uint32_t>(section->VirtualAddress + j), static_cast<uint32_t>(size), details::Hash( patched + j, size ) } );
+					j = lastChange + 1;
+				}
+				memcpy( original, patched, rawSize );
+			}
+
+			// Tables, then the header
+			details::Slot* slots = static_cast<details::Slot*>(Allocate( sizeof(details::Slot) * std::max<size_t>( m_thunks.size(), 1 ), alignof(details::Slot) ));
+			details::Range* rangeTable = static_cast<details::Range*>(Allocate( sizeof(details::Range) * std::max<size_t>( ranges.size(), 1 ), alignof(details::Range) ));
+			if ( slots == nullptr || rangeTable == nullptr ) return false;
+
+			for ( size_t i = 0; i < m_thunks.size(); i++ )
+			{
+				slots[i] = m_thunks[i].second;
+			}
+			std::copy( ranges.begin(), ranges.end(), rangeTable );
+
+			details::Header* header = reinterpret_cast<details::Header*>(m_base + m_caveRva);
+			header->magic = details::MAGIC;
+			header->version = details::VERSION;
+			header->patchSetId = patchSetId;
+			header->targetTimeDateStamp = 0;
+			header->targetSizeOfImage = 0;
+			if ( m_targetModule != nullptr )
+			{
+				const PIMAGE_NT_HEADERS targetHeader = details::GetNtHeaders( m_targetModule );
+				header->targetTimeDateStamp = targetHeader->FileHeader.TimeDateStamp;
+				header->targetSizeOfImage = targetHeader->OptionalHeader.SizeOfImage;
+			}
+			header->numSlots = static_cast<uint32_t>(m_thunks.size());
+			header->slotsRva = Rva( slots );
+			header->numRanges = static_cast<uint32_t>(ranges.size());
+			header->rangesRva = Rva( rangeTable );
+
+			// Append the new section at the end of the file, past any overlay
+			const DWORD fileAlignment = ntHeader->OptionalHeader.FileAlignment;
+			const DWORD rawSize = AlignUp( static_cast<DWORD>(m_caveUsed), fileAlignment );
+			const DWORD rawOffset = AlignUp( static_cast<DWORD>(file.size()), fileAlignment );
+			file.resize( rawOffset + rawSize, 0 );
+			memcpy( file.data() + rawOffset, m_base + m_caveRva, m_caveUsed );
+
+			ntHeader = details::GetNtHeaders( file.data() );
+			IMAGE_SECTION_HEADER& newSection = *reinterpret_cast<PIMAGE_SECTION_HEADER>(file.data() + sectionHeaderOffset);
+			memset( &newSection, 0, sizeof(newSection) );
+			memcpy( newSection.Name, details::SECTION_NAME, IMAGE_SIZEOF_SHORT_NAME );
+			newSection.Misc.VirtualSize = static_cast<DWORD>(m_caveUsed);
+			newSection.VirtualAddress = m_caveRva;
+			newSection.SizeOfRawData = rawSize;
+			newSection.PointerToRawData = rawOffset;
+			newSection.Characteristics = IMAGE_SCN_CNT_CODE|IMAGE_SCN_MEM_EXECUTE|IMAGE_SCN_MEM_READ;
+
+			ntHeader->FileHeader.NumberOfSections++;
+			ntHeader->OptionalHeader.SizeOfImage = AlignUp( m_caveRva + static_cast<DWORD>(m_caveUsed), ntHeader->OptionalHeader.SectionAlignment );
+			ntHeader->OptionalHeader.SizeOfCode += rawSize;
+			ntHeader->OptionalHeader.DllCharacteristics &= ~IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE;
+
+			// The signature can't be valid anymore
+			ntHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY].VirtualAddress = 0;
+			ntHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY].Size = 0;
+
+			const size_t checksumOffset = (uint8_t*)&ntHeader->OptionalHeader.CheckSum - file.data();
+			ntHeader->OptionalHeader.CheckSum = details::ComputeChecksum( file.data(), file.size(), checksumOffset );
+
+			HANDLE outFile = CreateFileW( path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+			if ( outFile == INVALID_HANDLE_VALUE ) return false;
+
+			DWORD written;
+			const bool result = WriteFile( outFile, file.data(), static_cast<DWORD>(file.size()), &written, nullptr ) != FALSE && written == file.size();
+			CloseHandle( outFile );
+			return result;
+		}
+
+	private:
+		static DWORD AlignUp( DWORD value, DWORD alignment )
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		uint32_t Rva( const void* ptr ) const
+		{
+			return static_cast<uint32_t>((const uint8_t*)ptr - m_base);
+		}
+
+		size_t RawSizeInImage( const IMAGE_SECTION_HEADER& section ) const
+		{
+			const size_t virtualSize = section.Misc.VirtualSize != 0 ? section.Misc.VirtualSize : section.SizeOfRawData;
+			return std::min<size_t>( std::min<size_t>( section.SizeOfRawData, virtualSize ), m_caveRva - std::min<size_t>( section.VirtualAddress, m_caveRva ) );
+		}
+
+		static bool MakeRoomForSectionHeader( std::vector<uint8_t>& file, size_t offset )
+		{
+			PIMAGE_NT_HEADERS ntHeader = details::GetNtHeaders( file.data() );
+			if ( offset + sizeof(IMAGE_SECTION_HEADER) > ntHeader->OptionalHeader.SizeOfHeaders ) return false;
+
+			const auto isFree = [&] {
+				return std::all_of( file.begin() + offset, file.begin() + offset + sizeof(IMAGE_SECTION_HEADER), []( uint8_t b ) { return b == 0; } );
+			};
+			if ( isFree() ) return true;
+
+			// Bound imports often live right after the section headers, but they are only an optimization
+			IMAGE_DATA_DIRECTORY& boundImports = ntHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT];
+			if ( boundImports.VirtualAddress != 0 && boundImports.VirtualAddress + boundImports.Size <= ntHeader->OptionalHeader.SizeOfHeaders )
+			{
+				memset( file.data() + boundImports.VirtualAddress, 0, boundImports.Size );
+				boundImports.VirtualAddress = 0;
+				boundImports.Size = 0;
+			}
+			return isFree();
+		}
+
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+		const uint8_t* m_fileView = nullptr;
+		size_t m_fileSize = 0;
+
+		uint8_t* m_base = nullptr;
+		DWORD m_caveRva = 0;
+		DWORD m_caveSize = 0;
+		size_t m_caveUsed = 0;
+
+		HMODULE m_targetModule = nullptr;
+		std::vector<std::pair<void*, details::Slot>> m_thunks;
+
+		bool m_valid = false;
+	};
+
+	// Redirects patterns, DynBase addresses and Target to the image for as long as the object is in scope
+	class Session
+	{
+	public:
+		explicit Session( Image& image )
+			: m_previousImage( std::exchange( details::CurrentImage(), &image ) )
+			, m_previousBase( std::exchange( Memory::details::ProcessBaseOverride(), uintptr_t(image.GetBase()) ) )
+		{
+			assert( image.Valid() );
+		}
+
+		~Session()
+		{
+			details::CurrentImage() = m_previousImage;
+			Memory::details::ProcessBaseOverride() = m_previousBase;
+		}
+
+		Session( const Session& ) = delete;
+		Session& operator=( const Session& ) = delete;
+
+	private:
+		Image* m_previousImage;
+		uintptr_t m_previousBase;
+	};
+
+	// Hook target - 'func' itself, or a thunk bound at runtime while patching offline
+	template<typename Func>
+	inline Func Target( Func func )
+	{
+		Image* image = details::CurrentImage();
+		if ( image == nullptr ) return func;
+
+		void* target;
+		memcpy( &target, std::addressof(func), sizeof(target) );
+
+		void* thunk = image->MakeThunk( target );
+		Func result = func;
+		memcpy( std::addressof(result), &thunk, sizeof(thunk) );
+		return result;
+	}
+
+	// Checks whether the running executable was patched offline with 'patchSetId', and binds the thunks to 'module'
+	// Does nothing beyond verification if it wasn't
+	inline Status Bind( uint64_t patchSetId, HMODULE module )
+	{
+		const uint8_t* base = (const uint8_t*)GetModuleHandle( nullptr );
+		const PIMAGE_SECTION_HEADER section = details::FindSection( details::GetNtHeaders( base ), details::SECTION_NAME );
+		if ( section == nullptr ) return Status::NotPatched;
+
+		const details::Header* header = (const details::Header*)(base + section->VirtualAddress);
+		if ( header->magic != details::MAGIC || header->version != details::VERSION || header->patchSetId != patchSetId )
+		{
+			return Status::Mismatch;
+		}
+
+		if ( header->numSlots != 0 )
+		{
+			const PIMAGE_NT_HEADERS targetHeader = details::GetNtHeaders( module );
+			if ( targetHeader->FileHeader.TimeDateStamp != header->targetTimeDateStamp || targetHeader->OptionalHeader.SizeOfImage != header->targetSizeOfImage )
+			{
+				return Status::Mismatch;
+			}
+		}
+
+		const details::Range* ranges = (const details::Range*)(base + header->rangesRva);
+		for ( uint32_t i = 0; i < header->numRanges; i++ )
+		{
+			if ( details::Hash( base + ranges[i].rva, ranges[i].size ) != ranges[i].hash ) return Status::Mismatch;
+		}
+
+		const details::Slot* slots = (const details::Slot*)(base + header->slotsRva);
+		for ( uint32_t i = 0; i < header->numSlots; i++ )
+		{
+			Memory::VP::Patch( base + slots[i].slotRva, (uintptr_t)module + slots[i].targetRva );
+		}
+		return Status::Applied;
+	}
+};
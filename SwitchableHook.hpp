@@ -0,0 +1,138 @@
+#pragma once
+
+// Hooks which can be toggled at runtime (e.g. from an options menu or a debug overlay) without rewriting any code
+// On installation, the call site is redirected once to a stub jumping through a pointer sized slot:
+// x64 - jmp [rip+slot], placed in a Trampoline near the call site
+// x86 - jmp [slot], placed in a small executable page owned by this header
+// Enabling and disabling the hook is then a single atomic store to that slot - no VirtualProtect calls,
+// and other threads can never observe a partially written instruction.
+// NOTE: Stubs and slots are never freed, just like trampolines
+
+#include "MemoryMgr.h"
+#include "Trampoline.h"
+
+#include <cstring>
+#include <memory>
+
+class SwitchableHook
+{
+public:
+	SwitchableHook() = default;
+
+	// Redirects an existing call or jump at 'address' through a switchable stub
+	// The hook starts enabled, and the original call target is preserved for Disable and GetOriginal
+	template<typename AT, typename Func>
+	static SwitchableHook MakeHook( AT address, Func hook )
+	{
+		assert( *reinterpret_cast<const uint8_t*>(address) == 0xE8 || *reinterpret_cast<const uint8_t*>(address) == 0xE9 );
+
+		void* hookPtr;
+		memcpy( &hookPtr, std::addressof(hook), sizeof(hookPtr) );
+
+		SwitchableHook result;
+		result.m_hook = hookPtr;
+		result.m_original = Memory::ReadCallFrom( address );
+
+		void* stub = result.CreateStub( uintptr_t(address) );
+		*result.m_slot = hookPtr;
+		Memory::VP::InjectHook( address, stub );
+		return result;
+	}
+
+	bool Valid() const { return m_slot != nullptr; }
+
+	void Enable()
+	{
+		assert( Valid() );
+		InterlockedExchangePointer( m_slot, m_hook );
+	}
+
+	void Disable()
+	{
+		assert( Valid() );
+		InterlockedExchangePointer( m_slot, m_original );
+	}
+
+	void Set( bool enable )
+	{
+		enable ? Enable() : Disable();
+	}
+
+	bool IsEnabled() const
+	{
+		assert( Valid() );
+		return *static_cast<void* volatile*>(m_slot) == m_hook;
+	}
+
+	template<typename Func>
+	void GetOriginal( Func& func ) const
+	{
+		func = {};
+		memcpy( std::addressof(func), &m_original, sizeof(m_original) );
+	}
+
+	void* GetOriginal() const
+	{
+		return m_original;
+	}
+
+private:
+#ifdef _WIN64
+	void* CreateStub( uintptr_t address )
+	{
+		// jmp [rip+disp32] - 6 bytes of code plus a pointer aligned slot
+		Trampoline* trampoline = Trampoline::MakeTrampoline( address, STUB_SIZE + sizeof(void*) + alignof(void*), alignof(void*) );
+		m_slot = trampoline->Pointer<void*>();
+
+		std::byte* code = trampoline->RawSpace( STUB_SIZE );
+		const int32_t disp = static_cast<int32_t>(reinterpret_cast<intptr_t>(m_slot) - reinterpret_cast<intptr_t>(code + STUB_SIZE));
+
+		const uint8_t jmp[] = { 0xFF, 0x25 };
+		memcpy( code, jmp, sizeof(jmp) );
+		memcpy( code + sizeof(jmp), &disp, sizeof(disp) );
+		return code;
+	}
+#else
+	void* CreateStub( uintptr_t )
+	{
+		// jmp [slot] - 6 bytes of code plus a pointer aligned slot, allocated together
+		uint8_t* space = static_cast<uint8_t*>(GetStubSpace( sizeof(void*) + STUB_SIZE ));
+		m_slot = reinterpret_cast<void**>(space);
+
+		uint8_t* code = space + sizeof(void*);
+		const uint8_t jmp[] = { 0xFF, 0x25 };
+		memcpy( code, jmp, sizeof(jmp) );
+		memcpy( code + sizeof(jmp), &m_slot, sizeof(m_slot) );
+		return code;
+	}
+
+	static void* GetStubSpace( size_t size )
+	{
+		static uint8_t* pageMemory = nullptr;
+		static size_t spaceLeft = 0;
+
+		// Keep slots pointer aligned
+		size = (size + alignof(void*) - 1) & ~(alignof(void*) - 1);
+		if ( spaceLeft < size )
+		{
+			SYSTEM_INFO systemInfo;
+			GetSystemInfo( &systemInfo );
+
+			pageMemory = static_cast<uint8_t*>(VirtualAlloc( nullptr, systemInfo.dwPageSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE ));
+			spaceLeft = pageMemory != nullptr ? systemInfo.dwPageSize : 0;
+			assert( spaceLeft >= size );
+		}
+
+		void* space = pageMemory;
+		pageMemory += size;
+		spaceLeft -= size;
+		return space;
+	}
+#endif
+
+	static constexpr size_t STUB_SIZE = 6;
+
+	void** m_slot = nullptr;
+	void* m_hook = nullptr;
+	void* m_original = nullptr;
+};
@@ -0,0 +1,470 @@
+#pragma once
+
+// Small work-stealing thread pool
+// Every worker owns a deque - it pushes and pops its own tasks at the back, while idle workers steal from the front.
+// Tasks submitted from outside of the pool go to a shared queue. Threads are only spun up on first use,
+// and a thread waiting on a TaskGroup runs pending tasks instead of just blocking.
+// Portable, so the offline tools use it too.
+//
+// NOTE: Tasks must not throw.
+// NOTE: On Windows, every worker holds a reference to the module the pool lives in, so FreeLibrary won't unmap it
+// while the workers still run - call Shutdown from your own teardown code before the module is meant to unload.
+// No tasks may be submitted concurrently with Shutdown.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+namespace TaskPool
+{
+	using Task = std::function<void()>;
+
+	namespace details
+	{
+#ifdef _WIN32
+		// True when called from static destructors during ExitProcess - all other threads are already gone by then
+		inline bool ProcessTerminating()
+		{
+			using Func = BOOLEAN (NTAPI*)();
+			static const Func func = [] {
+				const HMODULE ntdll = GetModuleHandleW( L"ntdll" );
+				return ntdll != nullptr ? reinterpret_cast<Func>(GetProcAddress( ntdll, "RtlDllShutdownInProgress" )) : nullptr;
+			}();
+			return func != nullptr && func() != 0;
+		}
+
+		// Keeps the module this code is in loaded, for threads which run it - they end with FreeLibraryAndExitThread
+		inline HMODULE ReferenceThisModule()
+		{
+			HMODULE module = nullptr;
+			if ( GetModuleHandleExW( GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCWSTR>(&ReferenceThisModule), &module ) == FALSE )
+			{
+				module = nullptr;
+			}
+			return module;
+		}
+
+		inline DWORD ExitThreadInModule( HMODULE module )
+		{
+			if ( module != nullptr )
+			{
+				FreeLibraryAndExitThread( module, 0 );
+			}
+			return 0;
+		}
+#endif
+	}
+
+	class Pool
+	{
+	public:
+		// By default one thread less than there are hardware threads, as the thread waiting for the results helps too
+		explicit Pool( size_t numThreads = 0 )
+			: m_numThreads( numThreads != 0 ? numThreads : DefaultNumThreads() )
+		{
+		}
+
+		~Pool()
+		{
+#ifdef _WIN32
+			// Workers may have been killed while holding a lock, there is nothing left to wait for
+			if ( details::ProcessTerminating() ) return;
+#endif
+			Shutdown();
+		}
+
+		Pool( const Pool& ) = delete;
+		Pool& operator=( const Pool& ) = delete;
+
+		// Process-wide pool shared by the library
+		static Pool& Get()
+		{
+			static Pool pool;
+			return pool;
+		}
+
+		size_t NumThreads() const { return m_numThreads; }
+
+		// Queues a task - onto the calling worker's own deque if called from within the pool
+		// After Shutdown, tasks are executed immediately on the calling thread
+		void Submit( Task task )
+		{
+			if ( m_state.load( std::memory_order_acquire ) != State::Running && !Start() )
+			{
+				task();
+				return;
+			}
+
+			// Counted before it's visible, so sleeping workers never miss it
+			m_pending.fetch_add( 1 );
+
+			Worker* self = CurrentWorker();
+			if ( self != nullptr )
+			{
+				std::lock_guard<std::mutex> lock( self->mutex );
+				self->tasks.push_back( std::move(task) );
+			}
+			else
+			{
+				std::lock_guard<std::mutex> lock( m_queueMutex );
+				m_queue.push_back( std::move(task) );
+			}
+
+			if ( m_sleepers.load() != 0 )
+			{
+				// Worker may be between checking the predicate and waiting - taking the mutex orders us after either
+				{ std::lock_guard<std::mutex> lock( m_sleepMutex ); }
+				m_wake.notify_one();
+			}
+		}
+
+		// Runs one pending task on the calling thread, if there is any
+		bool TryRunOne()
+		{
+			Task task;
+			if ( TryPop( CurrentWorker(), task ) )
+			{
+				task();
+				return true;
+			}
+			return false;
+		}
+
+		// Finishes all queued tasks and joins the workers
+		void Shutdown()
+		{
+			{
+				std::lock_guard<std::mutex> lock( m_startMutex );
+				if ( m_state.exchange( State::Stopped ) != State::Running )
+				{
+					return;
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock( m_sleepMutex );
+				m_stop = true;
+			}
+			m_wake.notify_all();
+
+			for ( auto& worker : m_workers )
+			{
+				Join( *worker );
+			}
+			m_workers.clear();
+		}
+
+	private:
+		enum class State
+		{
+			NotStarted,
+			Running,
+			Stopped,
+		};
+
+		struct Worker
+		{
+			Pool* pool;
+			std::mutex mutex;
+			std::deque<Task> tasks;
+#ifdef _WIN32
+			HANDLE thread = nullptr;
+			HANDLE exited = nullptr;
+			HMODULE module = nullptr;
+#else
+			std::thread thread;
+#endif
+		};
+
+		static size_t DefaultNumThreads()
+		{
+			const unsigned int hardwareThreads = std::thread::hardware_concurrency();
+			return hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+		}
+
+		static Worker*& CurrentWorkerSlot()
+		{
+			static thread_local Worker* worker = nullptr;
+			return worker;
+		}
+
+		Worker* CurrentWorker() const
+		{
+			Worker* worker = CurrentWorkerSlot();
+			return worker != nullptr && worker->pool == this ? worker : nullptr;
+		}
+
+		bool Start()
+		{
+			std::lock_guard<std::mutex> lock( m_startMutex );
+			if ( m_state.load() == State::NotStarted )
+			{
+				// All workers exist before any thread starts, as they iterate the list when stealing
+				m_workers.reserve( m_numThreads );
+				for ( size_t i = 0; i < m_numThreads; i++ )
+				{
+					m_workers.push_back( std::make_unique<Worker>() );
+					m_workers.back()->pool = this;
+				}
+
+				size_t numStarted = 0;
+				for ( auto& worker : m_workers )
+				{
+#ifdef _WIN32
+					worker->exited = CreateEventW( nullptr, TRUE, FALSE, nullptr );
+					worker->module = details::ReferenceThisModule();
+					worker->thread = worker->exited != nullptr ? CreateThread( nullptr, 0, ThreadProc, worker.get(), 0, nullptr ) : nullptr;
+					if ( worker->thread != nullptr )
+					{
+						numStarted++;
+					}
+					else if ( worker->module != nullptr )
+					{
+						FreeLibrary( worker->module );
+					}
+#else
+					worker->thread = std::thread( [this, w = worker.get()] { WorkerLoop( *w ); } );
+					numStarted++;
+#endif
+				}
+				m_state.store( numStarted != 0 ? State::Running : State::Stopped, std::memory_order_release );
+			}
+			return m_state.load() == State::Running;
+		}
+
+#ifdef _WIN32
+		static DWORD WINAPI ThreadProc( LPVOID lpParameter )
+		{
+			Worker* worker = static_cast<Worker*>(lpParameter);
+			worker->pool->WorkerLoop( *worker );
+
+			// Last thing touching the pool - see Join. The module reference keeps the rest of this code mapped
+			const HMODULE module = worker->module;
+			SetEvent( worker->exited );
+			return details::ExitThreadInModule( module );
+		}
+
+		static void Join( Worker& worker )
+		{
+			// From a static destructor on DLL unload we hold the loader lock, so threads can't finish exiting
+			// (DLL_THREAD_DETACH needs it too) - wait for them to leave the pool instead
+			if ( worker.thread != nullptr )
+			{
+				const HANDLE handles[] = { worker.exited, worker.thread };
+				WaitForMultipleObjects( 2, handles, FALSE, INFINITE );
+				CloseHandle( worker.thread );
+			}
+			if ( worker.exited != nullptr )
+			{
+				CloseHandle( worker.exited );
+			}
+		}
+#else
+		static void Join( Worker& worker )
+		{
+			if ( worker.thread.joinable() )
+			{
+				worker.thread.join();
+			}
+		}
+#endif
+
+		void WorkerLoop( Worker& self )
+		{
+			CurrentWorkerSlot() = &self;
+			while ( true )
+			{
+				if ( TryRunOne() )
+				{
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock( m_sleepMutex );
+				m_sleepers.fetch_add( 1 );
+				m_wake.wait( lock, [this] { return m_pending.load() > 0 || m_stop; } );
+				m_sleepers.fetch_sub( 1 );
+
+				// Queued work is still finished when stopping
+				if ( m_stop && m_pending.load() == 0 )
+				{
+					break;
+				}
+			}
+			CurrentWorkerSlot() = nullptr;
+		}
+
+		bool TryPop( Worker* self, Task& task )
+		{
+			auto take = [&]( std::deque<Task>& tasks, bool back ) {
+				if ( tasks.empty() ) return false;
+				if ( back )
+				{
+					task = std::move(tasks.back());
+					tasks.pop_back();
+				}
+				else
+				{
+					task = std::move(tasks.front());
+					tasks.pop_front();
+				}
+				m_pending.fetch_sub( 1 );
+				return true;
+			};
+
+			// Own work first, newest first - it's most likely to still be in cache
+			if ( self != nullptr )
+			{
+				std::lock_guard<std::mutex> lock( self->mutex );
+				if ( take( self->tasks, true ) ) return true;
+			}
+
+			if ( m_pending.load() <= 0 )
+			{
+				return false;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock( m_queueMutex );
+				if ( take( m_queue, false ) ) return true;
+			}
+
+			// Steal the oldest tasks, starting from a different victim every time to spread the contention
+			const size_t numWorkers = m_workers.size();
+			const size_t first = m_nextVictim.fetch_add( 1, std::memory_order_relaxed );
+			for ( size_t i = 0; i < numWorkers; i++ )
+			{
+				Worker& victim = *m_workers[(first + i) % numWorkers];
+				if ( &victim == self ) continue;
+
+				std::lock_guard<std::mutex> lock( victim.mutex );
+				if ( take( victim.tasks, false ) ) return true;
+			}
+			return false;
+		}
+
+		const size_t m_numThreads;
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		std::atomic<State> m_state { State::NotStarted };
+		std::mutex m_startMutex;
+
+		std::mutex m_queueMutex;
+		std::deque<Task> m_queue;
+
+		std::atomic<ptrdiff_t> m_pending { 0 };
+		std::atomic<size_t> m_nextVictim { 0 };
+
+		std::mutex m_sleepMutex;
+		std::condition_variable m_wake;
+		std::atomic<size_t> m_sleepers { 0 };
+		bool m_stop = false;
+	};
+
+	// Set of tasks that can be waited on together
+	// Waiting runs the pool's pending tasks, so it's fine to wait from within a task
+	class TaskGroup
+	{
+	public:
+		explicit TaskGroup( Pool& pool = Pool::Get() )
+			: m_pool( pool )
+		{
+		}
+
+		~TaskGroup()
+		{
+			Wait();
+		}
+
+		TaskGroup( const TaskGroup& ) = delete;
+		TaskGroup& operator=( const TaskGroup& ) = delete;
+
+		template<typename Func>
+		void Run( Func&& func )
+		{
+			m_outstanding.fetch_add( 1 );
+			m_pool.Submit( [this, func = std::forward<Func>(func)]() mutable {
+				func();
+				Done();
+			} );
+		}
+
+		void Wait()
+		{
+			while ( m_outstanding.load() != 0 )
+			{
+				if ( !m_pool.TryRunOne() )
+				{
+					// Everything left is already running on other threads
+					std::unique_lock<std::mutex> lock( m_mutex );
+					m_done.wait( lock, [this] { return m_outstanding.load() == 0; } );
+				}
+			}
+
+			// The last Done may still be holding the mutex - don't let the group be destroyed under it
+			std::lock_guard<std::mutex> lock( m_mutex );
+		}
+
+	private:
+		void Done()
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			if ( m_outstanding.fetch_sub( 1 ) == 1 )
+			{
+				m_done.notify_all();
+			}
+		}
+
+		Pool& m_pool;
+		std::atomic<size_t> m_outstanding { 0 };
+		std::mutex m_mutex;
+		std::condition_variable m_done;
+	};
+
+	// Calls func( i ) for every i in [begin, end), in chunks of grain indices
+	template<typename Func>
+	inline void ParallelFor( size_t begin, size_t end, size_t grain, Func&& func, Pool& pool = Pool::Get() )
+	{
+		grain = std::max<size_t>( grain, 1 );
+		if ( end <= begin )
+		{
+			return;
+		}
+
+		if ( end - begin <= grain )
+		{
+			for ( size_t i = begin; i < end; i++ )
+			{
+				func( i );
+			}
+			return;
+		}
+
+		TaskGroup group( pool );
+		for ( size_t chunk = begin; chunk < end; )
+		{
+			const size_t chunkEnd = end - chunk > grain ? chunk + grain : end;
+			group.Run( [&func, chunk, chunkEnd] {
+				for ( size_t i = chunk; i < chunkEnd; i++ )
+				{
+					func( i );
+				}
+			} );
+			chunk = chunkEnd;
+		}
+		group.Wait();
+	}
+};
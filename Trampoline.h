@@ -1,5 +1,7 @@
 #pragma once
 
+#include "MemoryMgr.h"
+
 // Trampolines are useless on x86 arch
 #ifdef _WIN64
 
@@ -8,9 +10,16 @@
 #include <type_traits>
 #include <cstddef>
 
+#if TRAMPOLINE_USE_SHARED_POOL
+#include <algorithm>
+#include <cwchar>
+#endif
+
 // Trampoline class for big (>2GB) jumps
 // Never needed in 32-bit processes so in those cases this does nothing but forwards to Memory functions
 // NOTE: Each Trampoline class allocates a page of executable memory for trampolines and does NOT free it when going out of scope
+// With TRAMPOLINE_USE_SHARED_POOL defined to 1, Trampolines instead take small chunks from pages shared with other modules
+// built with the same switch (see SharedPool)
 class Trampoline
 {
 public:
@@ -51,6 +60,12 @@ public:
 		return static_cast< std::byte* >(GetNewSpace( size, align ));
 	}
 
+	static bool IsAddressFeasible( uintptr_t trampolineOffset, uintptr_t addr )
+	{
+		const ptrdiff_t diff = trampolineOffset - addr;
+		return diff >= INT32_MIN && diff <= INT32_MAX;
+	}
+
 
 private:
 	static Trampoline* MakeTrampolineInternal( uintptr_t addr, size_t size, size_t align )
@@ -65,7 +80,17 @@ private:
 
 		size_t sizeToAlloc = size + ((sizeof(Trampoline) + align - 1) & ~(align - 1));
 
+#if TRAMPOLINE_USE_SHARED_POOL
+		// Take a chunk big enough to serve further trampolines too, fall back to private memory if the pool can't help
+		sizeToAlloc = std::max( sizeToAlloc, SharedPool::CHUNK_SIZE );
+		void* space = SharedPool::Allocate( addr, sizeToAlloc );
+		if ( space == nullptr )
+		{
+			space = FindAndAllocateMem(addr, sizeToAlloc);
+		}
+#else
 		void* space = FindAndAllocateMem(addr, sizeToAlloc);
+#endif
 		void* usableSpace = reinterpret_cast<char*>(space) + sizeof(Trampoline);
 		return new( space ) Trampoline( usableSpace, sizeToAlloc - sizeof(Trampoline) );
 	}
@@ -159,11 +184,114 @@ private:
 		return nullptr;
 	}
 
-	static bool IsAddressFeasible( uintptr_t trampolineOffset, uintptr_t addr )
+#if TRAMPOLINE_USE_SHARED_POOL
+	// Process-wide pool shared by all modules built with TRAMPOLINE_USE_SHARED_POOL, so each of them doesn't need
+	// to reserve its own 64KB region near every address it hooks
+	// The directory of regions lives in a named mapping, and chunks are handed out with a lock-free bump allocator.
+	// Regions are never freed, so chunks stay valid even after the module which allocated them is unloaded.
+	class SharedPool
 	{
-		const ptrdiff_t diff = trampolineOffset - addr;
-		return diff >= INT32_MIN && diff <= INT32_MAX;
-	}
+	public:
+		static constexpr size_t CHUNK_SIZE = 256;
+
+		static void* Allocate( uintptr_t addr, size_t size )
+		{
+			Header* header = GetHeader();
+			if ( header == nullptr ) return nullptr;
+
+			const LONG numRegions = std::min( static_cast<LONG>(header->numRegions), MAX_REGIONS );
+			for ( LONG i = 0; i < numRegions; i++ )
+			{
+				void* space = AllocateFromRegion( header->regions[i], addr, size );
+				if ( space != nullptr ) return space;
+			}
+
+			// Nothing in range, add a new region and take the first chunk of it before publishing
+			size_t regionSize = std::max( size, REGION_SIZE );
+			void* mem = FindAndAllocateMem( addr, regionSize );
+			if ( mem == nullptr ) return nullptr;
+
+			const LONG index = InterlockedIncrement( &header->numRegions ) - 1;
+			if ( index < MAX_REGIONS )
+			{
+				Region& region = header->regions[index];
+				region.size = static_cast<LONG64>(regionSize);
+				region.used = static_cast<LONG64>(AlignUp( size ));
+				InterlockedExchange64( &region.base, reinterpret_cast<LONG64>(mem) );
+			}
+			return mem;
+		}
+
+	private:
+		static constexpr uint32_t MAGIC = 0x4C4F4F50; // 'POOL'
+		static constexpr LONG MAX_REGIONS = 512;
+		static constexpr size_t REGION_SIZE = 64 * 1024;
+
+		struct Region
+		{
+			// Zero until the region is published
+			volatile LONG64 base;
+			volatile LONG64 size;
+			volatile LONG64 used;
+		};
+
+		struct Header
+		{
+			volatile LONG magic;
+			uint32_t headerSize;
+			volatile LONG numRegions;
+			Region regions[MAX_REGIONS];
+		};
+
+		static size_t AlignUp( size_t size )
+		{
+			return (size + 15) & ~size_t(15);
+		}
+
+		static void* AllocateFromRegion( Region& region, uintptr_t addr, size_t size )
+		{
+			const uintptr_t base = static_cast<uintptr_t>(InterlockedCompareExchange64( &region.base, 0, 0 ));
+			if ( base == 0 ) return nullptr;
+
+			const uintptr_t end = base + static_cast<uintptr_t>(region.size);
+			if ( !IsAddressFeasible( base, addr ) || !IsAddressFeasible( end, addr ) ) return nullptr;
+
+			LONG64 used = region.used;
+			while ( true )
+			{
+				const uintptr_t chunk = base + AlignUp( static_cast<size_t>(used) );
+				if ( chunk + size > end ) return nullptr;
+
+				const LONG64 previous = InterlockedCompareExchange64( &region.used, static_cast<LONG64>(chunk + size - base), used );
+				if ( previous == used ) return reinterpret_cast<void*>(chunk);
+				used = previous;
+			}
+		}
+
+		static Header* GetHeader()
+		{
+			static Header* const header = [] () -> Header* {
+				// Versioned in the name, so incompatible layouts never share a mapping
+				wchar_t name[64];
+				swprintf( name, _countof(name), L"Local\\ModUtils.TrampolinePool.v1.%lu", GetCurrentProcessId() );
+
+				// Deliberately never closed, the pool lives for as long as the process
+				HANDLE mapping = CreateFileMappingW( INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(Header), name );
+				if ( mapping == nullptr ) return nullptr;
+
+				Header* view = static_cast<Header*>(MapViewOfFile( mapping, FILE_MAP_READ|FILE_MAP_WRITE, 0, 0, sizeof(Header) ));
+				if ( view == nullptr ) return nullptr;
+
+				// A fresh mapping is zeroed, which is a valid empty pool - so initialization is just the magic
+				InterlockedCompareExchange( &view->magic, MAGIC, 0 );
+				if ( view->magic != MAGIC ) return nullptr;
+				if ( view->headerSize == 0 ) view->headerSize = sizeof(Header);
+				return view->headerSize == sizeof(Header) ? view : nullptr;
+			}();
+			return header;
+		}
+	};
+#endif
 
 	Trampoline* m_next = nullptr;
 	void* m_pageMemory = nullptr;
@@ -173,4 +301,59 @@ private:
 };
 
 
-#endif
\ No newline at end of file
+#else
+
+class Trampoline;
+
+#endif
+
+namespace Memory::VP
+{
+	enum class HookPath
+	{
+		Direct,
+		Trampoline,
+	};
+
+	// Injects a hook with a direct rel32 branch if 'hook' is reachable from 'address', and through a trampoline otherwise
+	// 'trampoline' receives the trampoline used, if any. MakeTrampoline picks one in range of 'address' with space left,
+	// creating it only if none exists, so hooks close to each other share it
+	// Returns the path taken
+	template<typename AT, typename Func>
+	inline HookPath InjectHook(AT address, Func hook, HookType type, [[maybe_unused]] Trampoline*& trampoline)
+	{
+#ifdef _WIN64
+		uintptr_t hookAddr;
+		memcpy( &hookAddr, std::addressof(hook), sizeof(hookAddr) );
+
+		if ( !Trampoline::IsAddressFeasible( hookAddr, uintptr_t(address) + 5 ) )
+		{
+			// Always looked up again - a trampoline used for another hook may be out of range of this one, or full
+			trampoline = Trampoline::MakeTrampoline( address );
+			InjectHook( address, trampoline->Jump( hook ), type );
+			return HookPath::Trampoline;
+		}
+#endif
+		InjectHook( address, hook, type );
+		return HookPath::Direct;
+	}
+
+	// As above, but keeps the existing opcode at 'address'
+	template<typename AT, typename Func>
+	inline HookPath InjectHook(AT address, Func hook, [[maybe_unused]] Trampoline*& trampoline)
+	{
+#ifdef _WIN64
+		uintptr_t hookAddr;
+		memcpy( &hookAddr, std::addressof(hook), sizeof(hookAddr) );
+
+		if ( !Trampoline::IsAddressFeasible( hookAddr, uintptr_t(address) + 5 ) )
+		{
+			trampoline = Trampoline::MakeTrampoline( address );
+			InjectHook( address, trampoline->Jump( hook ) );
+			return HookPath::Trampoline;
+		}
+#endif
+		InjectHook( address, hook );
+		return HookPath::Direct;
+	}
+}
@@ -0,0 +1,113 @@
+// Address porting between two versions of an executable (Linux)
+// Usage: AddressPorter [--min-confidence X] <old.exe> <new.exe> <addresses.txt>
+// One hex address per line (0x optional), optionally named as "name: address". Addresses below the old image base
+// are taken as RVAs, the rest as VAs - and printed in the same form for the new image.
+// Empty lines and lines starting with # or // are skipped.
+// Both binaries are split into functions and matched up (see FunctionMatcher.h), then every address is translated
+// through the matched functions. Prints a tab separated table of name, old address, new address, confidence and method,
+// followed by a summary. Exits with 2 if any address couldn't be ported with at least the minimum confidence.
+
+#include "FunctionMatcher.h"
+#include "MappedFile.h"
+#include "PEFile.h"
+#include "SignatureList.h"
+#include "../TaskPool.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+int main( int argc, char* argv[] )
+{
+	float minConfidence = 0.5f;
+
+	int arg = 1;
+	for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; arg++ )
+	{
+		if ( strcmp( argv[arg], "--min-confidence" ) == 0 && arg + 1 < argc )
+		{
+			minConfidence = strtof( argv[++arg], nullptr );
+		}
+	}
+
+	if ( argc - arg < 3 )
+	{
+		fprintf( stderr, "Usage: %s [--min-confidence X] <old.exe> <new.exe> <addresses.txt>\n", argv[0] );
+		return 1;
+	}
+
+	// Same format as signature lists, just with addresses
+	std::vector<Signature> addresses;
+	if ( !ReadSignatureList( argv[arg + 2], addresses ) )
+	{
+		fprintf( stderr, "Cannot open %s\n", argv[arg + 2] );
+		return 1;
+	}
+
+	const MappedFile oldFile( argv[arg] ), newFile( argv[arg + 1] );
+	const PEFile oldImage( oldFile.Data(), oldFile.Size() ), newImage( newFile.Data(), newFile.Size() );
+	if ( !oldFile.Valid() || !oldImage.Valid() || !newFile.Valid() || !newImage.Valid() )
+	{
+		fprintf( stderr, "Cannot read %s\n", !oldFile.Valid() || !oldImage.Valid() ? argv[arg] : argv[arg + 1] );
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	// Each index is parallel on its own already
+	std::unique_ptr<FunctionIndex> oldIndex, newIndex;
+	{
+		TaskPool::TaskGroup group;
+		group.Run( [&] { oldIndex = std::make_unique<FunctionIndex>( oldImage ); } );
+		group.Run( [&] { newIndex = std::make_unique<FunctionIndex>( newImage ); } );
+		group.Wait();
+	}
+	const FunctionMatcher matcher( *oldIndex, *newIndex );
+
+	std::vector<uint64_t> oldAddresses( addresses.size() );
+	for ( size_t i = 0; i < addresses.size(); i++ )
+	{
+		oldAddresses[i] = strtoull( addresses[i].pattern.c_str(), nullptr, 16 );
+	}
+	auto isVA = [&]( size_t i ) {
+		return oldAddresses[i] >= oldImage.ImageBase();
+	};
+
+	std::vector<FunctionMatcher::Translation> translations( addresses.size() );
+	TaskPool::ParallelFor( 0, addresses.size(), 16, [&]( size_t i ) {
+		const uint64_t rva = isVA( i ) ? oldAddresses[i] - oldImage.ImageBase() : oldAddresses[i];
+		if ( rva <= UINT32_MAX )
+		{
+			translations[i] = matcher.Translate( static_cast<uint32_t>(rva) );
+		}
+	} );
+
+	const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	size_t numFailed = 0;
+	printf( "name\told\tnew\tconfidence\tmethod\n" );
+	for ( size_t i = 0; i < addresses.size(); i++ )
+	{
+		const FunctionMatcher::Translation& translation = translations[i];
+		printf( "%s\t%" PRIX64, addresses[i].name.c_str(), oldAddresses[i] );
+		if ( translation.found )
+		{
+			const uint64_t newAddress = isVA( i ) ? newImage.ImageBase() + translation.rva : translation.rva;
+			printf( "\t%" PRIX64 "\t%.2f\t%s\n", newAddress, translation.confidence, translation.method );
+		}
+		else
+		{
+			printf( "\t-\t0.00\tnone\n" );
+		}
+
+		numFailed += !translation.found || translation.confidence < minConfidence ? 1 : 0;
+	}
+
+	fprintf( stderr, "%zu/%zu functions matched (%zu in the new binary), %zu addresses in %.2fs: %zu below %.2f confidence\n",
+		matcher.NumMatched(), oldIndex->NumFunctions(), newIndex->NumFunctions(), addresses.size(), seconds, numFailed, minConfidence );
+	return numFailed != 0 ? 2 : 0;
+}
@@ -0,0 +1,132 @@
+// Raw file scanner for large dumps and binaries (Linux)
+// Usage: DumpScanner [--chunk-mb N] [--buffers N] [--files N] [--no-uring] [--buffered] [--max-offsets N] <signatures.txt> <file1> [file2 ...]
+// Streams every file through io_uring (or pread) and runs the whole signature set over all of its bytes,
+// with no regard for the file format - works for memory dumps just as well as for executables.
+// Prints a tab separated matrix of match counts and file offsets (pattern x file), followed by a summary.
+// Exits with 2 if any signature is missing from any of the files.
+
+#include "FileStreamScanner.h"
+#include "MultiPatternScanner.h"
+#include "SignatureList.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+int main( int argc, char* argv[] )
+{
+	FileStreamScanner::Options options;
+	size_t maxOffsets = 4;
+
+	int arg = 1;
+	for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; arg++ )
+	{
+		if ( strcmp( argv[arg], "--chunk-mb" ) == 0 && arg + 1 < argc )
+		{
+			options.chunkSize = strtoul( argv[++arg], nullptr, 10 ) * 1024 * 1024;
+		}
+		else if ( strcmp( argv[arg], "--buffers" ) == 0 && arg + 1 < argc )
+		{
+			options.numBuffers = strtoul( argv[++arg], nullptr, 10 );
+		}
+		else if ( strcmp( argv[arg], "--files" ) == 0 && arg + 1 < argc )
+		{
+			options.filesInFlight = strtoul( argv[++arg], nullptr, 10 );
+		}
+		else if ( strcmp( argv[arg], "--no-uring" ) == 0 )
+		{
+			options.useUring = false;
+		}
+		else if ( strcmp( argv[arg], "--buffered" ) == 0 )
+		{
+			options.direct = false;
+		}
+		else if ( strcmp( argv[arg], "--max-offsets" ) == 0 && arg + 1 < argc )
+		{
+			maxOffsets = strtoul( argv[++arg], nullptr, 10 );
+		}
+	}
+
+	if ( argc - arg < 2 )
+	{
+		fprintf( stderr, "Usage: %s [--chunk-mb N] [--buffers N] [--files N] [--no-uring] [--buffered] [--max-offsets N] <signatures.txt> <file1> [file2 ...]\n", argv[0] );
+		return 1;
+	}
+
+	std::vector<Signature> signatures;
+	if ( !ReadSignatureList( argv[arg], signatures ) )
+	{
+		fprintf( stderr, "Cannot open %s\n", argv[arg] );
+		return 1;
+	}
+
+	const std::vector<const char*> files( argv + arg + 1, argv + argc );
+
+	std::vector<hook::analysis::parsed_pattern> patterns;
+	patterns.reserve( signatures.size() );
+	for ( const Signature& signature : signatures )
+	{
+		patterns.emplace_back( signature.pattern );
+	}
+	const MultiPatternScanner scanner( std::move(patterns) );
+
+	FileStreamScanner streamScanner( scanner, options );
+	const auto start = std::chrono::steady_clock::now();
+	const std::vector<FileStreamScanner::FileResult> results = streamScanner.Scan( files );
+	const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	uint64_t totalSize = 0;
+	printf( "signature" );
+	for ( size_t i = 0; i < files.size(); i++ )
+	{
+		const char* name = strrchr( files[i], '/' );
+		printf( "\t%s", name != nullptr ? name + 1 : files[i] );
+		if ( !results[i].valid )
+		{
+			fprintf( stderr, "%s: cannot be read\n", files[i] );
+		}
+		totalSize += results[i].size;
+	}
+	printf( "\n" );
+
+	size_t numMissing = 0;
+	for ( size_t sig = 0; sig < signatures.size(); sig++ )
+	{
+		bool missing = false;
+
+		printf( "%s", signatures[sig].name.c_str() );
+		for ( const FileStreamScanner::FileResult& result : results )
+		{
+			if ( !result.valid )
+			{
+				printf( "\t-" );
+				continue;
+			}
+
+			const auto& offsets = result.offsets[sig];
+			missing |= offsets.empty();
+
+			printf( "\t%zu", offsets.size() );
+			for ( size_t i = 0; i < std::min( offsets.size(), maxOffsets ); i++ )
+			{
+				printf( "%c%" PRIX64, i == 0 ? ':' : ',', offsets[i] );
+			}
+			if ( offsets.size() > maxOffsets )
+			{
+				printf( ",..." );
+			}
+		}
+		printf( "\n" );
+
+		numMissing += missing ? 1 : 0;
+	}
+
+	fprintf( stderr, "%zu signatures, %zu files (%.1f MB in %.2fs via %s): %zu missing\n", signatures.size(), files.size(),
+		totalSize / (1024.0 * 1024.0), seconds, streamScanner.UsedUring() ? "io_uring" : "pread", numMissing );
+	return numMissing != 0 ? 2 : 0;
+}
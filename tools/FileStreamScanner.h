@@ -0,0 +1,403 @@
+#pragma once
+
+// Streams whole files through a MultiPatternScanner without mapping them (Linux)
+// Large aligned reads go through io_uring (pread if it's unavailable) into a ring of buffers, and every buffer is
+// scanned on the TaskPool as soon as its read completes - so disk and cores stay busy at the same time, and nothing
+// stalls on page faults like with mmap. Several files are kept in flight at once.
+//
+// Every chunk is read together with the head of the next one (MaxLength() - 1 bytes, rounded up to the alignment),
+// and only matches starting inside the chunk itself are kept - so matches crossing chunk edges are reported exactly once.
+
+#include "IoUring.h"
+#include "MultiPatternScanner.h"
+#include "../TaskPool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class FileStreamScanner
+{
+public:
+	struct Options
+	{
+		size_t chunkSize = 8 * 1024 * 1024;
+		size_t numBuffers = 16;
+		size_t filesInFlight = 4;
+		bool useUring = true;
+		// Bypass the page cache when the file system allows it - dumps are usually only read once
+		bool direct = true;
+	};
+
+	struct FileResult
+	{
+		bool valid = false;
+		uint64_t size = 0;
+		// File offsets, per pattern
+		std::vector<std::vector<uint64_t>> offsets;
+	};
+
+	explicit FileStreamScanner( const MultiPatternScanner& scanner )
+		: FileStreamScanner( scanner, Options() )
+	{
+	}
+
+	FileStreamScanner( const MultiPatternScanner& scanner, Options options )
+		: m_scanner( scanner ), m_options( options )
+	{
+		m_options.chunkSize = AlignUp( std::max<size_t>( m_options.chunkSize, ALIGNMENT ) );
+		m_options.numBuffers = std::max<size_t>( m_options.numBuffers, 1 );
+		m_options.filesInFlight = std::max<size_t>( m_options.filesInFlight, 1 );
+		m_overlap = AlignUp( m_scanner.MaxLength() > 0 ? m_scanner.MaxLength() - 1 : 0 );
+	}
+
+	// True if the last Scan went through io_uring
+	bool UsedUring() const { return m_usedUring; }
+
+	std::vector<FileResult> Scan( const std::vector<const char*>& paths, TaskPool::Pool& pool = TaskPool::Pool::Get() )
+	{
+		std::vector<FileResult> results( paths.size() );
+
+		std::optional<IoUring> ring;
+		if ( m_options.useUring )
+		{
+			ring.emplace( static_cast<unsigned int>(m_options.numBuffers) );
+		}
+		m_ring = ring && ring->Valid() ? &*ring : nullptr;
+		m_usedUring = m_ring != nullptr;
+
+		const size_t bufferSize = m_options.chunkSize + m_overlap;
+		std::vector<Buffer> buffers( m_options.numBuffers );
+		for ( size_t i = 0; i < buffers.size(); i++ )
+		{
+			buffers[i].data.reset( static_cast<uint8_t*>(aligned_alloc( ALIGNMENT, bufferSize )) );
+			if ( buffers[i].data != nullptr )
+			{
+				m_freeBuffers.push_back( i );
+			}
+		}
+		if ( m_freeBuffers.empty() )
+		{
+			return results;
+		}
+
+		std::vector<std::unique_ptr<File>> files;
+		std::vector<File*> reading;
+		size_t nextPath = 0, nextFile = 0, readsInFlight = 0;
+
+		auto openFiles = [&] {
+			while ( reading.size() < m_options.filesInFlight && nextPath < paths.size() )
+			{
+				const size_t index = nextPath++;
+				auto file = OpenFile( paths[index], results[index] );
+				if ( file != nullptr )
+				{
+					reading.push_back( file.get() );
+					files.push_back( std::move(file) );
+				}
+			}
+		};
+
+		TaskPool::TaskGroup scans( pool );
+		while ( true )
+		{
+			openFiles();
+
+			// Round robin between the open files, one chunk each
+			size_t bufferIndex;
+			while ( !reading.empty() && TakeBuffer( bufferIndex, false ) )
+			{
+				nextFile %= reading.size();
+				File& file = *reading[nextFile];
+
+				Buffer& buffer = buffers[bufferIndex];
+				buffer.file = &file;
+				buffer.offset = file.nextOffset;
+				buffer.length = static_cast<size_t>(std::min<uint64_t>( bufferSize, AlignUp( file.result->size - file.nextOffset ) ));
+
+				file.nextOffset += m_options.chunkSize;
+				{
+					std::lock_guard<std::mutex> lock( m_mutex );
+					file.pending++;
+				}
+
+				if ( file.nextOffset >= file.result->size )
+				{
+					// Everything's been queued, the last scan closes it
+					reading.erase( reading.begin() + nextFile );
+					std::lock_guard<std::mutex> lock( m_mutex );
+					file.allQueued = true;
+				}
+				else
+				{
+					nextFile++;
+				}
+
+				QueueRead( buffer, bufferIndex );
+				readsInFlight++;
+				openFiles();
+			}
+
+			if ( readsInFlight == 0 )
+			{
+				if ( reading.empty() && nextPath >= paths.size() )
+				{
+					break;
+				}
+
+				// Every buffer is being scanned
+				TakeBuffer( bufferIndex, true );
+				ReturnBuffer( bufferIndex );
+				continue;
+			}
+
+			WaitForReads( [&]( size_t index, int bytesRead ) {
+				readsInFlight--;
+
+				Buffer& buffer = buffers[index];
+				const size_t size = FinishRead( buffer, bytesRead );
+				scans.Run( [this, &buffer, index, size] {
+					ScanBuffer( buffer, size );
+					ReturnBuffer( index );
+				} );
+			} );
+		}
+		scans.Wait();
+
+		for ( FileResult& result : results )
+		{
+			for ( auto& offsets : result.offsets )
+			{
+				std::sort( offsets.begin(), offsets.end() );
+			}
+		}
+
+		m_ring = nullptr;
+		m_freeBuffers.clear();
+		return results;
+	}
+
+private:
+	static constexpr size_t ALIGNMENT = 4096;
+
+	static uint64_t AlignUp( uint64_t value )
+	{
+		return (value + ALIGNMENT - 1) & ~static_cast<uint64_t>(ALIGNMENT - 1);
+	}
+
+	struct File
+	{
+		int fd = -1;
+		FileResult* result = nullptr;
+		uint64_t nextOffset = 0;
+		// Guarded by m_mutex
+		size_t pending = 0;
+		bool allQueued = false;
+	};
+
+	struct FreeDeleter
+	{
+		void operator()( void* ptr ) const { free( ptr ); }
+	};
+
+	struct Buffer
+	{
+		std::unique_ptr<uint8_t[], FreeDeleter> data;
+		File* file = nullptr;
+		uint64_t offset = 0;
+		size_t length = 0;
+	};
+
+	std::unique_ptr<File> OpenFile( const char* path, FileResult& result ) const
+	{
+		int fd = -1;
+		if ( m_options.direct )
+		{
+			fd = open( path, O_RDONLY | O_CLOEXEC | O_DIRECT );
+		}
+		if ( fd == -1 )
+		{
+			// Not every file system supports O_DIRECT (tmpfs doesn't)
+			fd = open( path, O_RDONLY | O_CLOEXEC );
+			if ( fd == -1 )
+			{
+				return nullptr;
+			}
+		}
+
+		struct stat st;
+		if ( fstat( fd, &st ) != 0 || !S_ISREG(st.st_mode) )
+		{
+			close( fd );
+			return nullptr;
+		}
+
+		result.valid = true;
+		result.size = static_cast<uint64_t>(st.st_size);
+		result.offsets.resize( m_scanner.NumPatterns() );
+		if ( result.size == 0 )
+		{
+			close( fd );
+			return nullptr;
+		}
+
+		if ( !m_options.direct )
+		{
+			posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+		}
+
+		auto file = std::make_unique<File>();
+		file->fd = fd;
+		file->result = &result;
+		return file;
+	}
+
+	void QueueRead( Buffer& buffer, size_t index )
+	{
+		if ( m_ring != nullptr )
+		{
+			while ( !m_ring->QueueRead( buffer.file->fd, buffer.data.get(), static_cast<unsigned int>(buffer.length), buffer.offset, index ) )
+			{
+				if ( !m_ring->Submit() )
+				{
+					// Let FinishRead do it with pread
+					m_completed.emplace_back( index, -1 );
+					return;
+				}
+			}
+		}
+		else
+		{
+			m_completed.emplace_back( index, -1 );
+		}
+	}
+
+	template<typename Func>
+	void WaitForReads( Func&& func )
+	{
+		// The pread fallback reads in FinishRead, one buffer at a time - scans still overlap with it
+		if ( !m_completed.empty() )
+		{
+			std::vector<std::pair<size_t, int>> completed;
+			completed.swap( m_completed );
+			for ( const auto& read : completed )
+			{
+				func( read.first, read.second );
+			}
+			return;
+		}
+
+		if ( m_ring != nullptr )
+		{
+			m_ring->Submit( 1 );
+
+			uint64_t userData;
+			int result;
+			while ( m_ring->PopCompletion( userData, result ) )
+			{
+				func( static_cast<size_t>(userData), result );
+			}
+		}
+	}
+
+	// Returns the number of valid bytes - short and failed reads are completed with pread
+	static size_t FinishRead( Buffer& buffer, int bytesRead )
+	{
+		size_t size = bytesRead > 0 ? static_cast<size_t>(bytesRead) : 0;
+		const uint64_t fileSize = buffer.file->result->size;
+		while ( size < buffer.length && buffer.offset + size < fileSize )
+		{
+			const ssize_t result = pread( buffer.file->fd, buffer.data.get() + size, buffer.length - size, static_cast<off_t>(buffer.offset + size) );
+			if ( result < 0 && errno == EINTR )
+			{
+				continue;
+			}
+			if ( result <= 0 )
+			{
+				// Includes O_DIRECT refusing to continue a short read from an unaligned offset
+				break;
+			}
+			size += static_cast<size_t>(result);
+		}
+
+		const size_t expected = static_cast<size_t>(std::min<uint64_t>( buffer.length, fileSize - buffer.offset ));
+		if ( size < expected )
+		{
+			// Don't pass off a partial scan as a complete one
+			buffer.file->result->valid = false;
+		}
+		return std::min( size, expected );
+	}
+
+	void ScanBuffer( const Buffer& buffer, size_t size )
+	{
+		std::vector<std::pair<uint32_t, uint64_t>> matches;
+		m_scanner.Scan( buffer.data.get(), size, [&]( uint32_t pattern, size_t offset ) {
+			// Anything further belongs to the next chunk
+			if ( offset < m_options.chunkSize )
+			{
+				matches.emplace_back( pattern, buffer.offset + offset );
+			}
+		} );
+
+		File& file = *buffer.file;
+		std::lock_guard<std::mutex> lock( m_mutex );
+		for ( const auto& match : matches )
+		{
+			file.result->offsets[match.first].push_back( match.second );
+		}
+
+		if ( --file.pending == 0 && file.allQueued )
+		{
+			close( file.fd );
+			file.fd = -1;
+		}
+	}
+
+	bool TakeBuffer( size_t& index, bool wait )
+	{
+		std::unique_lock<std::mutex> lock( m_mutex );
+		if ( wait )
+		{
+			m_bufferReturned.wait( lock, [this] { return !m_freeBuffers.empty(); } );
+		}
+		if ( m_freeBuffers.empty() )
+		{
+			return false;
+		}
+		index = m_freeBuffers.back();
+		m_freeBuffers.pop_back();
+		return true;
+	}
+
+	void ReturnBuffer( size_t index )
+	{
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			m_freeBuffers.push_back( index );
+		}
+		m_bufferReturned.notify_one();
+	}
+
+	const MultiPatternScanner& m_scanner;
+	Options m_options;
+	size_t m_overlap = 0;
+
+	IoUring* m_ring = nullptr;
+	bool m_usedUring = false;
+	std::vector<std::pair<size_t, int>> m_completed;
+
+	std::mutex m_mutex;
+	std::condition_variable m_bufferReturned;
+	std::vector<size_t> m_freeBuffers;
+};
@@ -0,0 +1,849 @@
+#pragma once
+
+// Function level matching between two versions of an executable, for porting addresses between them (offline tools)
+// FunctionIndex splits a binary into functions (.pdata on x64, call targets everywhere) and hashes every function twice:
+// exactly (opcodes, registers and immediates - but not addresses, as those move between builds) and loosely
+// (mnemonics and operand kinds only, so changed register allocation or struct offsets still match).
+// FunctionMatcher pairs up functions with hashes unique to both binaries, propagates matches over the call graph
+// (callees, callers) and address order, and repeats until nothing new matches. Addresses are then translated
+// through matched functions - instruction by instruction if their code differs - and addresses outside of them
+// (data, unmatched functions) through what the matched code references.
+
+#include "PEFile.h"
+#include "../InstructionDecoder.h"
+#include "../TaskPool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+class FunctionIndex
+{
+public:
+	static constexpr uint32_t NO_REF = UINT32_MAX;
+	static constexpr size_t NO_FUNCTION = SIZE_MAX;
+
+	struct Instruction
+	{
+		uint32_t rva;
+		// Call target, RIP-relative or absolute address referenced by the instruction, NO_REF if none
+		uint32_t ref;
+		// Mnemonic and operand kinds
+		uint32_t token;
+	};
+
+	struct Function
+	{
+		uint32_t begin;
+		uint32_t end;
+		uint64_t exactHash = 0;
+		uint64_t looseHash = 0;
+		std::vector<Instruction> instructions;
+		// Function indices, callees in call order
+		std::vector<uint32_t> callees;
+		std::vector<uint32_t> callers;
+	};
+
+	explicit FunctionIndex( const PEFile& image, TaskPool::Pool& pool = TaskPool::Pool::Get() )
+		: m_image( image )
+	{
+		if ( !image.Valid() )
+		{
+			return;
+		}
+
+		m_imageBase = image.ImageBase();
+		m_sizeOfImage = image.SizeOfImage();
+		for ( size_t i = 0; i < image.NumSections(); i++ )
+		{
+			const pe::SectionHeader& section = image.Section( i );
+			size_t size;
+			const uint8_t* data = image.SectionData( section, &size );
+			if ( PEFile::IsExecutable( section ) && data != nullptr && size != 0 )
+			{
+				m_code.push_back( { section.VirtualAddress, static_cast<uint32_t>(size), data } );
+			}
+		}
+
+		BuildFunctions( FindCallTargets( pool ) );
+		TaskPool::ParallelFor( 0, m_functions.size(), 64, [this]( size_t i ) {
+			Analyze( m_functions[i] );
+		}, pool );
+		Link();
+	}
+
+	bool Is64() const { return m_image.Is64(); }
+	uint64_t ImageBase() const { return m_imageBase; }
+
+	size_t NumFunctions() const { return m_functions.size(); }
+	const Function& GetFunction( size_t index ) const { return m_functions[index]; }
+
+	// Index of the function containing rva, or NO_FUNCTION
+	size_t FindFunction( uint32_t rva ) const
+	{
+		auto it = std::upper_bound( m_functions.begin(), m_functions.end(), rva, []( uint32_t value, const Function& func ) {
+			return value < func.begin;
+		} );
+		if ( it == m_functions.begin() ) return NO_FUNCTION;
+		--it;
+		return rva < it->end ? static_cast<size_t>(it - m_functions.begin()) : NO_FUNCTION;
+	}
+
+	// Index of the function starting at rva, or NO_FUNCTION
+	size_t FindFunctionStart( uint32_t rva ) const
+	{
+		const size_t index = FindFunction( rva );
+		return index != NO_FUNCTION && m_functions[index].begin == rva ? index : NO_FUNCTION;
+	}
+
+	// Index of the instruction containing rva within the function
+	static size_t FindInstruction( const Function& func, uint32_t rva )
+	{
+		auto it = std::upper_bound( func.instructions.begin(), func.instructions.end(), rva, []( uint32_t value, const Instruction& ins ) {
+			return value < ins.rva;
+		} );
+		return it != func.instructions.begin() ? static_cast<size_t>(it - func.instructions.begin()) - 1 : 0;
+	}
+
+	// Calls func( function, instruction ) for instructions referencing rva, until it returns false
+	template<typename Func>
+	void ForEachReference( uint32_t rva, Func&& func ) const
+	{
+		auto it = std::lower_bound( m_refs.begin(), m_refs.end(), rva, []( const Reference& ref, uint32_t value ) {
+			return ref.target < value;
+		} );
+		for ( ; it != m_refs.end() && it->target == rva; ++it )
+		{
+			if ( !func( it->function, it->instruction ) ) break;
+		}
+	}
+
+	// Closest referenced address at or below rva, NO_REF if none
+	uint32_t ReferenceBelow( uint32_t rva ) const
+	{
+		auto it = std::upper_bound( m_refs.begin(), m_refs.end(), rva, []( uint32_t value, const Reference& ref ) {
+			return value < ref.target;
+		} );
+		return it != m_refs.begin() ? std::prev(it)->target : NO_REF;
+	}
+
+private:
+	struct CodeRange
+	{
+		uint32_t rva;
+		uint32_t size;
+		const uint8_t* data;
+	};
+
+	struct Reference
+	{
+		uint32_t target;
+		uint32_t function;
+		uint32_t instruction;
+	};
+
+	static constexpr uint32_t SWEEP_CHUNK_SIZE = 1024 * 1024;
+
+	const CodeRange* FindCode( uint32_t rva ) const
+	{
+		for ( const CodeRange& range : m_code )
+		{
+			if ( rva >= range.rva && rva - range.rva < range.size ) return &range;
+		}
+		return nullptr;
+	}
+
+	// Address-like value within the image as an RVA, or NO_REF
+	uint32_t AddressToRva( uint64_t value ) const
+	{
+		return value >= m_imageBase && value - m_imageBase < m_sizeOfImage ? static_cast<uint32_t>(value - m_imageBase) : NO_REF;
+	}
+
+	static bool LooksLikeFunctionStart( const CodeRange& range, uint32_t rva )
+	{
+		if ( rva % 16 == 0 || rva == range.rva ) return true;
+		const uint8_t prev = range.data[rva - range.rva - 1];
+		return prev == 0xCC || prev == 0x90 || prev == 0xC3;
+	}
+
+	// Linear sweep over the code for call targets - each chunk on its own, decoding resynchronizes within a few instructions
+	std::vector<uint32_t> FindCallTargets( TaskPool::Pool& pool ) const
+	{
+		struct Chunk
+		{
+			const CodeRange* range;
+			uint32_t begin, end;
+		};
+		std::vector<Chunk> chunks;
+		for ( const CodeRange& range : m_code )
+		{
+			for ( uint32_t offset = 0; offset < range.size; offset += SWEEP_CHUNK_SIZE )
+			{
+				chunks.push_back( { &range, offset, std::min( range.size, offset + SWEEP_CHUNK_SIZE ) } );
+			}
+		}
+
+		const bool is64 = Is64();
+		std::vector<std::vector<uint32_t>> chunkTargets( chunks.size() );
+		TaskPool::ParallelFor( 0, chunks.size(), 1, [&]( size_t i ) {
+			const Chunk& chunk = chunks[i];
+			const CodeRange& range = *chunk.range;
+			for ( uint32_t offset = chunk.begin; offset < chunk.end; )
+			{
+				hook::x86::instruction ins;
+				if ( !hook::x86::decode( range.data + offset, range.size - offset, is64, ins ) )
+				{
+					offset++;
+					continue;
+				}
+				if ( ins.map == 0 && ins.opcode == 0xE8 )
+				{
+					const uint32_t target = static_cast<uint32_t>(ins.branch_target( range.rva + offset ));
+					if ( FindCode( target ) != nullptr )
+					{
+						chunkTargets[i].push_back( target );
+					}
+				}
+				offset += ins.length;
+			}
+		}, pool );
+
+		std::vector<uint32_t> targets;
+		for ( const auto& found : chunkTargets )
+		{
+			targets.insert( targets.end(), found.begin(), found.end() );
+		}
+		std::sort( targets.begin(), targets.end() );
+
+		// Calls decoded from data are noise - take targets called more than once or sitting where functions usually start
+		std::vector<uint32_t> result;
+		for ( size_t i = 0; i < targets.size(); )
+		{
+			size_t j = i;
+			while ( j < targets.size() && targets[j] == targets[i] ) j++;
+			if ( j - i > 1 || LooksLikeFunctionStart( *FindCode( targets[i] ), targets[i] ) )
+			{
+				result.push_back( targets[i] );
+			}
+			i = j;
+		}
+		return result;
+	}
+
+	void BuildFunctions( const std::vector<uint32_t>& callTargets )
+	{
+		// Exact bounds from the exception directory, where there is one
+		std::vector<std::pair<uint32_t, uint32_t>> bounds;
+		const pe::DataDirectory exceptions = m_image.Directory( pe::DIRECTORY_EXCEPTION );
+		if ( Is64() && exceptions.Size >= sizeof(pe::RuntimeFunction) )
+		{
+			const size_t count = exceptions.Size / sizeof(pe::RuntimeFunction);
+			const uint8_t* data = m_image.RvaToPointer( exceptions.VirtualAddress, count * sizeof(pe::RuntimeFunction) );
+			for ( size_t i = 0; data != nullptr && i < count; i++ )
+			{
+				pe::RuntimeFunction func;
+				memcpy( &func, data + i * sizeof(func), sizeof(func) );
+				if ( func.BeginAddress < func.EndAddress && FindCode( func.BeginAddress ) != nullptr )
+				{
+					bounds.emplace_back( func.BeginAddress, func.EndAddress );
+				}
+			}
+		}
+
+		// Leaf functions don't have unwind info, and 32-bit code has none at all - those end where the next function starts
+		for ( uint32_t target : callTargets )
+		{
+			bounds.emplace_back( target, 0 );
+		}
+		const uint32_t entryPoint = m_image.EntryPoint();
+		if ( FindCode( entryPoint ) != nullptr )
+		{
+			bounds.emplace_back( entryPoint, 0 );
+		}
+
+		// Known ends sort first, so duplicates keep them
+		std::sort( bounds.begin(), bounds.end(), []( const auto& left, const auto& right ) {
+			return left.first != right.first ? left.first < right.first : left.second > right.second;
+		} );
+
+		uint32_t coveredEnd = 0;
+		for ( size_t i = 0; i < bounds.size(); i++ )
+		{
+			auto [begin, end] = bounds[i];
+			if ( (!m_functions.empty() && m_functions.back().begin == begin) || begin < coveredEnd )
+			{
+				// Duplicate, or a call into the middle of a known function
+				continue;
+			}
+
+			const CodeRange& range = *FindCode( begin );
+			const uint32_t rangeEnd = range.rva + range.size;
+			if ( end == 0 )
+			{
+				end = rangeEnd;
+				for ( size_t j = i + 1; j < bounds.size(); j++ )
+				{
+					if ( bounds[j].first > begin )
+					{
+						end = std::min( end, bounds[j].first );
+						break;
+					}
+				}
+
+				// Trailing padding belongs to nobody
+				while ( end - begin > 1 && (range.data[end - 1 - range.rva] == 0xCC || range.data[end - 1 - range.rva] == 0x90) ) end--;
+			}
+			end = std::min( end, rangeEnd );
+			coveredEnd = std::max( coveredEnd, end );
+
+			Function func;
+			func.begin = begin;
+			func.end = end;
+			m_functions.push_back( std::move(func) );
+		}
+	}
+
+	static uint64_t Mix( uint64_t hash, uint64_t value )
+	{
+		hash = (hash ^ value) * UINT64_C(0x9E3779B97F4A7C15);
+		return hash ^ (hash >> 32);
+	}
+
+	static uint32_t Token( const hook::x86::instruction& ins )
+	{
+		if ( ins.family != hook::x86::mnemonic::unknown_ )
+		{
+			uint32_t kinds = 0;
+			for ( uint8_t i = 0; i < ins.numOperands; i++ )
+			{
+				kinds |= static_cast<uint32_t>(ins.operands[i].type) << (i * 3);
+			}
+			return 0x80000000u | (static_cast<uint32_t>(ins.family) << 16) | (static_cast<uint32_t>(ins.condition) << 12) | kinds;
+		}
+
+		// Mandatory prefixes select the SSE instruction
+		return (static_cast<uint32_t>(ins.vex) << 24) | (static_cast<uint32_t>(ins.map) << 16) | (static_cast<uint32_t>(ins.opcode) << 8) |
+			(static_cast<uint32_t>(ins.opsize) << 4) | (ins.rep & 0xF);
+	}
+
+	void Analyze( Function& func ) const
+	{
+		const CodeRange& range = *FindCode( func.begin );
+		const bool is64 = Is64();
+
+		uint64_t exactHash = 0, looseHash = 0;
+		for ( uint32_t rva = func.begin; rva < func.end; )
+		{
+			const uint8_t* code = range.data + (rva - range.rva);
+			Instruction instruction { rva, NO_REF, 0 };
+
+			hook::x86::instruction ins;
+			if ( !hook::x86::decode( code, func.end - rva, is64, ins ) )
+			{
+				// Undecodable, take it byte by byte
+				instruction.token = 0x7F000000u | *code;
+				exactHash = Mix( exactHash, instruction.token );
+				looseHash = Mix( looseHash, instruction.token );
+				func.instructions.push_back( instruction );
+				rva++;
+				continue;
+			}
+
+			instruction.token = Token( ins );
+			exactHash = Mix( exactHash, (uint64_t(instruction.token) << 32) | (uint32_t(ins.rex) << 16) | (uint32_t(ins.modrm) << 8) | ins.sib );
+			looseHash = Mix( looseHash, instruction.token );
+
+			if ( ins.relative )
+			{
+				// Only branches leaving the function are references, and their targets move between builds anyway
+				const uint32_t target = static_cast<uint32_t>(ins.branch_target( rva ));
+				if ( target < func.begin || target >= func.end )
+				{
+					instruction.ref = target;
+					if ( ins.map == 0 && ins.opcode == 0xE8 )
+					{
+						const size_t callee = FindFunctionStart( target );
+						if ( callee != NO_FUNCTION )
+						{
+							func.callees.push_back( static_cast<uint32_t>(callee) );
+						}
+					}
+				}
+				else
+				{
+					exactHash = Mix( exactHash, target - func.begin );
+				}
+			}
+			else
+			{
+				if ( ins.ripRelative )
+				{
+					instruction.ref = static_cast<uint32_t>(ins.rip_target( rva ));
+				}
+				else if ( ins.dispSize == 4 && AddressToRva( static_cast<uint32_t>(ins.disp) ) != NO_REF && !is64 )
+				{
+					instruction.ref = AddressToRva( static_cast<uint32_t>(ins.disp) );
+				}
+				else if ( ins.dispSize != 0 )
+				{
+					exactHash = Mix( exactHash, static_cast<uint64_t>(ins.disp) );
+				}
+
+				if ( ins.immSize != 0 )
+				{
+					const uint64_t value = ins.immSize == 8 ? static_cast<uint64_t>(ins.imm) : static_cast<uint32_t>(ins.imm);
+					const uint32_t immRva = ins.immSize >= 4 ? AddressToRva( value ) : NO_REF;
+					if ( immRva != NO_REF && instruction.ref == NO_REF )
+					{
+						instruction.ref = immRva;
+					}
+					else if ( immRva == NO_REF )
+					{
+						exactHash = Mix( exactHash, value );
+					}
+				}
+			}
+
+			func.instructions.push_back( instruction );
+			rva += ins.length;
+		}
+
+		func.exactHash = Mix( exactHash, func.instructions.size() );
+		func.looseHash = Mix( looseHash, func.instructions.size() );
+	}
+
+	void Link()
+	{
+		for ( size_t i = 0; i < m_functions.size(); i++ )
+		{
+			const Function& func = m_functions[i];
+			for ( uint32_t callee : func.callees )
+			{
+				auto& callers = m_functions[callee].callers;
+				if ( callers.empty() || callers.back() != i )
+				{
+					callers.push_back( static_cast<uint32_t>(i) );
+				}
+			}
+
+			for ( size_t j = 0; j < func.instructions.size(); j++ )
+			{
+				if ( func.instructions[j].ref != NO_REF )
+				{
+					m_refs.push_back( { func.instructions[j].ref, static_cast<uint32_t>(i), static_cast<uint32_t>(j) } );
+				}
+			}
+		}
+
+		std::sort( m_refs.begin(), m_refs.end(), []( const Reference& left, const Reference& right ) {
+			return left.target != right.target ? left.target < right.target : left.function < right.function;
+		} );
+	}
+
+	const PEFile& m_image;
+	uint64_t m_imageBase = 0;
+	uint32_t m_sizeOfImage = 0;
+	std::vector<CodeRange> m_code;
+	std::vector<Function> m_functions;
+	std::vector<Reference> m_refs;
+};
+
+class FunctionMatcher
+{
+public:
+	static constexpr uint32_t NO_MATCH = UINT32_MAX;
+
+	enum class Method : uint8_t
+	{
+		None,
+		ExactHash,
+		LooseHash,
+		Callee,
+		Caller,
+		Neighbour,
+	};
+
+	struct Match
+	{
+		uint32_t function = NO_MATCH;
+		float confidence = 0.0f;
+		Method method = Method::None;
+	};
+
+	struct Translation
+	{
+		bool found = false;
+		uint32_t rva = 0;
+		float confidence = 0.0f;
+		const char* method = "";
+	};
+
+	FunctionMatcher( const FunctionIndex& oldIndex, const FunctionIndex& newIndex )
+		: m_old( oldIndex ), m_new( newIndex ), m_matches( oldIndex.NumFunctions() ), m_reverse( newIndex.NumFunctions(), NO_MATCH )
+	{
+		// Every round of propagation can make more hashes unique among the leftovers
+		while ( true )
+		{
+			const size_t matched = m_numMatched;
+			HashJoin( &FunctionIndex::Function::exactHash, Method::ExactHash, 0.99f, 0.8f );
+			HashJoin( &FunctionIndex::Function::looseHash, Method::LooseHash, 0.9f, 0.6f );
+			Propagate();
+			if ( m_numMatched == matched ) break;
+		}
+	}
+
+	static const char* MethodName( Method method )
+	{
+		switch ( method )
+		{
+		case Method::ExactHash: return "exact";
+		case Method::LooseHash: return "loose";
+		case Method::Callee: return "callee";
+		case Method::Caller: return "caller";
+		case Method::Neighbour: return "neighbour";
+		default: return "none";
+		}
+	}
+
+	size_t NumMatched() const { return m_numMatched; }
+	const Match& GetMatch( size_t oldFunction ) const { return m_matches[oldFunction]; }
+
+	// Thread safe
+	Translation Translate( uint32_t oldRva ) const
+	{
+		Translation result;
+
+		const size_t oldFunction = m_old.FindFunction( oldRva );
+		if ( oldFunction != FunctionIndex::NO_FUNCTION && m_matches[oldFunction].function != NO_MATCH )
+		{
+			const FunctionIndex::Function& oldFunc = m_old.GetFunction( oldFunction );
+			const FunctionIndex::Function& newFunc = m_new.GetFunction( m_matches[oldFunction].function );
+
+			const size_t index = FunctionIndex::FindInstruction( oldFunc, oldRva );
+			float factor;
+			const size_t newIndex = MapInstruction( oldFunction, index, factor );
+			if ( newIndex != SIZE_MAX )
+			{
+				result.found = true;
+				result.rva = newFunc.instructions[newIndex].rva + (oldRva - oldFunc.instructions[index].rva);
+				result.confidence = m_matches[oldFunction].confidence * factor;
+				result.method = MethodName( m_matches[oldFunction].method );
+				return result;
+			}
+		}
+
+		// Data, or code in an unmatched function - see what matched code refers to instead
+		if ( TranslateByReferences( oldRva, 0, result ) )
+		{
+			return result;
+		}
+
+		// Into the middle of something referenced (arrays, struct members)
+		const uint32_t below = m_old.ReferenceBelow( oldRva );
+		if ( below != FunctionIndex::NO_REF && oldRva - below <= MAX_REFERENCE_DISTANCE && TranslateByReferences( below, oldRva - below, result ) )
+		{
+			result.confidence *= 0.7f;
+			result.method = "nearby reference";
+		}
+		return result;
+	}
+
+private:
+	static constexpr size_t SMALL_FUNCTION = 8;
+	static constexpr uint32_t MAX_REFERENCE_DISTANCE = 256;
+	static constexpr size_t MAX_VOTES = 32;
+	static constexpr size_t MAX_ALIGNMENT_CELLS = 2 * 1024 * 1024;
+
+	bool IsMatched( size_t oldFunction, size_t newFunction ) const
+	{
+		return m_matches[oldFunction].function != NO_MATCH || m_reverse[newFunction] != NO_MATCH;
+	}
+
+	bool SetMatch( size_t oldFunction, size_t newFunction, float confidence, Method method )
+	{
+		if ( IsMatched( oldFunction, newFunction ) ) return false;
+
+		m_matches[oldFunction] = { static_cast<uint32_t>(newFunction), confidence, method };
+		m_reverse[newFunction] = static_cast<uint32_t>(oldFunction);
+		m_numMatched++;
+		m_worklist.push_back( static_cast<uint32_t>(oldFunction) );
+		return true;
+	}
+
+	// Pairs up functions whose hash is unique to both binaries (among the unmatched ones)
+	void HashJoin( uint64_t FunctionIndex::Function::*hash, Method method, float confidence, float smallConfidence )
+	{
+		// Hash -> (count, index)
+		std::unordered_map<uint64_t, std::pair<size_t, size_t>> oldHashes, newHashes;
+		for ( size_t i = 0; i < m_old.NumFunctions(); i++ )
+		{
+			if ( m_matches[i].function != NO_MATCH ) continue;
+			oldHashes.try_emplace( m_old.GetFunction( i ).*hash, 0, i ).first->second.first++;
+		}
+		for ( size_t i = 0; i < m_new.NumFunctions(); i++ )
+		{
+			if ( m_reverse[i] != NO_MATCH ) continue;
+			newHashes.try_emplace( m_new.GetFunction( i ).*hash, 0, i ).first->second.first++;
+		}
+
+		for ( const auto& [key, entry] : oldHashes )
+		{
+			auto it = newHashes.find( key );
+			if ( entry.first == 1 && it != newHashes.end() && it->second.first == 1 )
+			{
+				const bool small = m_old.GetFunction( entry.second ).instructions.size() < SMALL_FUNCTION;
+				SetMatch( entry.second, it->second.second, small ? smallConfidence : confidence, method );
+			}
+		}
+	}
+
+	// How alike two functions look on their own, 0 if not enough to match them on
+	float Similarity( size_t oldFunction, size_t newFunction ) const
+	{
+		const FunctionIndex::Function& oldFunc = m_old.GetFunction( oldFunction );
+		const FunctionIndex::Function& newFunc = m_new.GetFunction( newFunction );
+		if ( oldFunc.exactHash == newFunc.exactHash ) return 0.98f;
+		if ( oldFunc.looseHash == newFunc.looseHash ) return 0.9f;
+
+		const size_t oldSize = oldFunc.instructions.size(), newSize = newFunc.instructions.size();
+		return std::min( oldSize, newSize ) * 10 >= std::max( oldSize, newSize ) * 7 ? 0.6f : 0.0f;
+	}
+
+	// Pairs up functions from both lists whose loose hash is unique within both lists
+	void MatchUnique( std::vector<uint32_t> oldList, std::vector<uint32_t> newList, float confidence, Method method )
+	{
+		std::sort( oldList.begin(), oldList.end() );
+		oldList.erase( std::unique( oldList.begin(), oldList.end() ), oldList.end() );
+		std::sort( newList.begin(), newList.end() );
+		newList.erase( std::unique( newList.begin(), newList.end() ), newList.end() );
+
+		std::unordered_map<uint64_t, std::pair<size_t, size_t>> oldHashes, newHashes;
+		for ( uint32_t i : oldList )
+		{
+			if ( m_matches[i].function != NO_MATCH ) continue;
+			oldHashes.try_emplace( m_old.GetFunction( i ).looseHash, 0, i ).first->second.first++;
+		}
+		for ( uint32_t i : newList )
+		{
+			if ( m_reverse[i] != NO_MATCH ) continue;
+			newHashes.try_emplace( m_new.GetFunction( i ).looseHash, 0, i ).first->second.first++;
+		}
+
+		for ( const auto& [key, entry] : oldHashes )
+		{
+			auto it = newHashes.find( key );
+			if ( entry.first == 1 && it != newHashes.end() && it->second.first == 1 )
+			{
+				SetMatch( entry.second, it->second.second, confidence * Similarity( entry.second, it->second.second ), method );
+			}
+		}
+	}
+
+	// Calls at instructions that line up between the two functions most likely call the same function
+	void MatchAlignedCalls( size_t oldFunction, const Match& match )
+	{
+		const FunctionIndex::Function& oldFunc = m_old.GetFunction( oldFunction );
+		const FunctionIndex::Function& newFunc = m_new.GetFunction( match.function );
+
+		const std::vector<size_t> alignment = Align( oldFunc, newFunc );
+		for ( size_t i = 0; i < alignment.size(); i++ )
+		{
+			if ( alignment[i] == SIZE_MAX || oldFunc.instructions[i].ref == FunctionIndex::NO_REF ) continue;
+
+			const size_t oldCallee = m_old.FindFunctionStart( oldFunc.instructions[i].ref );
+			const size_t newCallee = m_new.FindFunctionStart( newFunc.instructions[alignment[i]].ref );
+			if ( oldCallee == FunctionIndex::NO_FUNCTION || newCallee == FunctionIndex::NO_FUNCTION || IsMatched( oldCallee, newCallee ) ) continue;
+
+			// Alignment alone is some evidence, even if the functions themselves changed a lot
+			SetMatch( oldCallee, newCallee, match.confidence * 0.85f * std::max( Similarity( oldCallee, newCallee ), 0.7f ), Method::Callee );
+		}
+	}
+
+	void Propagate()
+	{
+		// Every new match is queued by SetMatch
+		while ( !m_worklist.empty() )
+		{
+			const size_t oldFunction = m_worklist.front();
+			m_worklist.pop_front();
+
+			const Match match = m_matches[oldFunction];
+			const FunctionIndex::Function& oldFunc = m_old.GetFunction( oldFunction );
+			const FunctionIndex::Function& newFunc = m_new.GetFunction( match.function );
+
+			// Same number of calls - the calls most likely line up
+			if ( oldFunc.callees.size() == newFunc.callees.size() )
+			{
+				for ( size_t i = 0; i < oldFunc.callees.size(); i++ )
+				{
+					const float similarity = IsMatched( oldFunc.callees[i], newFunc.callees[i] ) ? 0.0f : Similarity( oldFunc.callees[i], newFunc.callees[i] );
+					if ( similarity > 0.0f )
+					{
+						SetMatch( oldFunc.callees[i], newFunc.callees[i], match.confidence * similarity, Method::Callee );
+					}
+				}
+			}
+			else
+			{
+				MatchUnique( oldFunc.callees, newFunc.callees, match.confidence * 0.95f, Method::Callee );
+				MatchAlignedCalls( oldFunction, match );
+			}
+			MatchUnique( oldFunc.callers, newFunc.callers, match.confidence * 0.9f, Method::Caller );
+
+			// The linker mostly keeps the order of functions
+			for ( const int delta : { -1, 1 } )
+			{
+				const size_t oldNeighbour = oldFunction + delta, newNeighbour = match.function + delta;
+				if ( oldNeighbour >= m_old.NumFunctions() || newNeighbour >= m_new.NumFunctions() || IsMatched( oldNeighbour, newNeighbour ) ) continue;
+
+				const float similarity = Similarity( oldNeighbour, newNeighbour );
+				if ( similarity >= 0.9f )
+				{
+					SetMatch( oldNeighbour, newNeighbour, match.confidence * similarity * 0.95f, Method::Neighbour );
+				}
+			}
+		}
+	}
+
+	// Instruction index in the matched function, or SIZE_MAX - factor is how much to trust it
+	size_t MapInstruction( size_t oldFunction, size_t index, float& factor ) const
+	{
+		const FunctionIndex::Function& oldFunc = m_old.GetFunction( oldFunction );
+		const FunctionIndex::Function& newFunc = m_new.GetFunction( m_matches[oldFunction].function );
+		if ( oldFunc.exactHash == newFunc.exactHash || oldFunc.looseHash == newFunc.looseHash )
+		{
+			factor = oldFunc.exactHash == newFunc.exactHash ? 1.0f : 0.95f;
+			return index;
+		}
+
+		const std::vector<size_t> alignment = Align( oldFunc, newFunc );
+		if ( alignment[index] != SIZE_MAX )
+		{
+			factor = 0.85f;
+			return alignment[index];
+		}
+
+		// Not in the common part - count instructions from the closest aligned one before it
+		for ( size_t i = index; i-- > 0; )
+		{
+			if ( alignment[i] != SIZE_MAX )
+			{
+				const size_t newIndex = alignment[i] + (index - i);
+				factor = 0.5f;
+				return newIndex < newFunc.instructions.size() ? newIndex : SIZE_MAX;
+			}
+		}
+		factor = 0.4f;
+		return index < newFunc.instructions.size() ? index : SIZE_MAX;
+	}
+
+	// Longest common subsequence of instruction tokens, as old index -> new index (SIZE_MAX if not in it)
+	static std::vector<size_t> Align( const FunctionIndex::Function& oldFunc, const FunctionIndex::Function& newFunc )
+	{
+		const auto& a = oldFunc.instructions;
+		const auto& b = newFunc.instructions;
+		std::vector<size_t> result( a.size(), SIZE_MAX );
+
+		size_t prefix = 0;
+		while ( prefix < a.size() && prefix < b.size() && a[prefix].token == b[prefix].token )
+		{
+			result[prefix] = prefix;
+			prefix++;
+		}
+		size_t suffix = 0;
+		while ( suffix < a.size() - prefix && suffix < b.size() - prefix && a[a.size() - 1 - suffix].token == b[b.size() - 1 - suffix].token )
+		{
+			result[a.size() - 1 - suffix] = b.size() - 1 - suffix;
+			suffix++;
+		}
+
+		const size_t n = a.size() - prefix - suffix, m = b.size() - prefix - suffix;
+		if ( n == 0 || m == 0 || (n + 1) * (m + 1) > MAX_ALIGNMENT_CELLS )
+		{
+			return result;
+		}
+
+		// table[i][j] - LCS length of a[i..n) and b[j..m) (of the middle part)
+		std::vector<uint32_t> table( (n + 1) * (m + 1), 0 );
+		auto cell = [&]( size_t i, size_t j ) -> uint32_t& { return table[i * (m + 1) + j]; };
+		for ( size_t i = n; i-- > 0; )
+		{
+			for ( size_t j = m; j-- > 0; )
+			{
+				cell( i, j ) = a[prefix + i].token == b[prefix + j].token ? cell( i + 1, j + 1 ) + 1 : std::max( cell( i + 1, j ), cell( i, j + 1 ) );
+			}
+		}
+
+		for ( size_t i = 0, j = 0; i < n && j < m; )
+		{
+			if ( a[prefix + i].token == b[prefix + j].token )
+			{
+				result[prefix + i] = prefix + j;
+				i++, j++;
+			}
+			else if ( cell( i + 1, j ) >= cell( i, j + 1 ) ) i++;
+			else j++;
+		}
+		return result;
+	}
+
+	// Votes on where the matched code referencing oldRva refers to now
+	bool TranslateByReferences( uint32_t oldRva, uint32_t offset, Translation& result ) const
+	{
+		struct Vote
+		{
+			uint32_t rva;
+			size_t count;
+			float confidence;
+		};
+		std::vector<Vote> votes;
+		size_t numVotes = 0;
+		float total = 0.0f;
+		m_old.ForEachReference( oldRva, [&]( size_t function, size_t instruction ) {
+			if ( m_matches[function].function == NO_MATCH ) return true;
+
+			float factor;
+			const size_t newIndex = MapInstruction( function, instruction, factor );
+			if ( newIndex == SIZE_MAX ) return true;
+
+			const uint32_t newRef = m_new.GetFunction( m_matches[function].function ).instructions[newIndex].ref;
+			if ( newRef == FunctionIndex::NO_REF ) return true;
+
+			const float confidence = m_matches[function].confidence * factor;
+			auto it = std::find_if( votes.begin(), votes.end(), [newRef]( const Vote& vote ) { return vote.rva == newRef; } );
+			if ( it != votes.end() )
+			{
+				it->count++;
+				it->confidence += confidence;
+			}
+			else
+			{
+				votes.push_back( { newRef, 1, confidence } );
+			}
+			total += confidence;
+			return ++numVotes < MAX_VOTES;
+		} );
+
+		if ( votes.empty() ) return false;
+
+		const auto best = std::max_element( votes.begin(), votes.end(), []( const Vote& left, const Vote& right ) {
+			return left.confidence < right.confidence;
+		} );
+
+		// How much the votes agree, times how sure they are on average - a lone vote is worth less
+		result.found = true;
+		result.rva = best->rva + offset;
+		result.confidence = (best->confidence / total) * (best->confidence / best->count) * (numVotes > 1 ? 1.0f : 0.8f);
+		result.method = "reference";
+		return true;
+	}
+
+	const FunctionIndex& m_old;
+	const FunctionIndex& m_new;
+	std::vector<Match> m_matches;
+	std::vector<uint32_t> m_reverse;
+	size_t m_numMatched = 0;
+	std::deque<uint32_t> m_worklist;
+};
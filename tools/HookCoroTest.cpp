@@ -0,0 +1,193 @@
+// Self-check for the staged initialization coroutines in HookCoro.hpp (Linux, C++20)
+// Usage: HookCoroTest [library.so]
+// Runs an init_task through every kind of wait, checking where and with what it resumes:
+// - module_loaded on a library that isn't loaded yet (the first of a few common ones by default) - it must stay suspended
+//   until the library is dlopen'ed and check_modules() is called, then resume on that thread with the library's base
+// - module_loaded on a library that's already loaded, which mustn't suspend at all
+// - run_on_pool, with and without a result, scanning the library for its ELF header - resuming on a pool worker
+// - next_frame, resuming on the thread calling signal_frame(), once per frame
+// hook::scan itself needs Patterns.cpp, which is Windows only, so the scan runs through run_on_pool instead.
+// Exits with 1 on any failure. Worth running under -fsanitize=thread too.
+
+#include "../HookCoro.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <dlfcn.h>
+
+static size_t numFailures = 0;
+
+static void Check( bool condition, const char* what )
+{
+	printf( "%s: %s\n", condition ? "OK" : "FAILED", what );
+	numFailures += condition ? 0 : 1;
+}
+
+// Waits for the coroutine to get somewhere on another thread
+static bool WaitFor( const std::atomic<int>& stage, int expected )
+{
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+	while ( stage.load() < expected )
+	{
+		if ( std::chrono::steady_clock::now() > deadline )
+		{
+			return false;
+		}
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	return true;
+}
+
+// Byte pattern scan, the same as hook::pattern would do over the range
+static std::vector<size_t> Scan( const uint8_t* begin, size_t size, std::string_view patternString )
+{
+	std::basic_string<uint8_t> bytes, mask;
+	hook::details::TransformPattern( patternString, bytes, mask );
+
+	std::vector<size_t> matches;
+	for ( size_t i = 0; i + bytes.size() <= size; i++ )
+	{
+		size_t j = 0;
+		while ( j < bytes.size() && (begin[i + j] & mask[j]) == bytes[j] ) j++;
+		if ( j == bytes.size() ) matches.push_back( i );
+	}
+	return matches;
+}
+
+struct State
+{
+	std::atomic<int> stage { 0 };
+	std::thread::id mainThread = std::this_thread::get_id();
+
+	void* base = nullptr;
+	std::thread::id moduleThread, poolThread, frameThread;
+	std::vector<size_t> headerMatches;
+	bool voidTaskRan = false;
+	int numFrames = 0;
+};
+
+static hook::init_task Staged( State& state, std::string library )
+{
+	state.base = co_await hook::module_loaded( library );
+	state.moduleThread = std::this_thread::get_id();
+	state.stage = 1;
+
+	// The first page is enough - the header is at the very beginning
+	const uint8_t* image = static_cast<const uint8_t*>(state.base);
+	state.headerMatches = co_await hook::run_on_pool( [image] {
+		return Scan( image, 0x1000, "7F 45 4C 46 ? ? 01" );
+	} );
+	state.poolThread = std::this_thread::get_id();
+
+	co_await hook::run_on_pool( [&state] {
+		state.voidTaskRan = true;
+	} );
+	state.stage = 2;
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		co_await hook::next_frame();
+		state.numFrames++;
+		state.frameThread = std::this_thread::get_id();
+	}
+	state.stage = 3;
+}
+
+static hook::init_task AlreadyLoaded( std::atomic<int>& stage, void*& base )
+{
+	base = co_await hook::module_loaded( "libc" );
+	stage = 1;
+}
+
+static bool IsLoaded( const char* library )
+{
+	void* handle = dlopen( library, RTLD_LAZY | RTLD_NOLOAD );
+	if ( handle != nullptr )
+	{
+		dlclose( handle );
+	}
+	return handle != nullptr;
+}
+
+int main( int argc, char* argv[] )
+{
+	std::string library;
+	if ( argc > 1 )
+	{
+		library = argv[1];
+	}
+	else
+	{
+		for ( const char* candidate : { "libz.so.1", "libutil.so.1", "libanl.so.1", "libresolv.so.2" } )
+		{
+			if ( !IsLoaded( candidate ) )
+			{
+				library = candidate;
+				break;
+			}
+		}
+	}
+	if ( library.empty() || IsLoaded( library.c_str() ) )
+	{
+		fprintf( stderr, "Usage: %s [library.so] - the library must exist and not be loaded by the test itself\n", argv[0] );
+		return 1;
+	}
+	const std::string stem = library.substr( 0, library.find( ".so" ) );
+	printf( "Waiting for %s\n", stem.c_str() );
+
+	{
+		std::atomic<int> stage { 0 };
+		void* base = nullptr;
+		AlreadyLoaded( stage, base );
+		Check( stage == 1 && base != nullptr && memcmp( base, "\x7F" "ELF", 4 ) == 0, "module_loaded doesn't suspend for loaded modules" );
+	}
+
+	State state;
+	Staged( state, stem );
+	Check( state.stage == 0, "module_loaded suspends until the module loads" );
+
+	hook::check_modules();
+	Check( state.stage == 0, "check_modules keeps waiting while the module isn't loaded" );
+
+	void* handle = dlopen( library.c_str(), RTLD_NOW );
+	if ( handle == nullptr )
+	{
+		fprintf( stderr, "Cannot load %s: %s\n", library.c_str(), dlerror() );
+		return 1;
+	}
+	Check( state.stage == 0, "module_loaded needs check_modules to notice the module on Linux" );
+
+	hook::check_modules();
+	Check( state.stage >= 1 && state.moduleThread == state.mainThread, "module_loaded resumes on the thread calling check_modules" );
+	Check( state.base != nullptr && memcmp( state.base, "\x7F" "ELF", 4 ) == 0, "module_loaded returns the module base" );
+
+	Check( WaitFor( state.stage, 2 ), "run_on_pool resumes" );
+	Check( state.headerMatches.size() == 1 && state.headerMatches[0] == 0, "run_on_pool returns the result of the scan" );
+	Check( state.voidTaskRan, "run_on_pool runs functions without a result" );
+	Check( state.poolThread != state.mainThread, "run_on_pool resumes on a pool worker" );
+
+	// Signal from a thread of our own, so it's clear who resumed the coroutine
+	// Frames may come before the coroutine starts waiting for them, like they would in a game, so keep them coming
+	std::thread renderThread( [&state] {
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+		while ( state.stage < 3 && std::chrono::steady_clock::now() < deadline )
+		{
+			hook::signal_frame();
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		}
+	} );
+	const std::thread::id renderThreadId = renderThread.get_id();
+	renderThread.join();
+	Check( state.stage == 3 && state.numFrames == 3, "next_frame resumes once per signal_frame" );
+	Check( state.frameThread == renderThreadId, "next_frame resumes on the thread calling signal_frame" );
+
+	TaskPool::Pool::Get().Shutdown();
+	dlclose( handle );
+
+	printf( "%s\n", numFailures == 0 ? "All passed" : "FAILED" );
+	return numFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,263 @@
+// Self-check for instruction-level signatures (InstructionPatterns.h)
+// Usage: InstructionPatternsTest [--samples N] [--seed N] <image.exe> [signature ...]
+// Decodes the executable sections of the image, then checks that:
+// - every contiguous run of three instructions is in the sequence index under its key, and every instruction in its mnemonic bucket
+// - instruction_pattern::find, which only verifies candidates from the index, returns exactly what match_at
+//   over every instruction of the stream does
+// Signatures are the ones given, plus N (default 500) sampled from the image itself, with some instructions
+// replaced by wildcards and some operands spelled out - each has to match at least where it was taken from.
+// Works well with images from MakeSyntheticPE. Exits with 1 on any mismatch.
+
+#include "MappedFile.h"
+#include "PEFile.h"
+#include "../InstructionPatterns.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static bool CheckIndex( const hook::instruction_stream& stream )
+{
+	using hook::instruction_stream;
+
+	size_t numFailures = 0;
+	auto fail = [&]( const char* what, size_t index ) {
+		if ( numFailures++ < 10 )
+		{
+			fprintf( stderr, "Instruction %zu: %s\n", index, what );
+		}
+	};
+
+	auto isSequence = [&]( size_t index ) {
+		return index + instruction_stream::SEQUENCE_LENGTH <= stream.size() && stream.contiguous( index ) && stream.contiguous( index + 1 );
+	};
+
+	std::vector<bool> indexed( stream.size() );
+	for ( uint32_t key = 0; key < (1u << 18); key++ )
+	{
+		for ( uint32_t index : stream.sequences( key ) )
+		{
+			if ( !isSequence( index ) || instruction_stream::sequence_key( stream[index].family, stream[index + 1].family, stream[index + 2].family ) != key )
+			{
+				fail( "indexed under a wrong sequence key", index );
+			}
+			else if ( indexed[index] )
+			{
+				fail( "indexed twice", index );
+			}
+			else
+			{
+				indexed[index] = true;
+			}
+		}
+	}
+
+	size_t numSequences = 0;
+	for ( size_t i = 0; i < stream.size(); i++ )
+	{
+		if ( isSequence( i ) )
+		{
+			numSequences++;
+			if ( !indexed[i] ) fail( "sequence missing from the index", i );
+		}
+	}
+
+	size_t numInFamilies = 0;
+	for ( size_t family = 0; family < size_t(hook::x86::mnemonic::count); family++ )
+	{
+		for ( uint32_t index : stream.instructions( hook::x86::mnemonic(family) ) )
+		{
+			if ( stream[index].family != hook::x86::mnemonic(family) ) fail( "in a wrong mnemonic bucket", index );
+			numInFamilies++;
+		}
+	}
+	if ( numInFamilies != stream.size() )
+	{
+		fprintf( stderr, "Mnemonic index holds %zu entries, the stream has %zu instructions\n", numInFamilies, stream.size() );
+		numFailures++;
+	}
+
+	printf( "%zu instructions, %zu sequences indexed - %s\n", stream.size(), numSequences, numFailures == 0 ? "OK" : "FAILED" );
+	return numFailures == 0;
+}
+
+// Spells out an operand the way signatures do, or "*" if it can't be
+static std::string OperandText( const hook::x86::operand& operand )
+{
+	static const char* const regs64[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi" };
+
+	switch ( operand.type )
+	{
+	case hook::x86::operand_type::reg:
+		if ( operand.size == 64 ) return operand.reg < 8 ? regs64[operand.reg] : "r" + std::to_string( operand.reg );
+		if ( operand.size == 128 ) return "xmm";
+		return operand.size == 32 ? "r32" : operand.size == 16 ? "r16" : "reg8";
+	case hook::x86::operand_type::mem:
+		return operand.base == hook::x86::RIP_REG ? "[rip+*]" : "[*]";
+	case hook::x86::operand_type::imm:
+		return "imm";
+	case hook::x86::operand_type::rel:
+		return "rel";
+	default:
+		return "*";
+	}
+}
+
+struct Sample
+{
+	std::string signature;
+	const uint8_t* origin;
+};
+
+static std::vector<Sample> SampleSignatures( const hook::instruction_stream& stream, size_t count, uint64_t seed )
+{
+	std::vector<Sample> signatures;
+	if ( stream.size() < 8 )
+	{
+		return signatures;
+	}
+
+	std::mt19937_64 random( seed );
+	for ( size_t i = 0; i < count; i++ )
+	{
+		const size_t length = 1 + random() % 5;
+		const size_t start = random() % (stream.size() - length);
+
+		std::string signature;
+		for ( size_t j = start; j < start + length; j++ )
+		{
+			if ( !signature.empty() ) signature += "; ";
+
+			const hook::x86::mnemonic family = stream[j].family;
+			const unsigned roll = random() % 8;
+			if ( family == hook::x86::mnemonic::unknown_ || roll == 0 )
+			{
+				signature += "*";
+				continue;
+			}
+			signature += hook::x86::mnemonic_name( family );
+
+			hook::x86::instruction ins;
+			if ( roll < 4 && family != hook::x86::mnemonic::jcc_ && family != hook::x86::mnemonic::cmovcc_ && family != hook::x86::mnemonic::setcc_
+				&& stream.decode( j, ins ) && ins.numOperands != 0 )
+			{
+				for ( size_t k = 0; k < ins.numOperands; k++ )
+				{
+					signature += k == 0 ? " " : ", ";
+					signature += OperandText( ins.operands[k] );
+				}
+			}
+		}
+		signatures.push_back( { std::move(signature), stream.base() + stream[start].offset } );
+	}
+	return signatures;
+}
+
+static bool CheckSignature( const hook::instruction_stream& stream, const std::string& signature, bool verbose, const uint8_t* origin = nullptr )
+{
+	const hook::instruction_pattern pattern( signature );
+	if ( !pattern.valid() )
+	{
+		fprintf( stderr, "Invalid signature: %s\n", signature.c_str() );
+		return false;
+	}
+
+	std::vector<const uint8_t*> expected;
+	for ( size_t i = 0; i < stream.size(); i++ )
+	{
+		if ( pattern.match_at( stream, i ) )
+		{
+			expected.push_back( stream.base() + stream[i].offset );
+		}
+	}
+
+	std::vector<const uint8_t*> found;
+	for ( const hook::pattern_match& match : pattern.find( stream ) )
+	{
+		found.push_back( match.get<const uint8_t>() );
+	}
+
+	const bool ok = found == expected;
+	if ( !ok || verbose )
+	{
+		printf( "%s: %zu matches, %zu expected%s\n", signature.c_str(), found.size(), expected.size(), ok ? "" : " - MISMATCH" );
+	}
+	if ( origin != nullptr && std::find( expected.begin(), expected.end(), origin ) == expected.end() )
+	{
+		printf( "%s: doesn't match where it was sampled from\n", signature.c_str() );
+		return false;
+	}
+	return ok;
+}
+
+int main( int argc, char* argv[] )
+{
+	size_t numSamples = 500;
+	uint64_t seed = 1;
+
+	int arg = 1;
+	for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; arg++ )
+	{
+		if ( strcmp( argv[arg], "--samples" ) == 0 && arg + 1 < argc )
+		{
+			numSamples = strtoul( argv[++arg], nullptr, 10 );
+		}
+		else if ( strcmp( argv[arg], "--seed" ) == 0 && arg + 1 < argc )
+		{
+			seed = strtoull( argv[++arg], nullptr, 0 );
+		}
+	}
+
+	if ( argc - arg < 1 )
+	{
+		fprintf( stderr, "Usage: %s [--samples N] [--seed N] <image.exe> [signature ...]\n", argv[0] );
+		return 1;
+	}
+
+	const MappedFile file( argv[arg] );
+	const PEFile image( file.Data(), file.Size() );
+	if ( !file.Valid() || !image.Valid() )
+	{
+		fprintf( stderr, "Cannot open %s\n", argv[arg] );
+		return 1;
+	}
+
+	// Offsets are file offsets, which is all the checks need
+	const auto start = std::chrono::steady_clock::now();
+	hook::instruction_stream stream( image.Data(), image.Is64() );
+	for ( size_t i = 0; i < image.NumSections(); i++ )
+	{
+		const pe::SectionHeader& section = image.Section( i );
+		size_t size;
+		const uint8_t* data = image.SectionData( section, &size );
+		if ( PEFile::IsExecutable( section ) && data != nullptr )
+		{
+			stream.add_range( data, data + size );
+		}
+	}
+	stream.build_index();
+	printf( "Decoded and indexed in %.2fs\n", std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count() );
+
+	bool ok = CheckIndex( stream );
+
+	size_t numFailed = 0;
+	for ( int i = arg + 1; i < argc; i++ )
+	{
+		numFailed += CheckSignature( stream, argv[i], true ) ? 0 : 1;
+	}
+
+	const std::vector<Sample> samples = SampleSignatures( stream, numSamples, seed );
+	for ( const Sample& sample : samples )
+	{
+		numFailed += CheckSignature( stream, sample.signature, false, sample.origin ) ? 0 : 1;
+	}
+	printf( "%zu signatures checked against match_at, %zu mismatched\n", argc - arg - 1 + samples.size(), numFailed );
+
+	ok = ok && numFailed == 0;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+// Minimal io_uring wrapper for offline tools (Linux)
+// Talks to the kernel through the raw system calls, so liburing isn't needed. Only covers what batched reads need:
+// queue reads, submit them, and reap the completions. Valid() is false if io_uring isn't available
+// (old kernel, or blocked by seccomp), and callers are expected to fall back to pread then.
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class IoUring
+{
+public:
+	explicit IoUring( unsigned int entries )
+	{
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+		io_uring_params params;
+		memset( &params, 0, sizeof(params) );
+
+		const int fd = static_cast<int>(syscall( __NR_io_uring_setup, entries, &params ));
+		if ( fd < 0 )
+		{
+			return;
+		}
+		m_fd = fd;
+
+		m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if ( singleMmap )
+		{
+			m_sqRingSize = m_cqRingSize = m_sqRingSize > m_cqRingSize ? m_sqRingSize : m_cqRingSize;
+		}
+
+		void* sqRing = mmap( nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+		if ( sqRing == MAP_FAILED )
+		{
+			Close();
+			return;
+		}
+		m_sqRing = static_cast<uint8_t*>(sqRing);
+
+		if ( singleMmap )
+		{
+			m_cqRing = m_sqRing;
+		}
+		else
+		{
+			void* cqRing = mmap( nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+			if ( cqRing == MAP_FAILED )
+			{
+				Close();
+				return;
+			}
+			m_cqRing = static_cast<uint8_t*>(cqRing);
+		}
+
+		m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap( nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+		if ( sqes == MAP_FAILED )
+		{
+			Close();
+			return;
+		}
+		m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+		m_sqHead = reinterpret_cast<unsigned int*>(m_sqRing + params.sq_off.head);
+		m_sqTail = reinterpret_cast<unsigned int*>(m_sqRing + params.sq_off.tail);
+		m_sqMask = *reinterpret_cast<unsigned int*>(m_sqRing + params.sq_off.ring_mask);
+		m_sqEntries = params.sq_entries;
+		m_sqArray = reinterpret_cast<unsigned int*>(m_sqRing + params.sq_off.array);
+
+		m_cqHead = reinterpret_cast<unsigned int*>(m_cqRing + params.cq_off.head);
+		m_cqTail = reinterpret_cast<unsigned int*>(m_cqRing + params.cq_off.tail);
+		m_cqMask = *reinterpret_cast<unsigned int*>(m_cqRing + params.cq_off.ring_mask);
+		m_cqes = reinterpret_cast<io_uring_cqe*>(m_cqRing + params.cq_off.cqes);
+#else
+		(void)entries;
+#endif
+	}
+
+	~IoUring()
+	{
+		Close();
+	}
+
+	IoUring( const IoUring& ) = delete;
+	IoUring& operator=( const IoUring& ) = delete;
+
+	bool Valid() const { return m_sqes != nullptr; }
+
+	// Queues a read, false if the submission queue is full (Submit and try again)
+	bool QueueRead( int fd, void* buffer, unsigned int length, uint64_t offset, uint64_t userData )
+	{
+		const unsigned int tail = *m_sqTail;
+		if ( tail - __atomic_load_n( m_sqHead, __ATOMIC_ACQUIRE ) >= m_sqEntries )
+		{
+			return false;
+		}
+
+		const unsigned int index = tail & m_sqMask;
+		io_uring_sqe& sqe = m_sqes[index];
+		memset( &sqe, 0, sizeof(sqe) );
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = fd;
+		sqe.addr = reinterpret_cast<uintptr_t>(buffer);
+		sqe.len = length;
+		sqe.off = offset;
+		sqe.user_data = userData;
+		m_sqArray[index] = index;
+
+		__atomic_store_n( m_sqTail, tail + 1, __ATOMIC_RELEASE );
+		m_toSubmit++;
+		return true;
+	}
+
+	// Submits everything queued, and waits for at least minComplete completions
+	bool Submit( unsigned int minComplete = 0 )
+	{
+#if defined(__NR_io_uring_enter)
+		while ( true )
+		{
+			const unsigned int flags = minComplete != 0 ? IORING_ENTER_GETEVENTS : 0;
+			const long result = syscall( __NR_io_uring_enter, m_fd, m_toSubmit, minComplete, flags, nullptr, 0 );
+			if ( result >= 0 )
+			{
+				m_toSubmit -= static_cast<unsigned int>(result);
+				return true;
+			}
+			if ( errno != EINTR )
+			{
+				return false;
+			}
+		}
+#else
+		(void)minComplete;
+		return false;
+#endif
+	}
+
+	// Pops a completion, false if there is none ready
+	bool PopCompletion( uint64_t& userData, int& result )
+	{
+		const unsigned int head = *m_cqHead;
+		if ( head == __atomic_load_n( m_cqTail, __ATOMIC_ACQUIRE ) )
+		{
+			return false;
+		}
+
+		const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+		userData = cqe.user_data;
+		result = cqe.res;
+		__atomic_store_n( m_cqHead, head + 1, __ATOMIC_RELEASE );
+		return true;
+	}
+
+private:
+	void Close()
+	{
+		if ( m_sqes != nullptr )
+		{
+			munmap( m_sqes, m_sqesSize );
+			m_sqes = nullptr;
+		}
+		if ( m_cqRing != nullptr && m_cqRing != m_sqRing )
+		{
+			munmap( m_cqRing, m_cqRingSize );
+		}
+		if ( m_sqRing != nullptr )
+		{
+			munmap( m_sqRing, m_sqRingSize );
+		}
+		m_sqRing = m_cqRing = nullptr;
+		if ( m_fd >= 0 )
+		{
+			close( m_fd );
+			m_fd = -1;
+		}
+	}
+
+	int m_fd = -1;
+
+	uint8_t* m_sqRing = nullptr;
+	uint8_t* m_cqRing = nullptr;
+	size_t m_sqRingSize = 0;
+	size_t m_cqRingSize = 0;
+	io_uring_sqe* m_sqes = nullptr;
+	size_t m_sqesSize = 0;
+
+	unsigned int* m_sqHead = nullptr;
+	unsigned int* m_sqTail = nullptr;
+	unsigned int* m_sqArray = nullptr;
+	unsigned int m_sqMask = 0;
+	unsigned int m_sqEntries = 0;
+
+	unsigned int* m_cqHead = nullptr;
+	unsigned int* m_cqTail = nullptr;
+	io_uring_cqe* m_cqes = nullptr;
+	unsigned int m_cqMask = 0;
+
+	unsigned int m_toSubmit = 0;
+};
@@ -0,0 +1,107 @@
+// Synthetic PE image generator, for reproducible scanner and patcher benchmarks (Linux)
+// Usage: MakeSyntheticPE [--x86] [--dll] [--seed N] [--code-mb N] [--signatures N] [--no-relocs] [--plant signatures.txt] <out.exe>
+// Writes the image (see SyntheticPE.h), plus two files next to it:
+// - <out.exe>.sigs.txt - the planted signatures as a signature list, ready for SignatureMatrix and the like
+// - <out.exe>.rvas.txt - "name: rva" of every planted signature, in the AddressPorter address format
+// The same options always give the same files.
+
+#include "SyntheticPE.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static bool WriteFile( const std::string& path, const void* data, size_t size )
+{
+	FILE* file = fopen( path.c_str(), "wb" );
+	if ( file == nullptr )
+	{
+		return false;
+	}
+	const bool written = fwrite( data, 1, size, file ) == size;
+	return fclose( file ) == 0 && written;
+}
+
+int main( int argc, char* argv[] )
+{
+	SyntheticPE::Options options;
+
+	int arg = 1;
+	for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; arg++ )
+	{
+		if ( strcmp( argv[arg], "--x86" ) == 0 )
+		{
+			options.is64 = false;
+		}
+		else if ( strcmp( argv[arg], "--dll" ) == 0 )
+		{
+			options.isDll = true;
+		}
+		else if ( strcmp( argv[arg], "--no-relocs" ) == 0 )
+		{
+			options.relocations = false;
+		}
+		else if ( strcmp( argv[arg], "--seed" ) == 0 && arg + 1 < argc )
+		{
+			options.seed = strtoull( argv[++arg], nullptr, 0 );
+		}
+		else if ( strcmp( argv[arg], "--code-mb" ) == 0 && arg + 1 < argc )
+		{
+			options.codeSize = static_cast<size_t>(strtod( argv[++arg], nullptr ) * 1024 * 1024);
+		}
+		else if ( strcmp( argv[arg], "--signatures" ) == 0 && arg + 1 < argc )
+		{
+			options.numSignatures = strtoul( argv[++arg], nullptr, 10 );
+		}
+		else if ( strcmp( argv[arg], "--plant" ) == 0 && arg + 1 < argc )
+		{
+			if ( !ReadSignatureList( argv[++arg], options.planted ) )
+			{
+				fprintf( stderr, "Cannot open %s\n", argv[arg] );
+				return 1;
+			}
+		}
+	}
+
+	if ( argc - arg < 1 )
+	{
+		fprintf( stderr, "Usage: %s [--x86] [--dll] [--seed N] [--code-mb N] [--signatures N] [--no-relocs] [--plant signatures.txt] <out.exe>\n", argv[0] );
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const SyntheticPE pe( options );
+	const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	std::string signatures = "# Generated by MakeSyntheticPE, seed " + std::to_string( options.seed ) + "\n";
+	std::string rvas = signatures;
+	size_t numAmbiguous = 0;
+	for ( const SyntheticPE::PlantedSignature& signature : pe.Signatures() )
+	{
+		char rva[16];
+		snprintf( rva, sizeof(rva), "%X", signature.rva );
+		signatures += signature.name + ": " + signature.pattern + "\n";
+		rvas += signature.name + ": " + rva + "\n";
+
+		if ( signature.numMatches != 1 )
+		{
+			fprintf( stderr, "%s matches %zu times\n", signature.name.c_str(), signature.numMatches );
+			numAmbiguous++;
+		}
+	}
+
+	const std::string path = argv[arg];
+	if ( !WriteFile( path, pe.Image().data(), pe.Image().size() ) || !WriteFile( path + ".sigs.txt", signatures.data(), signatures.size() )
+		|| !WriteFile( path + ".rvas.txt", rvas.data(), rvas.size() ) )
+	{
+		fprintf( stderr, "Cannot write %s\n", path.c_str() );
+		return 1;
+	}
+
+	fprintf( stderr, "%s: %zu bytes, %zu functions, %zu signatures (%zu ambiguous) in %.2fs\n",
+		path.c_str(), pe.Image().size(), pe.NumFunctions(), pe.Signatures().size(), numAmbiguous, seconds );
+	return 0;
+}
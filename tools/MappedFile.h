@@ -0,0 +1,73 @@
+#pragma once
+
+// Read-only memory mapped file for offline tools (POSIX)
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+
+	explicit MappedFile( const char* path )
+	{
+		const int fd = open( path, O_RDONLY | O_CLOEXEC );
+		if ( fd == -1 )
+		{
+			return;
+		}
+
+		struct stat st;
+		if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+		{
+			void* data = mmap( nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0 );
+			if ( data != MAP_FAILED )
+			{
+				// Scans walk the file front to back
+				madvise( data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL );
+				madvise( data, static_cast<size_t>(st.st_size), MADV_WILLNEED );
+				m_data = static_cast<const uint8_t*>(data);
+				m_size = static_cast<size_t>(st.st_size);
+			}
+		}
+		close( fd );
+	}
+
+	~MappedFile()
+	{
+		if ( m_data != nullptr )
+		{
+			munmap( const_cast<uint8_t*>(m_data), m_size );
+		}
+	}
+
+	MappedFile( MappedFile&& other ) noexcept
+		: m_data( std::exchange(other.m_data, nullptr) ), m_size( std::exchange(other.m_size, 0) )
+	{
+	}
+
+	MappedFile& operator=( MappedFile&& other ) noexcept
+	{
+		std::swap( m_data, other.m_data );
+		std::swap( m_size, other.m_size );
+		return *this;
+	}
+
+	MappedFile( const MappedFile& ) = delete;
+	MappedFile& operator=( const MappedFile& ) = delete;
+
+	bool Valid() const { return m_data != nullptr; }
+	const uint8_t* Data() const { return m_data; }
+	size_t Size() const { return m_size; }
+
+private:
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+};
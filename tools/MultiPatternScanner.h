@@ -0,0 +1,160 @@
+#pragma once
+
+// Scans for a whole set of patterns in a single pass over the data
+// Every pattern is anchored on its rarest pair of adjacent fixed bytes (or a single byte, if it has no such pair),
+// and bucketed by that anchor. Each position then costs one or two table lookups, and only patterns
+// with a matching anchor get verified.
+
+#include "../PatternAnalyzer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+class MultiPatternScanner
+{
+public:
+	explicit MultiPatternScanner( std::vector<hook::analysis::parsed_pattern> patterns,
+			const hook::analysis::byte_frequencies& frequencies = hook::analysis::byte_frequencies::uniform() )
+		: m_patterns( std::move(patterns) )
+	{
+		std::vector<std::pair<uint32_t, Anchor>> pairAnchors, byteAnchors;
+		for ( size_t i = 0; i < m_patterns.size(); i++ )
+		{
+			const auto& pattern = m_patterns[i];
+			m_maxLength = std::max( m_maxLength, pattern.size() );
+
+			double bestPair = 2.0, bestByte = 2.0;
+			size_t pairOffset = SIZE_MAX, byteOffset = SIZE_MAX;
+			for ( size_t j = 0; j < pattern.size(); j++ )
+			{
+				if ( pattern.wildcard(j) ) continue;
+
+				const double freq = frequencies.freq[pattern.bytes[j]];
+				if ( freq < bestByte )
+				{
+					bestByte = freq;
+					byteOffset = j;
+				}
+				if ( j + 1 < pattern.size() && !pattern.wildcard(j + 1) && freq * frequencies.freq[pattern.bytes[j + 1]] < bestPair )
+				{
+					bestPair = freq * frequencies.freq[pattern.bytes[j + 1]];
+					pairOffset = j;
+				}
+			}
+
+			if ( pairOffset != SIZE_MAX )
+			{
+				const uint32_t key = (uint32_t(pattern.bytes[pairOffset]) << 8) | pattern.bytes[pairOffset + 1];
+				pairAnchors.emplace_back( key, Anchor{ static_cast<uint32_t>(i), static_cast<uint32_t>(pairOffset) } );
+			}
+			else if ( byteOffset != SIZE_MAX )
+			{
+				byteAnchors.emplace_back( pattern.bytes[byteOffset], Anchor{ static_cast<uint32_t>(i), static_cast<uint32_t>(byteOffset) } );
+			}
+			else
+			{
+				// Wildcards only - matches everywhere
+				m_unanchored.push_back( static_cast<uint32_t>(i) );
+			}
+		}
+
+		BuildBuckets( pairAnchors, 0x10000, m_pairStart, m_pairAnchors );
+		BuildBuckets( byteAnchors, 0x100, m_byteStart, m_byteAnchors );
+	}
+
+	size_t NumPatterns() const { return m_patterns.size(); }
+	size_t MaxLength() const { return m_maxLength; }
+	const hook::analysis::parsed_pattern& Pattern( size_t index ) const { return m_patterns[index]; }
+
+	// Calls callback(patternIndex, offset) for every match fully contained in [data, data + size)
+	// Matches are reported in order of their anchor position, not their start
+	template<typename Callback>
+	void Scan( const uint8_t* data, size_t size, Callback&& callback ) const
+	{
+		const bool hasPairs = !m_pairAnchors.empty();
+		const bool hasBytes = !m_byteAnchors.empty();
+
+		for ( size_t pos = 0; pos < size; pos++ )
+		{
+			if ( hasPairs && pos + 1 < size )
+			{
+				const uint32_t key = (uint32_t(data[pos]) << 8) | data[pos + 1];
+				for ( uint32_t i = m_pairStart[key], end = m_pairStart[key + 1]; i < end; i++ )
+				{
+					Verify( m_pairAnchors[i], data, size, pos, callback );
+				}
+			}
+			if ( hasBytes )
+			{
+				const uint32_t key = data[pos];
+				for ( uint32_t i = m_byteStart[key], end = m_byteStart[key + 1]; i < end; i++ )
+				{
+					Verify( m_byteAnchors[i], data, size, pos, callback );
+				}
+			}
+		}
+
+		for ( uint32_t index : m_unanchored )
+		{
+			for ( size_t pos = 0; pos + m_patterns[index].size() <= size; pos++ )
+			{
+				callback( index, pos );
+			}
+		}
+	}
+
+private:
+	struct Anchor
+	{
+		uint32_t pattern;
+		uint32_t offset;
+	};
+
+	template<typename Callback>
+	void Verify( const Anchor& anchor, const uint8_t* data, size_t size, size_t pos, Callback& callback ) const
+	{
+		if ( pos < anchor.offset ) return;
+
+		const size_t start = pos - anchor.offset;
+		const auto& pattern = m_patterns[anchor.pattern];
+		const size_t length = pattern.size();
+		if ( length > size - start ) return;
+
+		const uint8_t* ptr = data + start;
+		const uint8_t* bytes = pattern.bytes.data();
+		const uint8_t* mask = pattern.mask.data();
+		for ( size_t j = 0; j < length; j++ )
+		{
+			if ( bytes[j] != (ptr[j] & mask[j]) ) return;
+		}
+		callback( anchor.pattern, start );
+	}
+
+	static void BuildBuckets( std::vector<std::pair<uint32_t, Anchor>>& anchors, uint32_t numKeys, std::vector<uint32_t>& start, std::vector<Anchor>& out )
+	{
+		if ( anchors.empty() ) return;
+
+		std::stable_sort( anchors.begin(), anchors.end(), []( const auto& a, const auto& b ) { return a.first < b.first; } );
+
+		start.assign( numKeys + 1, 0 );
+		out.reserve( anchors.size() );
+		for ( const auto& anchor : anchors )
+		{
+			start[anchor.first + 1]++;
+			out.push_back( anchor.second );
+		}
+		for ( size_t i = 1; i < start.size(); i++ )
+		{
+			start[i] += start[i - 1];
+		}
+	}
+
+	std::vector<hook::analysis::parsed_pattern> m_patterns;
+	size_t m_maxLength = 0;
+
+	// CSR buckets: anchors for key k are [start[k], start[k + 1])
+	std::vector<uint32_t> m_pairStart, m_byteStart;
+	std::vector<Anchor> m_pairAnchors, m_byteAnchors;
+	std::vector<uint32_t> m_unanchored;
+};
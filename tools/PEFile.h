@@ -0,0 +1,219 @@
+#pragma once
+
+// Minimal PE32/PE32+ parser over a file image (file layout, not loaded layout) for offline tools
+// Defines its own structures, so it doesn't need windows.h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace pe
+{
+#pragma pack(push, 1)
+	struct DataDirectory
+	{
+		uint32_t VirtualAddress;
+		uint32_t Size;
+	};
+
+	struct FileHeader
+	{
+		uint16_t Machine;
+		uint16_t NumberOfSections;
+		uint32_t TimeDateStamp;
+		uint32_t PointerToSymbolTable;
+		uint32_t NumberOfSymbols;
+		uint16_t SizeOfOptionalHeader;
+		uint16_t Characteristics;
+	};
+
+	struct SectionHeader
+	{
+		char Name[8];
+		uint32_t VirtualSize;
+		uint32_t VirtualAddress;
+		uint32_t SizeOfRawData;
+		uint32_t PointerToRawData;
+		uint32_t PointerToRelocations;
+		uint32_t PointerToLinenumbers;
+		uint16_t NumberOfRelocations;
+		uint16_t NumberOfLinenumbers;
+		uint32_t Characteristics;
+	};
+
+	struct RuntimeFunction
+	{
+		uint32_t BeginAddress;
+		uint32_t EndAddress;
+		uint32_t UnwindInfoAddress;
+	};
+
+	struct ExportDirectory
+	{
+		uint32_t Characteristics;
+		uint32_t TimeDateStamp;
+		uint16_t MajorVersion;
+		uint16_t MinorVersion;
+		uint32_t Name;
+		uint32_t Base;
+		uint32_t NumberOfFunctions;
+		uint32_t NumberOfNames;
+		uint32_t AddressOfFunctions;
+		uint32_t AddressOfNames;
+		uint32_t AddressOfNameOrdinals;
+	};
+
+	struct ImportDescriptor
+	{
+		uint32_t OriginalFirstThunk;
+		uint32_t TimeDateStamp;
+		uint32_t ForwarderChain;
+		uint32_t Name;
+		uint32_t FirstThunk;
+	};
+#pragma pack(pop)
+
+	constexpr uint16_t OPTIONAL_HEADER_MAGIC_PE32 = 0x10B;
+	constexpr uint16_t OPTIONAL_HEADER_MAGIC_PE32_PLUS = 0x20B;
+
+	constexpr uint32_t SCN_CNT_CODE = 0x00000020;
+	constexpr uint32_t SCN_CNT_INITIALIZED_DATA = 0x00000040;
+	constexpr uint32_t SCN_MEM_EXECUTE = 0x20000000;
+	constexpr uint32_t SCN_MEM_READ = 0x40000000;
+	constexpr uint32_t SCN_MEM_WRITE = 0x80000000;
+
+	constexpr size_t DIRECTORY_EXPORT = 0;
+	constexpr size_t DIRECTORY_IMPORT = 1;
+	constexpr size_t DIRECTORY_EXCEPTION = 3;
+	constexpr size_t DIRECTORY_BASERELOC = 5;
+	constexpr size_t DIRECTORY_IAT = 12;
+
+	constexpr uint16_t REL_BASED_ABSOLUTE = 0;
+	constexpr uint16_t REL_BASED_HIGHLOW = 3;
+	constexpr uint16_t REL_BASED_DIR64 = 10;
+}
+
+class PEFile
+{
+public:
+	PEFile( const uint8_t* data, size_t size )
+		: m_data( data ), m_size( size )
+	{
+		if ( size < 0x40 || data[0] != 'M' || data[1] != 'Z' ) return;
+
+		uint32_t lfanew;
+		memcpy( &lfanew, data + 0x3C, sizeof(lfanew) );
+		if ( size < size_t(lfanew) + 4 + sizeof(pe::FileHeader) + 2 || memcmp( data + lfanew, "PE\0\0", 4 ) != 0 ) return;
+
+		m_fileHeader = reinterpret_cast<const pe::FileHeader*>(data + lfanew + 4);
+		const uint8_t* optionalHeader = data + lfanew + 4 + sizeof(pe::FileHeader);
+
+		uint16_t magic;
+		memcpy( &magic, optionalHeader, sizeof(magic) );
+		if ( magic != pe::OPTIONAL_HEADER_MAGIC_PE32 && magic != pe::OPTIONAL_HEADER_MAGIC_PE32_PLUS ) return;
+		m_is64 = magic == pe::OPTIONAL_HEADER_MAGIC_PE32_PLUS;
+
+		const size_t sectionsOffset = lfanew + 4 + sizeof(pe::FileHeader) + m_fileHeader->SizeOfOptionalHeader;
+		if ( size < sectionsOffset + m_fileHeader->NumberOfSections * sizeof(pe::SectionHeader) ) return;
+
+		m_optionalHeader = optionalHeader;
+		m_sections = reinterpret_cast<const pe::SectionHeader*>(data + sectionsOffset);
+	}
+
+	bool Valid() const { return m_sections != nullptr; }
+	bool Is64() const { return m_is64; }
+
+	const uint8_t* Data() const { return m_data; }
+	size_t Size() const { return m_size; }
+
+	const pe::FileHeader& FileHeader() const { return *m_fileHeader; }
+
+	uint64_t ImageBase() const
+	{
+		return m_is64 ? Read<uint64_t>( 24 ) : Read<uint32_t>( 28 );
+	}
+
+	uint32_t EntryPoint() const { return Read<uint32_t>( 16 ); }
+	uint32_t SectionAlignment() const { return Read<uint32_t>( 32 ); }
+	uint32_t FileAlignment() const { return Read<uint32_t>( 36 ); }
+	uint32_t SizeOfImage() const { return Read<uint32_t>( 56 ); }
+	uint32_t SizeOfHeaders() const { return Read<uint32_t>( 60 ); }
+	uint32_t CheckSum() const { return Read<uint32_t>( 64 ); }
+
+	pe::DataDirectory Directory( size_t index ) const
+	{
+		const size_t directoriesOffset = m_is64 ? 112 : 96;
+		const uint32_t count = Read<uint32_t>( directoriesOffset - 4 );
+		if ( index >= count ) return {};
+		return Read<pe::DataDirectory>( directoriesOffset + index * sizeof(pe::DataDirectory) );
+	}
+
+	size_t NumSections() const { return m_fileHeader->NumberOfSections; }
+	const pe::SectionHeader& Section( size_t index ) const { return m_sections[index]; }
+
+	static bool IsExecutable( const pe::SectionHeader& section )
+	{
+		return (section.Characteristics & (pe::SCN_MEM_EXECUTE | pe::SCN_CNT_CODE)) != 0;
+	}
+
+	static std::string_view SectionName( const pe::SectionHeader& section )
+	{
+		return std::string_view( section.Name, strnlen( section.Name, sizeof(section.Name) ) );
+	}
+
+	// Raw data of the section present in the file
+	const uint8_t* SectionData( const pe::SectionHeader& section, size_t* size ) const
+	{
+		size_t rawSize = std::min<size_t>( section.SizeOfRawData, section.VirtualSize != 0 ? section.VirtualSize : section.SizeOfRawData );
+		if ( section.PointerToRawData >= m_size )
+		{
+			*size = 0;
+			return nullptr;
+		}
+		*size = std::min<size_t>( rawSize, m_size - section.PointerToRawData );
+		return m_data + section.PointerToRawData;
+	}
+
+	// Returns nullptr if the RVA isn't backed by file data
+	const uint8_t* RvaToPointer( uint32_t rva, size_t size = 1 ) const
+	{
+		if ( rva < SizeOfHeaders() )
+		{
+			return size_t(rva) + size <= m_size ? m_data + rva : nullptr;
+		}
+		for ( size_t i = 0; i < NumSections(); i++ )
+		{
+			const pe::SectionHeader& section = m_sections[i];
+			if ( rva >= section.VirtualAddress && rva - section.VirtualAddress < section.SizeOfRawData )
+			{
+				const size_t offset = section.PointerToRawData + (rva - section.VirtualAddress);
+				return offset + size <= m_size ? m_data + offset : nullptr;
+			}
+		}
+		return nullptr;
+	}
+
+	uint32_t PointerToRva( const pe::SectionHeader& section, const uint8_t* ptr ) const
+	{
+		return static_cast<uint32_t>(section.VirtualAddress + (ptr - m_data - section.PointerToRawData));
+	}
+
+private:
+	template<typename T>
+	T Read( size_t offset ) const
+	{
+		T result;
+		memcpy( &result, m_optionalHeader + offset, sizeof(result) );
+		return result;
+	}
+
+	const uint8_t* m_data;
+	size_t m_size;
+
+	const pe::FileHeader* m_fileHeader = nullptr;
+	const uint8_t* m_optionalHeader = nullptr;
+	const pe::SectionHeader* m_sections = nullptr;
+	bool m_is64 = false;
+};
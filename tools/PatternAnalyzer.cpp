@@ -0,0 +1,92 @@
+// Pattern cost analyzer
+// Usage: PatternAnalyzer <signatures.txt> [corpus.bin]
+// See SignatureList.h for the signature list format.
+// If a corpus (e.g. a dumped code section) is given, byte frequencies are measured from it,
+// the scanner is run over it for real and suggested rewrites are checked to keep the same matches.
+
+#include "../PatternAnalyzer.h"
+#include "SignatureList.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static std::vector<uint8_t> ReadFile( const char* path )
+{
+	std::ifstream file( path, std::ios::binary );
+	return std::vector<uint8_t>( std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() );
+}
+
+int main( int argc, char* argv[] )
+{
+	if ( argc < 2 )
+	{
+		fprintf( stderr, "Usage: %s <signatures.txt> [corpus.bin]\n", argv[0] );
+		return 1;
+	}
+
+	std::vector<Signature> signatures;
+	if ( !ReadSignatureList( argv[1], signatures ) )
+	{
+		fprintf( stderr, "Cannot open %s\n", argv[1] );
+		return 1;
+	}
+
+	std::vector<uint8_t> corpus;
+	if ( argc >= 3 )
+	{
+		corpus = ReadFile( argv[2] );
+		if ( corpus.empty() )
+		{
+			fprintf( stderr, "Cannot read corpus %s\n", argv[2] );
+			return 1;
+		}
+	}
+
+	using namespace hook::analysis;
+	const byte_frequencies frequencies = corpus.empty() ? byte_frequencies::uniform() : byte_frequencies::from_corpus( corpus.data(), corpus.size() );
+	const uint8_t* corpusData = corpus.empty() ? nullptr : corpus.data();
+
+	for ( const Signature& signature : signatures )
+	{
+		const parsed_pattern pattern( signature.pattern );
+		const pattern_cost cost = analyze( pattern, frequencies );
+
+		printf( "%s: %s\n", signature.name.c_str(), signature.pattern.c_str() );
+		printf( "  length %zu, fixed %zu, wildcards leading %zu/trailing %zu, max shift %zu\n",
+			cost.length, cost.fixedBytes, cost.leadingWildcards, cost.trailingWildcards, cost.maxShift );
+		printf( "  expected shift %.2f, comparisons/byte %.3f, verifications/MB %.0f\n",
+			cost.expectedShift, cost.costPerByte, cost.verificationsPerMB );
+		printf( "  anchor +%zu (freq %.4f), rarest byte +%zu (freq %.4f)\n",
+			cost.anchorOffset, cost.anchorFrequency, cost.rarestOffset, cost.rarestFrequency );
+		if ( !cost.limitingWildcards.empty() )
+		{
+			printf( "  shift limited by wildcards at" );
+			for ( size_t pos : cost.limitingWildcards )
+			{
+				printf( " +%zu", pos );
+			}
+			printf( "\n" );
+		}
+
+		if ( corpusData != nullptr )
+		{
+			const corpus_stats stats = measure( pattern, corpusData, corpus.size() );
+			printf( "  corpus: %zu matches, %zu positions, %zu verifications, comparisons/byte %.3f\n",
+				stats.matches.size(), stats.positions, stats.verifications,
+				static_cast<double>(stats.comparisons) / static_cast<double>(corpus.size()) );
+		}
+
+		for ( const auto& suggestion : suggest( pattern, frequencies, corpusData, corpus.size() ) )
+		{
+			printf( "  suggest: \"%s\" (offset %+td) - %s; comparisons/byte %.3f%s\n",
+				suggestion.pattern.c_str(), suggestion.offsetAdjustment, suggestion.reason.c_str(), suggestion.costPerByte,
+				corpusData == nullptr ? ", unverified" : suggestion.verified ? ", same matches on corpus" : ", DIFFERENT matches on corpus" );
+		}
+		printf( "\n" );
+	}
+
+	return 0;
+}
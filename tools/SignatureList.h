@@ -0,0 +1,55 @@
+#pragma once
+
+// Signature list shared by offline tools
+// One IDA-style pattern per line, optionally named as "name: pattern"
+// Empty lines and lines starting with # or // are skipped
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct Signature
+{
+	std::string name;
+	std::string pattern;
+};
+
+inline bool ReadSignatureList( const char* path, std::vector<Signature>& signatures )
+{
+	std::ifstream file( path );
+	if ( !file )
+	{
+		return false;
+	}
+
+	auto trim = []( const std::string& str, size_t begin, size_t end ) -> std::string {
+		begin = str.find_first_not_of( " \t\r", begin );
+		if ( begin == std::string::npos || begin >= end ) return {};
+		end = str.find_last_not_of( " \t\r", end - 1 );
+		return str.substr( begin, end - begin + 1 );
+	};
+
+	std::string line;
+	size_t lineNumber = 0;
+	while ( std::getline( file, line ) )
+	{
+		lineNumber++;
+
+		const std::string trimmed = trim( line, 0, line.size() );
+		if ( trimmed.empty() || trimmed[0] == '#' || trimmed.compare( 0, 2, "//" ) == 0 )
+		{
+			continue;
+		}
+
+		const size_t colon = trimmed.find( ':' );
+		if ( colon != std::string::npos )
+		{
+			signatures.push_back( { trim( trimmed, 0, colon ), trim( trimmed, colon + 1, trimmed.size() ) } );
+		}
+		else
+		{
+			signatures.push_back( { "line " + std::to_string(lineNumber), trimmed } );
+		}
+	}
+	return true;
+}
@@ -0,0 +1,182 @@
+// Signature portability matrix
+// Usage: SignatureMatrix [--all-sections] [--max-rvas N] <signatures.txt> <exe1> [exe2 ...]
+// Maps every executable and runs the whole signature set against all of them in parallel, one pass per binary.
+// Prints a tab separated matrix of match counts and RVAs (pattern x binary), followed by a summary.
+// Exits with 2 if any signature is broken (no match) or ambiguous (more than one match) in any of the binaries.
+
+#include "MappedFile.h"
+#include "MultiPatternScanner.h"
+#include "PEFile.h"
+#include "SignatureList.h"
+#include "../TaskPool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct BinaryResult
+{
+	bool valid = false;
+	// Per signature
+	std::vector<std::vector<uint32_t>> rvas;
+};
+
+static BinaryResult ScanBinary( const char* path, const MultiPatternScanner& scanner, bool allSections )
+{
+	BinaryResult result;
+
+	const MappedFile file( path );
+	const PEFile image( file.Data(), file.Size() );
+	if ( !file.Valid() || !image.Valid() )
+	{
+		return result;
+	}
+
+	result.valid = true;
+	result.rvas.resize( scanner.NumPatterns() );
+	for ( size_t i = 0; i < image.NumSections(); i++ )
+	{
+		const pe::SectionHeader& section = image.Section( i );
+		if ( !allSections && !PEFile::IsExecutable( section ) )
+		{
+			continue;
+		}
+
+		size_t size;
+		const uint8_t* data = image.SectionData( section, &size );
+		if ( data == nullptr )
+		{
+			continue;
+		}
+
+		scanner.Scan( data, size, [&]( uint32_t pattern, size_t offset ) {
+			result.rvas[pattern].push_back( image.PointerToRva( section, data + offset ) );
+		} );
+	}
+
+	for ( auto& rvas : result.rvas )
+	{
+		std::sort( rvas.begin(), rvas.end() );
+	}
+	return result;
+}
+
+static hook::analysis::byte_frequencies CodeFrequencies( const char* path )
+{
+	const MappedFile file( path );
+	const PEFile image( file.Data(), file.Size() );
+	if ( !file.Valid() || !image.Valid() )
+	{
+		return hook::analysis::byte_frequencies::uniform();
+	}
+
+	for ( size_t i = 0; i < image.NumSections(); i++ )
+	{
+		size_t size;
+		const uint8_t* data = image.SectionData( image.Section( i ), &size );
+		if ( PEFile::IsExecutable( image.Section( i ) ) && data != nullptr )
+		{
+			return hook::analysis::byte_frequencies::from_corpus( data, size );
+		}
+	}
+	return hook::analysis::byte_frequencies::uniform();
+}
+
+int main( int argc, char* argv[] )
+{
+	bool allSections = false;
+	size_t maxRvas = 4;
+
+	int arg = 1;
+	for ( ; arg < argc && strncmp( argv[arg], "--", 2 ) == 0; arg++ )
+	{
+		if ( strcmp( argv[arg], "--all-sections" ) == 0 )
+		{
+			allSections = true;
+		}
+		else if ( strcmp( argv[arg], "--max-rvas" ) == 0 && arg + 1 < argc )
+		{
+			maxRvas = strtoul( argv[++arg], nullptr, 10 );
+		}
+	}
+
+	if ( argc - arg < 2 )
+	{
+		fprintf( stderr, "Usage: %s [--all-sections] [--max-rvas N] <signatures.txt> <exe1> [exe2 ...]\n", argv[0] );
+		return 1;
+	}
+
+	std::vector<Signature> signatures;
+	if ( !ReadSignatureList( argv[arg], signatures ) )
+	{
+		fprintf( stderr, "Cannot open %s\n", argv[arg] );
+		return 1;
+	}
+
+	const std::vector<const char*> binaries( argv + arg + 1, argv + argc );
+
+	std::vector<hook::analysis::parsed_pattern> patterns;
+	patterns.reserve( signatures.size() );
+	for ( const Signature& signature : signatures )
+	{
+		patterns.emplace_back( signature.pattern );
+	}
+	const MultiPatternScanner scanner( std::move(patterns), CodeFrequencies( binaries.front() ) );
+
+	std::vector<BinaryResult> results( binaries.size() );
+	TaskPool::ParallelFor( 0, binaries.size(), 1, [&]( size_t i ) {
+		results[i] = ScanBinary( binaries[i], scanner, allSections );
+	} );
+
+	printf( "signature" );
+	for ( size_t i = 0; i < binaries.size(); i++ )
+	{
+		const char* name = strrchr( binaries[i], '/' );
+		printf( "\t%s", name != nullptr ? name + 1 : binaries[i] );
+		if ( !results[i].valid )
+		{
+			fprintf( stderr, "%s: not a valid PE file\n", binaries[i] );
+		}
+	}
+	printf( "\n" );
+
+	size_t numBroken = 0, numAmbiguous = 0;
+	for ( size_t sig = 0; sig < signatures.size(); sig++ )
+	{
+		bool broken = false, ambiguous = false;
+
+		printf( "%s", signatures[sig].name.c_str() );
+		for ( const BinaryResult& result : results )
+		{
+			if ( !result.valid )
+			{
+				printf( "\t-" );
+				continue;
+			}
+
+			const auto& rvas = result.rvas[sig];
+			broken |= rvas.empty();
+			ambiguous |= rvas.size() > 1;
+
+			printf( "\t%zu", rvas.size() );
+			for ( size_t i = 0; i < std::min( rvas.size(), maxRvas ); i++ )
+			{
+				printf( "%c%X", i == 0 ? ':' : ',', rvas[i] );
+			}
+			if ( rvas.size() > maxRvas )
+			{
+				printf( ",..." );
+			}
+		}
+		printf( "\n" );
+
+		numBroken += broken ? 1 : 0;
+		numAmbiguous += ambiguous ? 1 : 0;
+	}
+
+	fprintf( stderr, "%zu signatures, %zu binaries: %zu broken, %zu ambiguous\n", signatures.size(), binaries.size(), numBroken, numAmbiguous );
+	return numBroken != 0 || numAmbiguous != 0 ? 2 : 0;
+}
@@ -0,0 +1,1334 @@
+#pragma once
+
+// Synthetic PE32/PE32+ images for reproducible scanner and patcher benchmarks (offline tools)
+// Everything is derived from the seed with a generator of its own (not <random> distributions, which differ between
+// standard libraries), so the same options give the same image everywhere. The image contains:
+// - .text - functions of compiler-like code: prologues/epilogues, instructions weighted roughly like MSVC output,
+//   branches, calls between functions and to imports, virtual calls, references to data (RIP-relative on x64,
+//   relocated absolute addresses on x86), int3 padding between functions
+// - .rdata - strings, vtables with MSVC RTTI (locators, hierarchies, base classes), unwind info and exports
+// - .data - globals and RTTI type descriptors, .idata - imports, .pdata (PE32+) and .reloc
+// Sections are filled independently and linked at the end, like a linker would - references between them are fixups,
+// and relocations are generated from the absolute ones.
+//
+// Known signatures are planted at known RVAs: given patterns (wildcards filled with random bytes) each in a function
+// of its own, and signatures cut out of the generated code - with addresses wildcarded, grown until unique in .text.
+
+#include "MultiPatternScanner.h"
+#include "PEFile.h"
+#include "SignatureList.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class SyntheticPE
+{
+public:
+	struct Options
+	{
+		uint64_t seed = 1;
+		bool is64 = true;
+		bool isDll = false;
+		size_t codeSize = 4 * 1024 * 1024;
+		size_t dataSize = 256 * 1024;
+		size_t numStrings = 4000;
+		size_t numClasses = 200;
+		size_t numImports = 80;
+		size_t numExports = 16;
+		bool relocations = true;
+		// Signatures cut out of the generated code
+		size_t numSignatures = 100;
+		// Planted as given, each in a function of its own
+		std::vector<Signature> planted;
+	};
+
+	struct PlantedSignature
+	{
+		std::string name;
+		std::string pattern;
+		uint32_t rva;
+		// Matches in .text - 1, unless a planted pattern is too generic to be unique
+		size_t numMatches;
+	};
+
+	explicit SyntheticPE( const Options& options )
+		: m_options( options ), m_random( options.seed ), m_is64( options.is64 )
+	{
+		m_imageBase = m_is64 ? (options.isDll ? UINT64_C(0x180000000) : UINT64_C(0x140000000)) : (options.isDll ? 0x10000000 : 0x400000);
+
+		BuildStrings();
+		BuildClasses();
+		BuildImports();
+		BuildGlobals();
+		BuildCode();
+		ResolveCode();
+		BuildUnwindInfo();
+		BuildExports();
+		Link();
+		FindSignatures();
+	}
+
+	const std::vector<uint8_t>& Image() const { return m_image; }
+	const std::vector<PlantedSignature>& Signatures() const { return m_signatures; }
+	size_t NumFunctions() const { return m_functions.size(); }
+
+private:
+	// xoshiro256**, seeded with splitmix64
+	class Random
+	{
+	public:
+		explicit Random( uint64_t seed )
+		{
+			for ( uint64_t& state : m_state )
+			{
+				seed += UINT64_C(0x9E3779B97F4A7C15);
+				uint64_t z = seed;
+				z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+				z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+				state = z ^ (z >> 31);
+			}
+		}
+
+		uint64_t Next()
+		{
+			const uint64_t result = Rotl( m_state[1] * 5, 7 ) * 9;
+			const uint64_t t = m_state[1] << 17;
+			m_state[2] ^= m_state[0];
+			m_state[3] ^= m_state[1];
+			m_state[1] ^= m_state[2];
+			m_state[0] ^= m_state[3];
+			m_state[2] ^= t;
+			m_state[3] = Rotl( m_state[3], 45 );
+			return result;
+		}
+
+		// [0, n)
+		uint32_t Below( uint32_t n )
+		{
+			return static_cast<uint32_t>(((Next() >> 32) * n) >> 32);
+		}
+
+		// [low, high]
+		uint32_t Range( uint32_t low, uint32_t high )
+		{
+			return low + Below( high - low + 1 );
+		}
+
+		bool Percent( uint32_t percent )
+		{
+			return Below( 100 ) < percent;
+		}
+
+		template<size_t N>
+		size_t Weighted( const uint32_t (&weights)[N] )
+		{
+			uint32_t total = 0;
+			for ( uint32_t weight : weights ) total += weight;
+
+			uint32_t value = Below( total );
+			for ( size_t i = 0; i < N; i++ )
+			{
+				if ( value < weights[i] ) return i;
+				value -= weights[i];
+			}
+			return N - 1;
+		}
+
+	private:
+		static uint64_t Rotl( uint64_t value, int bits )
+		{
+			return (value << bits) | (value >> (64 - bits));
+		}
+
+		uint64_t m_state[4];
+	};
+
+	enum SectionId : uint8_t
+	{
+		TEXT,
+		RDATA,
+		DATA,
+		IDATA,
+		PDATA,
+		RELOC,
+		NUM_SECTIONS,
+	};
+
+	enum class FixupKind : uint8_t
+	{
+		Rva32,
+		Va32,
+		Va64,
+		// Relative to the end of the 4 byte field
+		Rel32,
+	};
+
+	struct Fixup
+	{
+		SectionId section;
+		FixupKind kind;
+		SectionId target;
+		uint32_t offset;
+		uint32_t targetOffset;
+	};
+
+	struct Function
+	{
+		uint32_t begin;
+		uint32_t end;
+		bool planted;
+		uint8_t prologSize;
+		uint8_t frameSize;
+		// Pushed non-volatile registers, in push order
+		uint8_t numPushes;
+		uint8_t pushes[2];
+		// Instruction starts
+		std::vector<uint32_t> boundaries;
+	};
+
+	struct Class
+	{
+		std::string name;
+		size_t parent;
+		size_t depth;
+		size_t numVirtuals;
+		uint32_t typeDescriptor, baseClassDescriptor, baseClassArray, hierarchyDescriptor, objectLocator, vtable;
+	};
+
+	static constexpr uint32_t SECTION_ALIGNMENT = 0x1000;
+	static constexpr uint32_t FILE_ALIGNMENT = 0x200;
+	static constexpr size_t NO_PARENT = SIZE_MAX;
+	static constexpr size_t NO_FUNCTION = SIZE_MAX;
+
+	static uint32_t AlignUp( uint32_t value, uint32_t align )
+	{
+		return (value + align - 1) & ~(align - 1);
+	}
+
+	size_t PointerSize() const { return m_is64 ? 8 : 4; }
+
+	// Section buffers
+
+	std::vector<uint8_t>& Buffer( SectionId section ) { return m_sections[section]; }
+
+	uint32_t Reserve( SectionId section, size_t size, size_t align = 1 )
+	{
+		std::vector<uint8_t>& buffer = Buffer( section );
+		buffer.resize( AlignUp( static_cast<uint32_t>(buffer.size()), static_cast<uint32_t>(align) ) );
+		const uint32_t offset = static_cast<uint32_t>(buffer.size());
+		buffer.resize( buffer.size() + size );
+		return offset;
+	}
+
+	template<typename T>
+	void Put( SectionId section, uint32_t offset, T value )
+	{
+		memcpy( Buffer( section ).data() + offset, &value, sizeof(value) );
+	}
+
+	uint32_t AddString( SectionId section, const std::string& str, size_t align = 1 )
+	{
+		const uint32_t offset = Reserve( section, str.size() + 1, align );
+		memcpy( Buffer( section ).data() + offset, str.c_str(), str.size() + 1 );
+		return offset;
+	}
+
+	void AddFixup( SectionId section, uint32_t offset, FixupKind kind, SectionId target, uint32_t targetOffset )
+	{
+		m_fixups.push_back( { section, kind, target, offset, targetOffset } );
+	}
+
+	// Pointer sized absolute address
+	void AddPointer( SectionId section, uint32_t offset, SectionId target, uint32_t targetOffset )
+	{
+		AddFixup( section, offset, m_is64 ? FixupKind::Va64 : FixupKind::Va32, target, targetOffset );
+	}
+
+	// RTTI refers to other RTTI with RVAs in PE32+, with addresses in PE32
+	void AddRttiReference( SectionId section, uint32_t offset, SectionId target, uint32_t targetOffset )
+	{
+		AddFixup( section, offset, m_is64 ? FixupKind::Rva32 : FixupKind::Va32, target, targetOffset );
+	}
+
+	// Names and strings
+
+	std::string MakeWord( bool capitalize )
+	{
+		static const char* const syllables[] = {
+			"ve", "hi", "cle", "ped", "mo", "del", "tex", "ture", "an", "im", "ra", "di", "o", "wea", "pon", "ca", "me", "pla",
+			"yer", "sta", "tus", "map", "zo", "ne", "ob", "ject", "fi", "le", "buf", "fer", "stre", "am", "lo", "ad", "sa",
+		};
+
+		std::string word;
+		const uint32_t numSyllables = m_random.Range( 1, 4 );
+		for ( uint32_t i = 0; i < numSyllables; i++ )
+		{
+			word += syllables[m_random.Below( static_cast<uint32_t>(std::size(syllables)) )];
+		}
+		if ( capitalize ) word[0] = static_cast<char>(word[0] - 'a' + 'A');
+		return word;
+	}
+
+	std::string MakeString()
+	{
+		switch ( m_random.Below( 4 ) )
+		{
+		case 0:
+		{
+			// Path
+			std::string str = "data\\" + MakeWord( false );
+			const uint32_t depth = m_random.Range( 0, 2 );
+			for ( uint32_t i = 0; i < depth; i++ ) str += "\\" + MakeWord( false );
+			static const char* const extensions[] = { ".dff", ".txd", ".dat", ".ide", ".ipl", ".cfg", ".wav" };
+			return str + extensions[m_random.Below( static_cast<uint32_t>(std::size(extensions)) )];
+		}
+		case 1:
+		{
+			// Format string
+			static const char* const formats[] = { "%d", "%s", "%f", "%08X", "%u" };
+			std::string str = MakeWord( true );
+			const uint32_t numWords = m_random.Range( 1, 5 );
+			for ( uint32_t i = 0; i < numWords; i++ )
+			{
+				str += " ";
+				str += m_random.Percent( 25 ) ? formats[m_random.Below( static_cast<uint32_t>(std::size(formats)) )] : MakeWord( false ).c_str();
+			}
+			return str + (m_random.Percent( 50 ) ? "\n" : "");
+		}
+		case 2:
+			// Identifier
+			return MakeWord( true ) + MakeWord( true ) + (m_random.Percent( 30 ) ? std::to_string( m_random.Below( 100 ) ) : "");
+		default:
+		{
+			std::string str = MakeWord( true );
+			const uint32_t numWords = m_random.Range( 2, 8 );
+			for ( uint32_t i = 0; i < numWords; i++ ) str += " " + MakeWord( false );
+			return str + ".";
+		}
+		}
+	}
+
+	void BuildStrings()
+	{
+		// type_info's vftable, which type descriptors point at - normally imported from the runtime
+		m_typeInfoVftable = Reserve( RDATA, 2 * PointerSize(), PointerSize() );
+
+		for ( size_t i = 0; i < m_options.numStrings; i++ )
+		{
+			const std::string str = MakeString();
+			if ( m_random.Percent( 15 ) )
+			{
+				// UTF-16
+				const uint32_t offset = Reserve( RDATA, (str.size() + 1) * 2, 2 );
+				for ( size_t j = 0; j < str.size(); j++ )
+				{
+					Put<uint16_t>( RDATA, offset + static_cast<uint32_t>(j * 2), static_cast<uint8_t>(str[j]) );
+				}
+				m_strings.push_back( offset );
+			}
+			else
+			{
+				m_strings.push_back( AddString( RDATA, str, m_random.Percent( 50 ) ? 8 : 1 ) );
+			}
+		}
+	}
+
+	// MSVC RTTI, single inheritance
+	void BuildClasses()
+	{
+		const size_t ptr = PointerSize();
+		m_classes.resize( m_options.numClasses );
+		for ( size_t i = 0; i < m_classes.size(); i++ )
+		{
+			Class& cls = m_classes[i];
+			cls.name = "C" + MakeWord( true ) + MakeWord( true );
+			cls.parent = i > 0 && m_random.Percent( 60 ) ? m_random.Below( static_cast<uint32_t>(i) ) : NO_PARENT;
+			cls.depth = cls.parent != NO_PARENT ? m_classes[cls.parent].depth + 1 : 0;
+			cls.numVirtuals = m_random.Range( 3, 20 ) + (cls.parent != NO_PARENT ? m_classes[cls.parent].numVirtuals : 0);
+			cls.numVirtuals = std::min<size_t>( cls.numVirtuals, 60 );
+
+			// TypeDescriptor - vftable, spare, decorated name
+			const std::string decorated = ".?AV" + cls.name + "@@";
+			cls.typeDescriptor = Reserve( DATA, 2 * ptr + decorated.size() + 1, ptr );
+			memcpy( Buffer( DATA ).data() + cls.typeDescriptor + 2 * ptr, decorated.c_str(), decorated.size() + 1 );
+			AddPointer( DATA, cls.typeDescriptor, RDATA, m_typeInfoVftable );
+
+			cls.baseClassDescriptor = Reserve( RDATA, 28, 4 );
+			cls.hierarchyDescriptor = Reserve( RDATA, 16, 4 );
+			cls.baseClassArray = Reserve( RDATA, 4 * (cls.depth + 2), 4 );
+			cls.objectLocator = Reserve( RDATA, m_is64 ? 24 : 20, 4 );
+			cls.vtable = Reserve( RDATA, ptr * (cls.numVirtuals + 1), ptr ) + static_cast<uint32_t>(ptr);
+		}
+
+		for ( const Class& cls : m_classes )
+		{
+			// BaseClassDescriptor - type, contained bases, PMD, attributes, hierarchy
+			AddRttiReference( RDATA, cls.baseClassDescriptor, DATA, cls.typeDescriptor );
+			Put<uint32_t>( RDATA, cls.baseClassDescriptor + 4, static_cast<uint32_t>(cls.depth) );
+			Put<int32_t>( RDATA, cls.baseClassDescriptor + 12, -1 );
+			Put<uint32_t>( RDATA, cls.baseClassDescriptor + 20, 0x40 );
+			AddRttiReference( RDATA, cls.baseClassDescriptor + 24, RDATA, cls.hierarchyDescriptor );
+
+			// ClassHierarchyDescriptor - signature, attributes, number of bases, base class array
+			Put<uint32_t>( RDATA, cls.hierarchyDescriptor + 8, static_cast<uint32_t>(cls.depth + 1) );
+			AddRttiReference( RDATA, cls.hierarchyDescriptor + 12, RDATA, cls.baseClassArray );
+
+			// The class itself, then its bases
+			uint32_t entry = cls.baseClassArray;
+			for ( const Class* base = &cls; ; base = &m_classes[base->parent] )
+			{
+				AddRttiReference( RDATA, entry, RDATA, base->baseClassDescriptor );
+				entry += 4;
+				if ( base->parent == NO_PARENT ) break;
+			}
+
+			// CompleteObjectLocator - signature, offset, constructor displacement offset, type, hierarchy (, self)
+			Put<uint32_t>( RDATA, cls.objectLocator, m_is64 ? 1 : 0 );
+			AddRttiReference( RDATA, cls.objectLocator + 12, DATA, cls.typeDescriptor );
+			AddRttiReference( RDATA, cls.objectLocator + 16, RDATA, cls.hierarchyDescriptor );
+			if ( m_is64 )
+			{
+				AddFixup( RDATA, cls.objectLocator + 20, FixupKind::Rva32, RDATA, cls.objectLocator );
+			}
+
+			AddPointer( RDATA, cls.vtable - static_cast<uint32_t>(PointerSize()), RDATA, cls.objectLocator );
+		}
+	}
+
+	void BuildImports()
+	{
+		static const char* const kernel32[] = {
+			"GetModuleHandleW", "GetProcAddress", "LoadLibraryW", "FreeLibrary", "VirtualProtect", "VirtualAlloc", "VirtualFree",
+			"CreateFileW", "ReadFile", "WriteFile", "CloseHandle", "GetFileSize", "SetFilePointer", "CreateThread", "Sleep",
+			"WaitForSingleObject", "CreateEventW", "SetEvent", "ResetEvent", "EnterCriticalSection", "LeaveCriticalSection",
+			"InitializeCriticalSection", "DeleteCriticalSection", "GetTickCount", "QueryPerformanceCounter",
+			"QueryPerformanceFrequency", "GetLastError", "SetLastError", "HeapAlloc", "HeapFree", "GetProcessHeap",
+			"OutputDebugStringA", "GetCurrentThreadId", "GetCurrentProcess", "FlushInstructionCache", "MultiByteToWideChar",
+			"WideCharToMultiByte", "GetModuleFileNameW", "FindFirstFileW", "FindNextFileW", "FindClose", "GetSystemInfo",
+		};
+		static const char* const user32[] = {
+			"CreateWindowExW", "DestroyWindow", "ShowWindow", "UpdateWindow", "PeekMessageW", "TranslateMessage",
+			"DispatchMessageW", "DefWindowProcW", "RegisterClassExW", "GetClientRect", "SetWindowPos", "MessageBoxW",
+			"GetCursorPos", "ShowCursor", "GetAsyncKeyState", "LoadCursorW", "SetCursor", "GetSystemMetrics",
+		};
+		static const char* const d3d9[] = { "Direct3DCreate9" };
+
+		struct Dll
+		{
+			const char* name;
+			std::vector<std::string> functions;
+		};
+		std::vector<Dll> dlls = { { "KERNEL32.dll", {} }, { "USER32.dll", {} }, { "d3d9.dll", { d3d9[0] } } };
+		for ( size_t i = 0; i < m_options.numImports; i++ )
+		{
+			if ( i < std::size(kernel32) ) dlls[0].functions.push_back( kernel32[i] );
+			else if ( i - std::size(kernel32) < std::size(user32) ) dlls[1].functions.push_back( user32[i - std::size(kernel32)] );
+			else dlls[0].functions.push_back( "ImportedFunction" + std::to_string( i ) );
+		}
+
+		const size_t ptr = PointerSize();
+		// The IAT is contiguous, ahead of the descriptors
+		std::vector<uint32_t> iat;
+		for ( const Dll& dll : dlls )
+		{
+			iat.push_back( Reserve( IDATA, ptr * (dll.functions.size() + 1), ptr ) );
+		}
+		m_iatSize = static_cast<uint32_t>(Buffer( IDATA ).size());
+
+		const uint32_t descriptors = Reserve( IDATA, sizeof(pe::ImportDescriptor) * (dlls.size() + 1), 4 );
+		for ( size_t i = 0; i < dlls.size(); i++ )
+		{
+			const Dll& dll = dlls[i];
+			const uint32_t descriptor = descriptors + static_cast<uint32_t>(i * sizeof(pe::ImportDescriptor));
+
+			const uint32_t names = Reserve( IDATA, ptr * (dll.functions.size() + 1), ptr );
+			const uint32_t thunks = iat[i];
+			for ( size_t j = 0; j < dll.functions.size(); j++ )
+			{
+				// Hint/name
+				const uint32_t hintName = Reserve( IDATA, 2, 2 );
+				Put<uint16_t>( IDATA, hintName, static_cast<uint16_t>(m_random.Below( 1000 )) );
+				AddString( IDATA, dll.functions[j] );
+
+				const uint32_t offset = static_cast<uint32_t>(j * ptr);
+				AddFixup( IDATA, names + offset, FixupKind::Rva32, IDATA, hintName );
+				AddFixup( IDATA, thunks + offset, FixupKind::Rva32, IDATA, hintName );
+				m_importSlots.push_back( thunks + offset );
+			}
+
+			AddFixup( IDATA, descriptor + offsetof(pe::ImportDescriptor, OriginalFirstThunk), FixupKind::Rva32, IDATA, names );
+			AddFixup( IDATA, descriptor + offsetof(pe::ImportDescriptor, Name), FixupKind::Rva32, IDATA, AddString( IDATA, dll.name ) );
+			AddFixup( IDATA, descriptor + offsetof(pe::ImportDescriptor, FirstThunk), FixupKind::Rva32, IDATA, thunks );
+		}
+		m_importDescriptors = descriptors;
+		m_importDescriptorsSize = static_cast<uint32_t>(sizeof(pe::ImportDescriptor) * (dlls.size() + 1));
+	}
+
+	void BuildGlobals()
+	{
+		// Globals first, type descriptors are already there
+		std::vector<uint8_t>& data = Buffer( DATA );
+		const uint32_t globals = Reserve( DATA, m_options.dataSize, 16 );
+		for ( uint32_t offset = 0; offset + 4 <= m_options.dataSize; offset += 4 )
+		{
+			uint32_t value = 0;
+			switch ( m_random.Weighted( { 70, 15, 10, 5 } ) )
+			{
+			case 1: value = m_random.Below( 256 ); break;
+			case 2: { const float f = static_cast<float>(m_random.Below( 20000 )) / 16.0f; memcpy( &value, &f, sizeof(value) ); break; }
+			case 3: value = static_cast<uint32_t>(m_random.Next()); break;
+			default: break;
+			}
+			memcpy( data.data() + globals + offset, &value, sizeof(value) );
+		}
+		m_globals = globals;
+	}
+
+	// Code
+
+	void Emit( uint8_t byte ) { m_code.push_back( byte ); m_codeMask.push_back( 0 ); }
+
+	void Emit32( uint32_t value, bool address = false )
+	{
+		for ( int i = 0; i < 4; i++ )
+		{
+			m_code.push_back( static_cast<uint8_t>(value >> (i * 8)) );
+			m_codeMask.push_back( address ? 1 : 0 );
+		}
+	}
+
+	uint32_t CodePos() const { return static_cast<uint32_t>(m_code.size()); }
+
+	void Rex( bool wide, uint8_t reg, uint8_t base )
+	{
+		if ( !m_is64 ) return;
+		const uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+		if ( rex != 0x40 ) Emit( rex );
+	}
+
+	uint8_t Reg()
+	{
+		// Anything but the stack pointer
+		const uint8_t reg = static_cast<uint8_t>(m_random.Below( m_is64 ? 16 : 8 ));
+		return reg == 4 ? 0 : reg;
+	}
+
+	uint8_t Base()
+	{
+		// No SIB needed
+		const uint8_t base = Reg();
+		return base == 12 ? 3 : base;
+	}
+
+	int32_t Displacement()
+	{
+		if ( m_random.Percent( 75 ) ) return static_cast<int32_t>(m_random.Below( 0x20 ) * 4);
+		return static_cast<int32_t>(m_random.Below( 0x400 ) * 4);
+	}
+
+	void ModRMMemory( uint8_t reg, uint8_t base, int32_t disp )
+	{
+		if ( disp == 0 && (base & 7) != 5 )
+		{
+			Emit( static_cast<uint8_t>(((reg & 7) << 3) | (base & 7)) );
+		}
+		else if ( disp >= -128 && disp <= 127 )
+		{
+			Emit( static_cast<uint8_t>(0x40 | ((reg & 7) << 3) | (base & 7)) );
+			Emit( static_cast<uint8_t>(disp) );
+		}
+		else
+		{
+			Emit( static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)) );
+			Emit32( static_cast<uint32_t>(disp) );
+		}
+	}
+
+	void ModRMRegister( uint8_t reg, uint8_t rm )
+	{
+		Emit( static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)) );
+	}
+
+	// [rip+target] on x64, [target] on x86 - for instructions without an immediate after the displacement
+	void ModRMAbsolute( uint8_t reg, SectionId target, uint32_t targetOffset )
+	{
+		Emit( static_cast<uint8_t>(((reg & 7) << 3) | 5) );
+		AddFixup( TEXT, CodePos(), m_is64 ? FixupKind::Rel32 : FixupKind::Va32, target, targetOffset );
+		Emit32( 0, true );
+	}
+
+	void EmitInstruction( std::vector<std::pair<uint32_t, uint8_t>>& branches )
+	{
+		enum
+		{
+			MOV_LOAD, MOV_STORE, MOV_REG, LEA, MOV_IMM, CALL, CALL_IMPORT, CALL_VIRTUAL, LOAD_GLOBAL, STORE_GLOBAL, LOAD_STRING,
+			STORE_VTABLE, CMP_IMM, TEST, JCC_SHORT, JCC_NEAR, ALU_IMM, ALU_REG, XOR_SELF, SSE, MOVZX, PUSH_POP,
+		};
+		static const uint32_t weights64[] = { 18, 10, 9, 6, 3, 7, 2, 2, 4, 2, 3, 1, 5, 4, 6, 2, 4, 4, 2, 4, 2, 0 };
+		static const uint32_t weights32[] = { 16, 9, 8, 5, 3, 7, 2, 2, 4, 2, 3, 1, 5, 4, 6, 2, 4, 4, 2, 2, 2, 5 };
+
+		const bool wide = m_is64 && m_random.Percent( 50 );
+		switch ( m_is64 ? m_random.Weighted( weights64 ) : m_random.Weighted( weights32 ) )
+		{
+		case MOV_LOAD: case MOV_STORE: case LEA:
+		{
+			static const uint8_t opcodes[] = { 0x8B, 0x89, 0x8D };
+			const size_t kind = m_random.Weighted( { 18, 10, 6 } );
+			const uint8_t reg = Reg(), base = Base();
+			Rex( wide || kind == 2, reg, base );
+			Emit( opcodes[kind] );
+			ModRMMemory( reg, base, Displacement() );
+			break;
+		}
+		case MOV_REG:
+		{
+			const uint8_t reg = Reg(), rm = Reg();
+			Rex( wide, reg, rm );
+			Emit( 0x8B );
+			ModRMRegister( reg, rm );
+			break;
+		}
+		case MOV_IMM:
+		{
+			const uint8_t reg = Reg();
+			Rex( false, 0, reg );
+			Emit( static_cast<uint8_t>(0xB8 | (reg & 7)) );
+			Emit32( m_random.Percent( 70 ) ? m_random.Below( 0x1000 ) : static_cast<uint32_t>(m_random.Next()) );
+			break;
+		}
+		case CALL:
+			Emit( 0xE8 );
+			m_calls.push_back( CodePos() );
+			Emit32( 0, true );
+			break;
+		case CALL_IMPORT:
+			Emit( 0xFF );
+			ModRMAbsolute( 2, IDATA, m_importSlots[m_random.Below( static_cast<uint32_t>(m_importSlots.size()) )] );
+			break;
+		case CALL_VIRTUAL:
+		{
+			// call [reg+slot]
+			const uint8_t base = Base();
+			Rex( false, 0, base );
+			Emit( 0xFF );
+			ModRMMemory( 2, base, static_cast<int32_t>(m_random.Below( 16 ) * PointerSize()) );
+			break;
+		}
+		case LOAD_GLOBAL: case STORE_GLOBAL:
+		{
+			const uint8_t reg = Reg();
+			Rex( wide, reg, 0 );
+			Emit( m_random.Percent( 65 ) ? 0x8B : 0x89 );
+			ModRMAbsolute( reg, DATA, m_globals + m_random.Below( static_cast<uint32_t>(m_options.dataSize / 4) ) * 4 );
+			break;
+		}
+		case LOAD_STRING:
+		{
+			const uint32_t str = m_strings[m_random.Below( static_cast<uint32_t>(m_strings.size()) )];
+			if ( m_is64 )
+			{
+				// lea reg, [rip+str]
+				const uint8_t reg = Reg();
+				Rex( true, reg, 0 );
+				Emit( 0x8D );
+				ModRMAbsolute( reg, RDATA, str );
+			}
+			else
+			{
+				// push offset str
+				Emit( 0x68 );
+				AddFixup( TEXT, CodePos(), FixupKind::Va32, RDATA, str );
+				Emit32( 0, true );
+			}
+			break;
+		}
+		case STORE_VTABLE:
+		{
+			// Constructor - this->vftable = &Class::`vftable'
+			const uint32_t vtable = m_classes[m_random.Below( static_cast<uint32_t>(m_classes.size()) )].vtable;
+			if ( m_is64 )
+			{
+				Rex( true, 0, 0 );
+				Emit( 0x8D );
+				ModRMAbsolute( 0, RDATA, vtable );
+				Emit( 0x48 );
+				Emit( 0x89 );
+				Emit( 0x01 );
+			}
+			else
+			{
+				Emit( 0xC7 );
+				Emit( 0x01 );
+				AddFixup( TEXT, CodePos(), FixupKind::Va32, RDATA, vtable );
+				Emit32( 0, true );
+			}
+			break;
+		}
+		case CMP_IMM: case ALU_IMM:
+		{
+			static const uint8_t operations[] = { 7, 0, 5, 4, 1 }; // cmp, add, sub, and, or
+			const uint8_t rm = Reg();
+			Rex( wide, 0, rm );
+			Emit( 0x83 );
+			ModRMRegister( operations[m_random.Below( static_cast<uint32_t>(std::size(operations)) )], rm );
+			Emit( static_cast<uint8_t>(m_random.Below( 64 )) );
+			break;
+		}
+		case TEST: case ALU_REG:
+		{
+			static const uint8_t opcodes[] = { 0x85, 0x3B, 0x01, 0x29, 0x31, 0x09, 0x21 }; // test, cmp, add, sub, xor, or, and
+			const uint8_t reg = Reg(), rm = Reg();
+			Rex( wide, reg, rm );
+			Emit( opcodes[m_random.Below( static_cast<uint32_t>(std::size(opcodes)) )] );
+			ModRMRegister( reg, rm );
+			break;
+		}
+		case JCC_SHORT:
+			Emit( static_cast<uint8_t>(0x70 | m_random.Below( 16 )) );
+			branches.emplace_back( CodePos(), 1 );
+			Emit( 0 );
+			break;
+		case JCC_NEAR:
+			Emit( 0x0F );
+			Emit( static_cast<uint8_t>(0x80 | m_random.Below( 16 )) );
+			branches.emplace_back( CodePos(), 4 );
+			Emit32( 0, true );
+			break;
+		case XOR_SELF:
+		{
+			const uint8_t reg = Reg();
+			Rex( false, reg, reg );
+			Emit( 0x33 );
+			ModRMRegister( reg, reg );
+			break;
+		}
+		case SSE:
+		{
+			const uint8_t xmm = static_cast<uint8_t>(m_random.Below( m_is64 ? 16 : 8 ));
+			switch ( m_random.Below( 4 ) )
+			{
+			case 0: case 1:
+			{
+				// movss xmm, [mem] / movss [mem], xmm
+				const uint8_t base = Base();
+				Emit( 0xF3 );
+				Rex( false, xmm, base );
+				Emit( 0x0F );
+				Emit( m_random.Percent( 60 ) ? 0x10 : 0x11 );
+				ModRMMemory( xmm, base, Displacement() );
+				break;
+			}
+			case 2:
+			{
+				// addss/mulss/subss xmm, xmm
+				static const uint8_t opcodes[] = { 0x58, 0x59, 0x5C };
+				const uint8_t rm = static_cast<uint8_t>(m_random.Below( m_is64 ? 16 : 8 ));
+				Emit( 0xF3 );
+				Rex( false, xmm, rm );
+				Emit( 0x0F );
+				Emit( opcodes[m_random.Below( 3 )] );
+				ModRMRegister( xmm, rm );
+				break;
+			}
+			default:
+			{
+				// movaps xmm, xmm
+				const uint8_t rm = static_cast<uint8_t>(m_random.Below( m_is64 ? 16 : 8 ));
+				Rex( false, xmm, rm );
+				Emit( 0x0F );
+				Emit( 0x28 );
+				ModRMRegister( xmm, rm );
+				break;
+			}
+			}
+			break;
+		}
+		case MOVZX:
+		{
+			const uint8_t reg = Reg(), base = Base();
+			Rex( false, reg, base );
+			Emit( 0x0F );
+			Emit( 0xB6 );
+			ModRMMemory( reg, base, Displacement() );
+			break;
+		}
+		case PUSH_POP:
+			Emit( static_cast<uint8_t>((m_random.Percent( 60 ) ? 0x50 : 0x58) | (Reg() & 7)) );
+			break;
+		}
+	}
+
+	void EmitPrologue( Function& func )
+	{
+		const uint32_t begin = CodePos();
+		if ( m_is64 )
+		{
+			// push rbx/rsi/rdi; sub rsp, frame
+			static const uint8_t nonVolatile[] = { 3, 6, 7 };
+			func.numPushes = static_cast<uint8_t>(m_random.Below( 3 ));
+			const uint32_t first = m_random.Below( 3 ), second = (first + 1 + m_random.Below( 2 )) % 3;
+			func.pushes[0] = nonVolatile[first];
+			func.pushes[1] = nonVolatile[second];
+			for ( uint8_t i = 0; i < func.numPushes; i++ )
+			{
+				Emit( static_cast<uint8_t>(0x50 | func.pushes[i]) );
+			}
+			func.frameSize = static_cast<uint8_t>(0x20 + 16 * m_random.Below( 6 ) + (func.numPushes % 2 == 0 ? 8 : 0));
+			Emit( 0x48 );
+			Emit( 0x83 );
+			Emit( 0xEC );
+			Emit( func.frameSize );
+		}
+		else
+		{
+			// push ebp; mov ebp, esp; sub esp, frame
+			func.numPushes = 0;
+			func.frameSize = static_cast<uint8_t>(4 * m_random.Range( 1, 31 ));
+			Emit( 0x55 );
+			Emit( 0x8B );
+			Emit( 0xEC );
+			Emit( 0x83 );
+			Emit( 0xEC );
+			Emit( func.frameSize );
+		}
+		func.prologSize = static_cast<uint8_t>(CodePos() - begin);
+	}
+
+	void EmitEpilogue( const Function& func )
+	{
+		if ( m_is64 )
+		{
+			Emit( 0x48 );
+			Emit( 0x83 );
+			Emit( 0xC4 );
+			Emit( func.frameSize );
+			for ( uint8_t i = func.numPushes; i-- > 0; )
+			{
+				Emit( static_cast<uint8_t>(0x58 | func.pushes[i]) );
+			}
+			Emit( 0xC3 );
+		}
+		else
+		{
+			Emit( 0x8B );
+			Emit( 0xE5 );
+			Emit( 0x5D );
+			if ( m_random.Percent( 30 ) )
+			{
+				// __stdcall
+				Emit( 0xC2 );
+				Emit( static_cast<uint8_t>(4 * m_random.Range( 1, 4 )) );
+				Emit( 0 );
+			}
+			else
+			{
+				Emit( 0xC3 );
+			}
+		}
+	}
+
+	void EmitFunction( const std::basic_string<uint8_t>* planted )
+	{
+		Function func {};
+		func.begin = CodePos();
+		func.planted = planted != nullptr;
+
+		EmitPrologue( func );
+		func.boundaries.push_back( CodePos() );
+
+		std::vector<std::pair<uint32_t, uint8_t>> branches;
+		if ( planted != nullptr )
+		{
+			for ( uint8_t byte : *planted ) Emit( byte );
+		}
+		else
+		{
+			static const uint32_t sizeWeights[] = { 55, 35, 10 };
+			static const uint32_t sizeRanges[][2] = { { 4, 30 }, { 30, 150 }, { 150, 800 } };
+			const auto& range = sizeRanges[m_random.Weighted( sizeWeights )];
+			const uint32_t numInstructions = m_random.Range( range[0], range[1] );
+			for ( uint32_t i = 0; i < numInstructions; i++ )
+			{
+				EmitInstruction( branches );
+				func.boundaries.push_back( CodePos() );
+			}
+		}
+		func.boundaries.push_back( CodePos() );
+		EmitEpilogue( func );
+		func.end = CodePos();
+
+		// Branches go to instruction starts within the function, short ones as far as they can reach
+		for ( const auto& [pos, size] : branches )
+		{
+			const uint32_t from = pos + size;
+			auto first = func.boundaries.begin(), last = func.boundaries.end();
+			if ( size == 1 )
+			{
+				first = std::lower_bound( func.boundaries.begin(), func.boundaries.end(), from > 128 ? from - 128 : 0 );
+				last = std::upper_bound( func.boundaries.begin(), func.boundaries.end(), from + 127 );
+			}
+			const uint32_t target = *(first + m_random.Below( static_cast<uint32_t>(last - first) ));
+			const int32_t rel = static_cast<int32_t>(target - from);
+			if ( size == 1 ) m_code[pos] = static_cast<uint8_t>(rel);
+			else memcpy( m_code.data() + pos, &rel, sizeof(rel) );
+		}
+
+		// Pad to 16 with int3
+		while ( m_code.size() % 16 != 0 ) Emit( 0xCC );
+		m_functions.push_back( std::move(func) );
+	}
+
+	void BuildCode()
+	{
+		// Planted patterns go in at random points of the code
+		struct Planted
+		{
+			uint32_t position;
+			size_t index;
+			std::basic_string<uint8_t> bytes;
+		};
+		std::vector<Planted> planted;
+		for ( const Signature& signature : m_options.planted )
+		{
+			const hook::analysis::parsed_pattern pattern( signature.pattern );
+			std::basic_string<uint8_t> bytes = pattern.bytes;
+			for ( size_t i = 0; i < bytes.size(); i++ )
+			{
+				if ( pattern.wildcard( i ) ) bytes[i] = static_cast<uint8_t>(m_random.Below( 256 ));
+			}
+			const uint32_t position = m_random.Below( static_cast<uint32_t>(std::max<size_t>( m_options.codeSize, 1 )) );
+			planted.push_back( { position, planted.size(), std::move(bytes) } );
+		}
+		std::stable_sort( planted.begin(), planted.end(), []( const Planted& left, const Planted& right ) { return left.position < right.position; } );
+
+		m_plantedFunctions.resize( planted.size() );
+		auto plant = [&]( const Planted& entry ) {
+			m_plantedFunctions[entry.index] = m_functions.size();
+			EmitFunction( &entry.bytes );
+		};
+
+		size_t nextPlanted = 0;
+		while ( m_code.size() < m_options.codeSize || m_functions.empty() )
+		{
+			if ( nextPlanted < planted.size() && planted[nextPlanted].position <= m_code.size() )
+			{
+				plant( planted[nextPlanted++] );
+				continue;
+			}
+			EmitFunction( nullptr );
+		}
+		for ( ; nextPlanted < planted.size(); nextPlanted++ )
+		{
+			plant( planted[nextPlanted] );
+		}
+	}
+
+	size_t RandomFunction()
+	{
+		// Skip the planted ones, nothing should call into them
+		while ( true )
+		{
+			const size_t index = m_random.Below( static_cast<uint32_t>(m_functions.size()) );
+			if ( !m_functions[index].planted || m_functions.size() == m_plantedFunctions.size() ) return index;
+		}
+	}
+
+	void ResolveCode()
+	{
+		for ( uint32_t call : m_calls )
+		{
+			AddFixup( TEXT, call, FixupKind::Rel32, TEXT, m_functions[RandomFunction()].begin );
+		}
+
+		for ( const Class& cls : m_classes )
+		{
+			for ( size_t i = 0; i < cls.numVirtuals; i++ )
+			{
+				// Inherited virtuals mostly stay the same
+				const uint32_t slot = cls.vtable + static_cast<uint32_t>(i * PointerSize());
+				if ( cls.parent != NO_PARENT && i < m_classes[cls.parent].numVirtuals && m_random.Percent( 60 ) )
+				{
+					m_vtableSlots.emplace_back( slot, m_vtableSlots[m_classVirtuals[cls.parent] + i].second );
+				}
+				else
+				{
+					m_vtableSlots.emplace_back( slot, m_functions[RandomFunction()].begin );
+				}
+			}
+			m_classVirtuals.push_back( m_vtableSlots.size() - cls.numVirtuals );
+		}
+		for ( const auto& [slot, function] : m_vtableSlots )
+		{
+			AddPointer( RDATA, slot, TEXT, function );
+		}
+
+		m_entryPoint = m_functions[RandomFunction()].begin;
+	}
+
+	void BuildUnwindInfo()
+	{
+		if ( !m_is64 ) return;
+
+		for ( const Function& func : m_functions )
+		{
+			// UNWIND_INFO - version 1, prolog size, unwind codes (in reverse order), padded to an even count
+			const size_t numCodes = func.numPushes + 1;
+			const uint32_t info = Reserve( RDATA, 4 + 2 * ((numCodes + 1) & ~size_t(1)), 4 );
+			Put<uint8_t>( RDATA, info, 1 );
+			Put<uint8_t>( RDATA, info + 1, func.prologSize );
+			Put<uint8_t>( RDATA, info + 2, static_cast<uint8_t>(numCodes) );
+
+			// UWOP_ALLOC_SMALL, then UWOP_PUSH_NONVOL for every push
+			Put<uint8_t>( RDATA, info + 4, func.prologSize );
+			Put<uint8_t>( RDATA, info + 5, static_cast<uint8_t>(2 | ((func.frameSize / 8 - 1) << 4)) );
+			for ( uint8_t i = 0; i < func.numPushes; i++ )
+			{
+				const uint32_t code = info + 6 + 2 * i;
+				Put<uint8_t>( RDATA, code, static_cast<uint8_t>(func.numPushes - i) );
+				Put<uint8_t>( RDATA, code + 1, static_cast<uint8_t>(0 | (func.pushes[func.numPushes - 1 - i] << 4)) );
+			}
+
+			const uint32_t entry = Reserve( PDATA, sizeof(pe::RuntimeFunction), 4 );
+			AddFixup( PDATA, entry + offsetof(pe::RuntimeFunction, BeginAddress), FixupKind::Rva32, TEXT, func.begin );
+			AddFixup( PDATA, entry + offsetof(pe::RuntimeFunction, EndAddress), FixupKind::Rva32, TEXT, func.end );
+			AddFixup( PDATA, entry + offsetof(pe::RuntimeFunction, UnwindInfoAddress), FixupKind::Rva32, RDATA, info );
+		}
+	}
+
+	void BuildExports()
+	{
+		if ( m_options.numExports == 0 ) return;
+
+		const size_t numExports = m_options.numExports;
+		m_exportDirectory = Reserve( RDATA, sizeof(pe::ExportDirectory), 4 );
+		const uint32_t functions = Reserve( RDATA, 4 * numExports, 4 );
+		const uint32_t names = Reserve( RDATA, 4 * numExports, 4 );
+		const uint32_t ordinals = Reserve( RDATA, 2 * numExports, 2 );
+
+		Put<uint32_t>( RDATA, m_exportDirectory + offsetof(pe::ExportDirectory, Base), 1 );
+		Put<uint32_t>( RDATA, m_exportDirectory + offsetof(pe::ExportDirectory, NumberOfFunctions), static_cast<uint32_t>(numExports) );
+		Put<uint32_t>( RDATA, m_exportDirectory + offsetof(pe::ExportDirectory, NumberOfNames), static_cast<uint32_t>(numExports) );
+		AddFixup( RDATA, m_exportDirectory + offsetof(pe::ExportDirectory, Name), FixupKind::Rva32, RDATA,
+			AddString( RDATA, m_options.isDll ? "synthetic.dll" : "synthetic.exe" ) );
+		AddFixup( RDATA, m_exportDirectory + offsetof(pe::ExportDirectory, AddressOfFunctions), FixupKind::Rva32, RDATA, functions );
+		AddFixup( RDATA, m_exportDirectory + offsetof(pe::ExportDirectory, AddressOfNames), FixupKind::Rva32, RDATA, names );
+		AddFixup( RDATA, m_exportDirectory + offsetof(pe::ExportDirectory, AddressOfNameOrdinals), FixupKind::Rva32, RDATA, ordinals );
+
+		// Zero padded numbers keep the names sorted, as the loader expects
+		for ( size_t i = 0; i < numExports; i++ )
+		{
+			char name[48];
+			snprintf( name, sizeof(name), "SyntheticExport%04zu", i );
+
+			const uint32_t offset = static_cast<uint32_t>(i * 4);
+			AddFixup( RDATA, functions + offset, FixupKind::Rva32, TEXT, m_functions[RandomFunction()].begin );
+			AddFixup( RDATA, names + offset, FixupKind::Rva32, RDATA, AddString( RDATA, name ) );
+			Put<uint16_t>( RDATA, ordinals + static_cast<uint32_t>(i * 2), static_cast<uint16_t>(i) );
+		}
+		m_exportDirectorySize = static_cast<uint32_t>(Buffer( RDATA ).size()) - m_exportDirectory;
+	}
+
+	// Lays out the sections, applies fixups and builds the relocations and headers
+	void Link()
+	{
+		static const char* const names[NUM_SECTIONS] = { ".text", ".rdata", ".data", ".idata", ".pdata", ".reloc" };
+		static const uint32_t characteristics[NUM_SECTIONS] = {
+			pe::SCN_CNT_CODE | pe::SCN_MEM_EXECUTE | pe::SCN_MEM_READ,
+			pe::SCN_CNT_INITIALIZED_DATA | pe::SCN_MEM_READ,
+			pe::SCN_CNT_INITIALIZED_DATA | pe::SCN_MEM_READ | pe::SCN_MEM_WRITE,
+			pe::SCN_CNT_INITIALIZED_DATA | pe::SCN_MEM_READ | pe::SCN_MEM_WRITE,
+			pe::SCN_CNT_INITIALIZED_DATA | pe::SCN_MEM_READ,
+			pe::SCN_CNT_INITIALIZED_DATA | pe::SCN_MEM_READ | 0x02000000, // discardable
+		};
+		Buffer( TEXT ) = m_code;
+
+		// .reloc is sized before layout - one entry per absolute fixup, page blocks padded to 4 bytes
+		std::vector<uint32_t> relocated;
+		const bool relocate = m_options.relocations;
+
+		std::vector<SectionId> present;
+		for ( uint8_t i = 0; i < NUM_SECTIONS; i++ )
+		{
+			if ( i == RELOC ? relocate : !Buffer( SectionId(i) ).empty() ) present.push_back( SectionId(i) );
+		}
+
+		const uint32_t optionalHeaderSize = m_is64 ? 0xF0 : 0xE0;
+		const uint32_t headersSize = AlignUp( 0x80 + 4 + sizeof(pe::FileHeader) + optionalHeaderSize + static_cast<uint32_t>(present.size() * sizeof(pe::SectionHeader)), FILE_ALIGNMENT );
+
+		uint32_t rva = SECTION_ALIGNMENT;
+		for ( SectionId id : present )
+		{
+			if ( id == RELOC )
+			{
+				// Everything else has its address now
+				for ( const Fixup& fixup : m_fixups )
+				{
+					if ( fixup.kind == FixupKind::Va32 || fixup.kind == FixupKind::Va64 ) relocated.push_back( m_rvas[fixup.section] + fixup.offset );
+				}
+				std::sort( relocated.begin(), relocated.end() );
+				BuildRelocations( relocated );
+				if ( Buffer( RELOC ).empty() ) Reserve( RELOC, 8 );
+			}
+			m_rvas[id] = rva;
+			rva = AlignUp( rva + static_cast<uint32_t>(Buffer( id ).size()), SECTION_ALIGNMENT );
+		}
+		const uint32_t sizeOfImage = rva;
+
+		for ( const Fixup& fixup : m_fixups )
+		{
+			const uint32_t target = m_rvas[fixup.target] + fixup.targetOffset;
+			switch ( fixup.kind )
+			{
+			case FixupKind::Rva32: Put<uint32_t>( fixup.section, fixup.offset, target ); break;
+			case FixupKind::Va32: Put<uint32_t>( fixup.section, fixup.offset, static_cast<uint32_t>(m_imageBase + target) ); break;
+			case FixupKind::Va64: Put<uint64_t>( fixup.section, fixup.offset, m_imageBase + target ); break;
+			case FixupKind::Rel32: Put<int32_t>( fixup.section, fixup.offset, static_cast<int32_t>(target - (m_rvas[fixup.section] + fixup.offset + 4)) ); break;
+			}
+		}
+		m_code = Buffer( TEXT );
+
+		// Headers
+		std::vector<uint8_t>& image = m_image;
+		image.assign( headersSize, 0 );
+		image[0] = 'M';
+		image[1] = 'Z';
+		const uint32_t lfanew = 0x80;
+		memcpy( image.data() + 0x3C, &lfanew, sizeof(lfanew) );
+		memcpy( image.data() + lfanew, "PE\0\0", 4 );
+
+		pe::FileHeader fileHeader {};
+		fileHeader.Machine = m_is64 ? 0x8664 : 0x14C;
+		fileHeader.NumberOfSections = static_cast<uint16_t>(present.size());
+		fileHeader.TimeDateStamp = static_cast<uint32_t>(m_random.Next());
+		fileHeader.SizeOfOptionalHeader = static_cast<uint16_t>(optionalHeaderSize);
+		fileHeader.Characteristics = 0x0002 | (m_is64 ? 0x0020 : 0x0100) | (m_options.isDll ? 0x2000 : 0) | (relocate ? 0 : 0x0001);
+		memcpy( image.data() + lfanew + 4, &fileHeader, sizeof(fileHeader) );
+
+		uint8_t* optional = image.data() + lfanew + 4 + sizeof(pe::FileHeader);
+		auto write = [optional]( size_t offset, auto value ) {
+			memcpy( optional + offset, &value, sizeof(value) );
+		};
+		uint32_t sizeOfCode = 0, sizeOfData = 0;
+		for ( SectionId id : present )
+		{
+			(id == TEXT ? sizeOfCode : sizeOfData) += AlignUp( static_cast<uint32_t>(Buffer( id ).size()), FILE_ALIGNMENT );
+		}
+
+		write( 0, static_cast<uint16_t>(m_is64 ? pe::OPTIONAL_HEADER_MAGIC_PE32_PLUS : pe::OPTIONAL_HEADER_MAGIC_PE32) );
+		write( 2, static_cast<uint8_t>(14) );
+		write( 4, sizeOfCode );
+		write( 8, sizeOfData );
+		write( 16, m_rvas[TEXT] + m_entryPoint );
+		write( 20, m_rvas[TEXT] );
+		if ( m_is64 )
+		{
+			write( 24, m_imageBase );
+		}
+		else
+		{
+			write( 24, m_rvas[RDATA] );
+			write( 28, static_cast<uint32_t>(m_imageBase) );
+		}
+		write( 32, SECTION_ALIGNMENT );
+		write( 36, FILE_ALIGNMENT );
+		write( 40, static_cast<uint16_t>(6) ); // OS version
+		write( 48, static_cast<uint16_t>(6) ); // Subsystem version
+		write( 56, sizeOfImage );
+		write( 60, headersSize );
+		write( 68, static_cast<uint16_t>(2) ); // Windows GUI
+		write( 70, static_cast<uint16_t>((relocate ? 0x40 : 0) | 0x100 | (m_is64 && relocate ? 0x20 : 0)) ); // Dynamic base, NX, high entropy VA
+
+		const size_t stackOffset = 72, pointer = m_is64 ? 8 : 4;
+		const uint64_t stackAndHeap[] = { 0x100000, 0x1000, 0x100000, 0x1000 };
+		for ( size_t i = 0; i < std::size(stackAndHeap); i++ )
+		{
+			if ( m_is64 ) write( stackOffset + i * pointer, stackAndHeap[i] );
+			else write( stackOffset + i * pointer, static_cast<uint32_t>(stackAndHeap[i]) );
+		}
+
+		const size_t directories = m_is64 ? 112 : 96;
+		write( directories - 4, static_cast<uint32_t>(16) );
+		auto directory = [&]( size_t index, uint32_t directoryRva, uint32_t size ) {
+			write( directories + index * sizeof(pe::DataDirectory), pe::DataDirectory { directoryRva, size } );
+		};
+		if ( m_options.numExports != 0 ) directory( pe::DIRECTORY_EXPORT, m_rvas[RDATA] + m_exportDirectory, m_exportDirectorySize );
+		directory( pe::DIRECTORY_IMPORT, m_rvas[IDATA] + m_importDescriptors, m_importDescriptorsSize );
+		if ( m_is64 ) directory( pe::DIRECTORY_EXCEPTION, m_rvas[PDATA], static_cast<uint32_t>(Buffer( PDATA ).size()) );
+		if ( relocate ) directory( pe::DIRECTORY_BASERELOC, m_rvas[RELOC], static_cast<uint32_t>(Buffer( RELOC ).size()) );
+		directory( pe::DIRECTORY_IAT, m_rvas[IDATA], m_iatSize );
+
+		// Section headers and raw data
+		const size_t sectionHeaders = lfanew + 4 + sizeof(pe::FileHeader) + optionalHeaderSize;
+		for ( size_t i = 0; i < present.size(); i++ )
+		{
+			const SectionId id = present[i];
+			const std::vector<uint8_t>& data = Buffer( id );
+			const uint32_t rawSize = AlignUp( static_cast<uint32_t>(data.size()), FILE_ALIGNMENT );
+
+			pe::SectionHeader header {};
+			memcpy( header.Name, names[id], strlen( names[id] ) );
+			header.VirtualSize = static_cast<uint32_t>(data.size());
+			header.VirtualAddress = m_rvas[id];
+			header.SizeOfRawData = rawSize;
+			header.PointerToRawData = static_cast<uint32_t>(image.size());
+			header.Characteristics = characteristics[id];
+			memcpy( image.data() + sectionHeaders + i * sizeof(header), &header, sizeof(header) );
+
+			image.insert( image.end(), data.begin(), data.end() );
+			image.resize( image.size() + (rawSize - data.size()), id == TEXT ? 0xCC : 0 );
+		}
+	}
+
+	void BuildRelocations( const std::vector<uint32_t>& relocated )
+	{
+		const uint16_t type = m_is64 ? pe::REL_BASED_DIR64 : pe::REL_BASED_HIGHLOW;
+		for ( size_t i = 0; i < relocated.size(); )
+		{
+			const uint32_t page = relocated[i] & ~(SECTION_ALIGNMENT - 1);
+			size_t j = i;
+			while ( j < relocated.size() && (relocated[j] & ~(SECTION_ALIGNMENT - 1)) == page ) j++;
+
+			const size_t numEntries = (j - i + 1) & ~size_t(1);
+			const uint32_t block = Reserve( RELOC, 8 + 2 * numEntries, 4 );
+			Put<uint32_t>( RELOC, block, page );
+			Put<uint32_t>( RELOC, block + 4, static_cast<uint32_t>(8 + 2 * numEntries) );
+			for ( size_t k = i; k < j; k++ )
+			{
+				Put<uint16_t>( RELOC, block + 8 + static_cast<uint32_t>(2 * (k - i)), static_cast<uint16_t>((type << 12) | (relocated[k] - page)) );
+			}
+			i = j;
+		}
+	}
+
+	// Signatures
+
+	std::vector<size_t> CountMatches( const std::vector<hook::analysis::parsed_pattern>& patterns, std::vector<uint32_t>* firstMatch = nullptr ) const
+	{
+		std::vector<size_t> counts( patterns.size() );
+		if ( firstMatch != nullptr ) firstMatch->assign( patterns.size(), UINT32_MAX );
+
+		const MultiPatternScanner scanner( patterns );
+		scanner.Scan( m_code.data(), m_code.size(), [&]( uint32_t pattern, size_t offset ) {
+			counts[pattern]++;
+			if ( firstMatch != nullptr && (*firstMatch)[pattern] == UINT32_MAX ) (*firstMatch)[pattern] = static_cast<uint32_t>(offset);
+		} );
+		return counts;
+	}
+
+	hook::analysis::parsed_pattern PatternAt( uint32_t offset, size_t length ) const
+	{
+		std::basic_string<uint8_t> bytes( m_code.data() + offset, length ), mask( length, 0xFF );
+		for ( size_t i = 0; i < length; i++ )
+		{
+			if ( m_codeMask[offset + i] != 0 )
+			{
+				bytes[i] = 0;
+				mask[i] = 0;
+			}
+		}
+		return hook::analysis::parsed_pattern( std::move(bytes), std::move(mask) );
+	}
+
+	void FindSignatures()
+	{
+		// Planted patterns - check they're really unique
+		if ( !m_options.planted.empty() )
+		{
+			std::vector<hook::analysis::parsed_pattern> patterns;
+			for ( const Signature& signature : m_options.planted )
+			{
+				patterns.emplace_back( signature.pattern );
+			}
+			const std::vector<size_t> counts = CountMatches( patterns );
+			for ( size_t i = 0; i < m_options.planted.size(); i++ )
+			{
+				const Function& func = m_functions[m_plantedFunctions[i]];
+				m_signatures.push_back( { m_options.planted[i].name, m_options.planted[i].pattern, m_rvas[TEXT] + func.begin + func.prologSize, counts[i] } );
+			}
+		}
+
+		// Cut out of the code at instruction starts, grown until unique
+		struct Candidate
+		{
+			uint32_t offset;
+			size_t name;
+		};
+		std::vector<Candidate> candidates;
+		size_t attempts = 0;
+		for ( size_t i = 0; i < m_options.numSignatures && attempts < m_options.numSignatures * 4; attempts++ )
+		{
+			const Function& func = m_functions[RandomFunction()];
+			if ( func.boundaries.size() < 2 ) continue;
+
+			const uint32_t offset = func.boundaries[m_random.Below( static_cast<uint32_t>(func.boundaries.size() - 1) )];
+			if ( std::any_of( candidates.begin(), candidates.end(), [offset]( const Candidate& candidate ) { return candidate.offset == offset; } ) ) continue;
+			candidates.push_back( { offset, i++ } );
+		}
+
+		static const size_t lengths[] = { 12, 16, 24, 32, 48, 64 };
+		for ( size_t length : lengths )
+		{
+			std::vector<hook::analysis::parsed_pattern> patterns;
+			for ( const Candidate& candidate : candidates )
+			{
+				patterns.push_back( PatternAt( candidate.offset, std::min<size_t>( length, m_code.size() - candidate.offset ) ) );
+			}
+			if ( patterns.empty() ) break;
+
+			std::vector<uint32_t> firstMatch;
+			const std::vector<size_t> counts = CountMatches( patterns, &firstMatch );
+
+			std::vector<Candidate> remaining;
+			for ( size_t i = 0; i < candidates.size(); i++ )
+			{
+				if ( counts[i] == 1 && firstMatch[i] == candidates[i].offset )
+				{
+					char name[48];
+					snprintf( name, sizeof(name), "signature%04zu", candidates[i].name );
+					m_signatures.push_back( { name, patterns[i].to_string(), m_rvas[TEXT] + candidates[i].offset, 1 } );
+				}
+				else
+				{
+					remaining.push_back( candidates[i] );
+				}
+			}
+			candidates.swap( remaining );
+		}
+	}
+
+	const Options m_options;
+	Random m_random;
+	const bool m_is64;
+	uint64_t m_imageBase = 0;
+
+	std::vector<uint8_t> m_sections[NUM_SECTIONS];
+	uint32_t m_rvas[NUM_SECTIONS] = {};
+	std::vector<Fixup> m_fixups;
+
+	std::vector<uint8_t> m_code;
+	// 1 for bytes of addresses and relative offsets to other code, which change between builds
+	std::vector<uint8_t> m_codeMask;
+	std::vector<Function> m_functions;
+	std::vector<size_t> m_plantedFunctions;
+	std::vector<uint32_t> m_calls;
+	uint32_t m_entryPoint = 0;
+
+	uint32_t m_typeInfoVftable = 0;
+	std::vector<uint32_t> m_strings;
+	std::vector<Class> m_classes;
+	std::vector<std::pair<uint32_t, uint32_t>> m_vtableSlots;
+	std::vector<size_t> m_classVirtuals;
+	uint32_t m_globals = 0;
+
+	std::vector<uint32_t> m_importSlots;
+	uint32_t m_iatSize = 0;
+	uint32_t m_importDescriptors = 0, m_importDescriptorsSize = 0;
+	uint32_t m_exportDirectory = 0, m_exportDirectorySize = 0;
+
+	std::vector<uint8_t> m_image;
+	std::vector<PlantedSignature> m_signatures;
+};